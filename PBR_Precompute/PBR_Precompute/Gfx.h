@@ -39,6 +39,14 @@ namespace math
 		return vec * (1 / len(vec));
 	}
 
+	//turns vec radians around +Y, from +X toward +Z
+	inline math::vec3f
+	rotate_y(const math::vec3f& vec, float radians)
+	{
+		float c = cosf(radians), s = sinf(radians);
+		return math::vec3f{ vec[0] * c - vec[2] * s, vec[1], vec[0] * s + vec[2] * c };
+	}
+
 	inline vec3f
 	cross(const math::vec3f& first, const math::vec3f& second)
 	{
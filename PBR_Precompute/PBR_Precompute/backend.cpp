@@ -0,0 +1,552 @@
+#include "backend.h"
+
+#include "glew.h"
+
+#include <assert.h>
+
+#include "Gfx.h"
+#include "half.h"
+#include "equirect_splat.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+using namespace math;
+using namespace glgpu;
+using namespace io;
+using namespace geo;
+
+namespace pbr
+{
+	constexpr static Vertex quad[6] =
+	{
+		Vertex{-1.0f,  1.0f, 0.0f,  vec3f{0,0,1}, 0.0f, 1.0f},
+		Vertex{-1.0f, -1.0f, 0.0f,  vec3f{0,0,1}, 0.0f, 0.0f},
+		Vertex{ 1.0f,  1.0f, 0.0f,  vec3f{0,0,1}, 1.0f, 1.0f},
+
+		Vertex{ 1.0f,  1.0f, 0.0f,  vec3f{0,0,1}, 1.0f, 1.0f},
+		Vertex{-1.0f, -1.0f, 0.0f,  vec3f{0,0,1}, 0.0f, 0.0f},
+		Vertex{ 1.0f, -1.0f, 0.0f,  vec3f{0,0,1}, 1.0f, 0.0f}
+	};
+
+	struct Backend_Cube
+	{
+		int size;
+		int mip_count;
+
+		//GL, the light textures are only there once uploaded
+		cubemap cmap;
+		texture light_textures[3];
+		bool light_uploaded;
+
+		//the cube itself for the CPU backend, a readback for GL
+		Envmap env;
+	};
+
+	//what each backend does for the functions of backend.h. self is for the ops that need the backend's state (its pool,
+	//the GL target), the others leave it unnamed. cube_envmap and cube_light_upload are optional, null when the cube
+	//already is its own Envmap and the passes read its light distribution from it (the CPU backend)
+	struct Backend_Ops
+	{
+		Backend_Cube* (*cube_create)(Backend* self, const Image faces[6]);
+		Backend_Cube* (*cube_from_equirect)(Backend* self, const Image& equirect, int size, float rotation);
+		void (*cube_envmap)(Backend* self, Backend_Cube* cube);
+		void (*cube_light_upload)(Backend* self, Backend_Cube* cube, bool keep_envmap);
+		void (*cube_free)(Backend* self, Backend_Cube* cube);
+		std::vector<Image> (*pass_run)(Backend* self, const Backend_Pass& pass, Backend_Cube* input, int size, PIXEL_TYPE readback);
+		std::vector<Image> (*equirect_captures)(Backend* self, const Image& equirect, int size, const Face_View views[6], float rotation, PIXEL_TYPE readback);
+	};
+
+	struct Backend
+	{
+		cli::BACKEND kind;
+		const Backend_Ops* ops;
+		jobs::Pool* pool;
+
+		//GL, what the cube passes render into, grown to the biggest one
+		cubemap target;
+		int target_size;
+	};
+
+	inline int
+	_mip_count(int size)
+	{
+		return (int)std::log2(size) + 1;
+	}
+
+	//a texel of a float target as glReadPixels converts it into a readback image
+	inline void
+	_texel_store(Image& img, size_t texel, const float* color, int channels)
+	{
+		if (img.type == PIXEL_TYPE::FLOAT)
+		{
+			float* out = (float*)img.data + img.channels * texel;
+			for (int c = 0; c < img.channels; ++c)
+				out[c] = c < channels ? color[c] : 0.0f;
+			return;
+		}
+
+		unsigned char* out = (unsigned char*)img.data + 4 * texel;
+		for (int c = 0; c < 3; ++c)
+			out[c] = c < channels ? (unsigned char)(std::min(std::max(color[c], 0.0f), 1.0f) * 255.0f + 0.5f) : 0;
+		out[3] = 255;
+	}
+
+	inline GLenum
+	_readback_format(const Image& img)
+	{
+		return img.channels == 2 ? GL_RG : img.channels == 3 ? GL_RGB : GL_RGBA;
+	}
+
+	inline GLenum
+	_readback_type(const Image& img)
+	{
+		return img.type == PIXEL_TYPE::FLOAT ? GL_FLOAT : GL_UNSIGNED_BYTE;
+	}
+
+	//GL
+
+	Backend_Cube*
+	_gl_cube_create(Backend*, const Image faces[6])
+	{
+		Backend_Cube* cube = new Backend_Cube{};
+		cube->size = faces[0].width;
+		cube->mip_count = _mip_count(cube->size);
+		cube->cmap = cubemap_float_create(faces, true);
+		return cube;
+	}
+
+	Backend_Cube*
+	_gl_cube_from_equirect(Backend*, const Image& equirect, int size, float rotation)
+	{
+		Backend_Cube* cube = new Backend_Cube{};
+		cube->size = size;
+		cube->mip_count = _mip_count(size);
+		cube->cmap = cubemap_hdr_create(equirect, vec2f{ (float)size, (float)size }, true, rotation);
+		return cube;
+	}
+
+	void
+	_gl_cube_envmap(Backend*, Backend_Cube* cube)
+	{
+		if (cube->env.faces.empty())
+			cube->env = envmap_from_cubemap(cube->cmap, cube->size, cube->mip_count);
+	}
+
+	//pdf, marginal and conditional cdf textures of the light distribution bound to units 1, 2 and 3
+	void
+	_gl_cube_light_upload(Backend*, Backend_Cube* cube, bool keep_envmap)
+	{
+		const Env_Light& light = cube->env.light;
+		if (light.width > 0)
+		{
+			vec2f sizes[3] =
+			{
+				vec2f{ (float)light.width, (float)light.height },
+				vec2f{ (float)light.height + 1, 1.0f },
+				vec2f{ (float)light.width + 1, (float)light.height }
+			};
+			const float* data[3] = { light.pdf.data(), light.marginal_cdf.data(), light.conditional_cdf.data() };
+			TEXTURE_UNIT units[3] = { TEXTURE_UNIT::UNIT_1, TEXTURE_UNIT::UNIT_2, TEXTURE_UNIT::UNIT_3 };
+
+			for (int i = 0; i < 3; ++i)
+			{
+				cube->light_textures[i] = texture2d_create(sizes[i], INTERNAL_TEXTURE_FORMAT::R32F, EXTERNAL_TEXTURE_FORMAT::RED, DATA_TYPE::FLOAT, false);
+				texture2d_data_set(cube->light_textures[i], sizes[i], EXTERNAL_TEXTURE_FORMAT::RED, DATA_TYPE::FLOAT, data[i]);
+				texture2d_bind(cube->light_textures[i], units[i]);
+			}
+			cube->light_uploaded = true;
+		}
+		if (keep_envmap == false)
+			envmap_free(cube->env);
+	}
+
+	void
+	_gl_cube_free(Backend*, Backend_Cube* cube)
+	{
+		if (cube->light_uploaded)
+			for (int i = 0; i < 3; ++i)
+				texture_free(cube->light_textures[i]);
+		cubemap_free(cube->cmap);
+		envmap_free(cube->env);
+		delete cube;
+	}
+
+	std::vector<Image>
+	_gl_pass_run(Backend* self, const Backend_Pass& pass, Backend_Cube* input, int size, PIXEL_TYPE readback)
+	{
+		//every LOD renders into level 0 of the one target, the viewport takes its corner. grown before the input is bound,
+		//creating it unbinds the cube map of the active unit
+		if (pass.cube && self->target_size < size)
+		{
+			assert(pass.channels == 3);
+			if (self->target)
+				cubemap_free(self->target);
+			self->target = cubemap_create(vec2f{ (float)size, (float)size }, INTERNAL_TEXTURE_FORMAT::RGB16F, EXTERNAL_TEXTURE_FORMAT::RGB, DATA_TYPE::FLOAT, false);
+			self->target_size = size;
+		}
+
+		program prog = program_create(pass.cube ? "cube.vertex" : "quad.vertex", pass.pixel_shader);
+		program_use(prog);
+		if (input)
+		{
+			cubemap_bind(input->cmap, TEXTURE_UNIT::UNIT_0);
+			uniform1i_set(prog, "env_map", TEXTURE_UNIT::UNIT_0);
+		}
+		if (pass.uniforms)
+			pass.uniforms(prog, pass.params);
+
+		GLuint fbo;
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, size, size);
+
+		std::vector<Image> imgs(pass.cube ? 6 : 1);
+		for (Image& img : imgs)
+			img = readback_image(size, size, readback, pass.channels);
+
+		if (pass.cube)
+		{
+			Gl_Captures captures = gl_captures_create(POSTPROCESS_FACE_VIEWS, 0.0f);
+			//no clear, the target has no depth attachment and every capture covers the viewport it is read back from
+			for (unsigned int i = 0; i < 6; ++i)
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLuint)self->target, 0);
+				gl_captures_draw(captures, prog, i);
+				gl_readback_rows(imgs[i], 0, size);
+			}
+			gl_captures_free(captures);
+		}
+		else
+		{
+			bool rg = pass.channels == 2;
+			texture output = texture2d_create(vec2f{ (float)size, (float)size }, rg ? INTERNAL_TEXTURE_FORMAT::RG16F : INTERNAL_TEXTURE_FORMAT::RGB16F,
+				rg ? EXTERNAL_TEXTURE_FORMAT::RG : EXTERNAL_TEXTURE_FORMAT::RGB, DATA_TYPE::FLOAT, false);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, (GLuint)output, 0);
+
+			vao quad_vao = vao_create();
+			buffer quad_vs = vertex_buffer_create(quad, 6);
+			vao_bind(quad_vao, quad_vs, NULL);
+			draw_strip(6);
+			vao_unbind();
+			gl_readback_rows(imgs[0], 0, size);
+
+			vao_delete(quad_vao);
+			buffer_delete(quad_vs);
+			texture_free(output);
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, NULL);
+		glDeleteFramebuffers(1, &fbo);
+		program_delete(prog);
+		return imgs;
+	}
+
+	std::vector<Image>
+	_gl_equirect_captures(Backend*, const Image& equirect, int size, const Face_View views[6], float rotation, PIXEL_TYPE readback)
+	{
+		texture hdr = texture2d_create(equirect, IMAGE_FORMAT::HDR);
+
+		//HDR should a 32 bit for each channel to cover a wide range of colors,
+		//they make the exponent the alpha and each channel remains 8 so 16 bit for each -RGB-
+		cubemap cube_map = cubemap_create(vec2f{ (float)size, (float)size }, INTERNAL_TEXTURE_FORMAT::RGB16F, EXTERNAL_TEXTURE_FORMAT::RGB, DATA_TYPE::FLOAT, false);
+
+		GLuint fbo;
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+		program prog = program_create("cube.vertex", "equarectangular_to_cubemap.pixel");
+		program_use(prog);
+		texture2d_bind(hdr, TEXTURE_UNIT::UNIT_0);
+		glViewport(0, 0, size, size);
+
+		std::vector<Image> imgs(6);
+		Gl_Captures captures = gl_captures_create(views, rotation);
+		for (unsigned int i = 0; i < 6; ++i)
+		{
+			imgs[i] = readback_image(size, size, readback, 3);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLuint)cube_map, 0);
+			gl_captures_draw(captures, prog, i);
+			gl_readback_rows(imgs[i], 0, size);
+		}
+		gl_captures_free(captures);
+
+		texture2d_unbind();
+		glBindFramebuffer(GL_FRAMEBUFFER, NULL);
+		glDeleteFramebuffers(1, &fbo);
+		program_delete(prog);
+		cubemap_free(cube_map);
+		texture_free(hdr);
+		return imgs;
+	}
+
+	constexpr Backend_Ops GL_OPS =
+	{
+		_gl_cube_create,
+		_gl_cube_from_equirect,
+		_gl_cube_envmap,
+		_gl_cube_light_upload,
+		_gl_cube_free,
+		_gl_pass_run,
+		_gl_equirect_captures
+	};
+
+	//CPU
+
+	//every texel of count size targets, a row per job, color(face, s, t) gives its float channels
+	template<typename T>
+	std::vector<Image>
+	_cpu_rows(jobs::Pool* pool, int count, int size, int channels, PIXEL_TYPE readback, T&& color)
+	{
+		std::vector<Image> imgs(count);
+		for (Image& img : imgs)
+			img = readback_image(size, size, readback, channels);
+
+		jobs::parallel_for(pool, count * size, [&](unsigned int job)
+		{
+			int face = (int)job / size, y = (int)job % size;
+			for (int x = 0; x < size; ++x)
+			{
+				vec3f c = color(face, (x + 0.5f) / size, (y + 0.5f) / size);
+				_texel_store(imgs[face], (size_t)y * size + x, &c[0], channels);
+			}
+		});
+		return imgs;
+	}
+
+	Backend_Cube*
+	_cpu_cube_create(Backend* self, const Image faces[6])
+	{
+		Backend_Cube* cube = new Backend_Cube{};
+		cube->size = faces[0].width;
+		cube->mip_count = _mip_count(cube->size);
+		cube->env = envmap_from_faces(faces, cube->mip_count, self->pool);
+		return cube;
+	}
+
+	Backend_Cube*
+	_cpu_cube_from_equirect(Backend* self, const Image& equirect, int size, float rotation)
+	{
+		Image faces[6], luminance;
+		Equirect_Splat splat = equirect_splat_create(equirect.width, equirect.height, size, 0, rotation);
+		equirect_splat_image(splat, equirect, self->pool);
+		equirect_splat_resolve(splat, faces, luminance);
+		Backend_Cube* cube = _cpu_cube_create(self, faces);
+		for (int i = 0; i < 6; ++i)
+			image_free(faces[i]);
+		image_free(luminance);
+		return cube;
+	}
+
+	void
+	_cpu_cube_free(Backend*, Backend_Cube* cube)
+	{
+		envmap_free(cube->env);
+		delete cube;
+	}
+
+	std::vector<Image>
+	_cpu_pass_run(Backend* self, const Backend_Pass& pass, Backend_Cube* input, int size, PIXEL_TYPE readback)
+	{
+		assert(pass.texel);
+		const Envmap* env = input ? &input->env : nullptr;
+		return _cpu_rows(self->pool, pass.cube ? 6 : 1, size, pass.channels, readback, [&](int face, float s, float t) {
+			vec3f dir = pass.cube ? face_view_dir(POSTPROCESS_FACE_VIEWS[face], s, t) : vec3f{};
+			return pass.texel(pass.params, env, dir, s, t);
+		});
+	}
+
+	//texel (x, y) of an RGB FLOAT or HALF equirect clamped to its edges
+	inline vec3f
+	_equirect_texel(const Image& img, int x, int y)
+	{
+		x = std::min(std::max(x, 0), img.width - 1);
+		y = std::min(std::max(y, 0), img.height - 1);
+		size_t i = (size_t)img.channels * ((size_t)y * img.width + x);
+		if (img.type == PIXEL_TYPE::HALF)
+		{
+			const half* p = (const half*)img.data + i;
+			return vec3f{ half_to_float(p[0]), half_to_float(p[1]), half_to_float(p[2]) };
+		}
+		const float* p = (const float*)img.data + i;
+		return vec3f{ p[0], p[1], p[2] };
+	}
+
+	//GL_LINEAR with GL_CLAMP_TO_EDGE at the uv equarectangular_to_cubemap.pixel computes for dir
+	inline vec3f
+	_equirect_bilinear(const Image& img, const vec3f& dir)
+	{
+		vec3f d = math::normalize(dir);
+		float u = atan2f(d[2], d[0]) / (2.0f * PI) + 0.5f;
+		float v = asinf(std::min(std::max(d[1], -1.0f), 1.0f)) / PI + 0.5f;
+		float x = u * img.width - 0.5f, y = v * img.height - 0.5f;
+		int x0 = (int)floorf(x), y0 = (int)floorf(y);
+		float fx = x - x0, fy = y - y0;
+		vec3f top = _equirect_texel(img, x0, y0) * (1.0f - fx) + _equirect_texel(img, x0 + 1, y0) * fx;
+		vec3f bottom = _equirect_texel(img, x0, y0 + 1) * (1.0f - fx) + _equirect_texel(img, x0 + 1, y0 + 1) * fx;
+		return top * (1.0f - fy) + bottom * fy;
+	}
+
+	std::vector<Image>
+	_cpu_equirect_captures(Backend* self, const Image& equirect, int size, const Face_View views[6], float rotation, PIXEL_TYPE readback)
+	{
+		assert(equirect.channels >= 3 && (equirect.type == PIXEL_TYPE::FLOAT || equirect.type == PIXEL_TYPE::HALF));
+		return _cpu_rows(self->pool, 6, size, 3, readback, [&](int face, float s, float t) {
+			return _equirect_bilinear(equirect, rotate_y(face_view_dir(views[face], s, t), -rotation));
+		});
+	}
+
+	constexpr Backend_Ops CPU_OPS =
+	{
+		_cpu_cube_create,
+		_cpu_cube_from_equirect,
+		nullptr,
+		nullptr,
+		_cpu_cube_free,
+		_cpu_pass_run,
+		_cpu_equirect_captures
+	};
+
+	Backend*
+	backend_create(cli::BACKEND kind, jobs::Pool* pool)
+	{
+		Backend* self = new Backend{};
+		self->kind = kind;
+		self->ops = kind == cli::BACKEND::CPU ? &CPU_OPS : &GL_OPS;
+		self->pool = pool;
+		return self;
+	}
+
+	void
+	backend_free(Backend* backend)
+	{
+		if (backend->target)
+			cubemap_free(backend->target);
+		delete backend;
+	}
+
+	cli::BACKEND
+	backend_kind(const Backend* backend)
+	{
+		return backend->kind;
+	}
+
+	Backend_Cube*
+	backend_cube_create(Backend* backend, const io::Image faces[6])
+	{
+		return backend->ops->cube_create(backend, faces);
+	}
+
+	Backend_Cube*
+	backend_cube_from_equirect(Backend* backend, const io::Image& equirect, int size, float rotation)
+	{
+		return backend->ops->cube_from_equirect(backend, equirect, size, rotation);
+	}
+
+	Envmap&
+	backend_cube_envmap(Backend* backend, Backend_Cube* cube)
+	{
+		if (backend->ops->cube_envmap)
+			backend->ops->cube_envmap(backend, cube);
+		return cube->env;
+	}
+
+	void
+	backend_cube_light_upload(Backend* backend, Backend_Cube* cube, bool keep_envmap)
+	{
+		if (backend->ops->cube_light_upload)
+			backend->ops->cube_light_upload(backend, cube, keep_envmap);
+	}
+
+	void
+	backend_cube_free(Backend* backend, Backend_Cube* cube)
+	{
+		if (cube)
+			backend->ops->cube_free(backend, cube);
+	}
+
+	glgpu::cubemap
+	backend_cube_gl(const Backend_Cube* cube)
+	{
+		assert(cube->cmap);
+		return cube->cmap;
+	}
+
+	std::vector<io::Image>
+	backend_pass_run(Backend* backend, const Backend_Pass& pass, Backend_Cube* input, int size, io::PIXEL_TYPE readback)
+	{
+		return backend->ops->pass_run(backend, pass, input, size, readback);
+	}
+
+	std::vector<io::Image>
+	backend_equirect_captures(Backend* backend, const io::Image& equirect, int size, const Face_View views[6], float rotation, io::PIXEL_TYPE readback)
+	{
+		return backend->ops->equirect_captures(backend, equirect, size, views, rotation, readback);
+	}
+
+	io::Image
+	readback_image(int width, int height, io::PIXEL_TYPE type, int float_channels)
+	{
+		Image img{};
+		img.width = width;
+		img.height = height;
+		img.channels = type == io::PIXEL_TYPE::FLOAT ? float_channels : 4;
+		img.type = type;
+		img.data = malloc((type == io::PIXEL_TYPE::FLOAT ? sizeof(float) : 1) * img.channels * width * height);
+		return img;
+	}
+
+	void
+	readback_from_float(const io::Image& rgb, io::Image& readback)
+	{
+		const float* in = (const float*)rgb.data;
+		size_t texels = (size_t)rgb.width * rgb.height;
+		if (readback.type == io::PIXEL_TYPE::FLOAT && readback.channels == rgb.channels)
+		{
+			memcpy(readback.data, in, sizeof(float) * rgb.channels * texels);
+			return;
+		}
+		for (size_t texel = 0; texel < texels; ++texel)
+			_texel_store(readback, texel, in + rgb.channels * texel, rgb.channels);
+	}
+
+	Gl_Captures
+	gl_captures_create(const Face_View views[6], float rotation)
+	{
+		//don't use ortho projection as this will make z in NDC the same so your captures will look like duplicated
+		//1.00000004321 is tan(45 degrees)
+		Mat4f proj = proj_prespective_matrix(100, 0.1, 1, -1, 1, -1, 1.00000004321);
+		Gl_Captures self{};
+		for (int i = 0; i < 6; ++i)
+			self.vp[i] = proj * view_lookat_matrix(rotate_y(views[i].eye, -rotation), vec3f{ 0.0f, 0.0f, 0.0f }, rotate_y(views[i].up, -rotation));
+		self.vao = vao_create();
+		self.vertices = unit_cube_buffer_create();
+		return self;
+	}
+
+	void
+	gl_captures_draw(const Gl_Captures& captures, glgpu::program prog, int face)
+	{
+		uniformmat4f_set(prog, "vp", captures.vp[face]);
+		vao_bind(captures.vao, captures.vertices, NULL);
+		draw_strip(36);
+		vao_unbind();
+	}
+
+	void
+	gl_captures_free(Gl_Captures& captures)
+	{
+		vao_delete(captures.vao);
+		buffer_delete(captures.vertices);
+		captures = Gl_Captures{};
+	}
+
+	void
+	gl_readback_rows(io::Image& img, int first_row, int row_count)
+	{
+		size_t row_size = (img.type == io::PIXEL_TYPE::FLOAT ? sizeof(float) : 1) * img.channels * img.width;
+		glReadPixels(0, first_row, img.width, row_count, _readback_format(img), _readback_type(img), (unsigned char*)img.data + row_size * first_row);
+	}
+};
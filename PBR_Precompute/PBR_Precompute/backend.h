@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Vector.h"
+#include "Matrix.h"
+#include "envmap.h"
+#include "glgpu.h"
+#include "image.h"
+#include "options.h"
+#include "task_graph.h"
+
+#include <vector>
+
+namespace pbr
+{
+	//where the passes of a bake run. the GL backend renders them with the context current on the calling thread, the CPU
+	//backend runs the CPU version of their shader a row of texels per job over the pool and never touches GL, so a
+	//headless node bakes with it. the bake only ever goes through the functions below, either one runs it unchanged
+	struct Backend;
+
+	//env cube of a backend with its solid angle weighted mip chain, a GL cubemap or an Envmap
+	struct Backend_Cube;
+
+	//sets the uniforms of the pass on its program (in use), the input cube is bound to env_map on unit 0 already
+	typedef void(*Backend_Uniforms)(glgpu::program prog, const void* params);
+
+	//the pixel shader of the pass on the CPU, the color of the texel looking along dir of a cube target or at
+	//texture coords (s, t) of a 2D one. input is the CPU copy of the input cube, null without one
+	typedef math::vec3f(*Backend_Texel)(const void* params, const Envmap* input, const math::vec3f& dir, float s, float t);
+
+	struct Backend_Pass
+	{
+		//GL draws it with cube.vertex over the captures of a cube target and with quad.vertex over a 2D one
+		const char* pixel_shader;
+		Backend_Uniforms uniforms;
+		Backend_Texel texel;
+		const void* params;
+		bool cube;    //6 captures laid out like POSTPROCESS_FACE_VIEWS, otherwise a single 2D target
+		int channels; //float channels of the target, 3 (RGB) or 2 (RG)
+	};
+
+	Backend*
+	backend_create(cli::BACKEND kind, jobs::Pool* pool);
+
+	void
+	backend_free(Backend* backend);
+
+	cli::BACKEND
+	backend_kind(const Backend* backend);
+
+	//from 6 RGB float faces in the GL face layout, the mip chain down to 1x1
+	Backend_Cube*
+	backend_cube_create(Backend* backend, const io::Image faces[6]);
+
+	//from an RGB FLOAT or HALF equirect turned by rotation (radians) around +Y, rendered into the faces for GL (cubemap_hdr_create)
+	//and splatted for the CPU (equirect_splat)
+	Backend_Cube*
+	backend_cube_from_equirect(Backend* backend, const io::Image& equirect, int size, float rotation);
+
+	//the CPU copy of the mip chain the schedule (and the CPU engines) sample, a readback for GL the first time it is asked
+	//for. its light distribution is what the prefilter passes draw their light samples from
+	Envmap&
+	backend_cube_envmap(Backend* backend, Backend_Cube* cube);
+
+	//the light distribution of the envmap goes where the passes read it (the pdf and cdf textures on units 1, 2 and 3
+	//for GL) and a GL cube drops its CPU copy unless keep_envmap
+	void
+	backend_cube_light_upload(Backend* backend, Backend_Cube* cube, bool keep_envmap);
+
+	void
+	backend_cube_free(Backend* backend, Backend_Cube* cube);
+
+	//the cubemap of a GL cube, for the GL only prefilter modes of the bake (progressive and hybrid)
+	glgpu::cubemap
+	backend_cube_gl(const Backend_Cube* cube);
+
+	//runs pass over every texel of a size target and reads it back, FLOAT gives pass.channels floats a texel and UBYTE RGBA
+	//clamped to [0, 1] like glReadPixels does. input can be null for passes that don't sample a cube.
+	//rows are bottom up, the first one is what glReadPixels returns first
+	std::vector<io::Image>
+	backend_pass_run(Backend* backend, const Backend_Pass& pass, Backend_Cube* input, int size, io::PIXEL_TYPE readback);
+
+	//the captures of views (turned by rotation radians around +Y) of an RGB FLOAT or HALF equirect, bilinear like the GL texture
+	std::vector<io::Image>
+	backend_equirect_captures(Backend* backend, const io::Image& equirect, int size, const Face_View views[6], float rotation, io::PIXEL_TYPE readback);
+
+	//what a readback of type fills, RGBA bytes for the 8 bit writers or floats of the channels the target has
+	//(RGB for the cubes, RG for the LUT) for the formats that keep HDR
+	io::Image
+	readback_image(int width, int height, io::PIXEL_TYPE type, int float_channels);
+
+	//the same conversion glReadPixels does when reading a float target (2 or 3 channels) into a readback image,
+	//an 8 bit clamp for UBYTE with the missing channels 0 and alpha 1
+	void
+	readback_from_float(const io::Image& rgb, io::Image& readback);
+
+	//GL pieces the GL only prefilter modes of the bake share with the GL backend's passes
+
+	//the cube the captures are drawn with and the view projection of each view turned by rotation (radians) around +Y
+	struct Gl_Captures
+	{
+		glgpu::vao vao;
+		glgpu::buffer vertices;
+		math::Mat4f vp[6];
+	};
+
+	Gl_Captures
+	gl_captures_create(const Face_View views[6], float rotation);
+
+	//capture face with prog (in use, its vp set here) into whatever is attached to the framebuffer
+	void
+	gl_captures_draw(const Gl_Captures& captures, glgpu::program prog, int face);
+
+	void
+	gl_captures_free(Gl_Captures& captures);
+
+	//rows [first_row, first_row + row_count) of the framebuffer into the same rows of a readback image
+	void
+	gl_readback_rows(io::Image& img, int first_row, int row_count);
+};
@@ -0,0 +1,1384 @@
+#include "bake.h"
+
+#include "glew.h"
+
+#include <assert.h>
+
+#include "gl_context.h"
+#include "Gfx.h"
+#include "glgpu.h"
+#include "envmap.h"
+#include "prefilter.h"
+#include "hdr.h"
+#include "equirect_splat.h"
+#include "env_cache.h"
+#include "half.h"
+#include "sky.h"
+#include "sh.h"
+#include "mapped_file.h"
+#include "cube_source.h"
+#include "hybrid_prefilter.h"
+#include "backend.h"
+#include "pass_graph.h"
+
+#include <string.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+using namespace math;
+using namespace glgpu;
+using namespace io;
+using namespace geo;
+
+namespace pbr
+{
+	//reads back a float accumulator bound to the current framebuffer and divides its colors by the weights in alpha
+	void
+	_accumulator_resolve(cubemap accumulator, std::vector<float>& readback, io::Image faces[6])
+	{
+		for (unsigned int i = 0; i < 6; ++i)
+		{
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLuint)accumulator, 0);
+			glReadPixels(0, 0, faces[i].width, faces[i].height, GL_RGBA, GL_FLOAT, readback.data());
+			float* out = (float*)faces[i].data;
+			for (int texel = 0; texel < faces[i].width * faces[i].height; ++texel)
+			{
+				float w = readback[4 * texel + 3];
+				float inv = w > 0.0f ? 1.0f / w : 0.0f;
+				out[3 * texel + 0] = readback[4 * texel + 0] * inv;
+				out[3 * texel + 1] = readback[4 * texel + 1] * inv;
+				out[3 * texel + 2] = readback[4 * texel + 2] * inv;
+			}
+		}
+	}
+
+	//same passes as the GL backend's cube passes but the sample sequence is accumulated in disjoint ranges into a float
+	//accumulator (weights in alpha) and the resolved faces are published at the budget deadlines,
+	//the postprocessor has to take sample_offset, sample_count and sample_total like the prefiltering shader
+	void
+	cubemap_postprocess_progressive(cubemap input, program postprocessor, Unifrom_Float uniform, vec2f view_size, unsigned int sample_total, const Progressive_Budget& budget, Progressive_Publish publish, void* user)
+	{
+		int width = (int)view_size[0], height = (int)view_size[1];
+		cubemap accumulator = cubemap_create(view_size, INTERNAL_TEXTURE_FORMAT::RGBA32F, EXTERNAL_TEXTURE_FORMAT::RGBA, DATA_TYPE::FLOAT, false);
+
+		GLuint fbo;
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+		const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (unsigned int i = 0; i < 6; ++i)
+		{
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLuint)accumulator, 0);
+			glClearBufferfv(GL_COLOR, 0, zero);
+		}
+
+		program_use(postprocessor);
+		cubemap_bind(input, TEXTURE_UNIT::UNIT_0);
+		uniform1i_set(postprocessor, "env_map", TEXTURE_UNIT::UNIT_0);
+		uniform1f_set(postprocessor, uniform.uniform, uniform.value);
+		uniform1ui_set(postprocessor, "sample_total", sample_total);
+
+		//rgb += color * weight, a += weight
+		glEnable(GL_BLEND);
+		glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ONE, GL_ONE);
+
+		glViewport(0, 0, width, height);
+		Gl_Captures captures = gl_captures_create(POSTPROCESS_FACE_VIEWS, 0.0f);
+
+		std::vector<float> readback(4 * width * height);
+		io::Image faces[6];
+		for (int i = 0; i < 6; ++i)
+		{
+			faces[i].data = new float[3 * width * height];
+			faces[i].width = width;
+			faces[i].height = height;
+			faces[i].channels = 3;
+		}
+
+		Progressive_Run run = progressive_start(budget, sample_total);
+		unsigned int first, count;
+		while (progressive_next(run, first, count))
+		{
+			uniform1ui_set(postprocessor, "sample_offset", first);
+			uniform1ui_set(postprocessor, "sample_count", count);
+			for (unsigned int i = 0; i < 6; ++i)
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLuint)accumulator, 0);
+				gl_captures_draw(captures, postprocessor, i);
+			}
+
+			//deadlines are about finished work not queued commands
+			glFinish();
+			if (progressive_publish_due(run))
+			{
+				_accumulator_resolve(accumulator, readback, faces);
+				publish(faces, run.samples_done, sample_total, true, user);
+			}
+		}
+
+		_accumulator_resolve(accumulator, readback, faces);
+		publish(faces, run.samples_done, sample_total, false, user);
+
+		glDisable(GL_BLEND);
+		glBindFramebuffer(GL_FRAMEBUFFER, NULL);
+
+		//free
+		for (int i = 0; i < 6; ++i)
+			delete[] (float*)faces[i].data;
+		glDeleteFramebuffers(1, &fbo);
+		gl_captures_free(captures);
+		cubemap_free(accumulator);
+	}
+
+	//what a bake leaves for the next one on the same baker, see baker_cache_enable
+	struct Bake_Cache
+	{
+		//the options and sources the captures came from but the rotation, empty while nothing is cached
+		std::string key;
+		float rotation; //degrees
+		Sh9 diffuse_sh;
+		bool diffuse_sh_convolved; //of the diffuse captures (evaluated as is) instead of the radiance of a sky
+		std::vector<Image> diffuse_faces;          //RGB float captures of EQUIRECT_FACE_VIEWS
+		std::vector<std::vector<Image>> lod_faces; //of POSTPROCESS_FACE_VIEWS
+
+		//the LUT doesn't depend on the env at all
+		int lut_size;
+		unsigned int lut_samples;
+		io::PIXEL_TYPE lut_type;
+		Image lut;
+	};
+
+	struct Baker
+	{
+		//the GL context comes up with the first bake on the GL backend, a baker that only runs CPU bakes never has one
+		win_gl win;
+		bool use_current_context;
+		bool gl_ready;
+		int max_texture_size;
+
+		jobs::Pool* pool;
+		Backend* backends[2]; //by cli::BACKEND, null until a bake needs it
+		bool cache_enabled;
+		Bake_Cache cache;
+	};
+
+	//state the bake tasks share, every field is written by a single task and only read by the tasks depending on it
+	struct Bake
+	{
+		const cli::Bake_Options* options;
+		const Bake_Sources* sources;
+		const Bake_Output* output;
+		const std::atomic<bool>* cancel;
+		jobs::Pool* pool;
+
+		//a source that can't be read skips the tasks that need it, bake_run fails after the graph is done
+		bool diffuse_failed;
+		bool env_failed;
+
+		float rotation;            //radians
+		io::PIXEL_TYPE cube_type;  //of the readbacks, FLOAT while the captures are kept for the cache
+
+		//every pass but the GL only prefilter modes goes through it
+		Backend* backend;
+		cli::STREAM env_stream; //always ON for the CPU backend, its env cube comes from the splat
+
+		//a rotation-only change of the cached bake: cached is set when it is a whole number of quarter turns and
+		//every capture is a permutation of the cached ones, otherwise the diffuse comes from the rotated SH9
+		const Bake_Cache* cached;
+		int cached_turns;
+		bool diffuse_sh_known;
+		Sh9 diffuse_sh;
+		bool diffuse_sh_convolved;
+		const Image* cached_lut;
+
+		//copies of the float captures and the LUT for the cache, taken before they are published
+		bool keep;
+		bool keep_lut;
+		std::vector<Image> kept_diffuse;
+		std::vector<std::vector<Image>> kept_lods;
+		Image kept_lut;
+
+		Image diffuse_hdr;
+		std::vector<Image> diffuse_faces;
+
+		Image env_hdr;
+		int max_texture_size;
+
+		//streamed env, the faces and the luminance equirect come from the CPU splat instead of env_hdr
+		bool env_streamed;
+		Image env_faces[6];
+		Image env_light_source;
+
+		Backend_Cube* env_cube;
+		int env_mip_count;
+		Envmap* env_cpu; //of env_cube, gone once the light distribution is uploaded unless the hybrid prefilter needs it
+		Env_Light env_light;
+		float light_fraction;
+		program prefiltering_prog; //GL, the progressive and hybrid prefilter draw it themselves
+		std::vector<Prefilter_LOD> schedule;
+		std::vector<std::vector<Image>> lod_faces;
+		std::vector<std::string> lod_dirs;
+
+		//the GL pass and the CPU engine take tiles of every LOD from the split, env_cpu is kept for the CPU one
+		bool hybrid;
+		Hybrid_Split hybrid_split;
+
+		Image brdf_lut;
+	};
+
+	struct Lod_Job
+	{
+		Bake* bake;
+		unsigned int lod;
+	};
+
+	inline bool
+	_cancelled(const Bake* bake)
+	{
+		return bake->cancel && *bake->cancel;
+	}
+
+	Image
+	_image_copy(const Image& img)
+	{
+		size_t channel_size = img.type == io::PIXEL_TYPE::FLOAT ? sizeof(float) : img.type == io::PIXEL_TYPE::HALF ? sizeof(half) : 1;
+		size_t bytes = channel_size * img.channels * img.width * img.height;
+		Image copy = img;
+		copy.data = malloc(bytes);
+		memcpy(copy.data, img.data, bytes);
+		return copy;
+	}
+
+	//borrowed sources are the caller's
+	inline void
+	_source_free(Image& img, const io::Image* borrowed)
+	{
+		if (borrowed == nullptr)
+			image_free(img);
+		img = Image{};
+	}
+
+	//.pfm sources are mapped instead of decoded, everything else is read as Radiance HDR straight to half floats,
+	//the GPU keeps RGB16F anyway and a float copy of a 16k source alone is 1.5 GB
+	Image
+	_source_read(const char* path, jobs::Pool* pool, bool cache)
+	{
+		io::IMAGE_FORMAT format;
+		if (image_format_from_path(path, format) == false || format != io::IMAGE_FORMAT::PFM)
+			format = io::IMAGE_FORMAT::HDR;
+		return image_read(path, format, pool, io::PIXEL_TYPE::HALF, cache);
+	}
+
+	//SH9 of faces this size keep the irradiance of the sky, the sun's energy is in them whatever the size
+	constexpr int SKY_SH_SIZE = 64;
+
+	//the rotation turns the sun with the sky
+	inline Sky_Params
+	_sky_params(const cli::Bake_Options& options)
+	{
+		return Sky_Params{ options.sky_turbidity, options.sun_elevation, options.sun_azimuth + options.env_rotation, options.sun_illuminance, 0.3f };
+	}
+
+	//the diffuse captures evaluated from the SH9 of the bake, laid out like the equirect captures. an SH9 of radiance is
+	//convolved, one projected from diffuse captures already is and is only evaluated
+	void
+	_sh_diffuse(Bake* bake, const Sh9& sh)
+	{
+		bool convolved = bake->diffuse_sh_convolved;
+		int size = bake->options->diffuse_size;
+		bake->diffuse_faces.resize(6);
+		jobs::parallel_for(bake->pool, 6, [&](unsigned int i) {
+			Image rgb{};
+			rgb.width = size;
+			rgb.height = size;
+			rgb.channels = 3;
+			rgb.type = io::PIXEL_TYPE::FLOAT;
+			rgb.data = malloc(sizeof(float) * 3 * size * size);
+			float* out = (float*)rgb.data;
+			for (int y = 0; y < size; ++y)
+			{
+				for (int x = 0; x < size; ++x)
+				{
+					vec3f dir = face_view_dir(EQUIRECT_FACE_VIEWS[i], (x + 0.5f) / size, (y + 0.5f) / size);
+					vec3f irradiance = convolved ? sh9_eval(sh, dir) : sh9_irradiance(sh, dir);
+					float* p = out + 3 * ((size_t)y * size + x);
+					p[0] = std::max(irradiance[0], 0.0f);
+					p[1] = std::max(irradiance[1], 0.0f);
+					p[2] = std::max(irradiance[2], 0.0f);
+				}
+			}
+			bake->diffuse_faces[i] = readback_image(size, size, bake->cube_type, 3);
+			readback_from_float(rgb, bake->diffuse_faces[i]);
+			image_free(rgb);
+		});
+	}
+
+	void
+	_sky_diffuse(Bake* bake)
+	{
+		Image sky_faces_small[6];
+		sky_faces(_sky_params(*bake->options), SKY_SH_SIZE, sky_faces_small, bake->pool);
+		bake->diffuse_sh = sh9_project_faces(sky_faces_small, bake->pool);
+		bake->diffuse_sh_known = true;
+		bake->diffuse_sh_convolved = false;
+		for (int i = 0; i < 6; ++i)
+			image_free(sky_faces_small[i]);
+		_sh_diffuse(bake, bake->diffuse_sh);
+	}
+
+	//a diffuse source that already is a cube is resampled into the captures, no GL pass
+	void
+	_cube_diffuse(Bake* bake, const char* path, cli::LAYOUT layout)
+	{
+		Image faces[6];
+		if (cube_source_read(path, layout, bake->options->source_layer, bake->pool, faces) == false)
+		{
+			printf("can't read the diffuse source '%s'\n", path);
+			bake->diffuse_failed = true;
+			return;
+		}
+
+		int size = bake->options->diffuse_size;
+		Image captures[6];
+		cube_faces_resample(faces, size, EQUIRECT_FACE_VIEWS, bake->rotation, captures, bake->pool);
+		bake->diffuse_faces.resize(6);
+		for (int i = 0; i < 6; ++i)
+		{
+			bake->diffuse_faces[i] = readback_image(size, size, bake->cube_type, 3);
+			readback_from_float(captures[i], bake->diffuse_faces[i]);
+			image_free(captures[i]);
+			image_free(faces[i]);
+		}
+	}
+
+	void
+	_diffuse_decode(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		if (bake->cached)
+		{
+			Image faces[6];
+			captures_rotate_y(EQUIRECT_FACE_VIEWS, bake->cached->diffuse_faces.data(), bake->cached_turns, faces);
+			bake->diffuse_faces.assign(faces, faces + 6);
+			return;
+		}
+		//a rotation that isn't a quarter turn of the cached bake, the SH9 turns exactly
+		if (bake->diffuse_sh_known)
+		{
+			_sh_diffuse(bake, bake->diffuse_sh);
+			return;
+		}
+		if (bake->options->sky)
+		{
+			_sky_diffuse(bake);
+			return;
+		}
+		const char* path = bake->options->diffuse_hdr_path;
+		cli::LAYOUT layout = bake->sources->diffuse ? cli::LAYOUT::EQUIRECT : cube_source_layout(path, bake->options->source_layout);
+		if (layout != cli::LAYOUT::EQUIRECT)
+		{
+			_cube_diffuse(bake, path, layout);
+			return;
+		}
+		if (bake->sources->diffuse)
+			bake->diffuse_hdr = *bake->sources->diffuse;
+		else if (path)
+			bake->diffuse_hdr = _source_read(path, bake->pool, bake->options->cache);
+
+		if (bake->diffuse_hdr.data == nullptr)
+		{
+			printf("can't read the diffuse source '%s'\n", path ? path : "");
+			bake->diffuse_failed = true;
+		}
+	}
+
+	bool
+	_env_streams(const Bake* bake, int width)
+	{
+		cli::STREAM stream = bake->env_stream;
+		return stream == cli::STREAM::ON || (stream == cli::STREAM::AUTO && width > bake->max_texture_size);
+	}
+
+	struct Hdr_Rows
+	{
+		const io::Hdr_File* file;
+		jobs::Pool* pool;
+		io::Env_Cache_Writer* cache; //level 0 of the env cache is written from the bands when set
+	};
+
+	void
+	_hdr_rows_read(void* user, int first_row, int row_count, float* rows)
+	{
+		Hdr_Rows* source = (Hdr_Rows*)user;
+		io::hdr_rows_decode(*source->file, first_row, row_count, rows, source->pool);
+		if (source->cache)
+			half_from_float(rows, io::env_cache_row(*source->cache, first_row), (size_t)3 * source->file->width * row_count);
+	}
+
+	//a cached env that streams is splatted from the finest mip that still has 4 source texels per face texel
+	//(a fraction of the work of the source), or not at all when the cache has unrotated faces of this size
+	void
+	_env_splat_cached(Bake* bake, const io::Env_Cache& cache, int light_max_width)
+	{
+		int env_size = bake->options->env_size;
+		Image faces[6];
+		if (bake->rotation == 0.0f && io::env_cache_faces(cache, env_size, faces))
+		{
+			for (int i = 0; i < 6; ++i)
+			{
+				size_t count = (size_t)3 * env_size * env_size;
+				bake->env_faces[i] = faces[i];
+				bake->env_faces[i].type = io::PIXEL_TYPE::FLOAT;
+				bake->env_faces[i].data = malloc(sizeof(float) * count);
+				half_to_float((const half*)faces[i].data, (float*)bake->env_faces[i].data, count);
+			}
+
+			//the light distribution only needs light_max_width texels across
+			if (light_max_width > 0)
+			{
+				int level = 0;
+				while (level + 1 < cache.level_count && io::env_cache_level(cache, level).width > light_max_width)
+					++level;
+				Image source = io::env_cache_level(cache, level);
+				size_t bytes = sizeof(half) * 3 * (size_t)source.width * source.height;
+				bake->env_light_source = source;
+				bake->env_light_source.data = malloc(bytes);
+				memcpy(bake->env_light_source.data, source.data, bytes);
+			}
+			return;
+		}
+
+		int level = 0;
+		while (level + 1 < cache.level_count && io::env_cache_level(cache, level + 1).width >= 4 * env_size)
+			++level;
+		Image source = io::env_cache_level(cache, level);
+		Equirect_Splat splat = equirect_splat_create(source.width, source.height, env_size, light_max_width, bake->rotation);
+		equirect_splat_image(splat, source, bake->pool);
+		equirect_splat_resolve(splat, bake->env_faces, bake->env_light_source);
+	}
+
+	//a whole env that is too wide for a texture goes through the splat anyway
+	void
+	_env_splat_whole(Bake* bake, int light_max_width)
+	{
+		const cli::Bake_Options& options = *bake->options;
+		if (bake->env_hdr.data == nullptr || bake->env_stream == cli::STREAM::OFF || _env_streams(bake, bake->env_hdr.width) == false)
+			return;
+
+		Equirect_Splat splat = equirect_splat_create(bake->env_hdr.width, bake->env_hdr.height, options.env_size, light_max_width, bake->rotation);
+		equirect_splat_image(splat, bake->env_hdr, bake->pool);
+		equirect_splat_resolve(splat, bake->env_faces, bake->env_light_source);
+		bake->env_streamed = true;
+		_source_free(bake->env_hdr, bake->sources->env);
+	}
+
+	//an env that already is a cube goes to the prefilter like a streamed one, its faces only resized to env_size
+	//(a box when the sizes allow it) and turned, the light distribution is accumulated from them
+	void
+	_env_cube(Bake* bake, const char* path, cli::LAYOUT layout, int light_max_width)
+	{
+		const cli::Bake_Options& options = *bake->options;
+		Image faces[6];
+		if (cube_source_read(path, layout, options.source_layer, bake->pool, faces) == false)
+			return;
+
+		cube_faces_resample(faces, options.env_size, nullptr, bake->rotation, bake->env_faces, bake->pool);
+		if (light_max_width > 0)
+			bake->env_light_source = cube_faces_luminance_equirect(bake->env_faces, light_max_width);
+		bake->env_streamed = true;
+		printf("env cube %d faces resized to %d\n", faces[0].width, options.env_size);
+		for (int i = 0; i < 6; ++i)
+			image_free(faces[i]);
+	}
+
+	//an env too big for a texture (or for memory, a 64k equirect) never exists whole, a .hdr is indexed and decoded
+	//a band at a time while the bands are splatted into the cube faces, a .pfm is a mapped view anyway.
+	//with --cache the bands also fill the env cache and the faces go in it, a re-bake then maps it
+	void
+	_env_load(Bake* bake)
+	{
+		const cli::Bake_Options& options = *bake->options;
+		const char* path = options.env_hdr_path;
+		int light_max_width = options.light_fraction > 0.0f ? 2 * options.env_size : 0;
+
+		//generated straight into the faces like a streamed env
+		if (options.sky)
+		{
+			Sky_Params sky = _sky_params(options);
+			sky_faces(sky, options.env_size, bake->env_faces, bake->pool);
+			if (light_max_width > 0)
+				bake->env_light_source = sky_luminance_equirect(sky, light_max_width, bake->pool);
+			bake->env_streamed = true;
+			return;
+		}
+
+		if (bake->sources->env)
+		{
+			bake->env_hdr = *bake->sources->env;
+			_env_splat_whole(bake, light_max_width);
+			return;
+		}
+		if (path == nullptr)
+			return;
+
+		cli::LAYOUT layout = cube_source_layout(path, options.source_layout);
+		if (layout != cli::LAYOUT::EQUIRECT)
+		{
+			_env_cube(bake, path, layout, light_max_width);
+			return;
+		}
+
+		if (bake->env_stream == cli::STREAM::OFF)
+		{
+			bake->env_hdr = _source_read(path, bake->pool, options.cache);
+			return;
+		}
+
+		io::IMAGE_FORMAT format;
+		bool pfm = image_format_from_path(path, format) && format == io::IMAGE_FORMAT::PFM;
+		bool cache = options.cache && pfm == false;
+
+		io::Env_Cache env_cache;
+		if (cache && io::env_cache_open(path, env_cache))
+		{
+			if (_env_streams(bake, env_cache.width))
+			{
+				_env_splat_cached(bake, env_cache, light_max_width);
+				bake->env_streamed = true;
+				io::env_cache_close(env_cache);
+			}
+			else
+			{
+				bake->env_hdr = io::env_cache_image(env_cache);
+			}
+			return;
+		}
+
+		io::Hdr_File hdr;
+		if (pfm == false && io::hdr_open(path, hdr))
+		{
+			if (_env_streams(bake, hdr.width))
+			{
+				io::Env_Cache_Writer writer;
+				Hdr_Rows source{ &hdr, bake->pool, nullptr };
+				//the cache keeps the faces of the unrotated env
+				if (cache && bake->rotation == 0.0f && io::env_cache_create(path, hdr.width, hdr.height, options.env_size, writer))
+					source.cache = &writer;
+
+				Equirect_Splat splat = equirect_splat_create(hdr.width, hdr.height, options.env_size, light_max_width, bake->rotation);
+				equirect_splat_stream(splat, _hdr_rows_read, &source, bake->pool);
+				equirect_splat_resolve(splat, bake->env_faces, bake->env_light_source);
+				bake->env_streamed = true;
+				printf("env %dx%d streamed into %d faces\n", hdr.width, hdr.height, options.env_size);
+
+				if (source.cache)
+				{
+					for (int i = 0; i < 6; ++i)
+						half_from_float((const float*)bake->env_faces[i].data, io::env_cache_face(writer, i), (size_t)3 * options.env_size * options.env_size);
+					io::env_cache_finish(writer, bake->pool);
+				}
+			}
+			else if (io::hdr_file_decode(hdr, bake->env_hdr, bake->pool, io::PIXEL_TYPE::HALF) && cache)
+			{
+				io::env_cache_write(path, bake->env_hdr, bake->pool);
+			}
+			io::hdr_close(hdr);
+			return;
+		}
+
+		bake->env_hdr = _source_read(path, bake->pool, options.cache);
+		_env_splat_whole(bake, light_max_width);
+	}
+
+	void
+	_env_decode(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		_env_load(bake);
+		if (bake->env_streamed == false && bake->env_hdr.data == nullptr)
+		{
+			const char* path = bake->options->env_hdr_path;
+			printf("can't read the env source '%s'\n", path ? path : "");
+			bake->env_failed = true;
+		}
+	}
+
+	//main thread for GL
+	void
+	_diffuse_render(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		//a sky's faces are already there
+		if (bake->diffuse_failed || bake->diffuse_faces.empty() == false || _cancelled(bake))
+			return;
+		int size = bake->options->diffuse_size;
+		bake->diffuse_faces = backend_equirect_captures(bake->backend, bake->diffuse_hdr, size, EQUIRECT_FACE_VIEWS, bake->rotation, bake->cube_type);
+	}
+
+	//main thread for GL, the CPU copy of the env mip chain is what the schedule estimates the prefilter error on
+	void
+	_env_upload(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		if (bake->env_failed)
+			return;
+		const cli::Bake_Options& options = *bake->options;
+
+		if (bake->env_streamed)
+			bake->env_cube = backend_cube_create(bake->backend, bake->env_faces);
+		else
+			bake->env_cube = backend_cube_from_equirect(bake->backend, bake->env_hdr, options.env_size, bake->rotation);
+		bake->env_mip_count = (int)std::log2(options.env_size) + 1;
+		bake->env_cpu = &backend_cube_envmap(bake->backend, bake->env_cube);
+	}
+
+	//light samples need the luminance distribution of the env, built from the equirect so it runs beside the GL upload
+	void
+	_env_light(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		if (bake->env_failed)
+			return;
+		bake->light_fraction = 0.0f;
+		if (bake->options->light_fraction <= 0.0f)
+			return;
+
+		//the streamed luminance is already filtered down to this width and turned
+		const Image& source = bake->env_streamed ? bake->env_light_source : bake->env_hdr;
+		bake->env_light = env_light_build(source, 2 * bake->options->env_size, bake->env_streamed ? 0.0f : bake->rotation);
+		if (bake->env_light.width > 0)
+			bake->light_fraction = bake->options->light_fraction;
+	}
+
+	//schedule the samples of each roughness level from an error target instead of a flat count
+	void
+	_prefilter_schedule(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		if (bake->env_failed)
+			return;
+		const cli::Bake_Options& options = *bake->options;
+		bake->env_cpu->light = std::move(bake->env_light);
+
+		Prefilter_Schedule_Config schedule_config{};
+		schedule_config.error_target = options.error_target;
+		schedule_config.probes_per_face = 4;
+		schedule_config.pilot_samples = std::min(256u, options.prefilter_max_samples);
+		schedule_config.min_samples = std::min(16u, options.prefilter_max_samples);
+		schedule_config.max_samples = options.prefilter_max_samples;
+		schedule_config.pool = bake->pool;
+		schedule_config.light_fraction = bake->light_fraction;
+		bake->schedule = prefilter_schedule(*bake->env_cpu, options.lod_count, schedule_config);
+
+		double scheduled_work = 0, flat_work = 0;
+		for (unsigned int mip_level = 0; mip_level < options.lod_count; ++mip_level)
+		{
+			const Prefilter_LOD& lod = bake->schedule[mip_level];
+			double texels = 6.0 * std::pow(std::max(options.prefilter_size >> mip_level, 1), 2);
+			scheduled_work += texels * lod.sample_count;
+			flat_work += texels * options.prefilter_max_samples;
+			printf("LOD %u: roughness %.2f, %u samples (%u light), error requested %.4f achieved %.4f\n", mip_level, lod.roughness,
+				lod.sample_count, prefilter_light_count(lod.sample_count, lod.roughness, bake->light_fraction),
+				lod.requested_error, lod.achieved_error);
+		}
+		printf("prefilter work: %.0f samples (%.2fx of a flat %u samples per LOD)\n", scheduled_work, scheduled_work / flat_work, options.prefilter_max_samples);
+	}
+
+	//a prefilter LOD pass of specular_prefiltering_convolution.pixel, the CPU texels are prefilter_texel
+	struct Prefilter_Pass
+	{
+		float roughness;
+		unsigned int sample_count;
+		unsigned int light_total;
+		int env_size;
+		int env_mip_count;
+	};
+
+	inline Prefilter_Pass
+	_prefilter_pass(const Bake* bake, unsigned int lod)
+	{
+		const Prefilter_LOD& scheduled = bake->schedule[lod];
+		return Prefilter_Pass{ scheduled.roughness, scheduled.sample_count, prefilter_light_count(scheduled.sample_count, scheduled.roughness, bake->light_fraction),
+			bake->options->env_size, bake->env_mip_count };
+	}
+
+	void
+	_prefilter_uniforms(program prog, const void* params)
+	{
+		const Prefilter_Pass* pass = (const Prefilter_Pass*)params;
+		uniform1f_set(prog, "roughness", pass->roughness);
+		uniform1ui_set(prog, "sample_total", pass->sample_count);
+		uniform1ui_set(prog, "sample_offset", 0);
+		uniform1ui_set(prog, "sample_count", pass->sample_count);
+		uniform1ui_set(prog, "light_total", pass->light_total);
+
+		//the samplers get their own units even without light samples, a sampler2D can't share the cubemap's unit
+		uniform1i_set(prog, "env_light_pdf", TEXTURE_UNIT::UNIT_1);
+		uniform1i_set(prog, "env_light_marginal", TEXTURE_UNIT::UNIT_2);
+		uniform1i_set(prog, "env_light_conditional", TEXTURE_UNIT::UNIT_3);
+
+		//the source lod of each sample comes from the env resolution, not a fixed one
+		uniform1f_set(prog, "env_size", (float)pass->env_size);
+		uniform1i_set(prog, "env_mip_count", pass->env_mip_count);
+	}
+
+	vec3f
+	_prefilter_pass_texel(const void* params, const Envmap* env, const vec3f& dir, float s, float t)
+	{
+		const Prefilter_Pass* pass = (const Prefilter_Pass*)params;
+		return prefilter_texel(*env, dir, pass->roughness, pass->sample_count, pass->light_total);
+	}
+
+	//main thread for GL
+	void
+	_prefilter_setup(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		if (bake->env_failed)
+			return;
+
+		//the CPU engine of a hybrid prefilter keeps sampling the envmap
+		backend_cube_light_upload(bake->backend, bake->env_cube, bake->hybrid);
+		if (bake->hybrid == false)
+			bake->env_cpu = nullptr;
+
+		//the GL prefilter modes that draw the pass themselves
+		if (bake->hybrid || (bake->options->progressive_ms > 0.0 && backend_kind(bake->backend) == cli::BACKEND::GL))
+			bake->prefiltering_prog = program_create("cube.vertex", "specular_prefiltering_convolution.pixel");
+
+		//both engines write their tiles straight into the readback faces
+		if (bake->hybrid)
+		{
+			int prefilter_size = bake->options->prefilter_size;
+			hybrid_split_init(bake->hybrid_split, bake->schedule, prefilter_size);
+			for (unsigned int lod = 0; lod < bake->schedule.size(); ++lod)
+			{
+				int size = std::max(prefilter_size >> lod, 1);
+				bake->lod_faces[lod].resize(6);
+				for (int i = 0; i < 6; ++i)
+					bake->lod_faces[lod][i] = readback_image(size, size, bake->cube_type, 3);
+			}
+		}
+	}
+
+	void
+	_cube_publish(Bake* bake, BAKE_TEXTURE texture, int lod, const Face_View views[6], std::vector<Image>& faces, std::vector<Image>* kept, bool partial);
+
+	struct Progressive_Output
+	{
+		Bake* bake;
+		unsigned int lod;
+		std::vector<Image> imgs;
+	};
+
+	//the intermediate results go straight to the publish callback, the last one stays for the LOD publish
+	void
+	_progressive_publish(const io::Image faces[6], unsigned int samples_done, unsigned int sample_total, bool partial, void* user)
+	{
+		Progressive_Output* output = (Progressive_Output*)user;
+		Bake* bake = output->bake;
+		if (partial == false)
+		{
+			for (int i = 0; i < 6; ++i)
+				readback_from_float(faces[i], output->imgs[i]);
+			return;
+		}
+		if (bake->output->publish == nullptr)
+			return;
+
+		std::vector<Image> published(6);
+		for (int i = 0; i < 6; ++i)
+		{
+			published[i] = readback_image(faces[i].width, faces[i].height, bake->cube_type, 3);
+			readback_from_float(faces[i], published[i]);
+		}
+		_cube_publish(bake, BAKE_TEXTURE::PREFILTERED, (int)output->lod, POSTPROCESS_FACE_VIEWS, published, nullptr, true);
+	}
+
+	//main thread for GL
+	void
+	_prefilter_lod(void* user)
+	{
+		Lod_Job* job = (Lod_Job*)user;
+		Bake* bake = job->bake;
+		if (bake->cached)
+		{
+			Image faces[6];
+			captures_rotate_y(POSTPROCESS_FACE_VIEWS, bake->cached->lod_faces[job->lod].data(), bake->cached_turns, faces);
+			bake->lod_faces[job->lod].assign(faces, faces + 6);
+			return;
+		}
+		if (bake->env_failed || _cancelled(bake))
+			return;
+		const cli::Bake_Options& options = *bake->options;
+		Prefilter_Pass pass = _prefilter_pass(bake, job->lod);
+		int mip_size = std::max(options.prefilter_size >> job->lod, 1);
+
+		if (options.progressive_ms > 0.0)
+		{
+			Progressive_Output output{ bake, job->lod, std::vector<Image>(6) };
+			for (int i = 0; i < 6; ++i)
+				output.imgs[i] = readback_image(mip_size, mip_size, bake->cube_type, 3);
+
+			Progressive_Budget budget{};
+			budget.publish_interval_ms = options.progressive_ms;
+			budget.limit_ms = options.time_limit_ms;
+			budget.batch_size = 64;
+			budget.cancel = bake->cancel;
+			if (backend_kind(bake->backend) == cli::BACKEND::CPU)
+			{
+				prefilter_progressive(backend_cube_envmap(bake->backend, bake->env_cube), mip_size, pass.roughness, pass.sample_count, pass.light_total,
+					budget, _progressive_publish, &output, bake->pool);
+			}
+			else
+			{
+				program prog = bake->prefiltering_prog;
+				program_use(prog);
+				_prefilter_uniforms(prog, &pass);
+				cubemap_postprocess_progressive(backend_cube_gl(bake->env_cube), prog, Unifrom_Float{ "roughness", pass.roughness }, vec2f{ (float)mip_size, (float)mip_size },
+					pass.sample_count, budget, _progressive_publish, &output);
+			}
+			bake->lod_faces[job->lod] = output.imgs;
+		}
+		else
+		{
+			Backend_Pass prefilter{ "specular_prefiltering_convolution.pixel", _prefilter_uniforms, _prefilter_pass_texel, &pass, true, 3 };
+			bake->lod_faces[job->lod] = backend_pass_run(bake->backend, prefilter, bake->env_cube, mip_size, bake->cube_type);
+		}
+	}
+
+	//main thread, the GL engine of a hybrid prefilter: the same pass as the GL backend's but scissored to the rows of each
+	//tile it takes and read back into them. the readback waits for the tile so its time is what the GL side really takes
+	void
+	_hybrid_gl(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		if (bake->env_failed)
+			return;
+		program prog = bake->prefiltering_prog;
+		int prefilter_size = bake->options->prefilter_size;
+		cubemap target = cubemap_create(vec2f{ (float)prefilter_size, (float)prefilter_size }, INTERNAL_TEXTURE_FORMAT::RGB16F, EXTERNAL_TEXTURE_FORMAT::RGB, DATA_TYPE::FLOAT, false);
+
+		GLuint fbo;
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		program_use(prog);
+		cubemap_bind(backend_cube_gl(bake->env_cube), TEXTURE_UNIT::UNIT_0);
+		uniform1i_set(prog, "env_map", TEXTURE_UNIT::UNIT_0);
+		Gl_Captures captures = gl_captures_create(POSTPROCESS_FACE_VIEWS, 0.0f);
+		glEnable(GL_SCISSOR_TEST);
+
+		Hybrid_Tile tile;
+		while (_cancelled(bake) == false && hybrid_split_take(bake->hybrid_split, HYBRID_ENGINE::GL, tile))
+		{
+			auto start = std::chrono::steady_clock::now();
+			Prefilter_Pass pass = _prefilter_pass(bake, tile.lod);
+			int size = std::max(prefilter_size >> tile.lod, 1);
+			_prefilter_uniforms(prog, &pass);
+
+			glViewport(0, 0, size, size);
+			glScissor(0, tile.first_row, size, tile.row_count);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + tile.face, (GLuint)target, 0);
+			gl_captures_draw(captures, prog, tile.face);
+			gl_readback_rows(bake->lod_faces[tile.lod][tile.face], tile.first_row, tile.row_count);
+			hybrid_split_done(bake->hybrid_split, HYBRID_ENGINE::GL, tile, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		glDisable(GL_SCISSOR_TEST);
+		glBindFramebuffer(GL_FRAMEBUFFER, NULL);
+		glDeleteFramebuffers(1, &fbo);
+		gl_captures_free(captures);
+		cubemap_free(target);
+	}
+
+	//the CPU engine of a hybrid prefilter, a worker for the whole prefilter that spreads each tile over the others
+	void
+	_hybrid_cpu(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		if (bake->env_failed)
+			return;
+		hybrid_cpu_run(bake->hybrid_split, *bake->env_cpu, bake->schedule, bake->light_fraction, bake->lod_faces, bake->cancel, bake->pool);
+	}
+
+	//the sources go as soon as the passes reading them are done, a 16k equirect doesn't wait for the prefilter
+	void
+	_diffuse_source_free(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		_source_free(bake->diffuse_hdr, bake->sources->diffuse);
+	}
+
+	void
+	_env_source_free(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		_source_free(bake->env_hdr, bake->sources->env);
+		for (int i = 0; i < 6; ++i)
+			image_free(bake->env_faces[i]);
+		image_free(bake->env_light_source);
+	}
+
+	//main thread for GL, the readbacks are already copied out so the face writes don't hold the GL objects
+	void
+	_env_cube_free(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		backend_cube_free(bake->backend, bake->env_cube);
+		bake->env_cube = nullptr;
+		bake->env_cpu = nullptr;
+	}
+
+	//main thread for GL, once both engines of a hybrid prefilter are done with the split
+	void
+	_prefilter_state_free(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		if (bake->hybrid && bake->env_failed == false)
+			hybrid_split_report(bake->hybrid_split);
+		if (bake->prefiltering_prog)
+			program_delete(bake->prefiltering_prog);
+	}
+
+	struct Brdf_Lut_Pass
+	{
+		unsigned int sample_count;
+	};
+
+	void
+	_brdf_lut_uniforms(program prog, const void* params)
+	{
+		uniform1ui_set(prog, "sample_count", ((const Brdf_Lut_Pass*)params)->sample_count);
+	}
+
+	//s is cos(view, normal) and t the roughness like the uvs of the quad
+	vec3f
+	_brdf_lut_texel(const void* params, const Envmap* env, const vec3f& dir, float s, float t)
+	{
+		vec2f scale_bias = brdf_integrate(s, t, ((const Brdf_Lut_Pass*)params)->sample_count);
+		return vec3f{ scale_bias[0], scale_bias[1], 0.0f };
+	}
+
+	//main thread for GL, doesn't depend on the env so it fills the gaps while the CPU decodes and schedules
+	void
+	_brdf_lut_render(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		if (bake->cached_lut)
+		{
+			bake->brdf_lut = _image_copy(*bake->cached_lut);
+			return;
+		}
+		if (_cancelled(bake))
+			return;
+		Brdf_Lut_Pass params{ bake->options->brdf_lut_samples };
+		Backend_Pass pass{ "specular_BRDF_convolution.pixel", _brdf_lut_uniforms, _brdf_lut_texel, &params, false, 2 };
+		bake->brdf_lut = backend_pass_run(bake->backend, pass, nullptr, bake->options->brdf_lut_size, bake->output->lut_type)[0];
+		if (bake->keep_lut)
+			bake->kept_lut = _image_copy(bake->brdf_lut);
+	}
+
+	//the faces of a cube pass go to the publish callback (remapped to the GL layout first when asked) or stay for the result,
+	//kept gets a copy of the float captures first when they are cached
+	void
+	_cube_publish(Bake* bake, BAKE_TEXTURE texture, int lod, const Face_View views[6], std::vector<Image>& faces, std::vector<Image>* kept, bool partial)
+	{
+		const Bake_Output& output = *bake->output;
+		if (faces.empty())
+			return;
+
+		if (kept)
+			for (const Image& face : faces)
+				kept->push_back(_image_copy(face));
+
+		if (bake->cube_type != output.cube_type)
+		{
+			for (Image& face : faces)
+			{
+				Image converted = readback_image(face.width, face.height, output.cube_type, 3);
+				readback_from_float(face, converted);
+				image_free(face);
+				face = converted;
+			}
+		}
+
+		if (output.gl_faces)
+		{
+			for (int i = 0; i < 6; ++i)
+			{
+				Image face = readback_image(faces[i].width, faces[i].height, faces[i].type, faces[i].channels);
+				face_view_to_cube_face(views[i], faces[i], face);
+				image_free(faces[i]);
+				faces[i] = face;
+			}
+		}
+
+		if (output.publish == nullptr)
+			return;
+		output.publish(texture, lod, faces.data(), 6, partial, output.user);
+		for (Image& face : faces)
+		{
+			image_free(face);
+			face = Image{};
+		}
+	}
+
+	void
+	_diffuse_publish(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		_cube_publish(bake, BAKE_TEXTURE::DIFFUSE, 0, EQUIRECT_FACE_VIEWS, bake->diffuse_faces, bake->keep ? &bake->kept_diffuse : nullptr, false);
+	}
+
+	void
+	_lod_publish(void* user)
+	{
+		Lod_Job* job = (Lod_Job*)user;
+		Bake* bake = job->bake;
+		_cube_publish(bake, BAKE_TEXTURE::PREFILTERED, (int)job->lod, POSTPROCESS_FACE_VIEWS, bake->lod_faces[job->lod], bake->keep ? &bake->kept_lods[job->lod] : nullptr, false);
+	}
+
+	void
+	_brdf_lut_publish(void* user)
+	{
+		Bake* bake = (Bake*)user;
+		const Bake_Output& output = *bake->output;
+		if (output.publish == nullptr)
+			return;
+		output.publish(BAKE_TEXTURE::BRDF_LUT, 0, &bake->brdf_lut, 1, false, output.user);
+		image_free(bake->brdf_lut);
+		bake->brdf_lut = Image{};
+	}
+
+	void
+	_images_free(std::vector<Image>& images)
+	{
+		for (Image& img : images)
+			image_free(img);
+		images.clear();
+	}
+
+	void
+	_cache_free(Bake_Cache& cache)
+	{
+		_images_free(cache.diffuse_faces);
+		for (std::vector<Image>& faces : cache.lod_faces)
+			_images_free(faces);
+		image_free(cache.lut);
+		cache = Bake_Cache{};
+	}
+
+	//a source path with the size and modification time of its file, so an edited source isn't taken for the cached one
+	void
+	_key_append_source(std::string& key, const char* path)
+	{
+		unsigned long long size = 0, modified = 0;
+		if (path)
+			io::file_stamp(path, size, modified);
+		char stamp[64];
+		snprintf(stamp, sizeof(stamp), "|%llu|%llu|", size, modified);
+		key += path ? path : "";
+		key += stamp;
+	}
+
+	//every option the captures depend on but the rotation, empty (nothing cached) for borrowed sources,
+	//the caller can change them under the same options
+	std::string
+	_cache_key(const cli::Bake_Options& options, const Bake_Sources& sources)
+	{
+		if (sources.diffuse || sources.env)
+			return std::string{};
+
+		std::string key;
+		if (options.sky == false)
+		{
+			_key_append_source(key, options.diffuse_hdr_path);
+			_key_append_source(key, options.env_hdr_path);
+		}
+		char settings[512];
+		snprintf(settings, sizeof(settings), "%d|%d|%d|%g|%g|%g|%g|%d|%d|%d|%u|%g|%u|%g|%d|%d|%g|%g|%d",
+			(int)options.source_layout, options.source_layer, options.sky ? 1 : 0, options.sky_turbidity, options.sun_elevation, options.sun_azimuth, options.sun_illuminance,
+			options.diffuse_size, options.env_size, options.prefilter_size, options.lod_count, options.error_target,
+			options.prefilter_max_samples, options.light_fraction, (int)options.env_stream, options.cache ? 1 : 0,
+			options.progressive_ms, options.time_limit_ms, (int)options.backend);
+		key += settings;
+		return key;
+	}
+
+	//the captures of a finished bake replace the cached ones, the SH9 of the diffuse is projected from its captures
+	//unless it is already known
+	void
+	_cache_store(Baker* baker, const std::string& key, Bake& bake)
+	{
+		Bake_Cache& cache = baker->cache;
+		Image lut = cache.lut;
+		int lut_size = cache.lut_size;
+		unsigned int lut_samples = cache.lut_samples;
+		io::PIXEL_TYPE lut_type = cache.lut_type;
+		cache.lut = Image{};
+		_cache_free(cache);
+		cache.lut = lut;
+		cache.lut_size = lut_size;
+		cache.lut_samples = lut_samples;
+		cache.lut_type = lut_type;
+
+		cache.key = key;
+		cache.rotation = bake.options->env_rotation;
+		cache.diffuse_faces = std::move(bake.kept_diffuse);
+		cache.lod_faces = std::move(bake.kept_lods);
+		if (bake.diffuse_sh_known)
+		{
+			cache.diffuse_sh = bake.diffuse_sh;
+			cache.diffuse_sh_convolved = bake.diffuse_sh_convolved;
+			return;
+		}
+
+		Image faces[6];
+		for (int i = 0; i < 6; ++i)
+		{
+			faces[i] = _image_copy(cache.diffuse_faces[i]);
+			face_view_to_cube_face(EQUIRECT_FACE_VIEWS[i], cache.diffuse_faces[i], faces[i]);
+		}
+		//the captures are the convolved diffuse already, their SH9 is only evaluated again
+		cache.diffuse_sh = sh9_project_faces(faces, baker->pool);
+		cache.diffuse_sh_convolved = true;
+		for (int i = 0; i < 6; ++i)
+			image_free(faces[i]);
+	}
+
+	Baker*
+	baker_create(unsigned int threads, const char* shader_dir, bool use_current_context)
+	{
+		Baker* self = new Baker{};
+		self->use_current_context = use_current_context;
+		if (shader_dir)
+			shader_dir_set(shader_dir);
+
+		//the thread owning the GL context is worker 0 and runs every AFFINITY::MAIN task,
+		//decoding, the light distribution, the schedule and the publishes go to whichever worker is free
+		self->pool = jobs::pool_create(threads);
+		return self;
+	}
+
+	void
+	baker_free(Baker* baker)
+	{
+		_cache_free(baker->cache);
+		for (Backend* backend : baker->backends)
+			if (backend)
+				backend_free(backend);
+		jobs::pool_free(baker->pool);
+		if (baker->gl_ready)
+		{
+			program_cache_enable(false);
+			if (baker->use_current_context == false)
+				offline_win_free(baker->win);
+		}
+		delete baker;
+	}
+
+	Backend*
+	baker_backend(Baker* baker, cli::BACKEND kind)
+	{
+		if (kind == cli::BACKEND::GL && baker->gl_ready == false)
+		{
+			if (baker->use_current_context == false)
+			{
+				//for some reason the right read is after the second draw..double buffering? (TODO), so that's a dummy first draw
+				baker->win = offline_win_create(4, 5);
+				color_clear(1, 0, 0);
+				frame_start();
+			}
+			else
+			{
+				//the caller's context may not have gone through glew in this module
+				GLenum glew_result = glewInit();
+				assert(glew_result == GLEW_OK);
+			}
+
+			//programs stay linked from one bake to the next
+			program_cache_enable(true);
+			glGetIntegerv(GL_MAX_TEXTURE_SIZE, &baker->max_texture_size);
+			baker->gl_ready = true;
+		}
+
+		Backend*& backend = baker->backends[(int)kind];
+		if (backend == nullptr)
+			backend = backend_create(kind, baker->pool);
+		return backend;
+	}
+
+	jobs::Pool*
+	baker_pool(Baker* baker)
+	{
+		return baker->pool;
+	}
+
+	void
+	baker_cache_enable(Baker* baker, bool enable)
+	{
+		baker->cache_enabled = enable;
+		if (enable == false)
+			_cache_free(baker->cache);
+	}
+
+	bool
+	bake_run(Baker* baker, const cli::Bake_Options& options, const Bake_Sources& sources, const Bake_Output& output, Bake_Result& result,
+		const std::atomic<bool>* cancel)
+	{
+		result = Bake_Result{};
+		if (cli::options_valid(options) == false)
+			return false;
+
+		Bake bake{};
+		bake.options = &options;
+		bake.sources = &sources;
+		bake.output = &output;
+		bake.cancel = cancel;
+		bake.pool = baker->pool;
+		bake.backend = baker_backend(baker, options.backend);
+		bake.max_texture_size = baker->max_texture_size;
+		bake.env_stream = options.backend == cli::BACKEND::CPU ? cli::STREAM::ON : options.env_stream;
+		bake.lod_faces.resize(options.lod_count);
+		bake.rotation = options.env_rotation * PI / 180.0f;
+		bake.cube_type = output.cube_type;
+		bake.hybrid = options.hybrid_prefilter;
+
+		std::string key = baker->cache_enabled ? _cache_key(options, sources) : std::string{};
+		Bake_Cache& cache = baker->cache;
+		if (key.empty() == false)
+		{
+			bake.cube_type = io::PIXEL_TYPE::FLOAT;
+			float turns = (options.env_rotation - cache.rotation) / 90.0f;
+			int quarter_turns = (int)floorf(turns + 0.5f);
+			if (cache.key == key && fabsf(turns - quarter_turns) < 1e-3f)
+			{
+				bake.cached = &cache;
+				bake.cached_turns = quarter_turns;
+				bake.hybrid = false;
+				printf("rotation of the cached bake by %d quarter turns\n", quarter_turns);
+			}
+			else
+			{
+				//the diffuse doesn't need the source again, only the prefilter is redone
+				if (cache.key == key)
+				{
+					bake.diffuse_sh = sh9_rotate_y(cache.diffuse_sh, (options.env_rotation - cache.rotation) * PI / 180.0f);
+					bake.diffuse_sh_known = true;
+					bake.diffuse_sh_convolved = cache.diffuse_sh_convolved;
+				}
+				bake.keep = true;
+				bake.kept_lods.resize(options.lod_count);
+			}
+		}
+		if (baker->cache_enabled)
+		{
+			if (cache.lut.data && cache.lut_size == options.brdf_lut_size && cache.lut_samples == options.brdf_lut_samples && cache.lut_type == output.lut_type)
+				bake.cached_lut = &cache.lut;
+			else
+				bake.keep_lut = true;
+		}
+
+		//the passes of the bake and what they read and write, the run orders them from that. a cached bake skips every env pass
+		//before the LODs, which rotate the cached captures instead
+		jobs::Pass_Graph* graph = jobs::pass_graph_create(baker->pool);
+		std::vector<Lod_Job> lod_jobs(options.lod_count);
+		bool env_cached = bake.cached != nullptr;
+
+		//GL passes stay on the thread owning the context, the CPU backend's go to any worker and spread over the others
+		jobs::AFFINITY passes = options.backend == cli::BACKEND::GL ? jobs::AFFINITY::MAIN : jobs::AFFINITY::ANY;
+
+		jobs::Resource diffuse_source = jobs::pass_graph_resource(graph, "diffuse source", _diffuse_source_free, &bake);
+		jobs::Resource diffuse_faces = jobs::pass_graph_resource(graph, "diffuse faces");
+		jobs::Resource env_source = jobs::pass_graph_resource(graph, "env source", _env_source_free, &bake);
+		jobs::Resource env_light = jobs::pass_graph_resource(graph, "env light");
+		jobs::Resource env_cube = jobs::pass_graph_resource(graph, "env cube", _env_cube_free, &bake, passes);
+		jobs::Resource schedule = jobs::pass_graph_resource(graph, "prefilter schedule");
+		jobs::Resource prefilter_state = jobs::pass_graph_resource(graph, "prefilter state", _prefilter_state_free, &bake, passes);
+		std::vector<jobs::Resource> lods(options.lod_count);
+		for (unsigned int mip_level = 0; mip_level < options.lod_count; ++mip_level)
+			lods[mip_level] = jobs::pass_graph_resource(graph, "prefilter LOD");
+		jobs::Resource brdf_lut = jobs::pass_graph_resource(graph, "BRDF LUT");
+
+		//diffuse, a sky, an SH9 or a cube source has its faces straight out of the decode. both write the faces, the render
+		//is ordered after the decode by the source it reads
+		jobs::pass_graph_pass(graph, "diffuse decode", _diffuse_decode, &bake, {}, { diffuse_source, diffuse_faces });
+		jobs::pass_graph_pass(graph, "diffuse render", _diffuse_render, &bake, { diffuse_source }, { diffuse_faces }, passes);
+		jobs::pass_graph_pass(graph, "diffuse publish", _diffuse_publish, &bake, { diffuse_faces }, {});
+
+		//the LOD reflections cubemaps, the cube pass builds the mip chain with it
+		jobs::pass_graph_pass(graph, "env decode", _env_decode, &bake, {}, { env_source }, jobs::AFFINITY::ANY, env_cached);
+		jobs::pass_graph_pass(graph, "env cube", _env_upload, &bake, { env_source }, { env_cube }, passes, env_cached);
+		jobs::pass_graph_pass(graph, "env light", _env_light, &bake, { env_source }, { env_light }, jobs::AFFINITY::ANY, env_cached);
+		jobs::pass_graph_pass(graph, "prefilter schedule", _prefilter_schedule, &bake, { env_cube, env_light }, { schedule }, jobs::AFFINITY::ANY, env_cached);
+		jobs::pass_graph_pass(graph, "prefilter setup", _prefilter_setup, &bake, { env_cube, schedule }, { prefilter_state }, passes, env_cached);
+
+		//each LOD is published as soon as it is read back, a hybrid prefilter's once both engines ran out of tiles
+		std::vector<jobs::Resource> lod_inputs{ env_cube, schedule, prefilter_state };
+		if (bake.hybrid)
+		{
+			jobs::pass_graph_pass(graph, "hybrid prefilter GL", _hybrid_gl, &bake, lod_inputs, lods, jobs::AFFINITY::MAIN);
+			jobs::pass_graph_pass(graph, "hybrid prefilter CPU", _hybrid_cpu, &bake, lod_inputs, lods);
+		}
+		for (unsigned int mip_level = 0; mip_level < options.lod_count; ++mip_level)
+		{
+			lod_jobs[mip_level] = Lod_Job{ &bake, mip_level };
+			if (bake.hybrid == false)
+				jobs::pass_graph_pass(graph, "prefilter LOD", _prefilter_lod, &lod_jobs[mip_level], lod_inputs, { lods[mip_level] }, passes);
+			jobs::pass_graph_pass(graph, "LOD publish", _lod_publish, &lod_jobs[mip_level], { lods[mip_level] }, {});
+		}
+
+		//BRDF LUT Texture
+		jobs::pass_graph_pass(graph, "BRDF LUT render", _brdf_lut_render, &bake, {}, { brdf_lut }, passes);
+		jobs::pass_graph_pass(graph, "BRDF LUT publish", _brdf_lut_publish, &bake, { brdf_lut }, {});
+
+		auto start = std::chrono::steady_clock::now();
+		jobs::pass_graph_run(graph);
+		result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		jobs::pass_graph_free(graph);
+
+		result.diffuse_faces = std::move(bake.diffuse_faces);
+		result.lod_faces = std::move(bake.lod_faces);
+		result.brdf_lut = bake.brdf_lut;
+		bool ok = bake.diffuse_failed == false && bake.env_failed == false && _cancelled(&bake) == false;
+
+		if (ok && bake.keep)
+			_cache_store(baker, key, bake);
+		_images_free(bake.kept_diffuse);
+		for (std::vector<Image>& faces : bake.kept_lods)
+			_images_free(faces);
+		if (ok && bake.keep_lut)
+		{
+			image_free(cache.lut);
+			cache.lut = bake.kept_lut;
+			cache.lut_size = options.brdf_lut_size;
+			cache.lut_samples = options.brdf_lut_samples;
+			cache.lut_type = output.lut_type;
+		}
+		else
+		{
+			image_free(bake.kept_lut);
+		}
+
+		if (ok == false)
+		{
+			bake_result_free(result);
+			return false;
+		}
+		return true;
+	}
+
+	void
+	bake_result_free(Bake_Result& result)
+	{
+		for (Image& face : result.diffuse_faces)
+			image_free(face);
+		for (std::vector<Image>& faces : result.lod_faces)
+			for (Image& face : faces)
+				image_free(face);
+		image_free(result.brdf_lut);
+		result = Bake_Result{};
+	}
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "image.h"
+#include "options.h"
+#include "task_graph.h"
+
+#include <atomic>
+#include <vector>
+
+namespace pbr
+{
+	//a GL context and a worker pool kept between bakes, an editor pays the context creation and the thread startup once.
+	//the context is created by the first bake on the GL backend, a baker only running CPU bakes never has one
+	struct Baker;
+
+	struct Backend;
+
+	enum class BAKE_TEXTURE
+	{
+		DIFFUSE,     //irradiance cubemap
+		PREFILTERED, //specular prefiltered cubemap, one publish per LOD
+		BRDF_LUT     //split sum scale and bias
+	};
+
+	//a texture is handed over on a worker as soon as it is read back, images are the 6 faces of a cube (count 6) or the LUT
+	//(count 1) and get freed once it returns. it can keep an image by copying the struct and nulling the data of the one it got.
+	//a progressive LOD is also handed over partial at each deadline (on the thread running it), the same LOD comes again
+	//refined until its last publish, which isn't partial
+	typedef void(*Bake_Publish)(BAKE_TEXTURE texture, int lod, io::Image* images, int count, bool partial, void* user);
+
+	//in memory RGB equirects (FLOAT or HALF) the bake borrows, a null one is read from the path in the options
+	struct Bake_Sources
+	{
+		const io::Image* diffuse;
+		const io::Image* env;
+	};
+
+	struct Bake_Output
+	{
+		//FLOAT reads back the RGB of the cubes and the RG of the LUT, UBYTE RGBA clamped to [0, 1] for the 8 bit formats
+		io::PIXEL_TYPE cube_type;
+		io::PIXEL_TYPE lut_type;
+
+		//faces in GL order and layout (what uploads to GL_TEXTURE_CUBE_MAP_POSITIVE_X + i as it is),
+		//otherwise in the layout of the captures the face files are written in
+		bool gl_faces;
+
+		//null keeps every texture in the result
+		Bake_Publish publish;
+		void* user;
+	};
+
+	//the textures nobody took, faces in the order of the cube passes (+X, -X, +Y, -Y, +Z, -Z)
+	struct Bake_Result
+	{
+		std::vector<io::Image> diffuse_faces;
+		std::vector<std::vector<io::Image>> lod_faces;
+		io::Image brdf_lut;
+		double ms;
+	};
+
+	//threads counts the calling thread, shaders are read from shader_dir (null keeps PBR_Shaders).
+	//with use_current_context the bakes render with the context current on the calling thread instead of
+	//creating a hidden window, it has to stay current there for every bake
+	Baker*
+	baker_create(unsigned int threads, const char* shader_dir = nullptr, bool use_current_context = false);
+
+	void
+	baker_free(Baker* baker);
+
+	//the backend of kind the bakes with that cli::BACKEND run on, the GL one brings the GL context up the first time.
+	//only from the thread that created the baker
+	Backend*
+	baker_backend(Baker* baker, cli::BACKEND kind);
+
+	//the pool the bakes run on, publish callbacks can spread their work over it
+	jobs::Pool*
+	baker_pool(Baker* baker);
+
+	//keeps the float captures and the LUT of the last bake on the baker (memory of a whole bake) so a bake that only
+	//changes env_rotation skips most of the work: quarter turns of the cached rotation are face permutations of the
+	//cached captures, no GL pass, other angles rotate the SH9 of the cached diffuse and only prefilter again.
+	//the LUT is reused while its size, samples and type don't change. borrowed sources are never cached.
+	//off by default, turning it off frees the cache
+	void
+	baker_cache_enable(Baker* baker, bool enable);
+
+	//bakes the diffuse cube, the prefiltered LODs and the BRDF LUT with the sizes and samples of options, output_format,
+	//cube_encoding and pack_range are left to whoever writes the textures. only from the thread that created the baker,
+	//false (and the reason printed) if the options aren't valid or a source can't be read.
+	//once cancel is set the GL passes that haven't started are skipped (a progressive LOD stops at its next batch) and it fails
+	bool
+	bake_run(Baker* baker, const cli::Bake_Options& options, const Bake_Sources& sources, const Bake_Output& output, Bake_Result& result,
+		const std::atomic<bool>* cancel = nullptr);
+
+	void
+	bake_result_free(Bake_Result& result);
+};
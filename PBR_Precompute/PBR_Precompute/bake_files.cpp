@@ -0,0 +1,267 @@
+#include <Windows.h>
+
+#include "bake_files.h"
+#include "ktx2.h"
+#include "hdr_pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace io;
+
+namespace pbr
+{
+	//face names in the order the cube passes read them back
+	static const char* FACE_NAMES[6] = { "left", "right", "top", "bottom", "back", "front" };
+
+	//packing of the cube encoding, false for the ones hdr_pack doesn't do
+	inline bool
+	_cube_packing(cli::ENCODING encoding, io::HDR_PACKING& packing)
+	{
+		if (encoding == cli::ENCODING::RGBM)
+			packing = io::HDR_PACKING::RGBM;
+		else if (encoding == cli::ENCODING::RGBD)
+			packing = io::HDR_PACKING::RGBD;
+		else if (encoding == cli::ENCODING::RGB9E5)
+			packing = io::HDR_PACKING::RGB9E5;
+		else
+			return false;
+		return true;
+	}
+
+	inline void
+	_pack_stats_print(const char* name, io::HDR_PACKING packing, const io::Hdr_Pack_Stats& stats)
+	{
+		static const char* PACKING_NAMES[3] = { "RGB9E5", "RGBM", "RGBD" };
+		printf("%s: %s max error %.2e, rms %.2e, %.2f%% clipped\n", name, PACKING_NAMES[(int)packing],
+			stats.max_error, stats.rms_error, stats.clipped * 100.0);
+	}
+
+	void
+	_face_write(const Bake_Files* files, const std::string& dir, int face, const Image& img)
+	{
+		io::IMAGE_FORMAT format = files->options->output_format;
+		std::string path = dir + "/" + FACE_NAMES[face] + "." + image_extension(format);
+
+		//the float faces of an RGBM or RGBD bake go out as the RGBA8 texels they pack into
+		io::HDR_PACKING packing;
+		if (img.type == io::PIXEL_TYPE::FLOAT && image_format_float(format) == false && _cube_packing(files->options->cube_encoding, packing))
+		{
+			Image packed{};
+			packed.width = img.width;
+			packed.height = img.height;
+			packed.channels = 4;
+			packed.data = malloc((size_t)4 * img.width * img.height);
+			io::Hdr_Pack_Stats stats;
+			io::hdr_pack(img, packing, files->options->pack_range, (unsigned char*)packed.data, files->pool, &stats);
+			io::image_write(packed, path.c_str(), format, files->pool);
+			image_free(packed);
+			_pack_stats_print(path.c_str(), packing, stats);
+		}
+		else
+		{
+			io::image_write(img, path.c_str(), format, files->pool);
+		}
+	}
+
+	inline io::KTX2_FORMAT
+	_cube_ktx2_format(cli::ENCODING encoding, io::KTX2_FORMAT native_format)
+	{
+		switch (encoding)
+		{
+		case cli::ENCODING::BC6H_FAST:
+		case cli::ENCODING::BC6H:
+			return io::KTX2_FORMAT::BC6H;
+		case cli::ENCODING::RGB9E5:
+			return io::KTX2_FORMAT::RGB9E5;
+		case cli::ENCODING::RGBM:
+			return io::KTX2_FORMAT::RGBM;
+		case cli::ENCODING::RGBD:
+			return io::KTX2_FORMAT::RGBD;
+		default:
+			return native_format;
+		}
+	}
+
+	bool
+	cube_ktx2_write(const cli::Bake_Options& options, jobs::Pool* pool, const char* path, io::KTX2_FORMAT native_format, const Image* images, int layer_count, int level_count)
+	{
+		cli::ENCODING encoding = options.cube_encoding;
+		io::KTX2_FORMAT format = _cube_ktx2_format(encoding, native_format);
+
+		int layers = layer_count > 0 ? layer_count : 1;
+		size_t image_count = 6 * (size_t)layers * level_count;
+		std::vector<io::Bc6h_Stats> stats(image_count);
+		std::vector<io::Hdr_Pack_Stats> pack_stats(image_count);
+		io::Ktx2_Encode encode{};
+		encode.pool = pool;
+		encode.bc6h_quality = encoding == cli::ENCODING::BC6H_FAST ? io::BC6H_QUALITY::FAST : io::BC6H_QUALITY::QUALITY;
+		encode.pack_range = options.pack_range;
+		encode.bc6h_stats = stats.data();
+		encode.pack_stats = pack_stats.data();
+		if (io::ktx2_write_array(path, format, 6, layer_count, level_count, images, encode) == false)
+			return false;
+
+		bool packed = format == io::KTX2_FORMAT::RGB9E5 || format == io::KTX2_FORMAT::RGBM || format == io::KTX2_FORMAT::RGBD;
+		io::HDR_PACKING packing = format == io::KTX2_FORMAT::RGBM ? io::HDR_PACKING::RGBM : format == io::KTX2_FORMAT::RGBD ? io::HDR_PACKING::RGBD : io::HDR_PACKING::RGB9E5;
+		if (format != io::KTX2_FORMAT::BC6H && packed == false)
+			return true;
+
+		//a face a line for a cubemap, the worst face of every level for an array of them
+		for (int level = 0; level < level_count; ++level)
+		{
+			if (layer_count > 0)
+			{
+				io::Bc6h_Stats worst{ 0.0, 1e30 };
+				io::Hdr_Pack_Stats worst_pack{};
+				for (int i = 6 * layers * level; i < 6 * layers * (level + 1); ++i)
+				{
+					worst.encode_ms += stats[i].encode_ms;
+					//Windows.h takes min and max
+					if (stats[i].psnr < worst.psnr)
+						worst.psnr = stats[i].psnr;
+					if (pack_stats[i].max_error > worst_pack.max_error)
+						worst_pack.max_error = pack_stats[i].max_error;
+					if (pack_stats[i].rms_error > worst_pack.rms_error)
+						worst_pack.rms_error = pack_stats[i].rms_error;
+					if (pack_stats[i].clipped > worst_pack.clipped)
+						worst_pack.clipped = pack_stats[i].clipped;
+				}
+				char name[512];
+				snprintf(name, sizeof(name), "%s LOD %d worst of %d cubes", path, level, layers);
+				if (format == io::KTX2_FORMAT::BC6H)
+					printf("%s: BC6H %.1f ms, PSNR %.2f dB\n", name, worst.encode_ms, worst.psnr);
+				else
+					_pack_stats_print(name, packing, worst_pack);
+				continue;
+			}
+
+			for (int face = 0; face < 6; ++face)
+			{
+				int image = 6 * level + face;
+				char name[512];
+				snprintf(name, sizeof(name), "%s LOD %d %s", path, level, FACE_NAMES[face]);
+				if (format == io::KTX2_FORMAT::BC6H)
+					printf("%s: BC6H %.1f ms, PSNR %.2f dB\n", name, stats[image].encode_ms, stats[image].psnr);
+				else
+					_pack_stats_print(name, packing, pack_stats[image]);
+			}
+		}
+		return true;
+	}
+
+	//encoding and writing a face is CPU work, the faces of a cube go over the pool so they overlap with the GL passes
+	bool
+	bake_files_publish(BAKE_TEXTURE texture, int lod, Image* images, int count, bool partial, void* user)
+	{
+		Bake_Files* files = (Bake_Files*)user;
+		io::IMAGE_FORMAT format = files->options->output_format;
+
+		//the container of the prefiltered levels is written once, from the final LODs
+		if (partial && files->ktx2)
+			return false;
+
+		if (texture == BAKE_TEXTURE::BRDF_LUT)
+		{
+			if (files->ktx2)
+				io::ktx2_write(files->brdf_dir.c_str(), io::KTX2_FORMAT::RG16F, 1, 1, images);
+			else
+				io::image_write(images[0], std::string(files->brdf_dir + "/BRDF_LUT." + image_extension(format)).c_str(), format, files->pool);
+			return true;
+		}
+
+		//irradiance is positive and smooth, shared exponent keeps it at 4 bytes a texel
+		if (files->ktx2 && texture == BAKE_TEXTURE::DIFFUSE)
+		{
+			cube_ktx2_write(*files->options, files->pool, files->diffuse_dir.c_str(), io::KTX2_FORMAT::RGB9E5, images, 0, 1);
+			return true;
+		}
+
+		if (files->ktx2)
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				files->prefilter_levels[6 * lod + i] = images[i];
+				images[i].data = nullptr;
+			}
+			if (--files->prefilter_levels_left == 0)
+			{
+				int level_count = files->options->lod_count;
+				cube_ktx2_write(*files->options, files->pool, files->prefilter_dir.c_str(), io::KTX2_FORMAT::RGBA16F, files->prefilter_levels.data(), 0, level_count);
+				for (Image& img : files->prefilter_levels)
+					image_free(img);
+			}
+			return true;
+		}
+
+		const std::string& dir = texture == BAKE_TEXTURE::DIFFUSE ? files->diffuse_dir : files->lod_dirs[lod];
+		jobs::parallel_for(files->pool, count, [&](unsigned int face) {
+			_face_write(files, dir, face, images[face]);
+		});
+		return true;
+	}
+
+	void
+	_files_publish(BAKE_TEXTURE texture, int lod, Image* images, int count, bool partial, void* user)
+	{
+		bake_files_publish(texture, lod, images, count, partial, user);
+	}
+
+	void
+	bake_files_init(Bake_Files& files, const cli::Bake_Options& options, jobs::Pool* pool, const char* root, Bake_Output& output)
+	{
+		//KTX2 keeps every face and LOD of a texture in one file so it only needs the first two directories
+		bool ktx2 = options.output_format == io::IMAGE_FORMAT::KTX2;
+		std::string specular_dir = std::string(root) + "/Specular";
+		CreateDirectoryA(root, NULL);
+		CreateDirectoryA(specular_dir.c_str(), NULL);
+
+		files.options = &options;
+		files.pool = pool;
+		files.ktx2 = ktx2;
+		files.diffuse_dir = std::string(root) + "/Diffuse";
+		files.prefilter_dir = specular_dir + "/Prefiltering";
+		files.brdf_dir = specular_dir + "/BRDF_LUT";
+		files.lod_dirs.clear();
+		files.prefilter_levels.clear();
+		files.prefilter_levels_left = 0;
+		if (ktx2)
+		{
+			files.diffuse_dir += ".ktx2";
+			files.prefilter_dir += ".ktx2";
+			files.brdf_dir += ".ktx2";
+			files.prefilter_levels.resize(6 * options.lod_count);
+			files.prefilter_levels_left = options.lod_count;
+		}
+		else
+		{
+			CreateDirectoryA(files.diffuse_dir.c_str(), NULL);
+			CreateDirectoryA(files.prefilter_dir.c_str(), NULL);
+			CreateDirectoryA(files.brdf_dir.c_str(), NULL);
+			for (int mip_level = 0; mip_level < options.lod_count; ++mip_level)
+			{
+				files.lod_dirs.push_back(files.prefilter_dir + "/LOD_" + std::to_string(mip_level));
+				CreateDirectoryA(files.lod_dirs.back().c_str(), NULL);
+			}
+		}
+
+		//UBYTE readbacks for the 8 bit formats, FLOAT ones for the formats that keep HDR and the cubes that get packed,
+		//KTX2 takes the faces in the GL layout
+		io::HDR_PACKING packing;
+		bool float_format = image_format_float(options.output_format);
+		output = Bake_Output{};
+		output.cube_type = float_format || _cube_packing(options.cube_encoding, packing) ? io::PIXEL_TYPE::FLOAT : io::PIXEL_TYPE::UBYTE;
+		output.lut_type = float_format ? io::PIXEL_TYPE::FLOAT : io::PIXEL_TYPE::UBYTE;
+		output.gl_faces = ktx2;
+		output.publish = _files_publish;
+		output.user = &files;
+	}
+
+	void
+	bake_files_free(Bake_Files& files)
+	{
+		for (Image& img : files.prefilter_levels)
+			image_free(img);
+		files.prefilter_levels.clear();
+	}
+};
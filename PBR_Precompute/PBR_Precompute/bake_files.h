@@ -0,0 +1,47 @@
+#pragma once
+
+#include "bake.h"
+#include "ktx2.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace pbr
+{
+	//where the published textures go, <root>/Diffuse, <root>/Specular/Prefiltering/LOD_n and <root>/Specular/BRDF_LUT
+	//face files, or a .ktx2 per texture. the callbacks run on the bake workers
+	struct Bake_Files
+	{
+		const cli::Bake_Options* options;
+		jobs::Pool* pool;
+		bool ktx2;
+
+		std::string diffuse_dir;
+		std::string prefilter_dir;
+		std::string brdf_dir;
+		std::vector<std::string> lod_dirs;
+
+		//the KTX2 file needs every LOD, they are kept here until the last one is published
+		std::vector<io::Image> prefilter_levels;
+		std::atomic<int> prefilter_levels_left;
+	};
+
+	//creates the directories under root (its parent has to exist) and sets the output to publish into them
+	//in the format and encoding of the options, which have to outlive the bake
+	void
+	bake_files_init(Bake_Files& files, const cli::Bake_Options& options, jobs::Pool* pool, const char* root, Bake_Output& output);
+
+	//the LODs a cancelled or failed KTX2 bake never got to write
+	void
+	bake_files_free(Bake_Files& files);
+
+	//partial LODs overwrite the face files of the LOD, a KTX2 bake only keeps the final ones (false for a partial it didn't write)
+	bool
+	bake_files_publish(BAKE_TEXTURE texture, int lod, io::Image* images, int count, bool partial, void* user);
+
+	//GL layout faces of each level as one KTX2 cubemap (layer_count 0) or cubemap array in the format of the cube encoding of
+	//options, native_format unless it is set. images are ordered like ktx2_write_array takes them, the encoding stats get printed
+	bool
+	cube_ktx2_write(const cli::Bake_Options& options, jobs::Pool* pool, const char* path, io::KTX2_FORMAT native_format, const io::Image* images, int layer_count, int level_count);
+};
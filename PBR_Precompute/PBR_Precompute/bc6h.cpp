@@ -0,0 +1,487 @@
+#include "bc6h.h"
+#include "half.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace math;
+
+namespace io
+{
+	constexpr int BC6H_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	constexpr float BC6H_MAX_HALF = 65504.0f;
+
+	//the one region modes we write, 10 bit endpoints (mode 11) or an 11 bit one and a 9 bit signed delta (mode 12)
+	struct Bc6h_Mode
+	{
+		unsigned int bits;
+		int endpoint_bits;
+		int delta_bits;     //0 when both endpoints are stored whole
+	};
+
+	constexpr Bc6h_Mode BC6H_MODE_11{ 0x03, 10, 0 };
+	constexpr Bc6h_Mode BC6H_MODE_12{ 0x07, 11, 9 };
+
+	//a 4x4 block as half bits (what the decoder reproduces) and in the 16 bit domain endpoints are interpolated in,
+	//structure of arrays so 4 texels go in an SSE register
+	struct Bc6h_Block
+	{
+		alignas(16) float h[3][16];
+		alignas(16) float u[3][16];
+	};
+
+	struct Bc6h_Encoding
+	{
+		const Bc6h_Mode* mode;
+		int a[3];  //quantized endpoints
+		int b[3];
+		int indices[16];
+		float error;
+	};
+
+	inline int
+	_unquantize(int q, int bits)
+	{
+		if (q == 0)
+			return 0;
+		if (q == (1 << bits) - 1)
+			return 0xFFFF;
+		return ((q << 16) + 0x8000) >> bits;
+	}
+
+	inline int
+	_quantize(float u, int bits)
+	{
+		return std::min(std::max((int)(u * (float)(1 << bits) / 65536.0f), 0), (1 << bits) - 1);
+	}
+
+	//keeps b within the delta of a the mode stores
+	inline void
+	_delta_clamp(const Bc6h_Mode& mode, const int a[3], int b[3])
+	{
+		if (mode.delta_bits == 0)
+			return;
+		int range = 1 << (mode.delta_bits - 1);
+		for (int c = 0; c < 3; ++c)
+			b[c] = std::min(std::max(b[c], a[c] - range), std::min(a[c] + range - 1, (1 << mode.endpoint_bits) - 1));
+	}
+
+	inline bool
+	_delta_fits(const Bc6h_Mode& mode, const int a[3], const int b[3])
+	{
+		if (mode.delta_bits == 0)
+			return true;
+		int range = 1 << (mode.delta_bits - 1);
+		for (int c = 0; c < 3; ++c)
+			if (b[c] - a[c] < -range || b[c] - a[c] >= range)
+				return false;
+		return true;
+	}
+
+	//half bits the decoder produces for every index
+	inline void
+	_palette(const Bc6h_Mode& mode, const int a[3], const int b[3], float palette[3][16])
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			int ua = _unquantize(a[c], mode.endpoint_bits), ub = _unquantize(b[c], mode.endpoint_bits);
+			for (int i = 0; i < 16; ++i)
+				palette[c][i] = (float)((((ua * (64 - BC6H_WEIGHTS[i]) + ub * BC6H_WEIGHTS[i] + 32) >> 6) * 31) >> 6);
+		}
+	}
+
+	//the index of each texel from its projection on the segment between the unquantized endpoints, 4 texels at a time
+	void
+	_project(const Bc6h_Block& block, const Bc6h_Mode& mode, const int a[3], const int b[3], int indices[16])
+	{
+		float ua[3], d[3];
+		float length2 = 0.0f;
+		for (int c = 0; c < 3; ++c)
+		{
+			ua[c] = (float)_unquantize(a[c], mode.endpoint_bits);
+			d[c] = (float)_unquantize(b[c], mode.endpoint_bits) - ua[c];
+			length2 += d[c] * d[c];
+		}
+		if (length2 <= 0.0f)
+		{
+			memset(indices, 0, 16 * sizeof(int));
+			return;
+		}
+
+		const __m128 scale = _mm_set1_ps(15.0f / length2);
+		const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(15.0f), round = _mm_set1_ps(0.5f);
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 t = _mm_setzero_ps();
+			for (int c = 0; c < 3; ++c)
+				t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(block.u[c] + i), _mm_set1_ps(ua[c])), _mm_set1_ps(d[c])));
+			t = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(t, scale), round), lo), hi);
+			_mm_storeu_si128((__m128i*)(indices + i), _mm_cvttps_epi32(t));
+		}
+	}
+
+	inline float
+	_texel_error(const Bc6h_Block& block, const float palette[3][16], int texel, int index)
+	{
+		float error = 0.0f;
+		for (int c = 0; c < 3; ++c)
+		{
+			float e = palette[c][index] - block.h[c][texel];
+			error += e * e;
+		}
+		return error;
+	}
+
+	//texel 0 is the anchor, its index is stored without the top bit: swap the endpoints (the palette is symmetric)
+	//when that's representable, otherwise hold it to the lower half of the palette
+	void
+	_anchor_fix(const Bc6h_Block& block, Bc6h_Encoding& e, const float palette[3][16])
+	{
+		if (e.indices[0] < 8)
+			return;
+		if (_delta_fits(*e.mode, e.b, e.a))
+		{
+			for (int c = 0; c < 3; ++c)
+				std::swap(e.a[c], e.b[c]);
+			for (int i = 0; i < 16; ++i)
+				e.indices[i] = 15 - e.indices[i];
+			return;
+		}
+
+		float before = _texel_error(block, palette, 0, e.indices[0]);
+		int best = 0;
+		for (int i = 1; i < 8; ++i)
+			if (_texel_error(block, palette, 0, i) < _texel_error(block, palette, 0, best))
+				best = i;
+		e.indices[0] = best;
+		e.error += _texel_error(block, palette, 0, best) - before;
+	}
+
+	//indices and error of the endpoints in e, the projected index of each texel and its neighbours are tried on the decoded palette
+	void
+	_evaluate(const Bc6h_Block& block, Bc6h_Encoding& e)
+	{
+		float palette[3][16];
+		_palette(*e.mode, e.a, e.b, palette);
+		_project(block, *e.mode, e.a, e.b, e.indices);
+
+		e.error = 0.0f;
+		for (int texel = 0; texel < 16; ++texel)
+		{
+			int best = e.indices[texel];
+			float best_error = _texel_error(block, palette, texel, best);
+			for (int i = std::max(best - 1, 0); i <= std::min(best + 1, 15); ++i)
+			{
+				float error = _texel_error(block, palette, texel, i);
+				if (error < best_error)
+				{
+					best = i;
+					best_error = error;
+				}
+			}
+			e.indices[texel] = best;
+			e.error += best_error;
+		}
+		_anchor_fix(block, e, palette);
+	}
+
+	//endpoints at the ends of the block's principal axis
+	void
+	_principal_endpoints(const Bc6h_Block& block, float a[3], float b[3])
+	{
+		float mean[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			__m128 sum = _mm_setzero_ps();
+			for (int i = 0; i < 16; i += 4)
+				sum = _mm_add_ps(sum, _mm_load_ps(block.u[c] + i));
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, sum);
+			mean[c] = (lanes[0] + lanes[1] + lanes[2] + lanes[3]) / 16.0f;
+		}
+
+		float covariance[6] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			float d[3] = { block.u[0][i] - mean[0], block.u[1][i] - mean[1], block.u[2][i] - mean[2] };
+			covariance[0] += d[0] * d[0];
+			covariance[1] += d[0] * d[1];
+			covariance[2] += d[0] * d[2];
+			covariance[3] += d[1] * d[1];
+			covariance[4] += d[1] * d[2];
+			covariance[5] += d[2] * d[2];
+		}
+
+		float axis[3] = { 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			float next[3] =
+			{
+				covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+				covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+				covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+			};
+			float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+			if (length <= 0.0f)
+				break;
+			for (int c = 0; c < 3; ++c)
+				axis[c] = next[c] / length;
+		}
+
+		__m128 t_min = _mm_set1_ps(3.0e38f), t_max = _mm_set1_ps(-3.0e38f);
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 t = _mm_setzero_ps();
+			for (int c = 0; c < 3; ++c)
+				t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(block.u[c] + i), _mm_set1_ps(mean[c])), _mm_set1_ps(axis[c])));
+			t_min = _mm_min_ps(t_min, t);
+			t_max = _mm_max_ps(t_max, t);
+		}
+		alignas(16) float mins[4], maxs[4];
+		_mm_store_ps(mins, t_min);
+		_mm_store_ps(maxs, t_max);
+		float low = std::min(std::min(mins[0], mins[1]), std::min(mins[2], mins[3]));
+		float high = std::max(std::max(maxs[0], maxs[1]), std::max(maxs[2], maxs[3]));
+
+		for (int c = 0; c < 3; ++c)
+		{
+			a[c] = std::min(std::max(mean[c] + axis[c] * low, 0.0f), 65535.0f);
+			b[c] = std::min(std::max(mean[c] + axis[c] * high, 0.0f), 65535.0f);
+		}
+	}
+
+	inline void
+	_quantize_endpoints(const Bc6h_Mode& mode, const float a[3], const float b[3], Bc6h_Encoding& e)
+	{
+		e.mode = &mode;
+		for (int c = 0; c < 3; ++c)
+		{
+			e.a[c] = _quantize(a[c], mode.endpoint_bits);
+			e.b[c] = _quantize(b[c], mode.endpoint_bits);
+		}
+		_delta_clamp(mode, e.a, e.b);
+	}
+
+	//least squares endpoints for the current indices
+	bool
+	_refit(const Bc6h_Block& block, const Bc6h_Encoding& e, float a[3], float b[3])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ua[3] = {}, ub[3] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			float w = BC6H_WEIGHTS[e.indices[i]] / 64.0f;
+			aa += (1.0f - w) * (1.0f - w);
+			ab += (1.0f - w) * w;
+			bb += w * w;
+			for (int c = 0; c < 3; ++c)
+			{
+				ua[c] += (1.0f - w) * block.u[c][i];
+				ub[c] += w * block.u[c][i];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) < 1.0e-6f)
+			return false;
+		for (int c = 0; c < 3; ++c)
+		{
+			a[c] = std::min(std::max((bb * ua[c] - ab * ub[c]) / det, 0.0f), 65535.0f);
+			b[c] = std::min(std::max((aa * ub[c] - ab * ua[c]) / det, 0.0f), 65535.0f);
+		}
+		return true;
+	}
+
+	Bc6h_Encoding
+	_encode_mode(const Bc6h_Block& block, const Bc6h_Mode& mode)
+	{
+		float a[3], b[3];
+		_principal_endpoints(block, a, b);
+		Bc6h_Encoding best;
+		_quantize_endpoints(mode, a, b, best);
+		_evaluate(block, best);
+
+		for (int iteration = 0; iteration < 3 && best.error > 0.0f; ++iteration)
+		{
+			if (_refit(block, best, a, b) == false)
+				break;
+			Bc6h_Encoding e;
+			_quantize_endpoints(mode, a, b, e);
+			_evaluate(block, e);
+			if (e.error >= best.error)
+				break;
+			best = e;
+		}
+
+		//one quantization step at a time on each endpoint channel while it keeps helping
+		int max_q = (1 << mode.endpoint_bits) - 1;
+		for (int pass = 0; pass < 4 && best.error > 0.0f; ++pass)
+		{
+			bool improved = false;
+			for (int component = 0; component < 6; ++component)
+			{
+				for (int step = -1; step <= 1; step += 2)
+				{
+					for (;;)
+					{
+						Bc6h_Encoding e = best;
+						int* q = component < 3 ? &e.a[component] : &e.b[component - 3];
+						*q += step;
+						if (*q < 0 || *q > max_q || _delta_fits(mode, e.a, e.b) == false)
+							break;
+						_evaluate(block, e);
+						if (e.error >= best.error)
+							break;
+						best = e;
+						improved = true;
+					}
+				}
+			}
+			if (improved == false)
+				break;
+		}
+		return best;
+	}
+
+	Bc6h_Encoding
+	_encode_fast(const Bc6h_Block& block)
+	{
+		float a[3], b[3];
+		_principal_endpoints(block, a, b);
+		Bc6h_Encoding e;
+		_quantize_endpoints(BC6H_MODE_11, a, b, e);
+
+		float palette[3][16];
+		_palette(BC6H_MODE_11, e.a, e.b, palette);
+		_project(block, BC6H_MODE_11, e.a, e.b, e.indices);
+		e.error = 0.0f;
+		for (int texel = 0; texel < 16; ++texel)
+			e.error += _texel_error(block, palette, texel, e.indices[texel]);
+		_anchor_fix(block, e, palette);
+		return e;
+	}
+
+	inline void
+	_bits_put(unsigned char* block, int& position, unsigned int value, int count)
+	{
+		for (int i = 0; i < count; ++i, ++position)
+			if ((value >> i) & 1)
+				block[position >> 3] |= (unsigned char)(1 << (position & 7));
+	}
+
+	void
+	_pack(const Bc6h_Encoding& e, unsigned char* block)
+	{
+		memset(block, 0, 16);
+		int position = 0;
+		const Bc6h_Mode& mode = *e.mode;
+		_bits_put(block, position, mode.bits, 5);
+		for (int c = 0; c < 3; ++c)
+			_bits_put(block, position, e.a[c], 10);
+		for (int c = 0; c < 3; ++c)
+		{
+			if (mode.delta_bits)
+			{
+				//the delta then the 11th bit of the base endpoint
+				_bits_put(block, position, (unsigned int)(e.b[c] - e.a[c]), mode.delta_bits);
+				_bits_put(block, position, e.a[c] >> 10, 1);
+			}
+			else
+			{
+				_bits_put(block, position, e.b[c], 10);
+			}
+		}
+		assert(position == 65);
+		for (int i = 0; i < 16; ++i)
+			_bits_put(block, position, e.indices[i], i == 0 ? 3 : 4);
+	}
+
+	size_t
+	bc6h_size(int width, int height)
+	{
+		return (size_t)16 * ((width + 3) / 4) * ((height + 3) / 4);
+	}
+
+	void
+	bc6h_encode(const Image& img, BC6H_QUALITY quality, unsigned char* out, jobs::Pool* pool, Bc6h_Stats* stats)
+	{
+		assert(img.type == PIXEL_TYPE::FLOAT && img.channels >= 3);
+		auto start = std::chrono::steady_clock::now();
+
+		int blocks_x = (img.width + 3) / 4, blocks_y = (img.height + 3) / 4;
+		const float* texels = (const float*)img.data;
+
+		//squared error and peak of each block row, summed once they are all done
+		std::vector<double> row_error(blocks_y, 0.0);
+		std::vector<float> row_peak(blocks_y, 0.0f);
+
+		jobs::parallel_for(pool, blocks_y, [&](unsigned int by) {
+			for (int bx = 0; bx < blocks_x; ++bx)
+			{
+				Bc6h_Block block;
+				float source[3][16];
+				for (int i = 0; i < 16; ++i)
+				{
+					int x = std::min(4 * bx + (i & 3), img.width - 1);
+					int y = std::min(4 * (int)by + (i >> 2), img.height - 1);
+					const float* p = texels + (size_t)img.channels * ((size_t)y * img.width + x);
+					for (int c = 0; c < 3; ++c)
+					{
+						//NaNs fail the compare and become 0 too
+						float value = p[c] > 0.0f ? std::min(p[c], BC6H_MAX_HALF) : 0.0f;
+						source[c][i] = value;
+						block.h[c][i] = (float)half_from_float(value);
+						block.u[c][i] = block.h[c][i] * 64.0f / 31.0f;
+					}
+				}
+
+				Bc6h_Encoding e;
+				if (quality == BC6H_QUALITY::QUALITY)
+				{
+					Bc6h_Encoding e11 = _encode_mode(block, BC6H_MODE_11);
+					Bc6h_Encoding e12 = _encode_mode(block, BC6H_MODE_12);
+					e = e12.error < e11.error ? e12 : e11;
+				}
+				else
+				{
+					e = _encode_fast(block);
+				}
+				_pack(e, out + 16 * ((size_t)by * blocks_x + bx));
+
+				if (stats == nullptr)
+					continue;
+				float palette[3][16];
+				_palette(*e.mode, e.a, e.b, palette);
+				for (int i = 0; i < 16; ++i)
+				{
+					if (4 * bx + (i & 3) >= img.width || 4 * (int)by + (i >> 2) >= img.height)
+						continue;
+					for (int c = 0; c < 3; ++c)
+					{
+						double d = half_to_float((half)palette[c][e.indices[i]]) - source[c][i];
+						row_error[by] += d * d;
+						row_peak[by] = std::max(row_peak[by], source[c][i]);
+					}
+				}
+			}
+		});
+
+		if (stats)
+		{
+			double error = 0.0;
+			float peak = 0.0f;
+			for (int by = 0; by < blocks_y; ++by)
+			{
+				error += row_error[by];
+				peak = std::max(peak, row_peak[by]);
+			}
+			double mse = error / (3.0 * img.width * img.height);
+			stats->psnr = mse > 0.0 && peak > 0.0f ? 10.0 * log10((double)peak * peak / mse) : 999.0;
+			stats->encode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+	}
+};
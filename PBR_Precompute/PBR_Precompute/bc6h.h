@@ -0,0 +1,31 @@
+#pragma once
+
+#include "image.h"
+#include "task_graph.h"
+
+#include <stddef.h>
+
+namespace io
+{
+	enum class BC6H_QUALITY
+	{
+		FAST,    //one 10 bit mode, principal axis endpoints and projected indices, for previews
+		QUALITY  //both one region modes, indices searched on the decoded palette and refined endpoints
+	};
+
+	struct Bc6h_Stats
+	{
+		double encode_ms;
+		double psnr;      //dB over RGB, the peak is the brightest channel of the image
+	};
+
+	//bytes bc6h_encode writes for a width x height image, 16 a 4x4 block
+	size_t
+	bc6h_size(int width, int height);
+
+	//BC6H_UF16 blocks of the RGB of a FLOAT image, block rows in the order of the image rows like glCompressedTexImage2D
+	//takes them, edges of sizes that aren't a multiple of 4 repeat the last row and column, negatives become 0.
+	//block rows are encoded over the pool
+	void
+	bc6h_encode(const Image& img, BC6H_QUALITY quality, unsigned char* out, jobs::Pool* pool = nullptr, Bc6h_Stats* stats = nullptr);
+};
@@ -0,0 +1,332 @@
+#include "cube_source.h"
+
+#include "Gfx.h"
+#include "hdr.h"
+#include "ktx2.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+using namespace math;
+using namespace io;
+
+namespace pbr
+{
+	//file names of the faces in GL order, what %s becomes
+	constexpr const char* FACE_NAMES[6] = { "px", "nx", "py", "ny", "pz", "nz" };
+
+	inline Image
+	_face_create(int size)
+	{
+		Image face{};
+		face.width = size;
+		face.height = size;
+		face.channels = 3;
+		face.type = PIXEL_TYPE::FLOAT;
+		face.data = malloc(sizeof(float) * 3 * size * size);
+		return face;
+	}
+
+	inline IMAGE_FORMAT
+	_source_format(const char* path)
+	{
+		IMAGE_FORMAT format;
+		if (image_format_from_path(path, format) == false || format != IMAGE_FORMAT::PFM)
+			format = IMAGE_FORMAT::HDR;
+		return format;
+	}
+
+	//size of an image without decoding it, a .hdr is only indexed and a .pfm mapped
+	bool
+	_source_size(const char* path, int& width, int& height)
+	{
+		if (_source_format(path) == IMAGE_FORMAT::PFM)
+		{
+			Image img = image_read(path, IMAGE_FORMAT::PFM);
+			width = img.width;
+			height = img.height;
+			bool ok = img.data != nullptr;
+			image_free(img);
+			return ok;
+		}
+
+		Hdr_File hdr;
+		if (hdr_open(path, hdr) == false)
+			return false;
+		width = hdr.width;
+		height = hdr.height;
+		hdr_close(hdr);
+		return true;
+	}
+
+	cli::LAYOUT
+	cube_source_layout(const char* path, cli::LAYOUT layout)
+	{
+		if (layout != cli::LAYOUT::AUTO || path == nullptr)
+			return layout;
+
+		IMAGE_FORMAT format;
+		if (image_format_from_path(path, format) && format == IMAGE_FORMAT::KTX2)
+			return cli::LAYOUT::KTX2;
+		if (strstr(path, "%s"))
+			return cli::LAYOUT::FACES;
+
+		int width, height;
+		if (_source_size(path, width, height) == false)
+			return cli::LAYOUT::EQUIRECT;
+		if (width * 3 == height * 4 || width * 4 == height * 3)
+			return cli::LAYOUT::CROSS;
+		if (width == 6 * height || height == 6 * width)
+			return cli::LAYOUT::STRIP;
+		return cli::LAYOUT::EQUIRECT;
+	}
+
+	//the size x size face at (column, row) in face units of a picture counted from its top, turned 180 degrees when
+	//turned is set (the -Z face at the bottom of a vertical cross), the decoded rows are bottom up
+	Image
+	_face_extract(const Image& img, int size, int column, int row, bool turned)
+	{
+		Image face = _face_create(size);
+		float* out = (float*)face.data;
+		const float* in = (const float*)img.data;
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				int px = column * size + (turned ? size - 1 - x : x);
+				int py = row * size + (turned ? size - 1 - y : y);
+				const float* p = in + (size_t)img.channels * ((size_t)(img.height - 1 - py) * img.width + px);
+				for (int c = 0; c < 3; ++c)
+					out[3 * ((size_t)y * size + x) + c] = p[std::min(c, img.channels - 1)];
+			}
+		}
+		return face;
+	}
+
+	bool
+	cube_source_read(const char* path, cli::LAYOUT layout, int layer, jobs::Pool* pool, Image faces[6])
+	{
+		assert(layout != cli::LAYOUT::AUTO && layout != cli::LAYOUT::EQUIRECT);
+		if (layout == cli::LAYOUT::KTX2)
+			return ktx2_read_cube(path, layer, faces);
+
+		if (layout == cli::LAYOUT::FACES)
+		{
+			std::string pattern = path;
+			size_t at = pattern.find("%s");
+			if (at == std::string::npos)
+			{
+				printf("the six faces path '%s' has no %%s\n", path);
+				return false;
+			}
+
+			for (int i = 0; i < 6; ++i)
+			{
+				std::string face_path = pattern.substr(0, at) + FACE_NAMES[i] + pattern.substr(at + 2);
+				Image img = image_read(face_path.c_str(), _source_format(face_path.c_str()), pool);
+				bool ok = img.data && img.width == img.height && (i == 0 || img.width == faces[0].width);
+				if (ok)
+					faces[i] = _face_extract(img, img.width, 0, 0, false);
+				image_free(img);
+				if (ok == false)
+				{
+					printf("can't read the face '%s' (or it isn't square and the size of the others)\n", face_path.c_str());
+					for (int j = 0; j < i; ++j)
+						image_free(faces[j]);
+					return false;
+				}
+			}
+			return true;
+		}
+
+		Image img = image_read(path, _source_format(path), pool);
+		if (img.data == nullptr)
+			return false;
+
+		//face units of each face in GL order
+		int columns[6], rows[6];
+		bool turned[6] = {};
+		bool valid = true;
+		int size = 0;
+		if (layout == cli::LAYOUT::CROSS)
+		{
+			//    +Y             +Y
+			// -X +Z +X -Z    -X +Z +X
+			//    -Y             -Y
+			//                   -Z (turned)
+			bool horizontal = img.width * 3 == img.height * 4;
+			valid = horizontal || img.width * 4 == img.height * 3;
+			size = horizontal ? img.width / 4 : img.width / 3;
+			const int cross_columns[6] = { 2, 0, 1, 1, 1, horizontal ? 3 : 1 };
+			const int cross_rows[6] = { 1, 1, 0, 2, 1, horizontal ? 1 : 3 };
+			memcpy(columns, cross_columns, sizeof(columns));
+			memcpy(rows, cross_rows, sizeof(rows));
+			turned[5] = horizontal == false;
+		}
+		else
+		{
+			bool horizontal = img.width == 6 * img.height;
+			valid = horizontal || img.height == 6 * img.width;
+			size = horizontal ? img.height : img.width;
+			for (int i = 0; i < 6; ++i)
+			{
+				columns[i] = horizontal ? i : 0;
+				rows[i] = horizontal ? 0 : i;
+			}
+		}
+
+		if (valid == false || size == 0)
+		{
+			printf("'%s' is %dx%d, not a %s\n", path, img.width, img.height, layout == cli::LAYOUT::CROSS ? "4:3 or 3:4 cross" : "6:1 or 1:6 strip");
+			image_free(img);
+			return false;
+		}
+		for (int i = 0; i < 6; ++i)
+			faces[i] = _face_extract(img, size, columns[i], rows[i], turned[i]);
+		image_free(img);
+		return true;
+	}
+
+	//each texel the average of the factor x factor texels it covers
+	void
+	_face_box(const Image& face, int factor, Image& out)
+	{
+		int size = face.width / factor;
+		out = _face_create(size);
+		const float* in = (const float*)face.data;
+		float* dst = (float*)out.data;
+		float inv = 1.0f / (factor * factor);
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				float sum[3] = {};
+				for (int sy = y * factor; sy < (y + 1) * factor; ++sy)
+					for (int sx = x * factor; sx < (x + 1) * factor; ++sx)
+						for (int c = 0; c < 3; ++c)
+							sum[c] += in[3 * ((size_t)sy * face.width + sx) + c];
+				for (int c = 0; c < 3; ++c)
+					dst[3 * ((size_t)y * size + x) + c] = sum[c] * inv;
+			}
+		}
+	}
+
+	void
+	cube_faces_resample(const Image faces[6], int size, const Face_View* views, float rotation, Image out[6], jobs::Pool* pool)
+	{
+		int source_size = faces[0].width;
+		int factor = std::max(source_size / size, 1);
+		if (source_size % factor != 0)
+			factor = 1;
+
+		//the box does all of it, or brings the faces close to size before the bilinear lookups
+		bool box_only = views == nullptr && rotation == 0.0f && source_size == factor * size;
+		Envmap env{};
+		env.size = source_size / factor;
+		env.mip_count = 1;
+		env.faces.resize(6);
+		jobs::parallel_for(pool, 6, [&](unsigned int i) {
+			if (factor > 1)
+				_face_box(faces[i], factor, env.faces[i]);
+			else
+				env.faces[i] = faces[i];
+		});
+		if (box_only)
+		{
+			for (int i = 0; i < 6; ++i)
+				out[i] = factor > 1 ? env.faces[i] : _face_create(size);
+			if (factor == 1)
+				for (int i = 0; i < 6; ++i)
+					memcpy(out[i].data, faces[i].data, sizeof(float) * 3 * size * size);
+			return;
+		}
+
+		jobs::parallel_for(pool, 6, [&](unsigned int i) {
+			out[i] = _face_create(size);
+			float* dst = (float*)out[i].data;
+			for (int y = 0; y < size; ++y)
+			{
+				for (int x = 0; x < size; ++x)
+				{
+					float s = (x + 0.5f) / size, t = (y + 0.5f) / size;
+					vec3f dir = views ? face_view_dir(views[i], s, t) : normalize(cube_face_dir(i, s, t));
+					vec3f color = envmap_sample(env, rotate_y(dir, -rotation), 0.0f);
+					float* p = dst + 3 * ((size_t)y * size + x);
+					p[0] = color[0];
+					p[1] = color[1];
+					p[2] = color[2];
+				}
+			}
+		});
+		if (factor > 1)
+			for (int i = 0; i < 6; ++i)
+				image_free(env.faces[i]);
+	}
+
+	Image
+	cube_faces_luminance_equirect(const Image faces[6], int width)
+	{
+		int height = std::max(width / 2, 1);
+		std::vector<float> sum((size_t)width * height, 0.0f), weight((size_t)width * height, 0.0f);
+
+		//same mapping as equarectangular_to_cubemap.pixel, rows bottom up
+		int size = faces[0].width;
+		float texel_area = 4.0f / ((float)size * size);
+		for (int face = 0; face < 6; ++face)
+		{
+			const float* texels = (const float*)faces[face].data;
+			for (int y = 0; y < size; ++y)
+			{
+				for (int x = 0; x < size; ++x)
+				{
+					float s = (x + 0.5f) / size, t = (y + 0.5f) / size;
+					float a = 2.0f * s - 1.0f, b = 2.0f * t - 1.0f;
+					float d2 = 1.0f + a * a + b * b;
+					float solid_angle = texel_area / (d2 * sqrtf(d2));
+
+					vec3f dir = normalize(cube_face_dir(face, s, t));
+					float u = atan2f(dir[2], dir[0]) / (2.0f * PI) + 0.5f;
+					float v = asinf(std::min(std::max(dir[1], -1.0f), 1.0f)) / PI + 0.5f;
+					int ex = std::min((int)(u * width), width - 1), ey = std::min((int)(v * height), height - 1);
+					const float* p = texels + 3 * ((size_t)y * size + x);
+					sum[(size_t)ey * width + ex] += luminance(vec3f{ p[0], p[1], p[2] }) * solid_angle;
+					weight[(size_t)ey * width + ex] += solid_angle;
+				}
+			}
+		}
+
+		Image light{};
+		light.width = width;
+		light.height = height;
+		light.channels = 1;
+		light.type = PIXEL_TYPE::FLOAT;
+		light.data = malloc(sizeof(float) * width * height);
+		float* out = (float*)light.data;
+		for (int ey = 0; ey < height; ++ey)
+		{
+			for (int ex = 0; ex < width; ++ex)
+			{
+				size_t i = (size_t)ey * width + ex;
+				if (weight[i] > 0.0f)
+				{
+					out[i] = sum[i] / weight[i];
+					continue;
+				}
+
+				//texels near the poles are smaller than the face texels, no texel center lands in them
+				float phi = ((ex + 0.5f) / width - 0.5f) * 2.0f * PI;
+				float latitude = ((ey + 0.5f) / height - 0.5f) * PI;
+				float s, t;
+				int face = cube_face_uv(vec3f{ cosf(latitude) * cosf(phi), sinf(latitude), cosf(latitude) * sinf(phi) }, s, t);
+				int fx = std::min((int)(s * size), size - 1), fy = std::min((int)(t * size), size - 1);
+				const float* p = (const float*)faces[face].data + 3 * ((size_t)fy * size + fx);
+				out[i] = luminance(vec3f{ p[0], p[1], p[2] });
+			}
+		}
+		return light;
+	}
+};
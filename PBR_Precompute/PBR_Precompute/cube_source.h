@@ -0,0 +1,30 @@
+#pragma once
+
+#include "envmap.h"
+#include "image.h"
+#include "options.h"
+#include "task_graph.h"
+
+namespace pbr
+{
+	//what AUTO is for path, only the header of an image is read. anything else is returned as it is
+	cli::LAYOUT
+	cube_source_layout(const char* path, cli::LAYOUT layout);
+
+	//the faces of a cube layout as malloc'd RGB float images in GL order and layout, .hdr or .pfm images
+	//(faces of a cross or a strip seen from inside the cube with their top row up, like a GL face uploads)
+	//or a KTX2 cubemap (array). false (the reason printed) if it can't be read
+	bool
+	cube_source_read(const char* path, cli::LAYOUT layout, int layer, jobs::Pool* pool, io::Image faces[6]);
+
+	//faces resampled to size and turned rotation radians around +Y (from +X toward +Z) into malloc'd RGB float images,
+	//laid out like the captures of views or in the GL face layout when it is null. an integer ratio is box filtered,
+	//what is left (any other ratio, a rotation or another layout) is bilinear, a face per worker
+	void
+	cube_faces_resample(const io::Image faces[6], int size, const Face_View* views, float rotation, io::Image out[6], jobs::Pool* pool);
+
+	//luminance equirect (1 channel float) of width x width / 2 for env_light_build, every face texel is accumulated
+	//into the equirect texel it hits weighted by its solid angle so a sun smaller than an equirect texel isn't missed
+	io::Image
+	cube_faces_luminance_equirect(const io::Image faces[6], int width);
+};
@@ -0,0 +1,709 @@
+#include <winsock2.h>
+#include <afunix.h>
+
+#include "daemon.h"
+#include "bake.h"
+#include "bake_files.h"
+#include "options.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace pbr
+{
+	struct Connection
+	{
+		SOCKET socket;
+		bool open;
+		std::mutex write_mutex;
+		std::thread reader;
+		bool done; //under the daemon's mutex, the reader is about to return and only has to be joined
+	};
+
+	struct Job
+	{
+		unsigned long long id;
+		int priority;
+		std::shared_ptr<Connection> client;
+		std::vector<std::string> args;
+		std::string out_dir;
+		std::string tag;
+		std::atomic<bool> cancel;
+	};
+
+	struct Daemon
+	{
+		const Daemon_Options* options;
+		SOCKET listener;
+
+		//guards everything below and the done flag of each connection, the readers queue, the GL thread takes the jobs
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::vector<std::shared_ptr<Job>> queue; //highest priority first, in arrival order within one
+		std::shared_ptr<Job> running;
+		std::vector<std::shared_ptr<Connection>> connections;
+		unsigned long long next_id;
+		bool shutdown;
+	};
+
+	struct Request
+	{
+		std::string op;
+		std::vector<std::string> args;
+		std::string out_dir;
+		std::string tag;
+		double priority;
+		double job;
+	};
+
+	//just enough JSON for the requests: an object of strings, numbers and string arrays, anything else is skipped
+	struct Json_Reader
+	{
+		const char* it;
+		const char* end;
+	};
+
+	inline void
+	_json_ws(Json_Reader& r)
+	{
+		while (r.it < r.end && (*r.it == ' ' || *r.it == '\t' || *r.it == '\r' || *r.it == '\n'))
+			++r.it;
+	}
+
+	inline bool
+	_json_char(Json_Reader& r, char c)
+	{
+		_json_ws(r);
+		if (r.it < r.end && *r.it == c)
+		{
+			++r.it;
+			return true;
+		}
+		return false;
+	}
+
+	inline void
+	_utf8_append(std::string& out, unsigned int code)
+	{
+		if (code < 0x80)
+		{
+			out += (char)code;
+		}
+		else if (code < 0x800)
+		{
+			out += (char)(0xC0 | (code >> 6));
+			out += (char)(0x80 | (code & 0x3F));
+		}
+		else
+		{
+			out += (char)(0xE0 | (code >> 12));
+			out += (char)(0x80 | ((code >> 6) & 0x3F));
+			out += (char)(0x80 | (code & 0x3F));
+		}
+	}
+
+	bool
+	_json_string(Json_Reader& r, std::string& out)
+	{
+		out.clear();
+		if (_json_char(r, '"') == false)
+			return false;
+		while (r.it < r.end && *r.it != '"')
+		{
+			char c = *r.it++;
+			if (c != '\\')
+			{
+				out += c;
+				continue;
+			}
+			if (r.it == r.end)
+				return false;
+			c = *r.it++;
+			switch (c)
+			{
+			case 'n': out += '\n'; break;
+			case 't': out += '\t'; break;
+			case 'r': out += '\r'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'u':
+			{
+				if (r.end - r.it < 4)
+					return false;
+				char hex[5] = { r.it[0], r.it[1], r.it[2], r.it[3], '\0' };
+				char* hex_end;
+				unsigned int code = (unsigned int)strtoul(hex, &hex_end, 16);
+				if (hex_end != hex + 4)
+					return false;
+				_utf8_append(out, code);
+				r.it += 4;
+				break;
+			}
+			default: out += c; break;
+			}
+		}
+		return _json_char(r, '"');
+	}
+
+	inline bool
+	_json_number(Json_Reader& r, double& out)
+	{
+		_json_ws(r);
+		std::string number;
+		while (r.it < r.end && strchr("+-.0123456789eE", *r.it))
+			number += *r.it++;
+		char* end;
+		out = strtod(number.c_str(), &end);
+		return number.empty() == false && *end == '\0';
+	}
+
+	bool
+	_json_skip(Json_Reader& r)
+	{
+		_json_ws(r);
+		if (r.it == r.end)
+			return false;
+		std::string s;
+		double d;
+		switch (*r.it)
+		{
+		case '"':
+			return _json_string(r, s);
+		case '[':
+		case '{':
+		{
+			char close = *r.it == '[' ? ']' : '}';
+			++r.it;
+			if (_json_char(r, close))
+				return true;
+			do
+			{
+				if (close == '}' && (_json_string(r, s) == false || _json_char(r, ':') == false))
+					return false;
+				if (_json_skip(r) == false)
+					return false;
+			} while (_json_char(r, ','));
+			return _json_char(r, close);
+		}
+		default:
+			if (_json_number(r, d))
+				return true;
+			//true, false and null
+			while (r.it < r.end && *r.it >= 'a' && *r.it <= 'z')
+				++r.it;
+			return true;
+		}
+	}
+
+	bool
+	_request_parse(const std::string& line, Request& request)
+	{
+		request = Request{};
+		Json_Reader r{ line.data(), line.data() + line.size() };
+		if (_json_char(r, '{') == false)
+			return false;
+		if (_json_char(r, '}'))
+			return true;
+		do
+		{
+			std::string key;
+			if (_json_string(r, key) == false || _json_char(r, ':') == false)
+				return false;
+
+			bool ok = true;
+			if (key == "op")
+				ok = _json_string(r, request.op);
+			else if (key == "out")
+				ok = _json_string(r, request.out_dir);
+			else if (key == "tag")
+				ok = _json_string(r, request.tag);
+			else if (key == "priority")
+				ok = _json_number(r, request.priority);
+			else if (key == "job")
+				ok = _json_number(r, request.job);
+			else if (key == "args")
+			{
+				ok = _json_char(r, '[');
+				if (ok && _json_char(r, ']') == false)
+				{
+					do
+					{
+						std::string arg;
+						ok = _json_string(r, arg);
+						request.args.push_back(arg);
+					} while (ok && _json_char(r, ','));
+					ok = ok && _json_char(r, ']');
+				}
+			}
+			else
+				ok = _json_skip(r);
+			if (ok == false)
+				return false;
+		} while (_json_char(r, ','));
+		return _json_char(r, '}');
+	}
+
+	//quoted and escaped
+	std::string
+	_json_quote(const std::string& s)
+	{
+		std::string out = "\"";
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\')
+			{
+				out += '\\';
+				out += c;
+			}
+			else if ((unsigned char)c < 0x20)
+			{
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int)c);
+				out += escaped;
+			}
+			else
+			{
+				out += c;
+			}
+		}
+		return out + "\"";
+	}
+
+	//one event line, dropped once the client is gone. from any thread
+	void
+	_send(Connection* client, const std::string& event)
+	{
+		std::lock_guard<std::mutex> lock(client->write_mutex);
+		if (client->open == false)
+			return;
+		std::string line = event + "\n";
+		size_t sent = 0;
+		while (sent < line.size())
+		{
+			int n = send(client->socket, line.data() + sent, (int)(line.size() - sent), 0);
+			if (n == SOCKET_ERROR)
+				return;
+			sent += n;
+		}
+	}
+
+	inline std::string
+	_job_event(const char* event, unsigned long long job)
+	{
+		return std::string("{\"event\":\"") + event + "\",\"job\":" + std::to_string(job);
+	}
+
+	//an event waiting for the daemon's mutex to be released, a slow client never blocks the others behind a send
+	struct Reply
+	{
+		std::shared_ptr<Connection> client;
+		std::string event;
+	};
+
+	//under the daemon's mutex, the events go in replies
+	void
+	_request_apply(Daemon* self, const std::shared_ptr<Connection>& client, Request& request, std::vector<Reply>& replies)
+	{
+		if (request.op == "bake")
+		{
+			if (self->shutdown || self->queue.size() >= self->options->queue_size)
+			{
+				replies.push_back(Reply{ client, "{\"event\":\"rejected\",\"tag\":" + _json_quote(request.tag) + ",\"reason\":\"" +
+					(self->shutdown ? "shutting down" : "queue full") + "\"}" });
+				return;
+			}
+			if (request.out_dir.empty())
+			{
+				replies.push_back(Reply{ client, "{\"event\":\"rejected\",\"tag\":" + _json_quote(request.tag) + ",\"reason\":\"no out directory\"}" });
+				return;
+			}
+
+			std::shared_ptr<Job> job = std::make_shared<Job>();
+			job->id = ++self->next_id;
+			job->priority = (int)request.priority;
+			job->client = client;
+			job->args = std::move(request.args);
+			job->out_dir = std::move(request.out_dir);
+			job->tag = std::move(request.tag);
+			job->cancel = false;
+
+			//behind every job of the same or a higher priority
+			size_t position = 0;
+			while (position < self->queue.size() && self->queue[position]->priority >= job->priority)
+				++position;
+			self->queue.insert(self->queue.begin() + position, job);
+			replies.push_back(Reply{ client, _job_event("queued", job->id) + ",\"tag\":" + _json_quote(job->tag) +
+				",\"position\":" + std::to_string(position) + "}" });
+			self->wake.notify_one();
+		}
+		else if (request.op == "cancel")
+		{
+			//only the connection that sent a job can cancel it, the ids are just a counter
+			unsigned long long id = (unsigned long long)request.job;
+			auto queued = std::find_if(self->queue.begin(), self->queue.end(), [id](const std::shared_ptr<Job>& job) { return job->id == id; });
+			Job* job = queued != self->queue.end() ? queued->get() : self->running && self->running->id == id ? self->running.get() : nullptr;
+			if (job == nullptr || job->client != client)
+			{
+				replies.push_back(Reply{ client, "{\"event\":\"error\",\"reason\":\"no job " + std::to_string(id) + " of this connection\"}" });
+				return;
+			}
+			if (queued != self->queue.end())
+			{
+				replies.push_back(Reply{ client, _job_event("cancelled", id) + "}" });
+				self->queue.erase(queued);
+			}
+			else
+			{
+				//the GL thread reports it once the bake stops
+				job->cancel = true;
+			}
+		}
+		else if (request.op == "status")
+		{
+			replies.push_back(Reply{ client, std::string("{\"event\":\"status\",\"running\":") + (self->running ? std::to_string(self->running->id) : "null") +
+				",\"queued\":" + std::to_string(self->queue.size()) + "}" });
+		}
+		else if (request.op == "shutdown")
+		{
+			self->shutdown = true;
+			self->wake.notify_one();
+			//unblocks accept
+			closesocket(self->listener);
+		}
+		else
+		{
+			replies.push_back(Reply{ client, "{\"event\":\"error\",\"reason\":\"unknown op " + _json_quote(request.op) + "\"}" });
+		}
+	}
+
+	//the readers, one per connection
+	void
+	_request_handle(Daemon* self, const std::shared_ptr<Connection>& client, const std::string& line)
+	{
+		Request request;
+		if (_request_parse(line, request) == false)
+		{
+			_send(client.get(), "{\"event\":\"error\",\"reason\":\"bad request\"}");
+			return;
+		}
+
+		std::vector<Reply> replies;
+		{
+			std::lock_guard<std::mutex> lock(self->mutex);
+			_request_apply(self, client, request, replies);
+		}
+		for (const Reply& reply : replies)
+			_send(reply.client.get(), reply.event);
+	}
+
+	void
+	_connection_read(Daemon* self, std::shared_ptr<Connection> client)
+	{
+		std::string pending;
+		char buffer[4096];
+		while (true)
+		{
+			int n = recv(client->socket, buffer, sizeof(buffer), 0);
+			if (n <= 0)
+				break;
+			pending.append(buffer, n);
+
+			size_t line_end;
+			while ((line_end = pending.find('\n')) != std::string::npos)
+			{
+				std::string line = pending.substr(0, line_end);
+				pending.erase(0, line_end + 1);
+				if (line.find_first_not_of(" \t\r") != std::string::npos)
+					_request_handle(self, client, line);
+			}
+		}
+
+		//nobody is left to report to, its jobs go with it
+		{
+			std::lock_guard<std::mutex> lock(self->mutex);
+			for (size_t i = 0; i < self->queue.size();)
+			{
+				if (self->queue[i]->client == client)
+					self->queue.erase(self->queue.begin() + i);
+				else
+					++i;
+			}
+			if (self->running && self->running->client == client)
+				self->running->cancel = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(client->write_mutex);
+			client->open = false;
+			closesocket(client->socket);
+		}
+
+		std::lock_guard<std::mutex> lock(self->mutex);
+		client->done = true;
+	}
+
+	void
+	_accept(Daemon* self)
+	{
+		unsigned int backoff_ms = 0;
+		while (true)
+		{
+			SOCKET socket = accept(self->listener, nullptr, nullptr);
+			int error = socket == INVALID_SOCKET ? WSAGetLastError() : 0;
+			{
+				std::lock_guard<std::mutex> lock(self->mutex);
+				if (self->shutdown)
+				{
+					if (socket != INVALID_SOCKET)
+						closesocket(socket);
+					return;
+				}
+			}
+			if (socket == INVALID_SOCKET)
+			{
+				//an error that doesn't go away (out of handles or memory) would spin here, the retries slow down to one a second
+				if (error != WSAEINTR && error != WSAEWOULDBLOCK)
+				{
+					if (backoff_ms == 0)
+						printf("accept failed (%d), retrying\n", error);
+					backoff_ms = std::min(std::max(backoff_ms * 2, 10u), 1000u);
+					std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+				}
+				continue;
+			}
+			backoff_ms = 0;
+
+			std::lock_guard<std::mutex> lock(self->mutex);
+
+			//readers of the clients gone since the last accept, a daemon running for weeks doesn't keep a thread and a socket for each
+			for (size_t i = 0; i < self->connections.size();)
+			{
+				if (self->connections[i]->done)
+				{
+					self->connections[i]->reader.join();
+					self->connections.erase(self->connections.begin() + i);
+				}
+				else
+				{
+					++i;
+				}
+			}
+
+			std::shared_ptr<Connection> client = std::make_shared<Connection>();
+			client->socket = socket;
+			client->open = true;
+			client->done = false;
+			client->reader = std::thread(_connection_read, self, client);
+			self->connections.push_back(client);
+		}
+	}
+
+	struct Job_Files
+	{
+		Bake_Files files;
+		Job* job;
+	};
+
+	inline const char*
+	_texture_name(BAKE_TEXTURE texture)
+	{
+		static const char* TEXTURE_NAMES[3] = { "diffuse", "prefiltered", "brdf_lut" };
+		return TEXTURE_NAMES[(int)texture];
+	}
+
+	//writes the texture like the command line and tells the client where it is, a partial one (an intermediate result of a
+	//progressive LOD) only when it got written
+	void
+	_job_publish(BAKE_TEXTURE texture, int lod, io::Image* images, int count, bool partial, void* user)
+	{
+		Job_Files* job_files = (Job_Files*)user;
+		Bake_Files& files = job_files->files;
+		if (bake_files_publish(texture, lod, images, count, partial, &files) == false)
+			return;
+
+		const std::string* path = &files.brdf_dir;
+		if (texture == BAKE_TEXTURE::DIFFUSE)
+			path = &files.diffuse_dir;
+		else if (texture == BAKE_TEXTURE::PREFILTERED)
+			path = files.ktx2 ? &files.prefilter_dir : &files.lod_dirs[lod];
+		_send(job_files->job->client.get(), _job_event("texture", job_files->job->id) + ",\"texture\":\"" + _texture_name(texture) +
+			"\",\"lod\":" + std::to_string(lod) + ",\"partial\":" + (partial ? "true" : "false") + ",\"path\":" + _json_quote(*path) + "}");
+	}
+
+	void
+	_job_run(Baker* baker, Job* job)
+	{
+		Connection* client = job->client.get();
+		_send(client, _job_event("started", job->id) + "}");
+		printf("job %llu %s\n", job->id, job->tag.c_str());
+
+		//the options point into the args, which the job keeps
+		std::vector<char*> argv;
+		argv.push_back((char*)"PBR_Precompute");
+		for (std::string& arg : job->args)
+			argv.push_back(&arg[0]);
+		cli::Bake_Options options;
+		if (cli::options_parse((int)argv.size(), argv.data(), options) == false)
+		{
+			_send(client, _job_event("done", job->id) + ",\"ok\":false,\"reason\":\"invalid options\"}");
+			return;
+		}
+		cli::options_print(options);
+
+		Job_Files job_files;
+		job_files.job = job;
+		Bake_Output output;
+		bake_files_init(job_files.files, options, baker_pool(baker), job->out_dir.c_str(), output);
+		output.publish = _job_publish;
+		output.user = &job_files;
+
+		Bake_Result result;
+		bool ok = bake_run(baker, options, Bake_Sources{}, output, result, &job->cancel);
+		double ms = result.ms;
+		bake_result_free(result);
+		bake_files_free(job_files.files);
+
+		char done[64];
+		snprintf(done, sizeof(done), ",\"ok\":%s,\"ms\":%.1f}", ok ? "true" : "false", ms);
+		if (job->cancel)
+			_send(client, _job_event("cancelled", job->id) + "}");
+		else
+			_send(client, _job_event("done", job->id) + done);
+		printf("job %llu %s in %.1f ms\n", job->id, job->cancel ? "cancelled" : ok ? "baked" : "failed", ms);
+	}
+
+	bool
+	daemon_options_parse(int argc, char** argv, Daemon_Options& options)
+	{
+		options = Daemon_Options{};
+		options.threads = std::max(std::thread::hardware_concurrency(), 1u);
+		options.queue_size = 16;
+
+		for (int i = 1; i < argc; i += 2)
+		{
+			const char* arg = argv[i];
+			if (i + 1 >= argc)
+			{
+				printf("missing value for '%s'\n", arg);
+				return false;
+			}
+			const char* value = argv[i + 1];
+
+			char* end;
+			long n = strtol(value, &end, 10);
+			bool number = *end == '\0' && n > 0;
+			if (strcmp(arg, "--daemon") == 0)
+				options.socket_path = value;
+			else if (strcmp(arg, "--threads") == 0 && number)
+				options.threads = (unsigned int)n;
+			else if (strcmp(arg, "--queue") == 0 && number)
+				options.queue_size = (unsigned int)n;
+			else if (strcmp(arg, "--shaders") == 0)
+				options.shader_dir = value;
+			else
+			{
+				printf("invalid daemon option '%s %s'\n", arg, value);
+				return false;
+			}
+		}
+		return options.socket_path != nullptr;
+	}
+
+	bool
+	daemon_run(const Daemon_Options& options)
+	{
+		WSADATA wsa;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+		{
+			printf("winsock couldn't be started\n");
+			return false;
+		}
+
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		if (strlen(options.socket_path) >= sizeof(address.sun_path))
+		{
+			printf("socket path '%s' is too long\n", options.socket_path);
+			WSACleanup();
+			return false;
+		}
+		strcpy(address.sun_path, options.socket_path);
+
+		//a socket file left by a daemon that didn't shut down
+		DeleteFileA(options.socket_path);
+		SOCKET listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener == INVALID_SOCKET || bind(listener, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR || listen(listener, SOMAXCONN) == SOCKET_ERROR)
+		{
+			printf("couldn't listen on '%s' (%d)\n", options.socket_path, WSAGetLastError());
+			if (listener != INVALID_SOCKET)
+				closesocket(listener);
+			WSACleanup();
+			return false;
+		}
+
+		Baker* baker = baker_create(options.threads, options.shader_dir);
+		//a client turning an env around only pays for what the rotation changes
+		baker_cache_enable(baker, true);
+		printf("daemon listening on %s, %u threads, %u queued jobs at most\n", options.socket_path, options.threads, options.queue_size);
+
+		Daemon self{};
+		self.options = &options;
+		self.listener = listener;
+		std::thread acceptor(_accept, &self);
+
+		//bakes run here, on the thread owning the context
+		while (true)
+		{
+			std::shared_ptr<Job> job;
+			{
+				std::unique_lock<std::mutex> lock(self.mutex);
+				self.wake.wait(lock, [&self] { return self.shutdown || self.queue.empty() == false; });
+				if (self.shutdown)
+					break;
+				job = self.queue.front();
+				self.queue.erase(self.queue.begin());
+				self.running = job;
+			}
+			_job_run(baker, job.get());
+			std::lock_guard<std::mutex> lock(self.mutex);
+			self.running.reset();
+		}
+
+		acceptor.join();
+		std::vector<std::shared_ptr<Job>> dropped;
+		{
+			std::lock_guard<std::mutex> lock(self.mutex);
+			dropped.swap(self.queue);
+		}
+		for (const std::shared_ptr<Job>& job : dropped)
+			_send(job->client.get(), _job_event("cancelled", job->id) + "}");
+		//unblocks the readers, they close their sockets on the way out
+		for (const std::shared_ptr<Connection>& client : self.connections)
+		{
+			{
+				std::lock_guard<std::mutex> lock(client->write_mutex);
+				if (client->open)
+					shutdown(client->socket, SD_BOTH);
+			}
+			client->reader.join();
+		}
+
+		baker_free(baker);
+		DeleteFileA(options.socket_path);
+		WSACleanup();
+		printf("daemon shut down\n");
+		return true;
+	}
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+//a bake worker that stays up with its GL context, pool and linked programs, editor tools and the build farm hand it
+//jobs over a local socket (AF_UNIX, Windows 10 1803 and up) instead of starting a process per bake.
+//
+//one JSON object per line each way, requests:
+//  {"op":"bake", "args":["--preset","mobile","--format","ktx2","C:/hdr/diffuse.hdr","C:/hdr/env.hdr"],
+//   "out":"C:/bakes/sky", "priority":1, "tag":"sky"}
+//      args are the command line ones (--threads is the daemon's), paths are taken from the daemon's working directory,
+//      out is where the textures go the way PBR is for the command line. higher priorities run first, in order otherwise
+//  {"op":"cancel", "job":12}  a queued job is dropped, a running one stops at its next GL pass, only from the connection
+//                             that sent it
+//  {"op":"status"}
+//  {"op":"shutdown"}          the running job finishes, the queued ones are dropped
+//events, to the connection that sent the job:
+//  {"event":"queued", "job":12, "tag":"sky", "position":0}
+//  {"event":"rejected", "tag":"sky", "reason":"queue full"}
+//  {"event":"started", "job":12}
+//  {"event":"texture", "job":12, "texture":"prefiltered", "lod":3, "partial":false, "path":"C:/bakes/sky/Specular/Prefiltering/LOD_3"}
+//      a --progressive LOD comes partial at each interval (face files only, a KTX2 bake only has the final one)
+//  {"event":"done", "job":12, "ok":true, "ms":812.4}
+//  {"event":"cancelled", "job":12}
+//  {"event":"status", "running":12, "queued":3}
+//  {"event":"error", "reason":"..."}
+//a connection that closes takes its jobs with it
+
+namespace pbr
+{
+	struct Daemon_Options
+	{
+		const char* socket_path;
+		unsigned int threads;
+		unsigned int queue_size; //jobs waiting beyond it are rejected
+		const char* shader_dir;  //null keeps PBR_Shaders
+	};
+
+	//PBR_Precompute --daemon <socket path> [--threads <n>] [--queue <n>] [--shaders <dir>],
+	//false if the command line is not valid, the reason gets printed
+	bool
+	daemon_options_parse(int argc, char** argv, Daemon_Options& options);
+
+	//serves jobs until a shutdown request, the calling thread owns the GL context and runs the bakes.
+	//false if the socket can't be opened
+	bool
+	daemon_run(const Daemon_Options& options);
+};
@@ -0,0 +1,286 @@
+#include "env_cache.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using namespace math;
+
+namespace io
+{
+	constexpr char ENV_CACHE_MAGIC[8] = { 'P', 'B', 'R', 'E', 'N', 'V', 'C', '1' };
+	constexpr int ENV_CACHE_MAX_LEVELS = 32;
+	constexpr size_t ENV_CACHE_ALIGNMENT = 64;
+
+	//what the content hash samples, the ends of the file and evenly spaced blocks in between
+	constexpr size_t HASH_END_BYTES = 64 << 10;
+	constexpr size_t HASH_BLOCK_BYTES = 4 << 10;
+	constexpr size_t HASH_BLOCK_COUNT = 64;
+
+	//magic is written last so a file that was never finished is never valid
+	struct Env_Cache_Header
+	{
+		char magic[8];
+		unsigned int width;
+		unsigned int height;
+		unsigned int level_count;
+		unsigned int face_size;
+		unsigned long long source_size;
+		unsigned long long source_modified;
+		unsigned long long source_hash;
+		unsigned long long level_offsets[ENV_CACHE_MAX_LEVELS];
+		unsigned long long face_offset;
+	};
+
+	inline std::string
+	_cache_path(const char* source_path)
+	{
+		return std::string(source_path) + ".envcache";
+	}
+
+	inline size_t
+	_align(size_t offset)
+	{
+		return (offset + ENV_CACHE_ALIGNMENT - 1) / ENV_CACHE_ALIGNMENT * ENV_CACHE_ALIGNMENT;
+	}
+
+	inline int
+	_level_size(int size, int level)
+	{
+		return std::max(size >> level, 1);
+	}
+
+	inline void
+	_fnv1a(unsigned long long& hash, const unsigned char* data, size_t size)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= data[i];
+			hash *= 0x100000001b3ull;
+		}
+	}
+
+	//size, modification time and content sample of the source, false if it can't be read
+	bool
+	_source_key(const char* source_path, unsigned long long& size, unsigned long long& modified, unsigned long long& hash)
+	{
+		if (file_stamp(source_path, size, modified) == false)
+			return false;
+
+		Mapped_File source;
+		if (file_map(source_path, source, false) == false)
+			return false;
+
+		hash = 0xcbf29ce484222325ull;
+		_fnv1a(hash, (const unsigned char*)&source.size, sizeof(source.size));
+		_fnv1a(hash, source.data, std::min(source.size, HASH_END_BYTES));
+		_fnv1a(hash, source.data + source.size - std::min(source.size, HASH_END_BYTES), std::min(source.size, HASH_END_BYTES));
+		if (source.size > HASH_BLOCK_BYTES)
+		{
+			for (size_t i = 0; i < HASH_BLOCK_COUNT; ++i)
+			{
+				size_t offset = (source.size - HASH_BLOCK_BYTES) / HASH_BLOCK_COUNT * i;
+				_fnv1a(hash, source.data + offset, HASH_BLOCK_BYTES);
+			}
+		}
+		file_unmap(source);
+		return true;
+	}
+
+	bool
+	env_cache_open(const char* source_path, Env_Cache& self)
+	{
+		self = Env_Cache{};
+
+		unsigned long long size, modified;
+		if (file_stamp(source_path, size, modified) == false)
+			return false;
+
+		Mapped_File file;
+		if (file_map(_cache_path(source_path).c_str(), file, false) == false)
+			return false;
+
+		//cheap checks before the source is touched
+		const Env_Cache_Header* header = (const Env_Cache_Header*)file.data;
+		bool valid = file.size >= sizeof(Env_Cache_Header) &&
+			memcmp(header->magic, ENV_CACHE_MAGIC, sizeof(ENV_CACHE_MAGIC)) == 0 &&
+			header->source_size == size && header->source_modified == modified &&
+			header->level_count > 0 && header->level_count <= ENV_CACHE_MAX_LEVELS;
+
+		if (valid)
+		{
+			int last = header->level_count - 1;
+			size_t end = header->face_size ? header->face_offset + sizeof(half) * 18 * (size_t)header->face_size * header->face_size :
+				header->level_offsets[last] + sizeof(half) * 3 * (size_t)_level_size(header->width, last) * _level_size(header->height, last);
+			valid = end <= file.size;
+		}
+
+		unsigned long long hash;
+		if (valid)
+			valid = _source_key(source_path, size, modified, hash) && hash == header->source_hash;
+
+		if (valid == false)
+		{
+			file_unmap(file);
+			return false;
+		}
+
+		self.file = file;
+		self.width = header->width;
+		self.height = header->height;
+		self.level_count = header->level_count;
+		self.face_size = header->face_size;
+		return true;
+	}
+
+	Image
+	env_cache_level(const Env_Cache& self, int level)
+	{
+		const Env_Cache_Header* header = (const Env_Cache_Header*)self.file.data;
+		Image img{};
+		img.width = _level_size(self.width, level);
+		img.height = _level_size(self.height, level);
+		img.channels = 3;
+		img.type = PIXEL_TYPE::HALF;
+		img.data = (void*)(self.file.data + header->level_offsets[level]);
+		return img;
+	}
+
+	bool
+	env_cache_faces(const Env_Cache& self, int face_size, Image faces[6])
+	{
+		if (self.face_size == 0 || self.face_size != face_size)
+			return false;
+
+		const Env_Cache_Header* header = (const Env_Cache_Header*)self.file.data;
+		for (int face = 0; face < 6; ++face)
+		{
+			faces[face] = Image{};
+			faces[face].width = face_size;
+			faces[face].height = face_size;
+			faces[face].channels = 3;
+			faces[face].type = PIXEL_TYPE::HALF;
+			faces[face].data = (void*)(self.file.data + header->face_offset + sizeof(half) * 3 * (size_t)face_size * face_size * face);
+		}
+		return true;
+	}
+
+	void
+	env_cache_close(Env_Cache& self)
+	{
+		file_unmap(self.file);
+		self = Env_Cache{};
+	}
+
+	Image
+	env_cache_image(Env_Cache& self)
+	{
+		Image img = env_cache_level(self, 0);
+		img.mapping = new Mapped_File(self.file);
+		self = Env_Cache{};
+		return img;
+	}
+
+	bool
+	env_cache_create(const char* source_path, int width, int height, int face_size, Env_Cache_Writer& self)
+	{
+		self = Env_Cache_Writer{};
+
+		Env_Cache_Header header{};
+		if (_source_key(source_path, header.source_size, header.source_modified, header.source_hash) == false)
+			return false;
+		header.width = width;
+		header.height = height;
+		header.face_size = face_size;
+
+		size_t offset = _align(sizeof(Env_Cache_Header));
+		for (int level = 0; ; ++level)
+		{
+			assert(level < ENV_CACHE_MAX_LEVELS);
+			header.level_offsets[level] = offset;
+			header.level_count = level + 1;
+			offset = _align(offset + sizeof(half) * 3 * (size_t)_level_size(width, level) * _level_size(height, level));
+			if (_level_size(width, level) == 1 && _level_size(height, level) == 1)
+				break;
+		}
+		header.face_offset = face_size ? offset : 0;
+		offset += sizeof(half) * 18 * (size_t)face_size * face_size;
+
+		self.path = _cache_path(source_path);
+		self.data = file_create(self.path.c_str(), offset, self.file);
+		if (self.data == nullptr)
+		{
+			printf("can't write the env cache '%s'\n", self.path.c_str());
+			return false;
+		}
+		memcpy(self.data, &header, sizeof(header));
+		return true;
+	}
+
+	half*
+	env_cache_row(Env_Cache_Writer& self, int row)
+	{
+		const Env_Cache_Header* header = (const Env_Cache_Header*)self.data;
+		return (half*)(self.data + header->level_offsets[0]) + (size_t)3 * header->width * row;
+	}
+
+	half*
+	env_cache_face(Env_Cache_Writer& self, int face)
+	{
+		const Env_Cache_Header* header = (const Env_Cache_Header*)self.data;
+		assert(header->face_size > 0);
+		return (half*)(self.data + header->face_offset) + (size_t)3 * header->face_size * header->face_size * face;
+	}
+
+	void
+	env_cache_finish(Env_Cache_Writer& self, jobs::Pool* pool)
+	{
+		Env_Cache_Header* header = (Env_Cache_Header*)self.data;
+
+		//each level is the 2x2 box of the previous one, edges of odd sizes repeat their last texel
+		for (unsigned int level = 1; level < header->level_count; ++level)
+		{
+			int fine_width = _level_size(header->width, level - 1), fine_height = _level_size(header->height, level - 1);
+			int width = _level_size(header->width, level), height = _level_size(header->height, level);
+			const half* fine = (const half*)(self.data + header->level_offsets[level - 1]);
+			half* coarse = (half*)(self.data + header->level_offsets[level]);
+
+			jobs::parallel_for(pool, height, [&](unsigned int y) {
+				std::vector<float> rows(6 * (size_t)fine_width), out(3 * (size_t)width);
+				int y0 = std::min(2 * (int)y, fine_height - 1), y1 = std::min(2 * (int)y + 1, fine_height - 1);
+				half_to_float(fine + (size_t)3 * fine_width * y0, rows.data(), 3 * (size_t)fine_width);
+				half_to_float(fine + (size_t)3 * fine_width * y1, rows.data() + 3 * (size_t)fine_width, 3 * (size_t)fine_width);
+				for (int x = 0; x < width; ++x)
+				{
+					int x0 = std::min(2 * x, fine_width - 1), x1 = std::min(2 * x + 1, fine_width - 1);
+					for (int c = 0; c < 3; ++c)
+					{
+						const float* row0 = rows.data();
+						const float* row1 = rows.data() + 3 * (size_t)fine_width;
+						out[3 * x + c] = 0.25f * (row0[3 * x0 + c] + row0[3 * x1 + c] + row1[3 * x0 + c] + row1[3 * x1 + c]);
+					}
+				}
+				half_from_float(out.data(), coarse + (size_t)3 * width * y, out.size());
+			});
+		}
+
+		memcpy(header->magic, ENV_CACHE_MAGIC, sizeof(ENV_CACHE_MAGIC));
+		file_unmap(self.file);
+		self.data = nullptr;
+	}
+
+	bool
+	env_cache_write(const char* source_path, const Image& img, jobs::Pool* pool)
+	{
+		assert(img.type == PIXEL_TYPE::HALF && img.channels == 3);
+
+		Env_Cache_Writer writer;
+		if (env_cache_create(source_path, img.width, img.height, 0, writer) == false)
+			return false;
+		memcpy(env_cache_row(writer, 0), img.data, sizeof(half) * 3 * (size_t)img.width * img.height);
+		env_cache_finish(writer, pool);
+		return true;
+	}
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "image.h"
+#include "mapped_file.h"
+#include "half.h"
+#include "task_graph.h"
+
+#include <string>
+
+namespace io
+{
+	//sidecar next to an HDR source (<source>.envcache) holding it decoded, so re-bakes of the same env map it
+	//instead of decoding it again: a header, the source as RGB half floats with its box filtered mip pyramid
+	//(each level half the previous one down to 1x1, rows bottom up like every Image) and optionally the
+	//env cube faces of one face size the CPU splat produced
+	struct Env_Cache
+	{
+		Mapped_File file;
+		int width;
+		int height;
+		int level_count;
+		int face_size;   //0 without faces
+	};
+
+	//false unless it was written for this very source, same size and modification time and the same
+	//hash of a sample of its content (reading all of a 1 GB source to hash it costs as much as decoding it)
+	bool
+	env_cache_open(const char* source_path, Env_Cache& self);
+
+	//read only HALF views into the mapping, they go away with env_cache_close and must not be image_free'd
+	Image
+	env_cache_level(const Env_Cache& self, int level);
+
+	//false unless faces of that size were cached
+	bool
+	env_cache_faces(const Env_Cache& self, int face_size, Image faces[6]);
+
+	void
+	env_cache_close(Env_Cache& self);
+
+	//level 0 as an image that owns the mapping (image_free unmaps it), self is left closed
+	Image
+	env_cache_image(Env_Cache& self);
+
+	//a cache being written, level 0 is filled row by row (so a streamed source never exists whole) and
+	//env_cache_finish then builds the mips from it and marks the file valid
+	struct Env_Cache_Writer
+	{
+		Mapped_File file;
+		unsigned char* data;
+		std::string path;
+	};
+
+	bool
+	env_cache_create(const char* source_path, int width, int height, int face_size, Env_Cache_Writer& self);
+
+	//bottom up row of level 0, width RGB halves
+	math::half*
+	env_cache_row(Env_Cache_Writer& self, int row);
+
+	//face_size^2 RGB halves in GL face layout
+	math::half*
+	env_cache_face(Env_Cache_Writer& self, int face);
+
+	void
+	env_cache_finish(Env_Cache_Writer& self, jobs::Pool* pool);
+
+	//the whole cache of a source decoded to an RGB HALF image, without faces
+	bool
+	env_cache_write(const char* source_path, const Image& img, jobs::Pool* pool);
+};
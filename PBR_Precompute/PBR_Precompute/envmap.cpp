@@ -0,0 +1,458 @@
+#include "envmap.h"
+
+#include "Gfx.h"
+#include "half.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace math;
+using namespace io;
+
+namespace pbr
+{
+	Envmap
+	envmap_from_cubemap(glgpu::cubemap cmap, int size, int mip_count)
+	{
+		Envmap self{};
+		self.size = size;
+		self.mip_count = mip_count;
+		self.faces.resize(6 * mip_count);
+
+		for (int mip = 0; mip < mip_count; ++mip)
+		{
+			int mip_size = std::max(size >> mip, 1);
+			for (int face = 0; face < 6; ++face)
+			{
+				Image& img = self.faces[mip * 6 + face];
+				img.width = mip_size;
+				img.height = mip_size;
+				img.channels = 3;
+				img.data = new float[3 * mip_size * mip_size];
+				glgpu::cubemap_unpack(cmap, face, mip, img, glgpu::EXTERNAL_TEXTURE_FORMAT::RGB, glgpu::DATA_TYPE::FLOAT);
+			}
+		}
+
+		return self;
+	}
+
+	//solid angle of the face area between (0, 0) and (x, y) in [-1, 1] face coords, Area_Element of the shader
+	inline float
+	_area_element(float x, float y)
+	{
+		return atan2f(x * y, sqrtf(x * x + y * y + 1.0f));
+	}
+
+	Envmap
+	envmap_from_faces(const io::Image faces[6], int mip_count, jobs::Pool* pool)
+	{
+		int size = faces[0].width;
+		Envmap self{};
+		self.size = size;
+		self.mip_count = mip_count;
+		self.faces.resize(6 * mip_count);
+
+		for (int mip = 0; mip < mip_count; ++mip)
+		{
+			int mip_size = std::max(size >> mip, 1);
+			jobs::parallel_for(pool, 6, [&](unsigned int face)
+			{
+				Image& img = self.faces[mip * 6 + face];
+				img.width = mip_size;
+				img.height = mip_size;
+				img.channels = 3;
+				img.type = PIXEL_TYPE::FLOAT;
+				float* out = new float[3 * mip_size * mip_size];
+				img.data = out;
+				if (mip == 0)
+				{
+					assert(faces[face].type == PIXEL_TYPE::FLOAT && faces[face].channels == 3);
+					memcpy(out, faces[face].data, sizeof(float) * 3 * mip_size * mip_size);
+					return;
+				}
+
+				//each texel is its 2x2 children in the previous level weighted by the solid angle they cover
+				const Image& parent = self.faces[(mip - 1) * 6 + face];
+				const float* in = (const float*)parent.data;
+				float child_size = 1.0f / (2.0f * mip_size);
+				for (int y = 0; y < mip_size; ++y)
+				{
+					for (int x = 0; x < mip_size; ++x)
+					{
+						vec3f color{};
+						float weight = 0.0f;
+						for (int cy = 0; cy < 2; ++cy)
+						{
+							for (int cx = 0; cx < 2; ++cx)
+							{
+								float lo_x = 2.0f * (2 * x + cx) * child_size - 1.0f;
+								float lo_y = 2.0f * (2 * y + cy) * child_size - 1.0f;
+								float hi_x = lo_x + 2.0f * child_size, hi_y = lo_y + 2.0f * child_size;
+								float solid_angle = _area_element(lo_x, lo_y) - _area_element(lo_x, hi_y) - _area_element(hi_x, lo_y) + _area_element(hi_x, hi_y);
+
+								int px = std::min(2 * x + cx, parent.width - 1), py = std::min(2 * y + cy, parent.height - 1);
+								const float* p = in + 3 * ((size_t)py * parent.width + px);
+								color += vec3f{ p[0], p[1], p[2] } * solid_angle;
+								weight += solid_angle;
+							}
+						}
+						float* o = out + 3 * ((size_t)y * mip_size + x);
+						o[0] = color[0] / weight;
+						o[1] = color[1] / weight;
+						o[2] = color[2] / weight;
+					}
+				}
+			});
+		}
+
+		return self;
+	}
+
+	const Image&
+	envmap_face(const Envmap& env, int mip, int face)
+	{
+		return env.faces[mip * 6 + face];
+	}
+
+	int
+	cube_face_uv(const vec3f& dir, float& s, float& t)
+	{
+		//major axis selection from the GL spec (table 8.19)
+		float ax = fabsf(dir[0]), ay = fabsf(dir[1]), az = fabsf(dir[2]);
+		int face;
+		float sc, tc, ma;
+		if (ax >= ay && ax >= az)
+		{
+			face = dir[0] >= 0 ? 0 : 1;
+			sc = dir[0] >= 0 ? -dir[2] : dir[2];
+			tc = -dir[1];
+			ma = ax;
+		}
+		else if (ay >= az)
+		{
+			face = dir[1] >= 0 ? 2 : 3;
+			sc = dir[0];
+			tc = dir[1] >= 0 ? dir[2] : -dir[2];
+			ma = ay;
+		}
+		else
+		{
+			face = dir[2] >= 0 ? 4 : 5;
+			sc = dir[2] >= 0 ? dir[0] : -dir[0];
+			tc = -dir[1];
+			ma = az;
+		}
+
+		s = 0.5f * (sc / ma + 1.0f);
+		t = 0.5f * (tc / ma + 1.0f);
+		return face;
+	}
+
+	vec3f
+	cube_face_dir(int face, float s, float t)
+	{
+		float a = 2.0f * s - 1.0f;
+		float b = 2.0f * t - 1.0f;
+		switch (face)
+		{
+		case 0: return vec3f{ 1.0f, -b, -a };
+		case 1: return vec3f{ -1.0f, -b, a };
+		case 2: return vec3f{ a, 1.0f, b };
+		case 3: return vec3f{ a, -1.0f, -b };
+		case 4: return vec3f{ a, -b, 1.0f };
+		case 5: return vec3f{ -a, -b, -1.0f };
+		default:
+			assert("undefined cubemap face" && false);
+			return vec3f{};
+		}
+	}
+
+	vec3f
+	face_view_dir(const Face_View& view, float s, float t)
+	{
+		//same basis view_lookat_matrix builds, the projection is tan(45 degrees) so the frustum spans [-1, 1] on both axes
+		vec3f fwd = math::normalize(-view.eye);
+		vec3f right = math::normalize(cross(fwd, view.up));
+		vec3f up = math::normalize(cross(right, fwd));
+		return math::normalize(fwd + right * (2.0f * s - 1.0f) + up * (2.0f * t - 1.0f));
+	}
+
+	void
+	face_view_to_cube_face(const Face_View& view, const Image& capture, Image& face)
+	{
+		assert(capture.width == capture.height && face.width == capture.width && face.height == capture.height);
+		assert(face.type == capture.type && face.channels == capture.channels);
+
+		size_t channel_size = capture.type == PIXEL_TYPE::FLOAT ? sizeof(float) : capture.type == PIXEL_TYPE::HALF ? sizeof(half) : 1;
+		size_t texel_size = channel_size * capture.channels;
+		int size = capture.width;
+		const unsigned char* in = (const unsigned char*)capture.data;
+		unsigned char* out = (unsigned char*)face.data;
+
+		//texel centers land on texel centers
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				float s, t;
+				cube_face_uv(face_view_dir(view, (x + 0.5f) / size, (y + 0.5f) / size), s, t);
+				int face_x = std::min((int)(s * size), size - 1);
+				int face_y = std::min((int)(t * size), size - 1);
+				memcpy(out + texel_size * ((size_t)face_y * size + face_x), in + texel_size * ((size_t)y * size + x), texel_size);
+			}
+		}
+	}
+
+	void
+	captures_rotate_y(const Face_View views[6], const Image src[6], int quarter_turns, Image dst[6])
+	{
+		size_t channel_size = src[0].type == PIXEL_TYPE::FLOAT ? sizeof(float) : src[0].type == PIXEL_TYPE::HALF ? sizeof(half) : 1;
+		size_t texel_size = channel_size * src[0].channels;
+		int size = src[0].width;
+
+		//the basis face_view_dir builds for each capture
+		vec3f fwd[6], right[6], up[6];
+		for (int i = 0; i < 6; ++i)
+		{
+			fwd[i] = math::normalize(-views[i].eye);
+			right[i] = math::normalize(cross(fwd[i], views[i].up));
+			up[i] = math::normalize(cross(right[i], fwd[i]));
+		}
+
+		//a texel of dst shows what src has in its direction turned back
+		float angle = -0.5f * PI * quarter_turns;
+		for (int i = 0; i < 6; ++i)
+		{
+			assert(src[i].width == size && src[i].height == size);
+			dst[i] = src[i];
+			dst[i].data = malloc(texel_size * size * size);
+			unsigned char* out = (unsigned char*)dst[i].data;
+			for (int y = 0; y < size; ++y)
+			{
+				for (int x = 0; x < size; ++x)
+				{
+					vec3f dir = rotate_y(face_view_dir(views[i], (x + 0.5f) / size, (y + 0.5f) / size), angle);
+					int j = 0;
+					for (int k = 1; k < 6; ++k)
+						if (dot(dir, fwd[k]) > dot(dir, fwd[j]))
+							j = k;
+					float inv = 1.0f / dot(dir, fwd[j]);
+					int src_x = std::min(std::max((int)((dot(dir, right[j]) * inv + 1.0f) * 0.5f * size), 0), size - 1);
+					int src_y = std::min(std::max((int)((dot(dir, up[j]) * inv + 1.0f) * 0.5f * size), 0), size - 1);
+					memcpy(out + texel_size * ((size_t)y * size + x), (const unsigned char*)src[j].data + texel_size * ((size_t)src_y * size + src_x), texel_size);
+				}
+			}
+		}
+	}
+
+	inline vec3f
+	_texel(const Image& img, int x, int y)
+	{
+		x = std::min(std::max(x, 0), img.width - 1);
+		y = std::min(std::max(y, 0), img.height - 1);
+		const float* p = (const float*)img.data + 3 * (y * img.width + x);
+		return vec3f{ p[0], p[1], p[2] };
+	}
+
+	inline vec3f
+	_bilinear(const Image& img, float s, float t)
+	{
+		float x = s * img.width - 0.5f;
+		float y = t * img.height - 0.5f;
+		int x0 = (int)floorf(x), y0 = (int)floorf(y);
+		float fx = x - x0, fy = y - y0;
+		vec3f top = _texel(img, x0, y0) * (1.0f - fx) + _texel(img, x0 + 1, y0) * fx;
+		vec3f bottom = _texel(img, x0, y0 + 1) * (1.0f - fx) + _texel(img, x0 + 1, y0 + 1) * fx;
+		return top * (1.0f - fy) + bottom * fy;
+	}
+
+	vec3f
+	envmap_sample(const Envmap& env, const vec3f& dir, float lod)
+	{
+		float s, t;
+		int face = cube_face_uv(dir, s, t);
+
+		lod = std::min(std::max(lod, 0.0f), float(env.mip_count - 1));
+		int mip0 = (int)lod;
+		int mip1 = std::min(mip0 + 1, env.mip_count - 1);
+		float f = lod - mip0;
+
+		vec3f color = _bilinear(envmap_face(env, mip0, face), s, t);
+		if (f > 0.0f && mip1 != mip0)
+			color = color * (1.0f - f) + _bilinear(envmap_face(env, mip1, face), s, t) * f;
+		return color;
+	}
+
+	void
+	envmap_free(Envmap& env)
+	{
+		for (auto& img : env.faces)
+			delete[] (float*)img.data;
+		env.faces.clear();
+		env.light = Env_Light{};
+	}
+
+	//texels of the light distribution a bright texel's density spreads over
+	constexpr int LIGHT_DILATION = 8;
+
+	//fills cdf (count + 1) from func and returns the integral of func over [0, 1],
+	//a black func gets a uniform cdf so it can still be searched
+	inline float
+	_cdf_build(const float* func, int count, float* cdf)
+	{
+		cdf[0] = 0.0f;
+		for (int i = 0; i < count; ++i)
+			cdf[i + 1] = cdf[i] + func[i] / count;
+
+		float integral = cdf[count];
+		for (int i = 1; i <= count; ++i)
+			cdf[i] = integral > 0.0f ? cdf[i] / integral : float(i) / count;
+		return integral;
+	}
+
+	//index of the interval [cdf[i], cdf[i + 1]) containing u
+	inline int
+	_cdf_find(const float* cdf, int count, float u)
+	{
+		int lo = 0, hi = count;
+		while (lo + 1 < hi)
+		{
+			int mid = (lo + hi) / 2;
+			if (cdf[mid] <= u)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	//row y of a FLOAT or HALF image as floats, row is the scratch the half ones are expanded to
+	inline const float*
+	_equirect_row(const Image& img, int y, std::vector<float>& row)
+	{
+		size_t count = (size_t)img.channels * img.width;
+		if (img.type != PIXEL_TYPE::HALF)
+			return (const float*)img.data + count * y;
+
+		row.resize(count);
+		half_to_float((const half*)img.data + count * y, row.data(), count);
+		return row.data();
+	}
+
+	Env_Light
+	env_light_build(const Image& equirect, int max_width, float rotation)
+	{
+		int factor = std::max((equirect.width + max_width - 1) / max_width, 1);
+		int width = std::max(equirect.width / factor, 1);
+		int height = std::max(equirect.height / factor, 1);
+
+		//source columns the rotation moves the env by
+		int shift = (int)floorf(rotation / (2.0f * PI) * equirect.width + 0.5f) % equirect.width;
+		shift = shift < 0 ? shift + equirect.width : shift;
+
+		//box filtered luminance, a half float source is expanded once per row
+		std::vector<float> lum(width * height, 0.0f);
+		std::vector<float> row;
+		for (int y = 0; y < height; ++y)
+		{
+			for (int sy = y * factor; sy < std::min((y + 1) * factor, equirect.height); ++sy)
+			{
+				const float* src = _equirect_row(equirect, sy, row);
+				for (int x = 0; x < width; ++x)
+				{
+					float sum = 0.0f;
+					for (int sx = x * factor; sx < std::min((x + 1) * factor, equirect.width); ++sx)
+					{
+						const float* p = src + equirect.channels * ((sx - shift + equirect.width) % equirect.width);
+						sum += equirect.channels >= 3 ? luminance(vec3f{ p[0], p[1], p[2] }) : p[0];
+					}
+					lum[y * width + x] += sum;
+				}
+			}
+			for (int x = 0; x < width; ++x)
+				lum[y * width + x] = std::max(lum[y * width + x], 0.0f) / (factor * factor);
+		}
+
+		//the env is fetched bilinearly and from blurred mips so a sun spills into the texels around it, if those kept
+		//their own (dark) density the few samples landing there would be fireflies. each texel takes the max of its
+		//neighborhood (separable, wrapping around in longitude), that covers the spill of the first few mips
+		std::vector<float> row_max(width * height);
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				float value = 0.0f;
+				for (int dx = -LIGHT_DILATION; dx <= LIGHT_DILATION; ++dx)
+					value = std::max(value, lum[y * width + ((x + dx) % width + width) % width]);
+				row_max[y * width + x] = value;
+			}
+		}
+
+		//weighted by the solid angle its row covers (cos of the latitude)
+		std::vector<float> func(width * height);
+		for (int y = 0; y < height; ++y)
+		{
+			float latitude = ((y + 0.5f) / height - 0.5f) * PI;
+			for (int x = 0; x < width; ++x)
+			{
+				float value = 0.0f;
+				for (int ny = std::max(y - LIGHT_DILATION, 0); ny <= std::min(y + LIGHT_DILATION, height - 1); ++ny)
+					value = std::max(value, row_max[ny * width + x]);
+				func[y * width + x] = value * cosf(latitude);
+			}
+		}
+
+		Env_Light self{};
+		self.width = width;
+		self.height = height;
+		self.conditional_cdf.resize(height * (width + 1));
+		self.marginal_cdf.resize(height + 1);
+
+		std::vector<float> row_integrals(height);
+		for (int y = 0; y < height; ++y)
+			row_integrals[y] = _cdf_build(&func[y * width], width, &self.conditional_cdf[y * (width + 1)]);
+		float integral = _cdf_build(row_integrals.data(), height, self.marginal_cdf.data());
+		if (integral <= 0.0f)
+			return Env_Light{};
+
+		self.pdf.resize(width * height);
+		for (int i = 0; i < width * height; ++i)
+			self.pdf[i] = func[i] / integral;
+		return self;
+	}
+
+	vec3f
+	env_light_sample(const Env_Light& light, const vec2f& xi, float& pdf)
+	{
+		const float* marginal = light.marginal_cdf.data();
+		int y = _cdf_find(marginal, light.height, xi[1]);
+		float dv = (xi[1] - marginal[y]) / std::max(marginal[y + 1] - marginal[y], 1e-20f);
+		float v = (y + dv) / light.height;
+
+		const float* conditional = &light.conditional_cdf[y * (light.width + 1)];
+		int x = _cdf_find(conditional, light.width, xi[0]);
+		float du = (xi[0] - conditional[x]) / std::max(conditional[x + 1] - conditional[x], 1e-20f);
+		float u = (x + du) / light.width;
+
+		float latitude = (v - 0.5f) * PI;
+		float phi = (u - 0.5f) * 2.0f * PI;
+		float cos_latitude = cosf(latitude);
+
+		//du dv covers 2 PI^2 cos(latitude) steradians
+		pdf = light.pdf[y * light.width + x] / (2.0f * PI * PI * std::max(cos_latitude, 1e-6f));
+		return vec3f{ cos_latitude * cosf(phi), sinf(latitude), cos_latitude * sinf(phi) };
+	}
+
+	float
+	env_light_pdf(const Env_Light& light, const vec3f& dir)
+	{
+		float u = atan2f(dir[2], dir[0]) / (2.0f * PI) + 0.5f;
+		float v = asinf(std::min(std::max(dir[1], -1.0f), 1.0f)) / PI + 0.5f;
+		int x = std::min((int)(u * light.width), light.width - 1);
+		int y = std::min((int)(v * light.height), light.height - 1);
+		float cos_latitude = sqrtf(std::max(1.0f - dir[1] * dir[1], 0.0f));
+		return light.pdf[y * light.width + x] / (2.0f * PI * PI * std::max(cos_latitude, 1e-6f));
+	}
+};
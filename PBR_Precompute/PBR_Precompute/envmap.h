@@ -0,0 +1,137 @@
+#pragma once
+
+#include "Vector.h"
+#include "glgpu.h"
+#include "task_graph.h"
+
+#include <vector>
+
+namespace pbr
+{
+	//piecewise constant 2D distribution over an equirectangular env proportional to its luminance times the solid angle
+	//of its rows, samples directions where the bright parts of the env (a sun) are instead of waiting for the GGX lobe to hit them
+	struct Env_Light
+	{
+		int width;
+		int height;
+		std::vector<float> pdf;             //width * height, density over the [0, 1]^2 equirect domain of each texel
+		std::vector<float> marginal_cdf;    //height + 1, picks the row
+		std::vector<float> conditional_cdf; //height rows of width + 1, picks the texel in the row
+	};
+
+	//the equirect is box filtered down to max_width first (2x the env cube face size is plenty),
+	//empty (width 0) if the env is black. rotation (radians) turns it like cubemap_hdr_create does, to a source column
+	Env_Light
+	env_light_build(const io::Image& equirect, int max_width, float rotation = 0.0f);
+
+	//direction and its solid angle pdf, same mapping as equarectangular_to_cubemap.pixel
+	math::vec3f
+	env_light_sample(const Env_Light& light, const math::vec2f& xi, float& pdf);
+
+	float
+	env_light_pdf(const Env_Light& light, const math::vec3f& dir);
+
+	//CPU side copy of an environment cubemap with its whole mip chain so we can evaluate the same
+	//integrals the shaders do without going through the GPU
+	struct Envmap
+	{
+		int size;
+		int mip_count;
+
+		//mip major, 6 faces for each mip in GL order (+X, -X, +Y, -Y, +Z, -Z), RGB float texels
+		std::vector<io::Image> faces;
+
+		//luminance distribution of the source equirect, empty unless the env gets light samples
+		Env_Light light;
+	};
+
+	Envmap
+	envmap_from_cubemap(glgpu::cubemap cmap, int size, int mip_count);
+
+	//the same mip chain cubemap_float_create builds on the GPU (cubemap_downsample.pixel) from 6 RGB float faces in the
+	//GL face layout, copied as they are into the base level. a face of each level per job
+	Envmap
+	envmap_from_faces(const io::Image faces[6], int mip_count, jobs::Pool* pool);
+
+	const io::Image&
+	envmap_face(const Envmap& env, int mip, int face);
+
+	//trilinear lookup like textureLod on a cubemap (faces are filtered separately, no seamless filtering)
+	math::vec3f
+	envmap_sample(const Envmap& env, const math::vec3f& dir, float lod);
+
+	void
+	envmap_free(Envmap& env);
+
+	//eye offset and up vector of one of the 6 captures a cube pass renders (looking at the origin)
+	struct Face_View
+	{
+		math::vec3f eye;
+		math::vec3f up;
+	};
+
+	//captures of the cube passes (backend_pass_run), CPU passes that have to write their faces in the same layout
+	//the GL pass reads them back in use these instead of the GL face convention
+	constexpr Face_View POSTPROCESS_FACE_VIEWS[6] =
+	{
+		Face_View{math::vec3f{-0.001f,  0.0f,  0.0f}, math::vec3f{0.0f, 1.0f,  0.0f}},
+		Face_View{math::vec3f{0.001f,  0.0f,  0.0f},  math::vec3f{0.0f, 1.0f,  0.0f}},
+		Face_View{math::vec3f{0.0f, -0.001f,  0.0f},  math::vec3f{0.0f, 0.0f,  1.0f}},
+		Face_View{math::vec3f{0.0f,  0.001f,  0.0f},  math::vec3f{0.0f, 0.0f,  1.0f}},
+		Face_View{math::vec3f{0.0f,  0.0f, -0.001f},  math::vec3f{0.0f, 1.0f,  0.0f}},
+		Face_View{math::vec3f{0.0f,  0.0f,  0.001f},  math::vec3f{0.0f, 1.0f,  0.0f}}
+	};
+
+	//captures of the diffuse pass (backend_equirect_captures)
+	constexpr Face_View EQUIRECT_FACE_VIEWS[6] =
+	{
+		Face_View{math::vec3f{-0.001f,  0.0f,  0.0f}, math::vec3f{0.0f, -1.0f,  0.0f}},
+		Face_View{math::vec3f{0.001f,  0.0f,  0.0f},  math::vec3f{0.0f, -1.0f,  0.0f}},
+		Face_View{math::vec3f{0.0f, -0.001f,  0.0f},  math::vec3f{0.0f,  0.0f,  1.0f}},
+		Face_View{math::vec3f{0.0f,  0.001f,  0.0f},  math::vec3f{0.0f,  0.0f,  1.0f}},
+		Face_View{math::vec3f{0.0f,  0.0f, -0.001f},  math::vec3f{0.0f, -1.0f,  0.0f}},
+		Face_View{math::vec3f{0.0f,  0.0f,  0.001f},  math::vec3f{0.0f, -1.0f,  0.0f}}
+	};
+
+	//captures laid out like the GL faces they render into, what cubemap_hdr_create and the sky refresh draw with.
+	//t runs down the side faces of a GL cubemap (spec table 8.19) so their captures have -y up, with +y up
+	//texture(env_map, dir) would return the env of the direction rotated 180 degrees around the face axis
+	constexpr Face_View GL_FACE_VIEWS[6] =
+	{
+		Face_View{math::vec3f{-0.001f,  0.0f,  0.0f}, math::vec3f{0.0f, -1.0f,  0.0f}},
+		Face_View{math::vec3f{0.001f,  0.0f,  0.0f},  math::vec3f{0.0f, -1.0f,  0.0f}},
+		Face_View{math::vec3f{0.0f, -0.001f,  0.0f},  math::vec3f{0.0f,  0.0f,  1.0f}},
+		Face_View{math::vec3f{0.0f,  0.001f,  0.0f},  math::vec3f{0.0f,  0.0f, -1.0f}},
+		Face_View{math::vec3f{0.0f,  0.0f, -0.001f},  math::vec3f{0.0f, -1.0f,  0.0f}},
+		Face_View{math::vec3f{0.0f,  0.0f,  0.001f},  math::vec3f{0.0f, -1.0f,  0.0f}}
+	};
+
+	//direction through [0, 1] coords (s, t) of a capture's 90 degrees frustum, t = 0 is the first row glReadPixels returns
+	math::vec3f
+	face_view_dir(const Face_View& view, float s, float t);
+
+	//maps a direction to the GL cubemap face it hits and the [0, 1] texture coords inside that face
+	int
+	cube_face_uv(const math::vec3f& dir, float& s, float& t);
+
+	//inverse of cube_face_uv, direction isn't normalized
+	math::vec3f
+	cube_face_dir(int face, float s, float t);
+
+	//copies a square capture read back with view into face, the same size and type, laid out like the GL face
+	//it looks at (the captures only differ from it by flips and quarter turns), any texel type and channel count
+	void
+	face_view_to_cube_face(const Face_View& view, const io::Image& capture, io::Image& face);
+
+	//dst is src turned quarter_turns * 90 degrees around +Y (from +X toward +Z), both captures with views.
+	//a quarter turn only moves the side faces into each other and turns the top and bottom ones so every texel
+	//is copied from one of src, any texel type and channel count. no resampling, a cached bake is reused as it is
+	void
+	captures_rotate_y(const Face_View views[6], const io::Image src[6], int quarter_turns, io::Image dst[6]);
+
+	inline float
+	luminance(const math::vec3f& color)
+	{
+		return 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+	}
+};
@@ -0,0 +1,326 @@
+#include "equirect_splat.h"
+
+#include "Gfx.h"
+#include "envmap.h"
+#include "half.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace math;
+using namespace io;
+
+namespace pbr
+{
+	//decoded rows held at once by equirect_splat_stream
+	constexpr size_t EQUIRECT_BAND_BYTES = 32 << 20;
+
+	constexpr unsigned int TARGET_TEXEL_MASK = (1u << 28) - 1;
+
+	template<typename T>
+	inline void
+	_release(std::vector<T>& v)
+	{
+		std::vector<T>().swap(v);
+	}
+
+	Equirect_Splat
+	equirect_splat_create(int width, int height, int face_size, int light_max_width, float rotation)
+	{
+		assert(face_size > 0 && (size_t)face_size * face_size <= TARGET_TEXEL_MASK);
+
+		Equirect_Splat self{};
+		self.width = width;
+		self.height = height;
+		self.face_size = face_size;
+		for (int face = 0; face < 6; ++face)
+			self.faces[face].assign((size_t)4 * face_size * face_size, 0.0f);
+
+		//same mapping as equarectangular_to_cubemap.pixel, u = atan(z, x) / 2 PI + 0.5
+		self.cos_phi.resize(width);
+		self.sin_phi.resize(width);
+		for (int x = 0; x < width; ++x)
+		{
+			float phi = ((x + 0.5f) / width - 0.5f) * 2.0f * PI + rotation;
+			self.cos_phi[x] = cosf(phi);
+			self.sin_phi[x] = sinf(phi);
+		}
+
+		//same box env_light_build filters with
+		if (light_max_width > 0)
+		{
+			self.light_factor = std::max((width + light_max_width - 1) / light_max_width, 1);
+			self.light_width = std::max(width / self.light_factor, 1);
+			self.light_height = std::max(height / self.light_factor, 1);
+			self.light.assign((size_t)self.light_width * self.light_height, 0.0f);
+
+			//to the nearest source column, finer than the light texels
+			int shift = (int)floorf(rotation / (2.0f * PI) * width + 0.5f) % width;
+			self.light_shift = shift < 0 ? shift + width : shift;
+		}
+		return self;
+	}
+
+	inline float
+	_row_latitude(const Equirect_Splat& self, int y)
+	{
+		return ((y + 0.5f) / self.height - 0.5f) * PI;
+	}
+
+	void
+	equirect_splat_rows(Equirect_Splat& self, int first_row, int row_count, const float* rows, jobs::Pool* pool)
+	{
+		int width = self.width;
+		int size = self.face_size;
+		self.targets.resize((size_t)row_count * width);
+
+		//where every texel of the band lands, computed once instead of by each face
+		jobs::parallel_for(pool, row_count, [&](unsigned int r) {
+			float latitude = _row_latitude(self, first_row + r);
+			float cos_latitude = cosf(latitude), sin_latitude = sinf(latitude);
+			unsigned int* targets = &self.targets[(size_t)r * width];
+			for (int x = 0; x < width; ++x)
+			{
+				float s, t;
+				int face = cube_face_uv(vec3f{ cos_latitude * self.cos_phi[x], sin_latitude, cos_latitude * self.sin_phi[x] }, s, t);
+				int tx = std::min((int)(s * size), size - 1);
+				int ty = std::min((int)(t * size), size - 1);
+				targets[x] = ((unsigned int)face << 28) | (unsigned int)(ty * size + tx);
+			}
+		});
+
+		//a job per face so no two jobs touch the same accumulator, the 7th one is the luminance copy
+		jobs::parallel_for(pool, 7, [&](unsigned int job) {
+			if (job < 6)
+			{
+				float* acc = self.faces[job].data();
+				for (int r = 0; r < row_count; ++r)
+				{
+					//solid angle of the source texel
+					float weight = cosf(_row_latitude(self, first_row + r));
+					const unsigned int* targets = &self.targets[(size_t)r * width];
+					const float* row = rows + (size_t)3 * width * r;
+					for (int x = 0; x < width; ++x)
+					{
+						if ((targets[x] >> 28) != job)
+							continue;
+						float* texel = acc + 4 * (size_t)(targets[x] & TARGET_TEXEL_MASK);
+						texel[0] += row[3 * x + 0] * weight;
+						texel[1] += row[3 * x + 1] * weight;
+						texel[2] += row[3 * x + 2] * weight;
+						texel[3] += weight;
+					}
+				}
+				return;
+			}
+
+			if (self.light.empty())
+				return;
+			int factor = self.light_factor;
+			for (int r = 0; r < row_count; ++r)
+			{
+				int light_y = (first_row + r) / factor;
+				if (light_y >= self.light_height)
+					continue;
+				const float* row = rows + (size_t)3 * width * r;
+				float* light = &self.light[(size_t)light_y * self.light_width];
+				for (int x = 0; x < self.light_width; ++x)
+				{
+					float sum = 0.0f;
+					for (int sx = x * factor; sx < std::min((x + 1) * factor, width); ++sx)
+					{
+						const float* p = row + 3 * ((sx - self.light_shift + width) % width);
+						sum += luminance(vec3f{ p[0], p[1], p[2] });
+					}
+					light[x] += sum;
+				}
+			}
+		});
+	}
+
+	inline int
+	_band_rows(const Equirect_Splat& self)
+	{
+		return (int)std::min<size_t>(std::max<size_t>(EQUIRECT_BAND_BYTES / (sizeof(float) * 3 * self.width), 1), self.height);
+	}
+
+	void
+	equirect_splat_stream(Equirect_Splat& self, void(*read)(void* user, int first_row, int row_count, float* rows), void* user, jobs::Pool* pool)
+	{
+		int band_rows = _band_rows(self);
+		std::vector<float> band((size_t)3 * self.width * band_rows);
+		for (int end = self.height; end > 0; end -= band_rows)
+		{
+			int first = std::max(end - band_rows, 0);
+			read(user, first, end - first, band.data());
+			equirect_splat_rows(self, first, end - first, band.data(), pool);
+		}
+	}
+
+	struct Image_Rows
+	{
+		const Image* img;
+		jobs::Pool* pool;
+	};
+
+	void
+	_image_rows_read(void* user, int first_row, int row_count, float* rows)
+	{
+		const Image_Rows* source = (const Image_Rows*)user;
+		const Image& img = *source->img;
+		jobs::parallel_for(source->pool, row_count, [&](unsigned int r) {
+			size_t count = (size_t)img.channels * img.width;
+			size_t offset = count * (first_row + r);
+			float* out = rows + (size_t)3 * img.width * r;
+
+			//expanded in place at the end of the output row, gray texels are then spread from the front
+			float* src = img.channels == 3 ? out : out + 3 * img.width - count;
+			if (img.type == PIXEL_TYPE::HALF)
+				half_to_float((const half*)img.data + offset, src, count);
+			else
+				memcpy(src, (const float*)img.data + offset, count * sizeof(float));
+
+			if (img.channels != 3)
+			{
+				for (int x = 0; x < img.width; ++x)
+				{
+					const float* p = src + (size_t)img.channels * x;
+					float red = p[0], green = img.channels > 1 ? p[1] : p[0], blue = img.channels > 2 ? p[2] : p[0];
+					out[3 * x + 0] = red;
+					out[3 * x + 1] = green;
+					out[3 * x + 2] = blue;
+				}
+			}
+		});
+	}
+
+	void
+	equirect_splat_image(Equirect_Splat& self, const Image& img, jobs::Pool* pool)
+	{
+		assert(img.width == self.width && img.height == self.height && img.type != PIXEL_TYPE::UBYTE && img.channels <= 3);
+
+		//RGB float rows are splatted where they are
+		if (img.type == PIXEL_TYPE::FLOAT && img.channels == 3)
+		{
+			int band_rows = _band_rows(self);
+			for (int end = self.height; end > 0; end -= band_rows)
+			{
+				int first = std::max(end - band_rows, 0);
+				equirect_splat_rows(self, first, end - first, (const float*)img.data + (size_t)3 * img.width * first, pool);
+			}
+			return;
+		}
+
+		Image_Rows source{ &img, pool };
+		equirect_splat_stream(self, _image_rows_read, &source, pool);
+	}
+
+	//fills the texels of a face no source texel landed in from a pyramid of the ones that did, each level sums
+	//2x2 texels of the previous one and holes are then filled top down bilinearly from the level above
+	void
+	_push_pull(std::vector<float>& face, int size)
+	{
+		bool holes = false;
+		for (size_t i = 0; i < face.size() && holes == false; i += 4)
+			holes = face[i + 3] <= 0.0f;
+		if (holes == false)
+			return;
+
+		std::vector<std::vector<float>> levels;
+		std::vector<int> sizes{ size };
+		while (sizes.back() > 1)
+		{
+			const std::vector<float>& fine = levels.empty() ? face : levels.back();
+			int fine_size = sizes.back();
+			int coarse_size = (fine_size + 1) / 2;
+			std::vector<float> coarse((size_t)4 * coarse_size * coarse_size, 0.0f);
+			for (int y = 0; y < fine_size; ++y)
+				for (int x = 0; x < fine_size; ++x)
+					for (int c = 0; c < 4; ++c)
+						coarse[4 * ((size_t)(y / 2) * coarse_size + x / 2) + c] += fine[4 * ((size_t)y * fine_size + x) + c];
+			levels.push_back(std::move(coarse));
+			sizes.push_back(coarse_size);
+		}
+
+		for (int level = (int)levels.size() - 1; level >= 0; --level)
+		{
+			std::vector<float>& fine = level == 0 ? face : levels[level - 1];
+			const std::vector<float>& coarse = levels[level];
+			int fine_size = sizes[level], coarse_size = sizes[level + 1];
+
+			auto coarse_color = [&](int x, int y, int c) {
+				x = std::min(std::max(x, 0), coarse_size - 1);
+				y = std::min(std::max(y, 0), coarse_size - 1);
+				const float* texel = &coarse[4 * ((size_t)y * coarse_size + x)];
+				return texel[3] > 0.0f ? texel[c] / texel[3] : 0.0f;
+			};
+
+			for (int y = 0; y < fine_size; ++y)
+			{
+				for (int x = 0; x < fine_size; ++x)
+				{
+					float* texel = &fine[4 * ((size_t)y * fine_size + x)];
+					if (texel[3] > 0.0f)
+						continue;
+
+					float cx = (x + 0.5f) * 0.5f - 0.5f, cy = (y + 0.5f) * 0.5f - 0.5f;
+					int x0 = (int)floorf(cx), y0 = (int)floorf(cy);
+					float fx = cx - x0, fy = cy - y0;
+					for (int c = 0; c < 3; ++c)
+						texel[c] = (coarse_color(x0, y0, c) * (1 - fx) + coarse_color(x0 + 1, y0, c) * fx) * (1 - fy) +
+							(coarse_color(x0, y0 + 1, c) * (1 - fx) + coarse_color(x0 + 1, y0 + 1, c) * fx) * fy;
+					texel[3] = 1.0f;
+				}
+			}
+		}
+	}
+
+	void
+	equirect_splat_resolve(Equirect_Splat& self, Image faces[6], Image& light)
+	{
+		int size = self.face_size;
+		for (int face = 0; face < 6; ++face)
+		{
+			std::vector<float>& acc = self.faces[face];
+			_push_pull(acc, size);
+
+			Image& img = faces[face];
+			img.width = size;
+			img.height = size;
+			img.channels = 3;
+			img.type = PIXEL_TYPE::FLOAT;
+			img.mapping = nullptr;
+			float* out = (float*)malloc(sizeof(float) * 3 * (size_t)size * size);
+			img.data = out;
+			for (size_t i = 0; i < (size_t)size * size; ++i)
+			{
+				float weight = acc[4 * i + 3];
+				for (int c = 0; c < 3; ++c)
+					out[3 * i + c] = weight > 0.0f ? acc[4 * i + c] / weight : 0.0f;
+			}
+			_release(acc);
+		}
+
+		light = Image{};
+		if (self.light.empty() == false)
+		{
+			//already divided so env_light_build, which picks a factor of 1 for it, does nothing but clamp
+			float area = (float)(self.light_factor * self.light_factor);
+			float* out = (float*)malloc(sizeof(float) * self.light.size());
+			for (size_t i = 0; i < self.light.size(); ++i)
+				out[i] = self.light[i] / area;
+			light.width = self.light_width;
+			light.height = self.light_height;
+			light.channels = 1;
+			light.type = PIXEL_TYPE::FLOAT;
+			light.data = out;
+		}
+
+		_release(self.light);
+		_release(self.targets);
+		_release(self.cos_phi);
+		_release(self.sin_phi);
+	}
+};
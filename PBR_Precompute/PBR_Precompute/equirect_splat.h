@@ -0,0 +1,63 @@
+#pragma once
+
+#include "image.h"
+#include "task_graph.h"
+
+#include <vector>
+
+namespace pbr
+{
+	//equirect to cubemap conversion on the CPU that only ever sees a band of rows of the source, for sources
+	//too big to decode whole or to upload as one texture (a 64k x 32k equirect is 24 GB as float).
+	//every source texel is accumulated into the cube texel its direction hits weighted by its solid angle,
+	//so a source much bigger than the faces is box filtered instead of point sampled like the GL pass does.
+	//peak memory is the accumulators plus one band
+	struct Equirect_Splat
+	{
+		int width;        //source
+		int height;
+		int face_size;
+
+		//per face RGB sum and weight of every texel, GL face order and layout (cube_face_uv)
+		std::vector<float> faces[6];
+
+		//per column direction of the source, the rows only add the latitude
+		std::vector<float> cos_phi;
+		std::vector<float> sin_phi;
+
+		//box filtered luminance of the source for env_light_build, factor source texels on a side each
+		//and turned by shift source columns like the faces
+		int light_factor;
+		int light_shift;
+		int light_width;
+		int light_height;
+		std::vector<float> light;
+
+		//face << 28 | texel of each texel of the current band
+		std::vector<unsigned int> targets;
+	};
+
+	//light_max_width 0 skips the luminance copy, rotation (radians) turns the env around +Y from +X toward +Z,
+	//for free since every column gets its own direction anyway
+	Equirect_Splat
+	equirect_splat_create(int width, int height, int face_size, int light_max_width, float rotation = 0.0f);
+
+	//bottom up source rows [first_row, first_row + row_count) as RGB float, in any order
+	void
+	equirect_splat_rows(Equirect_Splat& self, int first_row, int row_count, const float* rows, jobs::Pool* pool);
+
+	//reads the whole source through read(user, first_row, row_count, rows) a band at a time, top down so a file
+	//stored top down (like .hdr) is read front to back
+	void
+	equirect_splat_stream(Equirect_Splat& self, void(*read)(void* user, int first_row, int row_count, float* rows), void* user, jobs::Pool* pool);
+
+	//splats an image that is already in memory (a mapped .pfm), half and float, gray or RGB
+	void
+	equirect_splat_image(Equirect_Splat& self, const io::Image& img, jobs::Pool* pool);
+
+	//averages the faces into malloc'd RGB float images (texels no source texel hit, a source smaller than the
+	//faces, are filled from the coarser levels of a push pull pyramid) and the luminance into a 1 channel float
+	//equirect that env_light_build keeps as it is when given the same max width. frees the accumulators
+	void
+	equirect_splat_resolve(Equirect_Splat& self, io::Image faces[6], io::Image& light);
+};
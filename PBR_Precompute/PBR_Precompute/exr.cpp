@@ -0,0 +1,222 @@
+#include "exr.h"
+#include "mapped_file.h"
+#include "half.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+//Stb_Image_Write.h's deflate, built in image.cpp
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
+using namespace math;
+
+namespace io
+{
+	constexpr int EXR_ZIP_ROWS = 16;
+	constexpr int EXR_ZIP_COMPRESSION = 3;
+	constexpr int EXR_HALF = 1;
+
+	inline void
+	_exr_put(std::vector<unsigned char>& out, const void* data, size_t size)
+	{
+		out.insert(out.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+	}
+
+	inline void
+	_exr_put32(std::vector<unsigned char>& out, int value)
+	{
+		for (int i = 0; i < 4; ++i)
+			out.push_back((unsigned char)(value >> (8 * i)));
+	}
+
+	inline void
+	_exr_put_float(std::vector<unsigned char>& out, float value)
+	{
+		unsigned int bits;
+		memcpy(&bits, &value, sizeof(bits));
+		_exr_put32(out, (int)bits);
+	}
+
+	inline void
+	_exr_attribute(std::vector<unsigned char>& out, const char* name, const char* type, int size)
+	{
+		_exr_put(out, name, strlen(name) + 1);
+		_exr_put(out, type, strlen(type) + 1);
+		_exr_put32(out, size);
+	}
+
+	//channel indices of img in the alphabetical order EXR stores them in
+	inline int
+	_exr_channels(int channels, const char** names, int* order)
+	{
+		static const char* NAMES[4] = { "A", "B", "G", "R" };
+		static const int ORDER[4] = { 3, 2, 1, 0 };
+		int count = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (ORDER[i] >= channels)
+				continue;
+			names[count] = NAMES[i];
+			order[count] = ORDER[i];
+			++count;
+		}
+		return count;
+	}
+
+	std::vector<unsigned char>
+	_exr_header(int width, int height, int channel_count, const char** names)
+	{
+		std::vector<unsigned char> out;
+		_exr_put32(out, 20000630);
+		_exr_put32(out, 2); //single part scanline
+
+		int chlist_size = 1;
+		for (int c = 0; c < channel_count; ++c)
+			chlist_size += (int)strlen(names[c]) + 1 + 16;
+		_exr_attribute(out, "channels", "chlist", chlist_size);
+		for (int c = 0; c < channel_count; ++c)
+		{
+			_exr_put(out, names[c], strlen(names[c]) + 1);
+			_exr_put32(out, EXR_HALF);
+			_exr_put32(out, 0); //pLinear and reserved
+			_exr_put32(out, 1); //x sampling
+			_exr_put32(out, 1); //y sampling
+		}
+		out.push_back(0);
+
+		_exr_attribute(out, "compression", "compression", 1);
+		out.push_back(EXR_ZIP_COMPRESSION);
+		const char* windows[2] = { "dataWindow", "displayWindow" };
+		for (const char* window : windows)
+		{
+			_exr_attribute(out, window, "box2i", 16);
+			_exr_put32(out, 0);
+			_exr_put32(out, 0);
+			_exr_put32(out, width - 1);
+			_exr_put32(out, height - 1);
+		}
+		_exr_attribute(out, "lineOrder", "lineOrder", 1);
+		out.push_back(0); //increasing y
+		_exr_attribute(out, "pixelAspectRatio", "float", 4);
+		_exr_put_float(out, 1.0f);
+		_exr_attribute(out, "screenWindowCenter", "v2f", 8);
+		_exr_put_float(out, 0.0f);
+		_exr_put_float(out, 0.0f);
+		_exr_attribute(out, "screenWindowWidth", "float", 4);
+		_exr_put_float(out, 1.0f);
+		out.push_back(0);
+		return out;
+	}
+
+	//rows of a chunk as EXR lays them out, each row every channel's halves one channel after the other
+	void
+	_exr_chunk_pack(const Image& img, int first_row, int row_count, int channel_count, const int* order, half* out)
+	{
+		std::vector<float> row((size_t)img.width * img.channels);
+		for (int r = 0; r < row_count; ++r)
+		{
+			size_t offset = (size_t)img.width * img.channels * (first_row + r);
+			if (img.type == PIXEL_TYPE::HALF)
+				half_to_float((const half*)img.data + offset, row.data(), row.size());
+			else
+				memcpy(row.data(), (const float*)img.data + offset, row.size() * sizeof(float));
+
+			for (int c = 0; c < channel_count; ++c)
+			{
+				half* dst = out + (size_t)img.width * (channel_count * r + c);
+				for (int x = 0; x < img.width; ++x)
+					dst[x] = half_from_float(row[(size_t)img.channels * x + order[c]]);
+			}
+		}
+	}
+
+	//ZIP predictor: bytes split into even and odd halves then delta coded, deflated after that
+	std::vector<unsigned char>
+	_exr_zip(const unsigned char* data, size_t size)
+	{
+		std::vector<unsigned char> split(size);
+		size_t half_size = (size + 1) / 2;
+		for (size_t i = 0; i < size; ++i)
+			split[(i & 1) ? half_size + i / 2 : i / 2] = data[i];
+
+		int previous = split.empty() ? 0 : split[0];
+		for (size_t i = 1; i < size; ++i)
+		{
+			int value = split[i];
+			split[i] = (unsigned char)(value - previous + (128 + 256));
+			previous = value;
+		}
+
+		int compressed_size = 0;
+		unsigned char* compressed = stbi_zlib_compress(split.data(), (int)size, &compressed_size, 8);
+
+		//a chunk that doesn't shrink is stored as it is, readers tell by its size
+		std::vector<unsigned char> out;
+		if (compressed && (size_t)compressed_size < size)
+			out.assign(compressed, compressed + compressed_size);
+		else
+			out.assign(data, data + size);
+		free(compressed);
+		return out;
+	}
+
+	bool
+	exr_write(const char* path, const Image& img, jobs::Pool* pool)
+	{
+		assert((img.type == PIXEL_TYPE::FLOAT || img.type == PIXEL_TYPE::HALF) && img.channels >= 1 && img.channels <= 4);
+
+		const char* names[4];
+		int order[4];
+		int channel_count = _exr_channels(img.channels, names, order);
+		std::vector<unsigned char> header = _exr_header(img.width, img.height, channel_count, names);
+
+		int chunk_count = (img.height + EXR_ZIP_ROWS - 1) / EXR_ZIP_ROWS;
+		std::vector<std::vector<unsigned char>> chunks(chunk_count);
+		jobs::parallel_for(pool, chunk_count, [&](unsigned int chunk) {
+			int first_row = chunk * EXR_ZIP_ROWS;
+			int row_count = std::min(EXR_ZIP_ROWS, img.height - first_row);
+			std::vector<half> packed((size_t)img.width * channel_count * row_count);
+			_exr_chunk_pack(img, first_row, row_count, channel_count, order, packed.data());
+			chunks[chunk] = _exr_zip((const unsigned char*)packed.data(), packed.size() * sizeof(half));
+		});
+
+		//header, the offset of every chunk, then the chunks as y, byte count and data
+		size_t size = header.size() + sizeof(unsigned long long) * chunk_count;
+		std::vector<unsigned long long> offsets(chunk_count);
+		for (int chunk = 0; chunk < chunk_count; ++chunk)
+		{
+			offsets[chunk] = size;
+			size += 8 + chunks[chunk].size();
+		}
+
+		Mapped_File file;
+		unsigned char* data = file_create(path, size, file);
+		if (data == nullptr)
+		{
+			printf("can't write '%s'\n", path);
+			return false;
+		}
+		memcpy(data, header.data(), header.size());
+		unsigned char* out = data + header.size();
+		for (int chunk = 0; chunk < chunk_count; ++chunk)
+		{
+			for (int i = 0; i < 8; ++i)
+				*out++ = (unsigned char)(offsets[chunk] >> (8 * i));
+		}
+		for (int chunk = 0; chunk < chunk_count; ++chunk)
+		{
+			int fields[2] = { chunk * EXR_ZIP_ROWS, (int)chunks[chunk].size() };
+			for (int field : fields)
+				for (int i = 0; i < 4; ++i)
+					*out++ = (unsigned char)((unsigned int)field >> (8 * i));
+			memcpy(out, chunks[chunk].data(), chunks[chunk].size());
+			out += chunks[chunk].size();
+		}
+		file_unmap(file);
+		return true;
+	}
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "image.h"
+#include "task_graph.h"
+
+namespace io
+{
+	//OpenEXR scanline file of half channels (R, G, B, A as many as img has, FLOAT or HALF), ZIP compressed
+	//16 rows a chunk with the chunks compressed over the pool, a null pool compresses them inline.
+	//rows go out in memory order like the other writers, so a face reads back the same way its PNG does
+	bool
+	exr_write(const char* path, const Image& img, jobs::Pool* pool = nullptr);
+};
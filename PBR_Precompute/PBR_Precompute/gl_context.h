@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Windows.h>
+
+//a hidden window owning a GL context current on the thread that created it, what the bakes render with
+//when nobody hands them a context
+struct win_gl
+{
+	HWND handle;
+	HDC dc;
+	HGLRC context;
+};
+
+//creates the window and a core profile context of that version, makes it current and loads the GL entry points
+win_gl
+offline_win_create(int gl_major, int gl_minor);
+
+void
+offline_win_free(win_gl& win);
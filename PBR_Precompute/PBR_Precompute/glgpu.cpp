@@ -4,9 +4,11 @@
 #include <assert.h>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "Matrix.h"
 #include "Gfx.h"
+#include "envmap.h"
 
 using namespace io;
 using namespace math;
@@ -87,6 +89,7 @@ namespace glgpu
 	enum class SHADER_STAGE
 	{
 		VERTEX,
+		GEOMETRY,
 		PIXEL
 	};
 
@@ -118,6 +121,8 @@ namespace glgpu
 			return GL_TEXTURE1;
 		case TEXTURE_UNIT::UNIT_2:
 			return GL_TEXTURE2;
+		case TEXTURE_UNIT::UNIT_3:
+			return GL_TEXTURE3;
 
 		default:
 			assert("undefined texture unit" && false);
@@ -132,6 +137,8 @@ namespace glgpu
 		{
 		case SHADER_STAGE::VERTEX:
 			return GL_VERTEX_SHADER;
+		case SHADER_STAGE::GEOMETRY:
+			return GL_GEOMETRY_SHADER;
 		case SHADER_STAGE::PIXEL:
 			return GL_FRAGMENT_SHADER;
 		default:
@@ -162,6 +169,8 @@ namespace glgpu
 	{
 		switch (format)
 		{
+		case EXTERNAL_TEXTURE_FORMAT::RED:
+			return GL_RED;
 		case EXTERNAL_TEXTURE_FORMAT::RG:
 			return GL_RG;
 		case EXTERNAL_TEXTURE_FORMAT::RGB:
@@ -181,6 +190,8 @@ namespace glgpu
 	{
 		switch (format)
 		{
+		case INTERNAL_TEXTURE_FORMAT::R32F:
+			return GL_R32F;
 		case INTERNAL_TEXTURE_FORMAT::RG16F:
 			return GL_RG16F;
 		case INTERNAL_TEXTURE_FORMAT::RGB:
@@ -189,6 +200,8 @@ namespace glgpu
 			return GL_RGBA;
 		case INTERNAL_TEXTURE_FORMAT::RGB16F:
 			return GL_RGB16F;
+		case INTERNAL_TEXTURE_FORMAT::RGBA32F:
+			return GL_RGBA32F;
 		case INTERNAL_TEXTURE_FORMAT::DEPTH_STENCIL:
 			return GL_DEPTH24_STENCIL8;
 		default:
@@ -206,6 +219,8 @@ namespace glgpu
 			return GL_UNSIGNED_BYTE;
 		case DATA_TYPE::FLOAT:
 			return GL_FLOAT;
+		case DATA_TYPE::HALF_FLOAT:
+			return GL_HALF_FLOAT;
 		case DATA_TYPE::UINT_24_8:
 			return GL_UNSIGNED_INT_24_8;
 		default:
@@ -265,19 +280,57 @@ namespace glgpu
 		return obj;
 	}
 
+	static std::string shader_dir = "PBR_Shaders";
+
+	void
+	shader_dir_set(const char* dir)
+	{
+		shader_dir = dir;
+	}
+
+	struct Cached_Program
+	{
+		std::string key;
+		program prog;
+	};
+
+	static bool program_cache_on = false;
+	static std::vector<Cached_Program> program_cache;
+
 	program
-	program_create(const char* vertex_shader_path, const char* pixel_shader_path)
+	program_create(const char* vertex_shader, const char* pixel_shader)
 	{
+		return program_create(vertex_shader, nullptr, pixel_shader);
+	}
+
+	program
+	program_create(const char* vertex_shader, const char* geometry_shader, const char* pixel_shader)
+	{
+		std::string key = shader_dir + "/" + vertex_shader + "|" + (geometry_shader ? geometry_shader : "") + "|" + pixel_shader;
+		if (program_cache_on)
+		{
+			for (const Cached_Program& cached : program_cache)
+				if (cached.key == key)
+					return cached.prog;
+		}
+
 		std::ifstream stream;
-		GLuint vobj = _shader_obj(stream, vertex_shader_path, SHADER_STAGE::VERTEX);
-		GLuint pobj = _shader_obj(stream, pixel_shader_path, SHADER_STAGE::PIXEL);
+		GLuint vobj = _shader_obj(stream, (shader_dir + "/" + vertex_shader).c_str(), SHADER_STAGE::VERTEX);
+		GLuint gobj = geometry_shader ? _shader_obj(stream, (shader_dir + "/" + geometry_shader).c_str(), SHADER_STAGE::GEOMETRY) : 0;
+		GLuint pobj = _shader_obj(stream, (shader_dir + "/" + pixel_shader).c_str(), SHADER_STAGE::PIXEL);
 		GLuint prog = glCreateProgram();
 		glAttachShader(prog, vobj);
+		if (gobj)
+			glAttachShader(prog, gobj);
 		glAttachShader(prog, pobj);
 		glLinkProgram(prog);
 		glDeleteShader(vobj);
+		if (gobj)
+			glDeleteShader(gobj);
 		glDeleteShader(pobj);
 
+		if (program_cache_on)
+			program_cache.push_back(Cached_Program{ key, (program)prog });
 		return (program)prog;
 	}
 
@@ -291,10 +344,28 @@ namespace glgpu
 	void
 	program_delete(program prog)
 	{
+		if (program_cache_on)
+		{
+			for (const Cached_Program& cached : program_cache)
+				if (cached.prog == prog)
+					return;
+		}
 		GLuint p = (GLuint)prog;
 		glDeleteProgram(p);
 	}
 
+	void
+	program_cache_enable(bool enable)
+	{
+		if (enable == false)
+		{
+			for (const Cached_Program& cached : program_cache)
+				glDeleteProgram((GLuint)cached.prog);
+			program_cache.clear();
+		}
+		program_cache_on = enable;
+	}
+
 	buffer
 	vertex_buffer_create(const geo::Vertex vertices[], std::size_t count)
 	{
@@ -305,6 +376,12 @@ namespace glgpu
 		return (buffer)vbo;
 	}
 
+	buffer
+	unit_cube_buffer_create()
+	{
+		return vertex_buffer_create(unit_cube, 36);
+	}
+
 	buffer
 	index_buffer_create(unsigned int indices[], std::size_t count)
 	{
@@ -403,9 +480,11 @@ namespace glgpu
 			type = DATA_TYPE::UBYTE;
 			break;
 		case IMAGE_FORMAT::HDR:
+		case IMAGE_FORMAT::PFM:
+			//half float images go up as they are instead of being converted by the driver
 			internal_format = INTERNAL_TEXTURE_FORMAT::RGB16F;
 			tex_format = EXTERNAL_TEXTURE_FORMAT::RGB;
-			type = DATA_TYPE::FLOAT;
+			type = img.type == io::PIXEL_TYPE::HALF ? DATA_TYPE::HALF_FLOAT : DATA_TYPE::FLOAT;
 			break;
 		default:
 			assert("unsuported image format" && false);
@@ -420,7 +499,11 @@ namespace glgpu
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		// revisit -- glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		//RGB half rows are 6 bytes a texel, not a multiple of the default 4 byte alignment for odd widths
+		if (type == DATA_TYPE::HALF_FLOAT)
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
 		glTexImage2D(GL_TEXTURE_2D, 0, _map(internal_format), img.width, img.height, 0, _map(tex_format), _map(type), img.data);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 		glBindTexture(GL_TEXTURE_2D, NULL);
 
 		return (texture)tex;
@@ -435,6 +518,14 @@ namespace glgpu
 		return tex;
 	}
 
+	void
+	texture2d_data_set(texture texture, vec2f size, EXTERNAL_TEXTURE_FORMAT format, DATA_TYPE type, const void* data)
+	{
+		glBindTexture(GL_TEXTURE_2D, (GLuint)texture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size[0], size[1], _map(format), _map(type), data);
+		glBindTexture(GL_TEXTURE_2D, NULL);
+	}
+
 	void
 	texture2d_render_offline_to(texture output, program prog, vec2f view_size)
 	{
@@ -539,7 +630,7 @@ namespace glgpu
 	}
 
 	cubemap
-	cubemap_hdr_create(const io::Image& img, vec2f view_size, bool mipmap)
+	cubemap_hdr_create(const io::Image& img, vec2f view_size, bool mipmap, float rotation)
 	{
 		//create hdr texture
 		texture hdr = texture2d_create(img, IMAGE_FORMAT::HDR);
@@ -549,15 +640,10 @@ namespace glgpu
 		//don't use ortho projection as this will make z in NDC the same so your captures will look like duplicated
 		//1.00000004321 is tan(45 degrees)
 		Mat4f proj = proj_prespective_matrix(100, 0.1, 1, -1, 1, -1, 1.00000004321);
-		Mat4f views[6] =
-		{
-			view_lookat_matrix(vec3f{-0.001f,  0.0f,  0.0f}, vec3f{0.0f, 0.0f, 0.0f}, vec3f{0.0f, 1.0f,  0.0f}),
-			view_lookat_matrix(vec3f{0.001f,  0.0f,  0.0f},  vec3f{0.0f, 0.0f, 0.0f}, vec3f{0.0f, 1.0f,  0.0f}),
-			view_lookat_matrix(vec3f{0.0f, -0.001f,  0.0f},  vec3f{0.0f, 0.0f, 0.0f}, vec3f{0.0f,  0.0f,  1.0f}),
-			view_lookat_matrix(vec3f{0.0f,  0.001f,  0.0f},  vec3f{0.0f, 0.0f, 0.0f}, vec3f{0.0f,  0.0f,  -1.0f}),
-			view_lookat_matrix(vec3f{0.0f,  0.0f, -0.001f},  vec3f{0.0f, 0.0f, 0.0f}, vec3f{0.0f, 1.0f,  0.0f}),
-			view_lookat_matrix(vec3f{0.0f,  0.0f,  0.001f},  vec3f{0.0f, 0.0f, 0.0f}, vec3f{0.0f, 1.0f,  0.0f})
-		};
+		//a texel of the rotated env shows what the source has in its direction turned back by rotation
+		Mat4f views[6];
+		for (int i = 0; i < 6; ++i)
+			views[i] = view_lookat_matrix(rotate_y(pbr::GL_FACE_VIEWS[i].eye, -rotation), vec3f{0.0f, 0.0f, 0.0f}, rotate_y(pbr::GL_FACE_VIEWS[i].up, -rotation));
 
 		//create env cubemap
 		//(HDR should a 32 bit for each channel to cover a wide range of colors,
@@ -574,14 +660,14 @@ namespace glgpu
 		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo);
 
 		//setup
-		program prog = program_create("PBR_Shaders/cube.vertex", "PBR_Shaders/equarectangular_to_cubemap.pixel");
+		program prog = program_create("cube.vertex", "equarectangular_to_cubemap.pixel");
 		program_use(prog);
 		texture2d_bind(hdr, TEXTURE_UNIT::UNIT_0);
 
 		//render offline to the output cubemap texs
 		glViewport(0, 0, view_size[0], view_size[1]);
 		vao cube_vao = vao_create();
-		buffer cube_vs = vertex_buffer_create(unit_cube, 36);
+		buffer cube_vs = unit_cube_buffer_create();
 
 		for (unsigned int i = 0; i < 6; ++i)
 		{
@@ -594,11 +680,7 @@ namespace glgpu
 		}
 
 		if (mipmap)
-		{
-			glBindTexture(GL_TEXTURE_CUBE_MAP, (GLuint)cube_map);
-			glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, NULL);
-		}
+			cubemap_mipmaps_generate(cube_map, view_size);
 
 		texture2d_unbind();
 		glBindFramebuffer(GL_FRAMEBUFFER, NULL);
@@ -614,6 +696,81 @@ namespace glgpu
 		return cube_map;
 	}
 
+	cubemap
+	cubemap_float_create(const io::Image faces[6], bool mipmap)
+	{
+		vec2f view_size{ (float)faces[0].width, (float)faces[0].height };
+		cubemap cube_map = cubemap_create(view_size, INTERNAL_TEXTURE_FORMAT::RGB16F, EXTERNAL_TEXTURE_FORMAT::RGB, DATA_TYPE::FLOAT, mipmap);
+
+		glBindTexture(GL_TEXTURE_CUBE_MAP, (GLuint)cube_map);
+		for (unsigned int i = 0; i < 6; ++i)
+			glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, faces[i].width, faces[i].height, GL_RGB, GL_FLOAT, faces[i].data);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, NULL);
+
+		if (mipmap)
+			cubemap_mipmaps_generate(cube_map, view_size);
+
+		return cube_map;
+	}
+
+	void
+	cubemap_mipmaps_generate(cubemap cmap, vec2f view_size)
+	{
+		int size = (int)view_size[0];
+		int level_count = 1;
+		while ((size >> level_count) > 0)
+			++level_count;
+
+		//allocate the levels with the format of the base one
+		GLint internal_format;
+		glBindTexture(GL_TEXTURE_CUBE_MAP, (GLuint)cmap);
+		glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_INTERNAL_FORMAT, &internal_format);
+		for (int level = 1; level < level_count; ++level)
+			for (unsigned int i = 0; i < 6; ++i)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, internal_format, size >> level, size >> level, 0, GL_RGB, GL_FLOAT, NULL);
+
+		GLuint fbo;
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+		program prog = program_create("quad.vertex", "cubemap_downsample.pixel");
+		program_use(prog);
+		cubemap_bind(cmap, TEXTURE_UNIT::UNIT_0);
+		uniform1i_set(prog, "env_map", TEXTURE_UNIT::UNIT_0);
+		vao quad_vao = vao_create();
+		buffer quad_vs = vertex_buffer_create(quad_ndc, 6);
+
+		//each level is rendered from the previous one, restricting the texture to that level keeps it
+		//from sampling the level it renders to
+		for (int level = 1; level < level_count; ++level)
+		{
+			int level_size = size >> level;
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, level - 1);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, level - 1);
+			glViewport(0, 0, level_size, level_size);
+			uniform1f_set(prog, "size", (float)level_size);
+
+			for (unsigned int i = 0; i < 6; ++i)
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLuint)cmap, level);
+				uniform1i_set(prog, "face", i);
+				vao_bind(quad_vao, quad_vs, NULL);
+				draw_strip(6);
+				vao_unbind();
+			}
+		}
+
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, NULL);
+		glBindFramebuffer(GL_FRAMEBUFFER, NULL);
+
+		glDeleteFramebuffers(1, &fbo);
+		vao_delete(quad_vao);
+		buffer_delete(quad_vs);
+		program_delete(prog);
+	}
+
 	void
 	cubemap_bind(cubemap cmap, TEXTURE_UNIT texture_unit)
 	{
@@ -621,6 +778,14 @@ namespace glgpu
 		glBindTexture(GL_TEXTURE_CUBE_MAP, (GLuint)cmap);
 	}
 
+	void
+	cubemap_unpack(cubemap cmap, unsigned int face, unsigned int level, io::Image& image, EXTERNAL_TEXTURE_FORMAT format, DATA_TYPE type)
+	{
+		cubemap_bind(cmap, TEXTURE_UNIT::UNIT_0);
+		glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, _map(format), _map(type), image.data);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, NULL);
+	}
+
 	void
 	cubemap_free(cubemap cmap)
 	{
@@ -746,6 +911,13 @@ namespace glgpu
 		glUniform1i(uniform_loc, data);
 	}
 
+	void
+	uniform1ui_set(program prog, const char* uniform, unsigned int data)
+	{
+		int uniform_loc = glGetUniformLocation((GLuint)prog, uniform);
+		glUniform1ui(uniform_loc, data);
+	}
+
 	void
 	view_port(int x, int y, int width, int height)
 	{
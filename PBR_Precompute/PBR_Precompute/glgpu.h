@@ -35,7 +35,8 @@ namespace glgpu
 	{
 		UNIT_0,
 		UNIT_1,
-		UNIT_2
+		UNIT_2,
+		UNIT_3
 	};
 
 	enum class DEPTH_TEST
@@ -54,6 +55,7 @@ namespace glgpu
 
 	enum class EXTERNAL_TEXTURE_FORMAT
 	{
+		RED,
 		RG,
 		RGB,
 		RGBA,
@@ -62,10 +64,12 @@ namespace glgpu
 	
 	enum class INTERNAL_TEXTURE_FORMAT
 	{
+		R32F,
 		RG16F,
 		RGB,
 		RGBA,
 		RGB16F,
+		RGBA32F,
 		DEPTH_STENCIL
 	};
 
@@ -73,6 +77,7 @@ namespace glgpu
 	{
 		UBYTE,
 		FLOAT,
+		HALF_FLOAT,
 		UINT_24_8
 	};
 
@@ -91,8 +96,17 @@ namespace glgpu
 	void
 	graphics_init();
 
+	//directory program_create reads the shaders from, PBR_Shaders in the working directory unless set
+	void
+	shader_dir_set(const char* dir);
+
+	//shader file names in the shader directory
 	program
-	program_create(const char* vertex_shader_path, const char* pixel_shader_path);
+	program_create(const char* vertex_shader, const char* pixel_shader);
+
+	//with a geometry stage between them (layered rendering), null skips it
+	program
+	program_create(const char* vertex_shader, const char* geometry_shader, const char* pixel_shader);
 
 	void
 	program_use(program prog);
@@ -100,9 +114,18 @@ namespace glgpu
 	void
 	program_delete(program prog);
 
+	//while it is on program_create hands out one linked program per shader pair and program_delete keeps them, so a
+	//long lived context compiles its shaders once. turning it off deletes them. GL thread only
+	void
+	program_cache_enable(bool enable);
+
 	buffer
 	vertex_buffer_create(const geo::Vertex vertices[], std::size_t count);
 
+	//the 36 vertices of the [-1, 1] cube the cube passes draw their captures with
+	buffer
+	unit_cube_buffer_create();
+
 	buffer
 	index_buffer_create(unsigned int indices[], std::size_t count);
 
@@ -130,6 +153,10 @@ namespace glgpu
 	texture
 	texture2d_create(math::vec2f size, INTERNAL_TEXTURE_FORMAT internal_format, EXTERNAL_TEXTURE_FORMAT format, DATA_TYPE type, bool mipmap);
 
+	//uploads the whole level 0 of a texture created with the size overload
+	void
+	texture2d_data_set(texture texture, math::vec2f size, EXTERNAL_TEXTURE_FORMAT format, DATA_TYPE type, const void* data);
+
 	void
 	texture2d_render_offline_to(texture output, program prog, math::vec2f view_size);
 
@@ -151,12 +178,25 @@ namespace glgpu
 	cubemap
 	cubemap_rgba_create(const io::Image imgs[6]);
 
+	//rotation (radians) turns the env around +Y from +X toward +Z, the captures look up the equirect through the views turned back
+	cubemap
+	cubemap_hdr_create(const io::Image& img, math::vec2f view_size, bool mipmap, float rotation = 0.0f);
+
+	//RGB16F cubemap from 6 RGB float faces already in GL face layout (the CPU equirect splat), mips like cubemap_hdr_create
 	cubemap
-	cubemap_hdr_create(const io::Image& img, math::vec2f view_size, bool mipmap);
+	cubemap_float_create(const io::Image faces[6], bool mipmap);
+
+	//fills the mip chain of a cubemap from its base level down to 1x1, each texel is the solid angle
+	//weighted average of the texels it covers in the previous level (unlike glGenerateMipmap's box filter)
+	void
+	cubemap_mipmaps_generate(cubemap cmap, math::vec2f view_size);
 
 	void
 	cubemap_bind(cubemap texture, TEXTURE_UNIT texture_unit);
 
+	void
+	cubemap_unpack(cubemap cmap, unsigned int face, unsigned int level, io::Image& image, EXTERNAL_TEXTURE_FORMAT format, DATA_TYPE type);
+
 	void
 	cubemap_free(cubemap cmap);
 
@@ -211,6 +251,9 @@ namespace glgpu
 	void
 	uniform1i_set(program prog, const char* uniform, int data);
 
+	void
+	uniform1ui_set(program prog, const char* uniform, unsigned int data);
+
 	void
 	view_port(int x, int y, int width, int height);
 
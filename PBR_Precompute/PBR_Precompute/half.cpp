@@ -0,0 +1,125 @@
+#include "half.h"
+
+#include <string.h>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define F16C_TARGET
+#else
+#include <cpuid.h>
+#define F16C_TARGET __attribute__((target("f16c")))
+#endif
+
+namespace math
+{
+	inline bool
+	_cpu_has_f16c()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 29)) != 0;
+#else
+		unsigned int eax, ebx, ecx, edx;
+		return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 29)) != 0;
+#endif
+	}
+
+	static const bool HAS_F16C = _cpu_has_f16c();
+
+	half
+	half_from_float(float value)
+	{
+		unsigned int bits;
+		memcpy(&bits, &value, sizeof(bits));
+		unsigned int sign = bits & 0x80000000u;
+		bits ^= sign;
+
+		half result;
+		if (bits >= 0x47800000u)
+		{
+			//too big for a half, or already inf/nan
+			result = bits > 0x7F800000u ? 0x7E00 : 0x7C00;
+		}
+		else if (bits < 0x38800000u)
+		{
+			//subnormal or zero, adding 0.5 lines the 10 mantissa bits up at the bottom and the FPU rounds them
+			float magic;
+			memcpy(&magic, &bits, sizeof(magic));
+			magic += 0.5f;
+			memcpy(&bits, &magic, sizeof(bits));
+			result = (half)(bits - 0x3F000000u);
+		}
+		else
+		{
+			//rebias the exponent and round the 13 dropped mantissa bits to nearest even
+			unsigned int mantissa_odd = (bits >> 13) & 1;
+			bits += 0xC8000FFFu + mantissa_odd;
+			result = (half)(bits >> 13);
+		}
+		return result | (half)(sign >> 16);
+	}
+
+	float
+	half_to_float(half value)
+	{
+		unsigned int sign = (unsigned int)(value & 0x8000) << 16;
+		unsigned int exponent = (value >> 10) & 0x1F;
+		unsigned int mantissa = value & 0x3FF;
+
+		unsigned int bits;
+		if (exponent == 0x1F)
+		{
+			bits = sign | 0x7F800000u | (mantissa << 13);
+		}
+		else if (exponent == 0)
+		{
+			float subnormal = mantissa * (1.0f / 16777216.0f);
+			memcpy(&bits, &subnormal, sizeof(bits));
+			bits |= sign;
+		}
+		else
+		{
+			bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		}
+
+		float result;
+		memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+
+	F16C_TARGET static size_t
+	_half_from_float_f16c(const float* in, half* out, size_t count)
+	{
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+			_mm_storel_epi64((__m128i*)(out + i), _mm_cvtps_ph(_mm_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+		return i;
+	}
+
+	F16C_TARGET static size_t
+	_half_to_float_f16c(const half* in, float* out, size_t count)
+	{
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(out + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(in + i))));
+		return i;
+	}
+
+	void
+	half_from_float(const float* in, half* out, size_t count)
+	{
+		size_t i = HAS_F16C ? _half_from_float_f16c(in, out, count) : 0;
+		for (; i < count; ++i)
+			out[i] = half_from_float(in[i]);
+	}
+
+	void
+	half_to_float(const half* in, float* out, size_t count)
+	{
+		size_t i = HAS_F16C ? _half_to_float_f16c(in, out, count) : 0;
+		for (; i < count; ++i)
+			out[i] = half_to_float(in[i]);
+	}
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace math
+{
+	//IEEE 754 binary16, what RGB16F textures store
+	typedef unsigned short half;
+
+	//round to nearest even, overflow goes to infinity like the GPU conversion
+	half
+	half_from_float(float value);
+
+	float
+	half_to_float(half value);
+
+	//F16C when the CPU has it, same results as the scalar versions
+	void
+	half_from_float(const float* in, half* out, size_t count);
+
+	void
+	half_to_float(const half* in, float* out, size_t count);
+};
@@ -0,0 +1,334 @@
+#include "hdr.h"
+#include "mapped_file.h"
+#include "half.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include <emmintrin.h>
+
+namespace io
+{
+	//scanlines decoded per job, a band shares one RGBE scratch row
+	constexpr int HDR_BAND_ROWS = 16;
+
+	//next header line without the '\n', false at the end of the data
+	inline bool
+	_hdr_line(const unsigned char* data, size_t size, size_t& offset, const char*& line, size_t& length)
+	{
+		if (offset >= size)
+			return false;
+
+		line = (const char*)data + offset;
+		const unsigned char* end = (const unsigned char*)memchr(data + offset, '\n', size - offset);
+		length = end ? end - (data + offset) : size - offset;
+		offset += length + (end ? 1 : 0);
+		return true;
+	}
+
+	inline bool
+	_hdr_line_is(const char* line, size_t length, const char* token)
+	{
+		return strlen(token) == length && strncmp(line, token, length) == 0;
+	}
+
+	//same RGBE encoding stbi__hdr_convert decodes, rgb * 2^(e - 136) and black for e = 0,
+	//the scale is built straight in the exponent bits (e << 23 is 2^(e - 127)) 4 texels at a time.
+	//e = 255 would be inf there, it is built as 254 and the scale's exponent is bumped by one after the bias
+	inline void
+	_rgbe_to_float(const unsigned char* rgbe, float* out, int width)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i max_exponent = _mm_set1_epi32(254);
+		const __m128i top_exponent = _mm_set1_epi32(255);
+		const __m128i exponent_one = _mm_set1_epi32(1 << 23);
+		const __m128 bias = _mm_set1_ps(1.0f / 512.0f);
+
+		//each store writes a 4th float that the next texel overwrites, so the last texel of the row is left to the scalar loop
+		int x = 0;
+		for (; x + 4 < width; x += 4)
+		{
+			__m128i texels = _mm_loadu_si128((const __m128i*)(rgbe + 4 * x));
+			__m128i lo = _mm_unpacklo_epi8(texels, zero);
+			__m128i hi = _mm_unpackhi_epi8(texels, zero);
+			__m128i t[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero), _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+
+			for (int i = 0; i < 4; ++i)
+			{
+				__m128i e = _mm_shuffle_epi32(t[i], _MM_SHUFFLE(3, 3, 3, 3));
+				__m128 scale = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_min_epi16(e, max_exponent), 23)), bias);
+				scale = _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(scale), _mm_and_si128(_mm_cmpeq_epi32(e, top_exponent), exponent_one)));
+				_mm_storeu_ps(out + 3 * (x + i), _mm_mul_ps(_mm_cvtepi32_ps(t[i]), scale));
+			}
+		}
+
+		for (; x < width; ++x)
+		{
+			const unsigned char* texel = rgbe + 4 * x;
+			float scale = texel[3] ? (float)ldexp(1.0f, texel[3] - (128 + 8)) : 0.0f;
+			out[3 * x + 0] = texel[0] * scale;
+			out[3 * x + 1] = texel[1] * scale;
+			out[3 * x + 2] = texel[2] * scale;
+		}
+	}
+
+	//end of the adaptive RLE scanline starting at offset (0 if corrupt)
+	inline size_t
+	_hdr_rle_skip(const unsigned char* data, size_t size, size_t offset, int width)
+	{
+		if (offset + 4 > size || data[offset] != 2 || data[offset + 1] != 2 || (data[offset + 2] & 0x80))
+			return 0;
+		if (((data[offset + 2] << 8) | data[offset + 3]) != width)
+			return 0;
+
+		offset += 4;
+		for (int channel = 0; channel < 4; ++channel)
+		{
+			for (int x = 0; x < width;)
+			{
+				if (offset >= size)
+					return 0;
+				int count = data[offset++];
+				if (count > 128)
+				{
+					count -= 128;
+					offset += 1;
+				}
+				else
+				{
+					offset += count;
+				}
+				if (count == 0 || x + count > width)
+					return 0;
+				x += count;
+			}
+		}
+		return offset <= size ? offset : 0;
+	}
+
+	//scanline already validated by _hdr_rle_skip, channels are stored one after the other
+	inline void
+	_hdr_rle_decode(const unsigned char* data, size_t offset, int width, unsigned char* rgbe)
+	{
+		offset += 4;
+		for (int channel = 0; channel < 4; ++channel)
+		{
+			for (int x = 0; x < width;)
+			{
+				int count = data[offset++];
+				if (count > 128)
+				{
+					count -= 128;
+					unsigned char value = data[offset++];
+					for (int i = 0; i < count; ++i)
+						rgbe[4 * (x + i) + channel] = value;
+				}
+				else
+				{
+					for (int i = 0; i < count; ++i)
+						rgbe[4 * (x + i) + channel] = data[offset++];
+				}
+				x += count;
+			}
+		}
+	}
+
+	struct Hdr_Decode_Job
+	{
+		const unsigned char* data;
+		const std::vector<size_t>* scanlines; //empty for flat (uncompressed) data
+		size_t flat_offset;
+		int width;
+		int height;
+		int first_row; //bottom up image rows [first_row, first_row + row_count) land in out
+		int row_count;
+		PIXEL_TYPE type;
+		void* out;
+	};
+
+	void
+	_hdr_band_decode(void* user, unsigned int band)
+	{
+		const Hdr_Decode_Job* job = (const Hdr_Decode_Job*)user;
+		//file scanlines of the image rows asked for, the file is stored top down
+		int begin = job->height - job->first_row - job->row_count + band * HDR_BAND_ROWS;
+		int end = std::min(begin + HDR_BAND_ROWS, job->height - job->first_row);
+
+		std::vector<unsigned char> scratch(4 * job->width);
+		std::vector<float> row(job->type == PIXEL_TYPE::HALF ? 3 * job->width : 0);
+		for (int y = begin; y < end; ++y)
+		{
+			const unsigned char* rgbe;
+			if (job->scanlines->empty())
+			{
+				rgbe = job->data + job->flat_offset + (size_t)4 * job->width * y;
+			}
+			else
+			{
+				_hdr_rle_decode(job->data, (*job->scanlines)[y], job->width, scratch.data());
+				rgbe = scratch.data();
+			}
+
+			size_t out_row = (size_t)3 * job->width * (job->height - 1 - y - job->first_row);
+			if (job->type == PIXEL_TYPE::HALF)
+			{
+				_rgbe_to_float(rgbe, row.data(), job->width);
+				math::half_from_float(row.data(), (math::half*)job->out + out_row, row.size());
+			}
+			else
+			{
+				_rgbe_to_float(rgbe, (float*)job->out + out_row, job->width);
+			}
+		}
+	}
+
+	bool
+	_hdr_decode_all(const unsigned char* data, const std::vector<size_t>& scanlines, size_t offset, int width, int height,
+		Image& img, jobs::Pool* pool, PIXEL_TYPE type)
+	{
+		size_t channel_size = type == PIXEL_TYPE::HALF ? sizeof(math::half) : sizeof(float);
+		void* out = malloc(channel_size * 3 * (size_t)width * height);
+		if (out == nullptr)
+			return false;
+
+		Hdr_Decode_Job job{ data, &scanlines, offset, width, height, 0, height, type, out };
+		jobs::parallel_for(pool, (height + HDR_BAND_ROWS - 1) / HDR_BAND_ROWS, _hdr_band_decode, &job);
+
+		img.width = width;
+		img.height = height;
+		img.channels = 3;
+		img.type = type;
+		img.data = out;
+		return true;
+	}
+
+	//header and scanline index, offset ends at the pixel data which is where flat (uncompressed) data starts
+	bool
+	_hdr_parse(const unsigned char* data, size_t size, int& width, int& height, size_t& offset, std::vector<size_t>& scanlines)
+	{
+		offset = 0;
+		const char* line;
+		size_t length;
+
+		//header
+		if (_hdr_line(data, size, offset, line, length) == false ||
+			(_hdr_line_is(line, length, "#?RADIANCE") == false && _hdr_line_is(line, length, "#?RGBE") == false))
+			return false;
+
+		bool rgbe = false;
+		while (true)
+		{
+			if (_hdr_line(data, size, offset, line, length) == false)
+				return false;
+			if (length == 0)
+				break;
+			if (_hdr_line_is(line, length, "FORMAT=32-bit_rle_rgbe"))
+				rgbe = true;
+		}
+		if (rgbe == false)
+			return false;
+
+		//only the standard orientation, like stbi
+		char resolution[64]{};
+		if (_hdr_line(data, size, offset, line, length) == false || length >= sizeof(resolution))
+			return false;
+		memcpy(resolution, line, length);
+		char* token = resolution;
+		if (strncmp(token, "-Y ", 3) != 0)
+			return false;
+		height = (int)strtol(token + 3, &token, 10);
+		while (*token == ' ')
+			++token;
+		if (strncmp(token, "+X ", 3) != 0)
+			return false;
+		width = (int)strtol(token + 3, nullptr, 10);
+		if (width <= 0 || height <= 0)
+			return false;
+
+		//index, new style RLE scanlines only exist for these widths and if the first one isn't RLE none of them is
+		scanlines.clear();
+		bool rle = width >= 8 && width < 32768 && _hdr_rle_skip(data, size, offset, width) != 0;
+		if (rle)
+		{
+			scanlines.resize(height);
+			size_t scanline = offset;
+			for (int y = 0; y < height; ++y)
+			{
+				scanlines[y] = scanline;
+				scanline = _hdr_rle_skip(data, size, scanline, width);
+				if (scanline == 0)
+				{
+					printf("corrupt HDR scanline %d of %d\n", y, height);
+					return false;
+				}
+			}
+		}
+		else if (offset + (size_t)4 * width * height > size)
+		{
+			printf("truncated HDR data\n");
+			return false;
+		}
+		return true;
+	}
+
+	bool
+	hdr_decode(const unsigned char* data, size_t size, Image& img, jobs::Pool* pool, PIXEL_TYPE type)
+	{
+		int width, height;
+		size_t offset;
+		std::vector<size_t> scanlines;
+		if (_hdr_parse(data, size, width, height, offset, scanlines) == false)
+			return false;
+		return _hdr_decode_all(data, scanlines, offset, width, height, img, pool, type);
+	}
+
+	bool
+	hdr_read(const char* path, Image& img, jobs::Pool* pool, PIXEL_TYPE type)
+	{
+		//the index pass reads the file front to back, the bands then revisit pages that are still cached
+		Mapped_File file;
+		if (file_map(path, file, true) == false)
+			return false;
+
+		bool decoded = hdr_decode(file.data, file.size, img, pool, type);
+		file_unmap(file);
+		return decoded;
+	}
+
+	bool
+	hdr_open(const char* path, Hdr_File& self)
+	{
+		if (file_map(path, self.file, true) == false)
+			return false;
+
+		if (_hdr_parse(self.file.data, self.file.size, self.width, self.height, self.data_offset, self.scanlines) == false)
+		{
+			file_unmap(self.file);
+			return false;
+		}
+		return true;
+	}
+
+	void
+	hdr_rows_decode(const Hdr_File& self, int first_row, int row_count, float* rows, jobs::Pool* pool)
+	{
+		Hdr_Decode_Job job{ self.file.data, &self.scanlines, self.data_offset, self.width, self.height, first_row, row_count, PIXEL_TYPE::FLOAT, rows };
+		jobs::parallel_for(pool, (row_count + HDR_BAND_ROWS - 1) / HDR_BAND_ROWS, _hdr_band_decode, &job);
+	}
+
+	bool
+	hdr_file_decode(const Hdr_File& self, Image& img, jobs::Pool* pool, PIXEL_TYPE type)
+	{
+		return _hdr_decode_all(self.file.data, self.scanlines, self.data_offset, self.width, self.height, img, pool, type);
+	}
+
+	void
+	hdr_close(Hdr_File& self)
+	{
+		file_unmap(self.file);
+		self.scanlines.clear();
+	}
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "image.h"
+#include "mapped_file.h"
+#include "task_graph.h"
+
+#include <stddef.h>
+#include <vector>
+
+namespace io
+{
+	//Radiance .hdr (RGBE) decoder, a serial pass indexes where every scanline starts and then bands of
+	//scanlines are decoded in parallel over the pool, rows are written bottom up so the image comes out
+	//flipped like stbi_loadf with flip on load, RGB allocated with malloc so image_free releases it
+	//returns false (and img untouched) when the header isn't one it handles, same formats stbi accepts
+	//type FLOAT or HALF, half floats are converted per scanline so the float image never exists
+	bool
+	hdr_decode(const unsigned char* data, size_t size, Image& img, jobs::Pool* pool, PIXEL_TYPE type = PIXEL_TYPE::FLOAT);
+
+	bool
+	hdr_read(const char* path, Image& img, jobs::Pool* pool, PIXEL_TYPE type = PIXEL_TYPE::FLOAT);
+
+	//a mapped .hdr with its scanlines indexed, for decoding it a few rows at a time without ever holding the whole image
+	struct Hdr_File
+	{
+		Mapped_File file;
+		int width;
+		int height;
+		size_t data_offset;             //first scanline
+		std::vector<size_t> scanlines;  //offset of each RLE scanline, empty for flat data
+	};
+
+	//maps and indexes the file, only the header and the RLE run lengths are read
+	bool
+	hdr_open(const char* path, Hdr_File& self);
+
+	//bottom up image rows [first_row, first_row + row_count) as RGB float, rows has room for row_count * width texels
+	void
+	hdr_rows_decode(const Hdr_File& self, int first_row, int row_count, float* rows, jobs::Pool* pool);
+
+	//the whole image, same as hdr_read
+	bool
+	hdr_file_decode(const Hdr_File& self, Image& img, jobs::Pool* pool, PIXEL_TYPE type = PIXEL_TYPE::FLOAT);
+
+	void
+	hdr_close(Hdr_File& self);
+};
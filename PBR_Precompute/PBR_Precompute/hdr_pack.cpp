@@ -0,0 +1,209 @@
+#include "hdr_pack.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <vector>
+
+namespace io
+{
+	//EXT_texture_shared_exponent, 511 / 512 * 2^16
+	constexpr float RGB9E5_MAX = 65408.0f;
+
+	//4 texels of each channel, negatives and NaNs already 0
+	struct Pack_Texels
+	{
+		__m128 r, g, b;
+	};
+
+	inline __m128i
+	_pack_rgb9e5(const Pack_Texels& t)
+	{
+		const __m128 max_value = _mm_set1_ps(RGB9E5_MAX);
+		__m128 r = _mm_min_ps(t.r, max_value), g = _mm_min_ps(t.g, max_value), b = _mm_min_ps(t.b, max_value);
+		__m128 max_c = _mm_max_ps(r, _mm_max_ps(g, b));
+
+		//floor(log2(max_c)) is the float exponent, shared = max(floor(log2), -16) + 16
+		__m128i biased = _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(max_c), 23), _mm_set1_epi32(0xFF));
+		__m128i shared = _mm_sub_epi32(biased, _mm_set1_epi32(111));
+		shared = _mm_and_si128(shared, _mm_cmpgt_epi32(shared, _mm_setzero_si128()));
+
+		//2^(24 - shared) is what turns a channel into its mantissa, one more exponent when the biggest rounds up to 512
+		__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(24 + 127), shared), 23));
+		__m128 half = _mm_set1_ps(0.5f);
+		__m128i max_m = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(max_c, scale), half));
+		__m128i overflow = _mm_cmpeq_epi32(max_m, _mm_set1_epi32(512));
+		shared = _mm_sub_epi32(shared, overflow);
+		scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(24 + 127), shared), 23));
+
+		//no channel is above the biggest so none rounds past 511 now
+		__m128i rm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, scale), half));
+		__m128i gm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, scale), half));
+		__m128i bm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), half));
+		return _mm_or_si128(_mm_or_si128(rm, _mm_slli_epi32(gm, 9)), _mm_or_si128(_mm_slli_epi32(bm, 18), _mm_slli_epi32(shared, 27)));
+	}
+
+	inline __m128i
+	_rgba8(__m128 r, __m128 g, __m128 b, __m128i a)
+	{
+		const __m128 half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f), unorm = _mm_set1_ps(255.0f);
+		__m128i ri = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(r, one), unorm), half));
+		__m128i gi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(g, one), unorm), half));
+		__m128i bi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(b, one), unorm), half));
+		return _mm_or_si128(_mm_or_si128(ri, _mm_slli_epi32(gi, 8)), _mm_or_si128(_mm_slli_epi32(bi, 16), _mm_slli_epi32(a, 24)));
+	}
+
+	//multiplier m = ceil(max / range * 255) / 255 at least 1 / 255, color / (m * range)
+	inline __m128i
+	_pack_rgbm(const Pack_Texels& t, float range)
+	{
+		__m128 max_c = _mm_max_ps(t.r, _mm_max_ps(t.g, t.b));
+		__m128 m = _mm_mul_ps(max_c, _mm_set1_ps(255.0f / range));
+		__m128i mi = _mm_cvttps_epi32(_mm_min_ps(m, _mm_set1_ps(255.0f)));
+		mi = _mm_sub_epi32(mi, _mm_castps_si128(_mm_cmpgt_ps(m, _mm_cvtepi32_ps(mi))));
+		mi = _mm_sub_epi32(mi, _mm_cmpeq_epi32(mi, _mm_setzero_si128()));
+		__m128i over = _mm_cmpgt_epi32(mi, _mm_set1_epi32(255));
+		mi = _mm_or_si128(_mm_andnot_si128(over, mi), _mm_and_si128(over, _mm_set1_epi32(255)));
+
+		__m128 inverse = _mm_div_ps(_mm_set1_ps(255.0f / range), _mm_cvtepi32_ps(mi));
+		return _rgba8(_mm_mul_ps(t.r, inverse), _mm_mul_ps(t.g, inverse), _mm_mul_ps(t.b, inverse), mi);
+	}
+
+	//divider d = floor(range / max) in [1, 255], color * d / range
+	inline __m128i
+	_pack_rgbd(const Pack_Texels& t, float range)
+	{
+		__m128 max_c = _mm_max_ps(_mm_max_ps(t.r, _mm_max_ps(t.g, t.b)), _mm_set1_ps(1.0e-30f));
+		__m128 d = _mm_min_ps(_mm_max_ps(_mm_div_ps(_mm_set1_ps(range), max_c), _mm_set1_ps(1.0f)), _mm_set1_ps(255.0f));
+		__m128i di = _mm_cvttps_epi32(d);
+
+		__m128 scale = _mm_div_ps(_mm_cvtepi32_ps(di), _mm_set1_ps(range));
+		return _rgba8(_mm_mul_ps(t.r, scale), _mm_mul_ps(t.g, scale), _mm_mul_ps(t.b, scale), di);
+	}
+
+	void
+	hdr_unpack(const unsigned char* in, size_t count, HDR_PACKING packing, float range, float* rgb)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			unsigned int word;
+			memcpy(&word, in + 4 * i, 4);
+			float* out = rgb + 3 * i;
+			switch (packing)
+			{
+			case HDR_PACKING::RGB9E5:
+			{
+				float scale = ldexpf(1.0f, (int)(word >> 27) - 24);
+				for (int c = 0; c < 3; ++c)
+					out[c] = ((word >> (9 * c)) & 511) * scale;
+				break;
+			}
+			case HDR_PACKING::RGBM:
+			{
+				float scale = (word >> 24) / 255.0f * range / 255.0f;
+				for (int c = 0; c < 3; ++c)
+					out[c] = ((word >> (8 * c)) & 255) * scale;
+				break;
+			}
+			case HDR_PACKING::RGBD:
+			{
+				float scale = range / std::max(word >> 24, 1u) / 255.0f;
+				for (int c = 0; c < 3; ++c)
+					out[c] = ((word >> (8 * c)) & 255) * scale;
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+
+	void
+	hdr_pack(const Image& img, HDR_PACKING packing, float range, unsigned char* out, jobs::Pool* pool, Hdr_Pack_Stats* stats)
+	{
+		assert(img.type == PIXEL_TYPE::FLOAT && img.channels >= 3 && (packing == HDR_PACKING::RGB9E5 || range > 0.0f));
+		float max_value = packing == HDR_PACKING::RGB9E5 ? RGB9E5_MAX : range;
+
+		//per row sums, added up once all rows are done
+		std::vector<double> row_max(img.height, 0.0), row_squares(img.height, 0.0), row_clipped(img.height, 0.0);
+
+		jobs::parallel_for(pool, img.height, [&](unsigned int y) {
+			const float* row = (const float*)img.data + (size_t)img.channels * img.width * y;
+			unsigned char* packed = out + (size_t)4 * img.width * y;
+
+			for (int x = 0; x < img.width; x += 4)
+			{
+				//the last texels of a row are padded with black
+				alignas(16) float channels[3][4] = {};
+				int count = std::min(4, img.width - x);
+				for (int i = 0; i < count; ++i)
+					for (int c = 0; c < 3; ++c)
+						channels[c][i] = row[(size_t)img.channels * (x + i) + c];
+
+				//max(NaN, 0) is 0
+				const __m128 zero = _mm_setzero_ps();
+				Pack_Texels t{ _mm_max_ps(_mm_load_ps(channels[0]), zero), _mm_max_ps(_mm_load_ps(channels[1]), zero), _mm_max_ps(_mm_load_ps(channels[2]), zero) };
+				__m128i words;
+				switch (packing)
+				{
+				case HDR_PACKING::RGB9E5:
+					words = _pack_rgb9e5(t);
+					break;
+				case HDR_PACKING::RGBM:
+					words = _pack_rgbm(t, range);
+					break;
+				default:
+					words = _pack_rgbd(t, range);
+					break;
+				}
+				alignas(16) unsigned int lanes[4];
+				_mm_store_si128((__m128i*)lanes, words);
+				memcpy(packed + 4 * x, lanes, 4 * count);
+			}
+
+			if (stats == nullptr)
+				return;
+			std::vector<float> decoded(3 * (size_t)img.width);
+			hdr_unpack(packed, img.width, packing, range, decoded.data());
+			for (int x = 0; x < img.width; ++x)
+			{
+				float source[3], max_c = 0.0f;
+				for (int c = 0; c < 3; ++c)
+				{
+					float value = row[(size_t)img.channels * x + c];
+					source[c] = value > 0.0f ? value : 0.0f;
+					max_c = std::max(max_c, source[c]);
+				}
+				if (max_c > max_value)
+				{
+					row_clipped[y] += 1.0;
+					continue;
+				}
+				if (max_c <= 0.0f)
+					continue;
+				double error = 0.0;
+				for (int c = 0; c < 3; ++c)
+					error = std::max(error, (double)fabsf(decoded[3 * x + c] - source[c]) / max_c);
+				row_max[y] = std::max(row_max[y], error);
+				row_squares[y] += error * error;
+			}
+		});
+
+		if (stats)
+		{
+			*stats = Hdr_Pack_Stats{};
+			double squares = 0.0, clipped = 0.0;
+			for (int y = 0; y < img.height; ++y)
+			{
+				stats->max_error = std::max(stats->max_error, row_max[y]);
+				squares += row_squares[y];
+				clipped += row_clipped[y];
+			}
+			double texels = (double)img.width * img.height;
+			stats->rms_error = sqrt(squares / texels);
+			stats->clipped = clipped / texels;
+		}
+	}
+};
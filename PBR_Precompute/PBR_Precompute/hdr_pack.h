@@ -0,0 +1,34 @@
+#pragma once
+
+#include "image.h"
+#include "task_graph.h"
+
+#include <stddef.h>
+
+namespace io
+{
+	//32 bit HDR texels for targets without BC6H
+	enum class HDR_PACKING
+	{
+		RGB9E5, //EXT_texture_shared_exponent words, 9 bit mantissas and a shared 5 bit exponent
+		RGBM,   //RGBA8, color divided by a multiplier kept in alpha (alpha / 255 * range)
+		RGBD    //RGBA8, color times a divider kept in alpha (range / alpha), more range for bright texels
+	};
+
+	//round trip of the packed texels, errors are relative to the brightest channel of each texel
+	struct Hdr_Pack_Stats
+	{
+		double max_error;
+		double rms_error;
+		double clipped;   //share of the texels brighter than the packing keeps
+	};
+
+	//4 bytes a texel from the RGB of a FLOAT image, rows are packed over the pool 4 texels at a time.
+	//range is the brightest value RGBM and RGBD keep, RGB9E5 keeps up to 65408 whatever it is, negatives and NaNs become 0
+	void
+	hdr_pack(const Image& img, HDR_PACKING packing, float range, unsigned char* out, jobs::Pool* pool = nullptr, Hdr_Pack_Stats* stats = nullptr);
+
+	//count packed texels back to RGB floats
+	void
+	hdr_unpack(const unsigned char* in, size_t count, HDR_PACKING packing, float range, float* rgb);
+};
@@ -0,0 +1,138 @@
+#include "hybrid_prefilter.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+
+namespace pbr
+{
+	//tiles the whole prefilter is cut into, enough for the two ends to meet within a few percent of the work
+	constexpr double HYBRID_TILES = 192.0;
+
+	void
+	hybrid_split_init(Hybrid_Split& split, const std::vector<Prefilter_LOD>& schedule, int prefilter_size)
+	{
+		double total = 0.0;
+		for (size_t lod = 0; lod < schedule.size(); ++lod)
+		{
+			double size = std::max(prefilter_size >> lod, 1);
+			total += 6.0 * size * size * schedule[lod].sample_count;
+		}
+		double tile_work = total / HYBRID_TILES;
+
+		split.tiles.clear();
+		for (unsigned int lod = 0; lod < schedule.size(); ++lod)
+		{
+			int size = std::max(prefilter_size >> lod, 1);
+			double row_work = (double)size * schedule[lod].sample_count;
+			int rows = (int)std::min(std::max(std::ceil(tile_work / row_work), 1.0), (double)size);
+			for (int face = 0; face < 6; ++face)
+			{
+				for (int first_row = 0; first_row < size; first_row += rows)
+				{
+					int row_count = std::min(rows, size - first_row);
+					split.tiles.push_back(Hybrid_Tile{ lod, face, first_row, row_count, row_work * row_count });
+				}
+			}
+		}
+
+		split.front = 0;
+		split.back = split.tiles.size();
+		split.engines[0] = Hybrid_Engine_Stats{};
+		split.engines[1] = Hybrid_Engine_Stats{};
+		split.start = std::chrono::steady_clock::now();
+		split.ms = 0.0;
+	}
+
+	bool
+	hybrid_split_take(Hybrid_Split& split, HYBRID_ENGINE engine, Hybrid_Tile& tile)
+	{
+		std::lock_guard<std::mutex> lock(split.mutex);
+		if (split.front == split.back)
+			return false;
+		tile = engine == HYBRID_ENGINE::GL ? split.tiles[split.front++] : split.tiles[--split.back];
+		return true;
+	}
+
+	void
+	hybrid_split_done(Hybrid_Split& split, HYBRID_ENGINE engine, const Hybrid_Tile& tile, double ms)
+	{
+		std::lock_guard<std::mutex> lock(split.mutex);
+		Hybrid_Engine_Stats& stats = split.engines[(int)engine];
+		if (stats.tiles == 0)
+			stats.calibration_rate = tile.work / std::max(ms, 1e-3);
+		++stats.tiles;
+		stats.work += tile.work;
+		stats.busy_ms += ms;
+		split.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - split.start).count();
+	}
+
+	void
+	hybrid_split_report(const Hybrid_Split& split)
+	{
+		const Hybrid_Engine_Stats& gl = split.engines[(int)HYBRID_ENGINE::GL];
+		const Hybrid_Engine_Stats& cpu = split.engines[(int)HYBRID_ENGINE::CPU];
+		double work = gl.work + cpu.work;
+		if (work <= 0.0)
+			return;
+
+		const char* names[2] = { "GL", "CPU" };
+		for (int i = 0; i < 2; ++i)
+		{
+			const Hybrid_Engine_Stats& stats = split.engines[i];
+			printf("hybrid prefilter %s: %.1f%% of the work, %u tiles, %.3gM texel samples/s (%.3gM calibrated)\n", names[i],
+				stats.work / work * 100.0, stats.tiles, stats.busy_ms > 0.0 ? stats.work / stats.busy_ms * 1e-3 : 0.0, stats.calibration_rate * 1e-3);
+		}
+
+		//what the calibration predicted against what the two ends of the queue ended up with
+		double calibrated = gl.calibration_rate + cpu.calibration_rate;
+		if (calibrated > 0.0)
+			printf("hybrid prefilter split: calibrated %.0f/%.0f, achieved %.0f/%.0f (GL/CPU)\n",
+				gl.calibration_rate / calibrated * 100.0, cpu.calibration_rate / calibrated * 100.0, gl.work / work * 100.0, cpu.work / work * 100.0);
+
+		//the GL engine alone at the rate it kept
+		if (gl.work > 0.0 && split.ms > 0.0)
+		{
+			double gl_alone_ms = work / (gl.work / gl.busy_ms);
+			printf("hybrid prefilter: %.1f ms, %.2fx the %.1f ms of GL alone\n", split.ms, gl_alone_ms / split.ms, gl_alone_ms);
+		}
+	}
+
+	void
+	hybrid_cpu_run(Hybrid_Split& split, const Envmap& env, const std::vector<Prefilter_LOD>& schedule, float light_fraction, std::vector<std::vector<io::Image>>& lod_faces, const std::atomic<bool>* cancel, jobs::Pool* pool)
+	{
+		std::vector<float> rows;
+		Hybrid_Tile tile;
+		while ((cancel == nullptr || *cancel == false) && hybrid_split_take(split, HYBRID_ENGINE::CPU, tile))
+		{
+			auto start = std::chrono::steady_clock::now();
+			const Prefilter_LOD& lod = schedule[tile.lod];
+			io::Image& face = lod_faces[tile.lod][tile.face];
+			int size = face.width;
+			unsigned int light_total = prefilter_light_count(lod.sample_count, lod.roughness, light_fraction);
+
+			//RGB float readbacks take the rows as they are, 8 bit ones get them clamped like the GL readback
+			if (face.type == io::PIXEL_TYPE::FLOAT)
+			{
+				assert(face.channels == 3);
+				float* out = (float*)face.data + 3 * (size_t)tile.first_row * size;
+				prefilter_rows(env, size, tile.face, tile.first_row, tile.row_count, lod.roughness, lod.sample_count, light_total, out, pool);
+			}
+			else
+			{
+				rows.resize(3 * (size_t)tile.row_count * size);
+				prefilter_rows(env, size, tile.face, tile.first_row, tile.row_count, lod.roughness, lod.sample_count, light_total, rows.data(), pool);
+				unsigned char* out = (unsigned char*)face.data + 4 * (size_t)tile.first_row * size;
+				for (size_t texel = 0; texel < (size_t)tile.row_count * size; ++texel)
+				{
+					for (int c = 0; c < 3; ++c)
+						out[4 * texel + c] = (unsigned char)(std::min(std::max(rows[3 * texel + c], 0.0f), 1.0f) * 255.0f + 0.5f);
+					out[4 * texel + 3] = 255;
+				}
+			}
+
+			hybrid_split_done(split, HYBRID_ENGINE::CPU, tile, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+	}
+};
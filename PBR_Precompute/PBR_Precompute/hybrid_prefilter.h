@@ -0,0 +1,72 @@
+#pragma once
+
+#include "image.h"
+#include "prefilter.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace pbr
+{
+	//the engines a hybrid prefilter splits its tiles between
+	enum class HYBRID_ENGINE
+	{
+		GL,
+		CPU
+	};
+
+	//a band of rows of a capture face of a LOD, what either engine takes at a time
+	struct Hybrid_Tile
+	{
+		unsigned int lod;
+		int face;
+		int first_row;
+		int row_count;
+		double work; //texel samples
+	};
+
+	struct Hybrid_Engine_Stats
+	{
+		unsigned int tiles;
+		double work;
+		double busy_ms;
+		double calibration_rate; //texel samples per ms of its first tile, 0 until it is done
+	};
+
+	//the tiles of every LOD in LOD order, the GL engine takes them from the front and the CPU engine from the back so each
+	//one's share follows its throughput and they meet wherever their speeds put them. the first tile an engine takes
+	//calibrates it, the report compares that split with the achieved one
+	struct Hybrid_Split
+	{
+		std::vector<Hybrid_Tile> tiles;
+		std::mutex mutex;
+		size_t front; //tiles [front, back) are left
+		size_t back;
+		Hybrid_Engine_Stats engines[2];
+		std::chrono::steady_clock::time_point start;
+		double ms;
+	};
+
+	//tiles are cut so there are a couple hundred of them over the whole prefilter, a band is at least a row
+	void
+	hybrid_split_init(Hybrid_Split& split, const std::vector<Prefilter_LOD>& schedule, int prefilter_size);
+
+	//next tile of engine, false once every tile is taken. thread safe
+	bool
+	hybrid_split_take(Hybrid_Split& split, HYBRID_ENGINE engine, Hybrid_Tile& tile);
+
+	//ms is the time the engine took for the tile, readback included. thread safe
+	void
+	hybrid_split_done(Hybrid_Split& split, HYBRID_ENGINE engine, const Hybrid_Tile& tile, double ms);
+
+	//share of the work each engine did, their rates, the calibrated split and the speedup over the GL engine alone
+	void
+	hybrid_split_report(const Hybrid_Split& split);
+
+	//the CPU engine, prefilters the tiles it takes into the rows of lod_faces (the readback images of the GL engine, RGB float
+	//or RGBA8 clamped to [0, 1]) until the split is empty or cancel is set. runs on a worker and spreads a tile's rows over the pool
+	void
+	hybrid_cpu_run(Hybrid_Split& split, const Envmap& env, const std::vector<Prefilter_LOD>& schedule, float light_fraction, std::vector<std::vector<io::Image>>& lod_faces, const std::atomic<bool>* cancel, jobs::Pool* pool);
+};
@@ -1,4 +1,9 @@
 #include "Image.h"
+#include "hdr.h"
+#include "pfm.h"
+#include "exr.h"
+#include "mapped_file.h"
+#include "env_cache.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "Stb_Image.h"
@@ -6,12 +11,19 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "Stb_Image_Write.h"
 
+#include <string.h>
+#include <ctype.h>
+
 namespace io
 {
 	Image
-		image_read(const char* path, IMAGE_FORMAT format)
+		image_read(const char* path, IMAGE_FORMAT format, jobs::Pool* pool, PIXEL_TYPE hdr_type, bool cache)
 	{
 		Image self{};
+		cache = cache && format == IMAGE_FORMAT::HDR && hdr_type == PIXEL_TYPE::HALF;
+		Env_Cache env_cache;
+		if (cache && env_cache_open(path, env_cache))
+			return env_cache_image(env_cache);
 
 		switch (format)
 		{
@@ -19,10 +31,22 @@ namespace io
 		case IMAGE_FORMAT::PNG:
 		case IMAGE_FORMAT::JPG:
 			self.data = stbi_load(path, &self.width, &self.height, &self.channels, 0);
+			self.type = PIXEL_TYPE::UBYTE;
 			break;
 		case IMAGE_FORMAT::HDR:
+			//the RGBE files we know come out of our own decoder already flipped, anything else goes to stbi
+			if (hdr_read(path, self, pool, hdr_type))
+			{
+				if (cache)
+					env_cache_write(path, self, pool);
+				break;
+			}
 			stbi_set_flip_vertically_on_load(true);
 			self.data = stbi_loadf(path, &self.width, &self.height, &self.channels, 0);
+			self.type = PIXEL_TYPE::FLOAT;
+			break;
+		case IMAGE_FORMAT::PFM:
+			pfm_read(path, self, true);
 			break;
 		default:
 			break;
@@ -31,7 +55,7 @@ namespace io
 	}
 
 	void
-	image_write(const Image& img, const char* path, IMAGE_FORMAT format)
+	image_write(const Image& img, const char* path, IMAGE_FORMAT format, jobs::Pool* pool)
 	{
 		switch (format)
 		{
@@ -47,6 +71,9 @@ namespace io
 		case IMAGE_FORMAT::HDR:
 			stbi_write_hdr(path, img.width, img.height, 4, (float*)img.data);
 			break;
+		case IMAGE_FORMAT::EXR:
+			exr_write(path, img, pool);
+			break;
 		default:
 			assert("unsupported image format" && false);
 			break;
@@ -56,6 +83,73 @@ namespace io
 	void
 		image_free(Image& img)
 	{
-		stbi_image_free(img.data);
+		if (img.mapping)
+		{
+			file_unmap(*img.mapping);
+			delete img.mapping;
+			img.mapping = nullptr;
+		}
+		else
+		{
+			stbi_image_free(img.data);
+		}
+	}
+
+	bool
+		image_format_from_path(const char* path, IMAGE_FORMAT& format)
+	{
+		const char* dot = strrchr(path, '.');
+		if (dot == nullptr)
+			return false;
+
+		IMAGE_FORMAT formats[7] = { IMAGE_FORMAT::BMP, IMAGE_FORMAT::PNG, IMAGE_FORMAT::JPG, IMAGE_FORMAT::HDR, IMAGE_FORMAT::PFM, IMAGE_FORMAT::EXR, IMAGE_FORMAT::KTX2 };
+		for (IMAGE_FORMAT candidate : formats)
+		{
+			const char* extension = image_extension(candidate);
+			size_t length = strlen(extension);
+			if (strlen(dot + 1) != length)
+				continue;
+
+			bool match = true;
+			for (size_t i = 0; i < length; ++i)
+				match &= tolower((unsigned char)dot[1 + i]) == extension[i];
+			if (match)
+			{
+				format = candidate;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool
+		image_format_float(IMAGE_FORMAT format)
+	{
+		return format == IMAGE_FORMAT::HDR || format == IMAGE_FORMAT::PFM || format == IMAGE_FORMAT::EXR || format == IMAGE_FORMAT::KTX2;
+	}
+
+	const char*
+		image_extension(IMAGE_FORMAT format)
+	{
+		switch (format)
+		{
+		case IMAGE_FORMAT::BMP:
+			return "bmp";
+		case IMAGE_FORMAT::PNG:
+			return "png";
+		case IMAGE_FORMAT::JPG:
+			return "jpg";
+		case IMAGE_FORMAT::HDR:
+			return "hdr";
+		case IMAGE_FORMAT::PFM:
+			return "pfm";
+		case IMAGE_FORMAT::EXR:
+			return "exr";
+		case IMAGE_FORMAT::KTX2:
+			return "ktx2";
+		default:
+			assert("unsupported image format" && false);
+			return "";
+		}
 	}
 };
\ No newline at end of file
@@ -1,11 +1,29 @@
 #pragma once
 
+#include "task_graph.h"
+
 namespace io
 {
+	struct Mapped_File;
+
+	//type of each channel in data
+	enum class PIXEL_TYPE
+	{
+		UBYTE,
+		FLOAT,
+		HALF   //math::half, 6 bytes per RGB texel, half the memory of FLOAT and what RGB16F textures keep anyway
+	};
+
 	struct Image
 	{
 		int width, height, channels;
 		void* data;
+
+		//image_read sets it, images built by hand are whatever the code building them says
+		PIXEL_TYPE type = PIXEL_TYPE::UBYTE;
+
+		//set when data is a read only view into a mapped file, image_free unmaps it instead of freeing data
+		Mapped_File* mapping = nullptr;
 	};
 
 	enum class IMAGE_FORMAT
@@ -13,15 +31,34 @@ namespace io
 		BMP,
 		PNG,
 		JPG,
-		HDR
+		HDR,
+		PFM,
+		EXR,   //output only, half channels ZIP compressed
+		KTX2   //output only, written whole by ktx2_write, image_write doesn't take it
 	};
 
+	//HDR files are decoded in bands over the pool when one is given, straight to half floats with hdr_type HALF,
+	//little endian RGB PFM files come back as read only FLOAT views into the mapped file.
+	//with cache a HALF HDR read maps the source's env cache instead of decoding it, or writes one after decoding
 	Image
-		image_read(const char* path, IMAGE_FORMAT format);
+		image_read(const char* path, IMAGE_FORMAT format, jobs::Pool* pool = nullptr, PIXEL_TYPE hdr_type = PIXEL_TYPE::FLOAT, bool cache = false);
 
+	//EXR compresses its chunks over the pool
 	void
-		image_write(const Image& img, const char* path, IMAGE_FORMAT format);
+		image_write(const Image& img, const char* path, IMAGE_FORMAT format, jobs::Pool* pool = nullptr);
 
 	void
 		image_free(Image& img);
+
+	//format from the file extension, false if it isn't one we know
+	bool
+		image_format_from_path(const char* path, IMAGE_FORMAT& format);
+
+	//formats that keep the HDR range, what is written in them is read back as floats instead of clamped bytes
+	bool
+		image_format_float(IMAGE_FORMAT format);
+
+	//file extension without the dot
+	const char*
+		image_extension(IMAGE_FORMAT format);
 };
\ No newline at end of file
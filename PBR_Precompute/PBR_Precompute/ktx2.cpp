@@ -0,0 +1,383 @@
+#include "ktx2.h"
+#include "mapped_file.h"
+#include "half.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+using namespace math;
+
+namespace io
+{
+	constexpr unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+	//identifier, header and index up to the level index
+	constexpr size_t KTX2_LEVEL_INDEX_OFFSET = 80;
+
+	//data format descriptor color models, sample qualifiers and channel ids
+	constexpr unsigned char DF_MODEL_RGBSDA = 1;
+	constexpr unsigned char DF_MODEL_BC6H = 133;
+	constexpr unsigned char DF_FLOAT = 0x80;
+	constexpr unsigned char DF_SIGNED = 0x40;
+	constexpr unsigned char DF_EXPONENT = 0x20;
+	constexpr unsigned char DF_ALPHA = 15;
+
+	struct Ktx2_Format_Info
+	{
+		unsigned int vk_format;
+		unsigned int type_size;
+		unsigned int texel_size; //bytes of a texel block
+		int channels;
+		int block_size;          //texels on a side of a block
+	};
+
+	inline Ktx2_Format_Info
+	_format_info(KTX2_FORMAT format)
+	{
+		switch (format)
+		{
+		case KTX2_FORMAT::RGBA16F:
+			return Ktx2_Format_Info{ 97, 2, 8, 4, 1 };
+		case KTX2_FORMAT::RG16F:
+			return Ktx2_Format_Info{ 83, 2, 4, 2, 1 };
+		case KTX2_FORMAT::RGB9E5:
+			return Ktx2_Format_Info{ 123, 4, 4, 3, 1 };
+		case KTX2_FORMAT::BC6H:
+			return Ktx2_Format_Info{ 143, 1, 16, 3, 4 }; //VK_FORMAT_BC6H_UFLOAT_BLOCK
+		case KTX2_FORMAT::RGBM:
+		case KTX2_FORMAT::RGBD:
+			return Ktx2_Format_Info{ 37, 1, 4, 4, 1 };
+		default:
+			assert("unsupported KTX2 format" && false);
+			return Ktx2_Format_Info{};
+		}
+	}
+
+	inline void
+	_put32(std::vector<unsigned char>& out, unsigned int value)
+	{
+		for (int i = 0; i < 4; ++i)
+			out.push_back((unsigned char)(value >> (8 * i)));
+	}
+
+	inline void
+	_put64(std::vector<unsigned char>& out, unsigned long long value)
+	{
+		_put32(out, (unsigned int)value);
+		_put32(out, (unsigned int)(value >> 32));
+	}
+
+	inline void
+	_pad(std::vector<unsigned char>& out, size_t alignment)
+	{
+		while (out.size() % alignment)
+			out.push_back(0);
+	}
+
+	inline void
+	_sample(std::vector<unsigned char>& out, unsigned int bit_offset, unsigned int bit_length, unsigned char channel, unsigned int lower, unsigned int upper)
+	{
+		out.push_back((unsigned char)bit_offset);
+		out.push_back((unsigned char)(bit_offset >> 8));
+		out.push_back((unsigned char)(bit_length - 1));
+		out.push_back(channel);
+		_put32(out, 0); //sample position
+		_put32(out, lower);
+		_put32(out, upper);
+	}
+
+	//basic data format descriptor, linear BT.709 RGB(A) or BC6H blocks
+	std::vector<unsigned char>
+	_dfd(KTX2_FORMAT format)
+	{
+		Ktx2_Format_Info info = _format_info(format);
+		int sample_count = format == KTX2_FORMAT::RGB9E5 ? 6 : format == KTX2_FORMAT::BC6H ? 1 : info.channels;
+
+		std::vector<unsigned char> out;
+		_put32(out, 4 + 24 + 16 * sample_count);
+		_put32(out, 0);                                    //vendor id, descriptor type
+		_put32(out, 2 | ((24 + 16 * sample_count) << 16)); //version, block size
+		out.push_back(format == KTX2_FORMAT::BC6H ? DF_MODEL_BC6H : DF_MODEL_RGBSDA);
+		out.push_back(1);                                  //BT.709 primaries
+		out.push_back(1);                                  //linear
+		out.push_back(0);                                  //straight alpha
+		_put32(out, (info.block_size - 1) * 0x0101);       //texel block dimensions minus 1
+		out.push_back((unsigned char)info.texel_size);
+		for (int i = 0; i < 7; ++i)
+			out.push_back(0);
+
+		if (format == KTX2_FORMAT::BC6H)
+		{
+			//the whole 128 bit block is the color
+			_sample(out, 0, 128, DF_FLOAT, 0, 0x3F800000);
+		}
+		else if (format == KTX2_FORMAT::RGB9E5)
+		{
+			//9 bit mantissas and the shared 5 bit exponent described once for each channel
+			for (unsigned char channel = 0; channel < 3; ++channel)
+			{
+				_sample(out, 9 * channel, 9, channel, 0, 8448);
+				_sample(out, 27, 5, channel | DF_EXPONENT, 15, 31);
+			}
+		}
+		else if (format == KTX2_FORMAT::RGBM || format == KTX2_FORMAT::RGBD)
+		{
+			for (int channel = 0; channel < 4; ++channel)
+				_sample(out, 8 * channel, 8, channel == 3 ? DF_ALPHA : (unsigned char)channel, 0, 255);
+		}
+		else
+		{
+			const unsigned int minus_one = 0xBF800000, one = 0x3F800000;
+			for (int channel = 0; channel < info.channels; ++channel)
+			{
+				unsigned char id = channel == 3 ? DF_ALPHA : (unsigned char)channel;
+				_sample(out, 16 * channel, 16, id | DF_FLOAT | DF_SIGNED, minus_one, one);
+			}
+		}
+		return out;
+	}
+
+	inline void
+	_kv(std::vector<unsigned char>& out, const char* key, const char* value)
+	{
+		size_t key_length = strlen(key) + 1, value_length = strlen(value) + 1;
+		_put32(out, (unsigned int)(key_length + value_length));
+		out.insert(out.end(), key, key + key_length);
+		out.insert(out.end(), value, value + value_length);
+		_pad(out, 4);
+	}
+
+	inline HDR_PACKING
+	_packing(KTX2_FORMAT format)
+	{
+		return format == KTX2_FORMAT::RGBM ? HDR_PACKING::RGBM : format == KTX2_FORMAT::RGBD ? HDR_PACKING::RGBD : HDR_PACKING::RGB9E5;
+	}
+
+	void
+	_encode(KTX2_FORMAT format, const Image& img, unsigned char* out, const Ktx2_Encode& encode, int image)
+	{
+		assert(img.type == PIXEL_TYPE::FLOAT && img.channels >= std::min(_format_info(format).channels, 3));
+		const float* in = (const float*)img.data;
+		size_t texels = (size_t)img.width * img.height;
+
+		switch (format)
+		{
+		case KTX2_FORMAT::RGBA16F:
+		case KTX2_FORMAT::RG16F:
+		{
+			int channels = _format_info(format).channels;
+			half* dst = (half*)out;
+			for (size_t i = 0; i < texels; ++i)
+				for (int c = 0; c < channels; ++c)
+					dst[i * channels + c] = half_from_float(c < img.channels ? in[i * img.channels + c] : 1.0f);
+			break;
+		}
+		case KTX2_FORMAT::RGB9E5:
+		case KTX2_FORMAT::RGBM:
+		case KTX2_FORMAT::RGBD:
+			hdr_pack(img, _packing(format), encode.pack_range, out, encode.pool, encode.pack_stats ? encode.pack_stats + image : nullptr);
+			break;
+		case KTX2_FORMAT::BC6H:
+			bc6h_encode(img, encode.bc6h_quality, out, encode.pool, encode.bc6h_stats ? encode.bc6h_stats + image : nullptr);
+			break;
+		default:
+			break;
+		}
+	}
+
+	inline unsigned int
+	_get32(const unsigned char* in)
+	{
+		return in[0] | (in[1] << 8) | (in[2] << 16) | ((unsigned int)in[3] << 24);
+	}
+
+	inline unsigned long long
+	_get64(const unsigned char* in)
+	{
+		return _get32(in) | ((unsigned long long)_get32(in + 4) << 32);
+	}
+
+	bool
+	ktx2_read_cube(const char* path, int layer, Image faces[6])
+	{
+		Mapped_File file;
+		if (file_map(path, file, false) == false)
+			return false;
+
+		const unsigned char* data = file.data;
+		bool valid = file.size >= KTX2_LEVEL_INDEX_OFFSET + 24 && memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0;
+		unsigned int vk_format = valid ? _get32(data + 12) : 0;
+		int width = valid ? (int)_get32(data + 20) : 0;
+		int height = valid ? (int)_get32(data + 24) : 0;
+		int layer_count = valid ? std::max((int)_get32(data + 32), 1) : 0;
+		int face_count = valid ? (int)_get32(data + 36) : 0;
+		unsigned int supercompression = valid ? _get32(data + 44) : 0;
+		if (valid == false || face_count != 6 || width != height || width <= 0 || supercompression != 0 || layer < 0 || layer >= layer_count)
+		{
+			printf("'%s' isn't a cubemap (with layer %d) we read\n", path, layer);
+			file_unmap(file);
+			return false;
+		}
+
+		//VK_FORMAT_R16G16B16_SFLOAT, R16G16B16A16_SFLOAT, R32G32B32_SFLOAT, R32G32B32A32_SFLOAT and E5B9G9R9_UFLOAT_PACK32
+		int channels = 0;
+		size_t channel_size = 0;
+		switch (vk_format)
+		{
+		case 90: channels = 3; channel_size = 2; break;
+		case 97: channels = 4; channel_size = 2; break;
+		case 106: channels = 3; channel_size = 4; break;
+		case 109: channels = 4; channel_size = 4; break;
+		case 123: channels = 1; channel_size = 4; break;
+		default: break;
+		}
+
+		size_t texels = (size_t)width * height;
+		size_t face_bytes = texels * channels * channel_size;
+		unsigned long long level_offset = _get64(data + KTX2_LEVEL_INDEX_OFFSET);
+		unsigned long long level_size = _get64(data + KTX2_LEVEL_INDEX_OFFSET + 8);
+		if (channels == 0 || level_size < face_bytes * 6 * layer_count || level_offset + level_size > file.size)
+		{
+			printf("'%s' has a texel format (%u) or level size we don't read\n", path, vk_format);
+			file_unmap(file);
+			return false;
+		}
+
+		//layer major, then faces
+		const unsigned char* layer_data = data + level_offset + face_bytes * 6 * layer;
+		for (int face = 0; face < 6; ++face)
+		{
+			const unsigned char* in = layer_data + face_bytes * face;
+			faces[face] = Image{};
+			faces[face].width = width;
+			faces[face].height = height;
+			faces[face].channels = 3;
+			faces[face].type = PIXEL_TYPE::FLOAT;
+			faces[face].data = malloc(sizeof(float) * 3 * texels);
+			float* out = (float*)faces[face].data;
+			if (vk_format == 123)
+			{
+				hdr_unpack(in, texels, HDR_PACKING::RGB9E5, 0.0f, out);
+				continue;
+			}
+			for (size_t i = 0; i < texels; ++i)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					const unsigned char* p = in + (i * channels + c) * channel_size;
+					if (channel_size == 2)
+					{
+						half h;
+						memcpy(&h, p, sizeof(h));
+						out[3 * i + c] = half_to_float(h);
+					}
+					else
+					{
+						memcpy(out + 3 * i + c, p, sizeof(float));
+					}
+				}
+			}
+		}
+		file_unmap(file);
+		return true;
+	}
+
+	bool
+	ktx2_write(const char* path, KTX2_FORMAT format, int face_count, int level_count, const Image* images, const Ktx2_Encode& encode)
+	{
+		return ktx2_write_array(path, format, face_count, 0, level_count, images, encode);
+	}
+
+	bool
+	ktx2_write_array(const char* path, KTX2_FORMAT format, int face_count, int layer_count, int level_count, const Image* images, const Ktx2_Encode& encode)
+	{
+		assert((face_count == 1 || face_count == 6) && layer_count >= 0 && level_count > 0);
+		//images of a level, layer major like the level data
+		int level_images = face_count * std::max(layer_count, 1);
+		Ktx2_Format_Info info = _format_info(format);
+		int width = images[0].width, height = images[0].height;
+
+		std::vector<unsigned char> dfd = _dfd(format);
+		std::vector<unsigned char> kvd;
+		if (face_count == 1)
+			_kv(kvd, "KTXorientation", "ru");
+		_kv(kvd, "KTXwriter", "PBR_Precompute");
+
+		//the range a runtime needs to unpack RGBM and RGBD, keys after the KTX ones keep them sorted
+		if (format == KTX2_FORMAT::RGBM || format == KTX2_FORMAT::RGBD)
+		{
+			char value[64];
+			snprintf(value, sizeof(value), "%s %g", format == KTX2_FORMAT::RGBM ? "RGBM" : "RGBD", encode.pack_range);
+			_kv(kvd, "PBR_Precompute.encoding", value);
+		}
+
+		size_t dfd_offset = KTX2_LEVEL_INDEX_OFFSET + 24 * (size_t)level_count;
+		size_t kvd_offset = dfd_offset + dfd.size();
+
+		//level data goes smallest level first, each level aligned to the texel block size (all multiples of 4)
+		std::vector<size_t> level_offsets(level_count), level_sizes(level_count);
+		size_t offset = kvd_offset + kvd.size();
+		for (int level = level_count - 1; level >= 0; --level)
+		{
+			const Image& img = images[level * level_images];
+			assert(img.width == std::max(width >> level, 1) && img.height == std::max(height >> level, 1));
+			offset = (offset + info.texel_size - 1) / info.texel_size * info.texel_size;
+			level_offsets[level] = offset;
+			size_t blocks = (size_t)((img.width + info.block_size - 1) / info.block_size) * ((img.height + info.block_size - 1) / info.block_size);
+			level_sizes[level] = info.texel_size * blocks * level_images;
+			offset += level_sizes[level];
+		}
+
+		std::vector<unsigned char> head(KTX2_IDENTIFIER, KTX2_IDENTIFIER + sizeof(KTX2_IDENTIFIER));
+		_put32(head, info.vk_format);
+		_put32(head, info.type_size);
+		_put32(head, width);
+		_put32(head, height);
+		_put32(head, 0); //depth
+		_put32(head, layer_count);
+		_put32(head, face_count);
+		_put32(head, level_count);
+		_put32(head, 0); //no supercompression
+		_put32(head, (unsigned int)dfd_offset);
+		_put32(head, (unsigned int)dfd.size());
+		_put32(head, (unsigned int)kvd_offset);
+		_put32(head, (unsigned int)kvd.size());
+		_put64(head, 0);
+		_put64(head, 0);
+		assert(head.size() == KTX2_LEVEL_INDEX_OFFSET);
+		for (int level = 0; level < level_count; ++level)
+		{
+			_put64(head, level_offsets[level]);
+			_put64(head, level_sizes[level]);
+			_put64(head, level_sizes[level]);
+		}
+		head.insert(head.end(), dfd.begin(), dfd.end());
+		head.insert(head.end(), kvd.begin(), kvd.end());
+
+		Mapped_File file;
+		unsigned char* data = file_create(path, offset, file);
+		if (data == nullptr)
+		{
+			printf("can't write '%s'\n", path);
+			return false;
+		}
+		memcpy(data, head.data(), head.size());
+		memset(data + head.size(), 0, offset - head.size());
+		for (int level = 0; level < level_count; ++level)
+		{
+			size_t face_size = level_sizes[level] / level_images;
+			for (int i = 0; i < level_images; ++i)
+			{
+				int image = level * level_images + i;
+				_encode(format, images[image], data + level_offsets[level] + face_size * i, encode, image);
+			}
+		}
+		file_unmap(file);
+		return true;
+	}
+};
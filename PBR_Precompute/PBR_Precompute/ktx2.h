@@ -0,0 +1,46 @@
+#pragma once
+
+#include "image.h"
+#include "bc6h.h"
+#include "hdr_pack.h"
+
+namespace io
+{
+	//texel formats we write, the names are the GL internal formats they upload to
+	enum class KTX2_FORMAT
+	{
+		RGBA16F, //VK_FORMAT_R16G16B16A16_SFLOAT
+		RG16F,   //VK_FORMAT_R16G16_SFLOAT
+		RGB9E5,  //VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, shared exponent, 4 bytes a texel for positive HDR colors
+		BC6H,    //VK_FORMAT_BC6H_UFLOAT_BLOCK, 16 bytes a 4x4 block, encoded by bc6h_encode
+		RGBM,    //VK_FORMAT_R8G8B8A8_UNORM holding hdr_pack texels, the packing and its range go in the key/values
+		RGBD
+	};
+
+	//how the images are encoded, the stats are optional
+	struct Ktx2_Encode
+	{
+		jobs::Pool* pool;           //BC6H block rows and packed rows are encoded over it
+		BC6H_QUALITY bc6h_quality;
+		float pack_range;           //brightest value RGBM and RGBD keep
+		Bc6h_Stats* bc6h_stats;     //when set, the stats of every image in the order of images
+		Hdr_Pack_Stats* pack_stats; //same for RGB9E5, RGBM and RGBD
+	};
+
+	//a 2D texture (face_count 1) or a cubemap (face_count 6) with all its mip levels in one KTX2 file,
+	//images are FLOAT with at least the channels the format keeps (a missing alpha is 1), level major (images[level * face_count + face]),
+	//level 0 first and each level half the previous one. cube faces in GL order and layout, rows in the order
+	//glTexImage2D takes them so every level and face uploads as it is stored; a 2D texture is marked y up
+	bool
+	ktx2_write(const char* path, KTX2_FORMAT format, int face_count, int level_count, const Image* images, const Ktx2_Encode& encode = Ktx2_Encode{ nullptr, BC6H_QUALITY::QUALITY, 8.0f, nullptr, nullptr });
+
+	//an array of layer_count textures or cubemaps (0 isn't an array, same as ktx2_write), images are level, layer then face
+	//major (images[(level * layer_count + layer) * face_count + face]) like the level data of the file
+	bool
+	ktx2_write_array(const char* path, KTX2_FORMAT format, int face_count, int layer_count, int level_count, const Image* images, const Ktx2_Encode& encode = Ktx2_Encode{ nullptr, BC6H_QUALITY::QUALITY, 8.0f, nullptr, nullptr });
+
+	//level 0 of layer of a cubemap (array), uncompressed RGB(A) half or float or RGB9E5 and not supercompressed,
+	//as malloc'd RGB float faces in the GL order and layout ktx2_write keeps them in. false (the reason printed) otherwise
+	bool
+	ktx2_read_cube(const char* path, int layer, Image faces[6]);
+};
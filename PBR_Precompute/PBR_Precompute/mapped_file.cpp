@@ -0,0 +1,185 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace io
+{
+#ifdef _WIN32
+	bool
+	file_map(const char* path, Mapped_File& self, bool sequential)
+	{
+		self = Mapped_File{};
+
+		//windows has no madvise for views, the sequential scan flag is the closest read ahead hint
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (GetFileSizeEx(file, &size) == FALSE || size.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data == NULL)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		self.data = (const unsigned char*)data;
+		self.size = (size_t)size.QuadPart;
+		self.file = file;
+		self.mapping = mapping;
+		return true;
+	}
+
+	unsigned char*
+	file_create(const char* path, size_t size, Mapped_File& self)
+	{
+		self = Mapped_File{};
+
+		HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return nullptr;
+
+		//the mapping grows the file to its size
+		unsigned long long length = size;
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(length >> 32), (DWORD)length, NULL);
+		if (mapping == NULL)
+		{
+			CloseHandle(file);
+			return nullptr;
+		}
+
+		void* data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+		if (data == NULL)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return nullptr;
+		}
+
+		self.data = (const unsigned char*)data;
+		self.size = size;
+		self.file = file;
+		self.mapping = mapping;
+		return (unsigned char*)data;
+	}
+
+	void
+	file_unmap(Mapped_File& self)
+	{
+		if (self.data)
+			UnmapViewOfFile(self.data);
+		if (self.mapping)
+			CloseHandle((HANDLE)self.mapping);
+		if (self.file)
+			CloseHandle((HANDLE)self.file);
+		self = Mapped_File{};
+	}
+
+	bool
+	file_stamp(const char* path, unsigned long long& size, unsigned long long& modified)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA info;
+		if (GetFileAttributesExA(path, GetFileExInfoStandard, &info) == FALSE)
+			return false;
+		size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+		modified = ((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+		return true;
+	}
+#else
+	bool
+	file_map(const char* path, Mapped_File& self, bool sequential)
+	{
+		self = Mapped_File{};
+
+		int file = open(path, O_RDONLY);
+		if (file < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(file, &info) != 0 || info.st_size == 0)
+		{
+			close(file);
+			return false;
+		}
+
+		//the mapping keeps its own reference to the file
+		void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		close(file);
+		if (data == MAP_FAILED)
+			return false;
+
+		if (sequential)
+			madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+		self.data = (const unsigned char*)data;
+		self.size = (size_t)info.st_size;
+		return true;
+	}
+
+	unsigned char*
+	file_create(const char* path, size_t size, Mapped_File& self)
+	{
+		self = Mapped_File{};
+
+		int file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (file < 0)
+			return nullptr;
+
+		if (ftruncate(file, (off_t)size) != 0)
+		{
+			close(file);
+			return nullptr;
+		}
+
+		void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		close(file);
+		if (data == MAP_FAILED)
+			return nullptr;
+
+		self.data = (const unsigned char*)data;
+		self.size = size;
+		return (unsigned char*)data;
+	}
+
+	void
+	file_unmap(Mapped_File& self)
+	{
+		if (self.data)
+			munmap((void*)self.data, self.size);
+		self = Mapped_File{};
+	}
+
+	bool
+	file_stamp(const char* path, unsigned long long& size, unsigned long long& modified)
+	{
+		struct stat info;
+		if (stat(path, &info) != 0)
+			return false;
+		size = (unsigned long long)info.st_size;
+		modified = (unsigned long long)info.st_mtim.tv_sec * 1000000000ull + (unsigned long long)info.st_mtim.tv_nsec;
+		return true;
+	}
+#endif
+};
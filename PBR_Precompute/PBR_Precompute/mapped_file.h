@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace io
+{
+	//read only view of a whole file, pages are faulted in from the page cache on first touch
+	//instead of being copied through stdio buffers
+	struct Mapped_File
+	{
+		const unsigned char* data;
+		size_t size;
+		void* file;    //platform handles
+		void* mapping;
+	};
+
+	//sequential tells the OS the file is read front to back once so it reads ahead aggressively and drops pages behind
+	bool
+	file_map(const char* path, Mapped_File& self, bool sequential);
+
+	//creates (or truncates) the file at size bytes and maps it writable, nullptr if it can't,
+	//file_unmap writes it back
+	unsigned char*
+	file_create(const char* path, size_t size, Mapped_File& self);
+
+	void
+	file_unmap(Mapped_File& self);
+
+	//size and last write time without opening the file, modified is only comparable to other values from here
+	bool
+	file_stamp(const char* path, unsigned long long& size, unsigned long long& modified);
+};
@@ -0,0 +1,591 @@
+#include "options.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <algorithm>
+
+namespace cli
+{
+	inline bool
+	_power_of_two(int value)
+	{
+		return value > 0 && (value & (value - 1)) == 0;
+	}
+
+	inline int
+	_max_lod_count(int size)
+	{
+		int count = 1;
+		while (size > 1)
+		{
+			size >>= 1;
+			++count;
+		}
+		return count;
+	}
+
+	inline bool
+	_parse_int(const char* value, int& out)
+	{
+		char* end;
+		long v = strtol(value, &end, 10);
+		if (*end != '\0' || v <= 0)
+			return false;
+		out = (int)v;
+		return true;
+	}
+
+	inline bool
+	_parse_float(const char* value, double& out)
+	{
+		char* end;
+		double v = strtod(value, &end);
+		if (*end != '\0' || v < 0.0)
+			return false;
+		out = v;
+		return true;
+	}
+
+	inline bool
+	_parse_preset(const char* value, PRESET& out)
+	{
+		if (strcmp(value, "preview") == 0)
+			out = PRESET::PREVIEW;
+		else if (strcmp(value, "mobile") == 0)
+			out = PRESET::MOBILE;
+		else if (strcmp(value, "desktop") == 0)
+			out = PRESET::DESKTOP;
+		else if (strcmp(value, "cinematic") == 0)
+			out = PRESET::CINEMATIC;
+		else
+			return false;
+		return true;
+	}
+
+	inline bool
+	_parse_format(const char* value, io::IMAGE_FORMAT& out)
+	{
+		if (strcmp(value, "png") == 0)
+			out = io::IMAGE_FORMAT::PNG;
+		else if (strcmp(value, "bmp") == 0)
+			out = io::IMAGE_FORMAT::BMP;
+		else if (strcmp(value, "jpg") == 0)
+			out = io::IMAGE_FORMAT::JPG;
+		else if (strcmp(value, "exr") == 0)
+			out = io::IMAGE_FORMAT::EXR;
+		else if (strcmp(value, "ktx2") == 0)
+			out = io::IMAGE_FORMAT::KTX2;
+		else
+			return false;
+		return true;
+	}
+
+	inline bool
+	_parse_stream(const char* value, STREAM& out)
+	{
+		if (strcmp(value, "auto") == 0)
+			out = STREAM::AUTO;
+		else if (strcmp(value, "on") == 0)
+			out = STREAM::ON;
+		else if (strcmp(value, "off") == 0)
+			out = STREAM::OFF;
+		else
+			return false;
+		return true;
+	}
+
+	inline bool
+	_parse_backend(const char* value, BACKEND& out)
+	{
+		if (strcmp(value, "gl") == 0)
+			out = BACKEND::GL;
+		else if (strcmp(value, "cpu") == 0)
+			out = BACKEND::CPU;
+		else
+			return false;
+		return true;
+	}
+
+	inline bool
+	_parse_layout(const char* value, LAYOUT& out)
+	{
+		if (strcmp(value, "auto") == 0)
+			out = LAYOUT::AUTO;
+		else if (strcmp(value, "equirect") == 0)
+			out = LAYOUT::EQUIRECT;
+		else if (strcmp(value, "cross") == 0)
+			out = LAYOUT::CROSS;
+		else if (strcmp(value, "strip") == 0)
+			out = LAYOUT::STRIP;
+		else if (strcmp(value, "faces") == 0)
+			out = LAYOUT::FACES;
+		else if (strcmp(value, "ktx2") == 0)
+			out = LAYOUT::KTX2;
+		else
+			return false;
+		return true;
+	}
+
+	inline bool
+	_parse_encoding(const char* value, ENCODING& out)
+	{
+		if (strcmp(value, "native") == 0)
+			out = ENCODING::NATIVE;
+		else if (strcmp(value, "bc6h-fast") == 0)
+			out = ENCODING::BC6H_FAST;
+		else if (strcmp(value, "bc6h") == 0)
+			out = ENCODING::BC6H;
+		else if (strcmp(value, "rgb9e5") == 0)
+			out = ENCODING::RGB9E5;
+		else if (strcmp(value, "rgbm") == 0)
+			out = ENCODING::RGBM;
+		else if (strcmp(value, "rgbd") == 0)
+			out = ENCODING::RGBD;
+		else
+			return false;
+		return true;
+	}
+
+	inline bool
+	_parse_switch(const char* value, bool& out)
+	{
+		if (strcmp(value, "on") == 0)
+			out = true;
+		else if (strcmp(value, "off") == 0)
+			out = false;
+		else
+			return false;
+		return true;
+	}
+
+	//<elevation>,<azimuth> in degrees
+	inline bool
+	_parse_sun(const char* value, float& elevation, float& azimuth)
+	{
+		char* end;
+		double e = strtod(value, &end);
+		if (*end != ',' || e < 0.0 || e > 90.0)
+			return false;
+		double a = strtod(end + 1, &end);
+		if (*end != '\0')
+			return false;
+		elevation = (float)e;
+		azimuth = (float)a;
+		return true;
+	}
+
+	//any sign, unlike _parse_float
+	inline bool
+	_parse_angle(const char* value, float& out)
+	{
+		char* end;
+		double v = strtod(value, &end);
+		if (*end != '\0' || end == value)
+			return false;
+		out = (float)v;
+		return true;
+	}
+
+	Bake_Options
+	options_preset(PRESET preset)
+	{
+		Bake_Options self{};
+		self.output_format = io::IMAGE_FORMAT::PNG;
+		self.pack_range = 8.0f;
+		self.threads = std::max(std::thread::hardware_concurrency(), 1u);
+		self.sky_turbidity = 3.0f;
+		self.sun_elevation = 45.0f;
+		self.sun_illuminance = 20.0f;
+
+		switch (preset)
+		{
+		case PRESET::PREVIEW:
+			self.diffuse_size = 64;
+			self.env_size = 128;
+			self.prefilter_size = 128;
+			self.brdf_lut_size = 128;
+			self.lod_count = 4;
+			self.error_target = 0.05f;
+			self.prefilter_max_samples = 256;
+			self.brdf_lut_samples = 256;
+			break;
+		case PRESET::MOBILE:
+			self.diffuse_size = 128;
+			self.env_size = 256;
+			self.prefilter_size = 256;
+			self.brdf_lut_size = 256;
+			self.lod_count = 5;
+			self.error_target = 0.02f;
+			self.prefilter_max_samples = 1024;
+			self.brdf_lut_samples = 512;
+			break;
+		case PRESET::DESKTOP:
+			self.diffuse_size = 512;
+			self.env_size = 512;
+			self.prefilter_size = 512;
+			self.brdf_lut_size = 512;
+			self.lod_count = 5;
+			self.error_target = 0.01f;
+			self.prefilter_max_samples = 8192;
+			self.brdf_lut_samples = 1024;
+			break;
+		case PRESET::CINEMATIC:
+			self.diffuse_size = 1024;
+			self.env_size = 2048;
+			self.prefilter_size = 1024;
+			self.brdf_lut_size = 1024;
+			self.lod_count = _max_lod_count(1024);
+			self.error_target = 0.0025f;
+			self.prefilter_max_samples = 65536;
+			self.brdf_lut_samples = 4096;
+			break;
+		default:
+			break;
+		}
+
+		return self;
+	}
+
+	void
+	options_usage()
+	{
+		printf(
+			" Generates the precomputed cubemap faces for PBR.\n"
+			" usage: PBR_Precompute [options] <diffuse.hdr> <environment.hdr>\n"
+			" Pass two paths, the Diffuse HDR and the Enviroment HDR. Path their names if in the same EXE Directory.\n"
+			" Note : Use cmftstudio in tools folder to generate the Irradiance (diffuse) HDR from the Enviroment HDR.\n"
+			" Either can be a .pfm (portable float map) instead, little endian RGB ones are used straight from the mapped file.\n"
+			"\n"
+			" options (applied in order, a preset resets everything before it):\n"
+			"  --preset <preview|mobile|desktop|cinematic>  default desktop\n"
+			"  --diffuse-size <n>         diffuse cubemap face size\n"
+			"  --env-size <n>             environment cubemap face size the prefilter samples from\n"
+			"  --prefilter-size <n>       LOD 0 face size of the prefiltered map\n"
+			"  --lods <n|max>             prefiltered LODs, max goes down to 1x1\n"
+			"  --error <e>                prefilter relative error target per LOD, 0 uses --samples for every LOD\n"
+			"  --samples <n>              max prefilter samples per texel\n"
+			"  --mis <f>                  share of the prefilter samples drawn from the env luminance, 0 is GGX only, 0.5 for suns\n"
+			"  --stream <auto|on|off>     convert the env a band of rows at a time on the CPU, auto does it for\n"
+			"                             envs wider than the GPU max texture size\n"
+			"  --layout <auto|equirect|cross|strip|faces|ktx2>  layout of the sources, the cube ones go to the cube\n"
+			"                             passes without equirect resampling. auto takes a .ktx2 for a cubemap, a path\n"
+			"                             with %%s for six faces (%%s is px, nx, py, ny, pz, nz), a 4:3 or 3:4 image for\n"
+			"                             a cross and a 6:1 or 1:6 one for a strip of the faces in GL order\n"
+			"  --layer <n>                cube of a KTX2 cubemap array source, default 0\n"
+			"  --hybrid <on|off>          split the prefilter between GL and the CPU threads by their measured speed\n"
+			"  --backend <gl|cpu>         where the passes run, cpu needs no GL context (headless nodes), default gl\n"
+			"  --cache <on|off>           keep decoded sources in <source>.envcache and map them on later runs\n"
+			"  --lut-size <n>             BRDF LUT size\n"
+			"  --lut-samples <n>          BRDF LUT samples per texel\n"
+			"  --format <png|bmp|jpg|exr|ktx2>  output image format, exr and ktx2 keep the HDR range (half floats),\n"
+			"                             ktx2 writes one upload ready file per texture\n"
+			"                             (PBR/Diffuse.ktx2, PBR/Specular/Prefiltering.ktx2 and BRDF_LUT.ktx2)\n"
+			"  --encoding <native|bc6h-fast|bc6h|rgb9e5|rgbm|rgbd>  texels of the cubemaps, native is RGB9E5 diffuse\n"
+			"                             and RGBA16F prefiltered, bc6h compresses both (fast for previews), rgb9e5\n"
+			"                             packs both, rgbm and rgbd pack HDR into RGBA8 ktx2, png or bmp\n"
+			"  --pack-range <f>           brightest value rgbm and rgbd keep, default 8\n"
+			"  --sky <turbidity>          bake a Preetham sky (turbidity 2 clear to 10 hazy) instead of the HDRs,\n"
+			"                             no paths are passed then\n"
+			"  --sun <elevation>,<azimuth>  sun of the sky in degrees, azimuth from +X toward +Z, default 45,0\n"
+			"  --sun-illuminance <f>      sun illuminance in units of the zenith radiance, default 20\n"
+			"  --rotation <degrees>       turn the env (or the sky) around +Y, from +X toward +Z\n"
+			"  --probes <out.ktx2>        probe batch, every path is a probe env (--layout and --layer apply to all of them)\n"
+			"                             and their prefiltered maps are baked together into one KTX2 cubemap array,\n"
+			"                             a cube per probe in the order of the paths\n"
+			"  --threads <n>              CPU worker threads\n"
+			"  --progressive <ms>         refine the prefilter progressively, publishing every <ms>\n"
+			"  --time-limit <ms>          stop refining each LOD after <ms>, needs --progressive\n"
+			"\n"
+			" usage: PBR_Precompute --daemon <socket path> [--threads <n>] [--queue <n>] [--shaders <dir>]\n"
+			" Stays up with a warm GL context and takes bake jobs as JSON lines over a local socket (see daemon.h),\n"
+			" --queue bounds the jobs waiting (default 16), --shaders is where the shaders are read from.\n");
+	}
+
+	bool
+	options_valid(const Bake_Options& options)
+	{
+		if (options.diffuse_size <= 0 || options.brdf_lut_size <= 0 || options.lod_count <= 0 || options.prefilter_max_samples == 0 || options.brdf_lut_samples == 0)
+		{
+			printf("sizes, LODs and samples have to be positive\n");
+			return false;
+		}
+
+		if (_power_of_two(options.env_size) == false || _power_of_two(options.prefilter_size) == false)
+		{
+			printf("environment and prefilter sizes have to be powers of two\n");
+			return false;
+		}
+
+		int max_lods = _max_lod_count(options.prefilter_size);
+		if (options.lod_count > max_lods)
+		{
+			printf("%d LODs of a %d prefiltered map go below 1x1, at most %d\n", options.lod_count, options.prefilter_size, max_lods);
+			return false;
+		}
+
+		//the shader spreads the light samples with 32 bit integer math
+		if (options.light_fraction > 0.0f && options.prefilter_max_samples > 65536)
+		{
+			printf("--mis needs at most 65536 prefilter samples\n");
+			return false;
+		}
+
+		if (options.time_limit_ms > 0.0 && options.progressive_ms <= 0.0)
+		{
+			printf("--time-limit needs --progressive\n");
+			return false;
+		}
+
+		if (options.hybrid_prefilter && options.progressive_ms > 0.0)
+		{
+			printf("--hybrid prefilters in one shot, not with --progressive\n");
+			return false;
+		}
+
+		//the CPU engines already are the CPU backend's passes, a progressive LOD runs the CPU progressive engine
+		if (options.backend == BACKEND::CPU && (options.hybrid_prefilter || options.probes_path))
+		{
+			printf("--backend cpu bakes without --hybrid and --probes\n");
+			return false;
+		}
+
+		//the batch prefilters every probe of a LOD in one pass with GGX samples only
+		if (options.probes_path && (options.progressive_ms > 0.0 || options.light_fraction > 0.0f))
+		{
+			printf("--probes bakes without --progressive and --mis\n");
+			return false;
+		}
+
+		return true;
+	}
+
+	bool
+	options_parse(int argc, char** argv, Bake_Options& options)
+	{
+		options = options_preset(PRESET::DESKTOP);
+
+		std::vector<const char*> positional;
+		bool lods_max = false;
+
+		for (int i = 1; i < argc; ++i)
+		{
+			const char* arg = argv[i];
+			if (strncmp(arg, "--", 2) != 0)
+			{
+				positional.push_back(arg);
+				continue;
+			}
+
+			if (i + 1 >= argc)
+			{
+				printf("missing value for '%s'\n", arg);
+				return false;
+			}
+			const char* value = argv[++i];
+
+			bool ok = true;
+			int n = 0;
+			double d = 0.0;
+			if (strcmp(arg, "--preset") == 0)
+			{
+				PRESET preset;
+				ok = _parse_preset(value, preset);
+				if (ok)
+				{
+					options = options_preset(preset);
+					lods_max = false;
+				}
+			}
+			else if (strcmp(arg, "--diffuse-size") == 0)
+				ok = _parse_int(value, options.diffuse_size);
+			else if (strcmp(arg, "--env-size") == 0)
+				ok = _parse_int(value, options.env_size);
+			else if (strcmp(arg, "--prefilter-size") == 0)
+				ok = _parse_int(value, options.prefilter_size);
+			else if (strcmp(arg, "--lut-size") == 0)
+				ok = _parse_int(value, options.brdf_lut_size);
+			else if (strcmp(arg, "--lods") == 0)
+			{
+				lods_max = strcmp(value, "max") == 0;
+				ok = lods_max || _parse_int(value, options.lod_count);
+			}
+			else if (strcmp(arg, "--error") == 0)
+			{
+				ok = _parse_float(value, d);
+				options.error_target = (float)d;
+			}
+			else if (strcmp(arg, "--samples") == 0)
+			{
+				ok = _parse_int(value, n);
+				options.prefilter_max_samples = n;
+			}
+			else if (strcmp(arg, "--mis") == 0)
+			{
+				ok = _parse_float(value, d) && d < 1.0;
+				options.light_fraction = (float)d;
+			}
+			else if (strcmp(arg, "--stream") == 0)
+				ok = _parse_stream(value, options.env_stream);
+			else if (strcmp(arg, "--hybrid") == 0)
+				ok = _parse_switch(value, options.hybrid_prefilter);
+			else if (strcmp(arg, "--backend") == 0)
+				ok = _parse_backend(value, options.backend);
+			else if (strcmp(arg, "--cache") == 0)
+				ok = _parse_switch(value, options.cache);
+			else if (strcmp(arg, "--lut-samples") == 0)
+			{
+				ok = _parse_int(value, n);
+				options.brdf_lut_samples = n;
+			}
+			else if (strcmp(arg, "--format") == 0)
+				ok = _parse_format(value, options.output_format);
+			else if (strcmp(arg, "--encoding") == 0)
+				ok = _parse_encoding(value, options.cube_encoding);
+			else if (strcmp(arg, "--pack-range") == 0)
+			{
+				ok = _parse_float(value, d) && d > 0.0;
+				options.pack_range = (float)d;
+			}
+			else if (strcmp(arg, "--threads") == 0)
+			{
+				ok = _parse_int(value, n);
+				options.threads = n;
+			}
+			else if (strcmp(arg, "--sky") == 0)
+			{
+				ok = _parse_float(value, d) && d >= 1.0;
+				options.sky = true;
+				options.sky_turbidity = (float)d;
+			}
+			else if (strcmp(arg, "--sun") == 0)
+				ok = _parse_sun(value, options.sun_elevation, options.sun_azimuth);
+			else if (strcmp(arg, "--layout") == 0)
+				ok = _parse_layout(value, options.source_layout);
+			else if (strcmp(arg, "--layer") == 0)
+			{
+				//0 is a layer, _parse_int only takes sizes
+				char* end;
+				long v = strtol(value, &end, 10);
+				ok = *end == '\0' && end != value && v >= 0;
+				options.source_layer = (int)v;
+			}
+			else if (strcmp(arg, "--probes") == 0)
+				options.probes_path = value;
+			else if (strcmp(arg, "--rotation") == 0)
+				ok = _parse_angle(value, options.env_rotation);
+			else if (strcmp(arg, "--sun-illuminance") == 0)
+			{
+				ok = _parse_float(value, d);
+				options.sun_illuminance = (float)d;
+			}
+			else if (strcmp(arg, "--progressive") == 0)
+				ok = _parse_float(value, options.progressive_ms);
+			else if (strcmp(arg, "--time-limit") == 0)
+				ok = _parse_float(value, options.time_limit_ms);
+			else
+			{
+				printf("unknown option '%s'\n", arg);
+				return false;
+			}
+
+			if (ok == false)
+			{
+				printf("invalid value '%s' for '%s'\n", value, arg);
+				return false;
+			}
+		}
+
+		if (options.sky && (positional.empty() == false || options.probes_path))
+		{
+			printf("--sky bakes without source HDRs or probes\n");
+			return false;
+		}
+		if (options.probes_path)
+		{
+			if (positional.empty())
+			{
+				printf("--probes expects at least one probe env path\n");
+				return false;
+			}
+			options.probe_paths = positional;
+		}
+		else if (options.sky == false)
+		{
+			if (positional.size() > 2)
+			{
+				printf("unexpected argument '%s'\n", positional[2]);
+				return false;
+			}
+			if (positional.size() != 2)
+			{
+				printf("expected the diffuse and the environment HDR paths\n");
+				return false;
+			}
+			options.diffuse_hdr_path = positional[0];
+			options.env_hdr_path = positional[1];
+		}
+
+		if (lods_max)
+			options.lod_count = _max_lod_count(options.prefilter_size);
+		if (options_valid(options) == false)
+			return false;
+
+		//RGBM and RGBD are 8 bit texels any lossless 8 bit format keeps, the rest are KTX2 formats. a probe batch is always a KTX2 file
+		bool packs_rgba8 = options.cube_encoding == ENCODING::RGBM || options.cube_encoding == ENCODING::RGBD;
+		bool rgba8_format = options.output_format == io::IMAGE_FORMAT::PNG || options.output_format == io::IMAGE_FORMAT::BMP;
+		bool ktx2 = options.output_format == io::IMAGE_FORMAT::KTX2 || options.probes_path;
+		if (packs_rgba8 && ktx2 == false && rgba8_format == false)
+		{
+			printf("--encoding rgbm and rgbd need --format ktx2, png or bmp\n");
+			return false;
+		}
+		if (packs_rgba8 == false && options.cube_encoding != ENCODING::NATIVE && ktx2 == false)
+		{
+			printf("--encoding needs --format ktx2\n");
+			return false;
+		}
+
+		return true;
+	}
+
+	Work_Estimate
+	options_work_estimate(const Bake_Options& options)
+	{
+		Work_Estimate self{};
+		self.diffuse = 6.0 * options.diffuse_size * options.diffuse_size;
+		self.env = 6.0 * options.env_size * options.env_size;
+		for (int lod = 0; lod < options.lod_count; ++lod)
+		{
+			double size = std::max(options.prefilter_size >> lod, 1);
+			double samples = lod == 0 ? 1.0 : options.prefilter_max_samples;
+			self.prefilter += 6.0 * size * size * samples;
+		}
+		self.brdf_lut = (double)options.brdf_lut_size * options.brdf_lut_size * options.brdf_lut_samples;
+		return self;
+	}
+
+	void
+	options_print(const Bake_Options& options)
+	{
+		if (options.sky)
+			printf("sky: turbidity %.1f, sun at %.1f elevation %.1f azimuth, illuminance %.1f\n",
+				options.sky_turbidity, options.sun_elevation, options.sun_azimuth, options.sun_illuminance);
+		if (options.probes_path)
+			printf("probe batch: %d probes into '%s'\n", (int)options.probe_paths.size(), options.probes_path);
+		if (options.env_rotation != 0.0f)
+			printf("env turned %.1f degrees around +Y\n", options.env_rotation);
+		printf("diffuse %d, env %d, prefilter %d x %d LODs, BRDF LUT %d, %s, %u threads, %s backend\n",
+			options.diffuse_size, options.env_size, options.prefilter_size, options.lod_count, options.brdf_lut_size,
+			io::image_extension(options.output_format), options.threads, options.backend == BACKEND::CPU ? "CPU" : "GL");
+		printf("prefilter samples: error target %.4f, at most %u, %.0f%% light samples, BRDF LUT samples %u%s\n",
+			options.error_target, options.prefilter_max_samples, options.light_fraction * 100.0f, options.brdf_lut_samples,
+			options.hybrid_prefilter ? ", GL and CPU prefilter" : "");
+
+		Work_Estimate work = options_work_estimate(options);
+		printf("work estimate (texel samples): diffuse %.3gM, env %.3gM, prefilter <= %.3gM, BRDF LUT %.3gM, total <= %.3gM\n",
+			work.diffuse * 1e-6, work.env * 1e-6, work.prefilter * 1e-6, work.brdf_lut * 1e-6,
+			(work.diffuse + work.env + work.prefilter + work.brdf_lut) * 1e-6);
+	}
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "image.h"
+
+#include <vector>
+
+namespace cli
+{
+	enum class PRESET
+	{
+		PREVIEW,
+		MOBILE,
+		DESKTOP,
+		CINEMATIC
+	};
+
+	//how the env equirect becomes a cubemap
+	enum class STREAM
+	{
+		AUTO, //streamed when it is wider than the GPU takes a texture
+		ON,   //decoded a band at a time and splatted into the faces on the CPU
+		OFF   //decoded whole, uploaded and rendered into the faces on the GPU
+	};
+
+	//how a source lays out its texels, the cube layouts skip the equirect resampling and go to the cube passes as they are
+	enum class LAYOUT
+	{
+		AUTO,     //a .ktx2 is a cubemap, a path with %s six faces, a 4:3 or 3:4 image a cross, a 6:1 or 1:6 one a strip
+		EQUIRECT,
+		CROSS,    //horizontal (4:3) or vertical (3:4) cross
+		STRIP,    //the 6 faces in GL order side by side (6:1) or stacked (1:6)
+		FACES,    //six files, %s in the path is px, nx, py, ny, pz and nz
+		KTX2      //a cubemap or a layer of a cubemap array
+	};
+
+	//where the passes of a bake run
+	enum class BACKEND
+	{
+		GL, //rendered with the baker's GL context
+		CPU //the same passes on the worker threads, no GL context at all (a headless build node)
+	};
+
+	//how the KTX2 cubemaps keep their texels
+	enum class ENCODING
+	{
+		NATIVE,    //shared exponent diffuse, half float prefiltered map
+		BC6H_FAST, //BC6H blocks, one mode and projected indices, for previews
+		BC6H,      //BC6H blocks, both one region modes with refined endpoints
+		RGB9E5,    //shared exponent for both cubemaps
+		RGBM,      //RGBA8 packed HDR up to pack_range, also for png and bmp faces
+		RGBD
+	};
+
+	struct Bake_Options
+	{
+		const char* diffuse_hdr_path;
+		const char* env_hdr_path;
+
+		//a Preetham sky with a sun instead of the two sources, the env faces are generated straight into the cube and
+		//the diffuse comes from its SH9 irradiance, no decode, file or equirect resampling
+		bool sky;
+		float sky_turbidity;
+		float sun_elevation;   //degrees
+		float sun_azimuth;     //degrees from +X toward +Z
+		float sun_illuminance; //in units of the zenith radiance
+
+		//of both sources, layer picks the cube of a KTX2 cubemap array
+		LAYOUT source_layout;
+		int source_layer;
+
+		//probe batch: every path is a probe env (any layout) and only their prefiltered maps are baked, all of them in the
+		//same passes, into one KTX2 cubemap array at probes_path (a cube per probe in the order of the paths). null bakes the
+		//two sources, the paths are borrowed like the source ones
+		const char* probes_path;
+		std::vector<const char*> probe_paths;
+
+		//degrees the env (or the sky) is turned around +Y, from +X toward +Z, applied where the cube directions are
+		//generated so the source isn't touched. a baker with its cache on rebakes a rotation-only change from the
+		//previous bake (see baker_cache_enable)
+		float env_rotation;
+
+		//face sizes of each stage
+		int diffuse_size;
+		int env_size;       //env cubemap the prefilter samples from
+		int prefilter_size; //LOD 0 of the prefiltered map
+		int brdf_lut_size;
+
+		//prefiltered LODs, each half the size of the previous one, down to 1x1 at most
+		int lod_count;
+
+		//prefilter samples come from the error target, bounded by max, an error target of 0 uses max for every LOD
+		float error_target;
+		unsigned int prefilter_max_samples;
+		unsigned int brdf_lut_samples;
+
+		//share of the prefilter samples drawn from the env luminance (multiple importance sampling), 0 is GGX only,
+		//pays off on envs with a small very bright sun
+		float light_fraction;
+
+		STREAM env_stream;
+
+		//split the prefilter tiles between the GL pass and the CPU engine by their measured throughput,
+		//for weak or software GL where either side alone leaves the other idle
+		bool hybrid_prefilter;
+
+		//the CPU backend streams the env (the splat is its equirect to cube conversion) and has no hybrid prefilter
+		BACKEND backend;
+
+		//map a decoded copy of the sources kept next to them (<source>.envcache) instead of decoding them,
+		//written on the first run
+		bool cache;
+
+		io::IMAGE_FORMAT output_format;
+		ENCODING cube_encoding; //ktx2 only, but for RGBM and RGBD which also pack png and bmp faces
+		float pack_range;       //brightest value RGBM and RGBD keep
+		unsigned int threads;
+
+		//progressive prefilter, publish interval and time limit per LOD in ms, 0 is a one shot prefilter
+		double progressive_ms;
+		double time_limit_ms;
+	};
+
+	Bake_Options
+	options_preset(PRESET preset);
+
+	//false if the command line is not valid, the reason gets printed
+	bool
+	options_parse(int argc, char** argv, Bake_Options& options);
+
+	//false if the sizes and samples can't be baked, the reason gets printed. options_parse checks it,
+	//options built by hand (the bake library) have to
+	bool
+	options_valid(const Bake_Options& options);
+
+	void
+	options_usage();
+
+	//number of texel * sample evaluations of each stage, prefilter counts are an upper bound when an error target is used
+	struct Work_Estimate
+	{
+		double diffuse;
+		double env;
+		double prefilter;
+		double brdf_lut;
+	};
+
+	Work_Estimate
+	options_work_estimate(const Bake_Options& options);
+
+	void
+	options_print(const Bake_Options& options);
+};
@@ -0,0 +1,163 @@
+#include "pass_graph.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+
+namespace jobs
+{
+	struct Pass_Resource
+	{
+		const char* name;
+		Resource_Free free;
+		void* user;
+		AFFINITY affinity;
+		std::vector<unsigned int> writers; //passes
+		std::vector<unsigned int> readers;
+	};
+
+	struct Pass
+	{
+		const char* name;
+		Task_Function function;
+		void* user;
+		std::vector<Resource> inputs;
+		std::vector<Resource> outputs;
+		AFFINITY affinity;
+		bool cached;
+	};
+
+	struct Pass_Graph
+	{
+		Pool* pool;
+		std::vector<Pass_Resource> resources;
+		std::vector<Pass> passes;
+	};
+
+	//the passes that ran writing any of resources, each one once
+	std::vector<unsigned int>
+	_running_writers(const Pass_Graph* graph, const std::vector<Resource>& resources)
+	{
+		std::vector<unsigned int> writers;
+		for (Resource resource : resources)
+			for (unsigned int writer : graph->resources[resource].writers)
+				if (graph->passes[writer].cached == false)
+					writers.push_back(writer);
+		std::sort(writers.begin(), writers.end());
+		writers.erase(std::unique(writers.begin(), writers.end()), writers.end());
+		return writers;
+	}
+
+	Pass_Graph*
+	pass_graph_create(Pool* pool)
+	{
+		Pass_Graph* self = new Pass_Graph{};
+		self->pool = pool;
+		return self;
+	}
+
+	Resource
+	pass_graph_resource(Pass_Graph* graph, const char* name, Resource_Free free, void* user, AFFINITY affinity)
+	{
+		graph->resources.push_back(Pass_Resource{ name, free, user, affinity, std::vector<unsigned int>{}, std::vector<unsigned int>{} });
+		return (Resource)(graph->resources.size() - 1);
+	}
+
+	void
+	pass_graph_pass(Pass_Graph* graph, const char* name, Task_Function function, void* user, const std::vector<Resource>& inputs, const std::vector<Resource>& outputs,
+		AFFINITY affinity, bool cached)
+	{
+		unsigned int index = (unsigned int)graph->passes.size();
+		graph->passes.push_back(Pass{ name, function, user, inputs, outputs, affinity, cached });
+		for (Resource resource : inputs)
+		{
+			assert(resource < graph->resources.size() && "input of another pass graph");
+			graph->resources[resource].readers.push_back(index);
+		}
+		for (Resource resource : outputs)
+		{
+			assert(resource < graph->resources.size() && "output of another pass graph");
+			assert(std::find(inputs.begin(), inputs.end(), resource) == inputs.end() && "a pass can't read the resource it writes");
+			graph->resources[resource].writers.push_back(index);
+		}
+	}
+
+	void
+	pass_graph_run(Pass_Graph* graph)
+	{
+		//topological order of the passes that run, a pass is ready once the writers of its inputs are.
+		//the tasks are created in it so a cycle shows up here with its passes instead of as a graph_run that never returns
+		size_t pass_count = graph->passes.size();
+		std::vector<std::vector<unsigned int>> waits(pass_count);
+		std::vector<std::vector<unsigned int>> successors(pass_count);
+		std::vector<unsigned int> pending(pass_count, 0);
+		std::vector<unsigned int> order;
+		for (unsigned int i = 0; i < pass_count; ++i)
+		{
+			if (graph->passes[i].cached)
+				continue;
+			waits[i] = _running_writers(graph, graph->passes[i].inputs);
+			for (unsigned int writer : waits[i])
+				successors[writer].push_back(i);
+			pending[i] = (unsigned int)waits[i].size();
+			if (pending[i] == 0)
+				order.push_back(i);
+		}
+		for (size_t next = 0; next < order.size(); ++next)
+			for (unsigned int successor : successors[order[next]])
+				if (--pending[successor] == 0)
+					order.push_back(successor);
+
+		size_t running = 0;
+		for (const Pass& pass : graph->passes)
+			running += pass.cached ? 0 : 1;
+		if (order.size() != running)
+		{
+			for (unsigned int i = 0; i < pass_count; ++i)
+				if (pending[i] > 0)
+					printf("pass '%s' is in a dependency cycle\n", graph->passes[i].name);
+			assert(false && "dependency cycle");
+			return;
+		}
+
+		Graph* tasks = graph_create(graph->pool);
+		std::vector<Task*> pass_tasks(pass_count, nullptr);
+		for (unsigned int i : order)
+		{
+			const Pass& pass = graph->passes[i];
+			pass_tasks[i] = graph_task(tasks, pass.name, pass.function, pass.user, pass.affinity);
+			for (unsigned int writer : waits[i])
+				graph_depend(pass_tasks[i], pass_tasks[writer]);
+		}
+
+		//a resource is freed after every pass touching it, nothing was written to it when none of its writers ran
+		for (Resource i = 0; i < graph->resources.size(); ++i)
+		{
+			const Pass_Resource& resource = graph->resources[i];
+			if (resource.free == nullptr)
+				continue;
+			std::vector<unsigned int> users = _running_writers(graph, std::vector<Resource>{ i });
+			if (users.empty())
+				continue;
+			for (unsigned int reader : resource.readers)
+				if (graph->passes[reader].cached == false)
+					users.push_back(reader);
+			//a pass listing it twice waits once
+			std::sort(users.begin(), users.end());
+			users.erase(std::unique(users.begin(), users.end()), users.end());
+
+			Task* free = graph_task(tasks, resource.name, resource.free, resource.user, resource.affinity);
+			for (unsigned int user : users)
+				graph_depend(free, pass_tasks[user]);
+		}
+
+		graph_run(tasks);
+		graph_free(tasks);
+	}
+
+	void
+	pass_graph_free(Pass_Graph* graph)
+	{
+		delete graph;
+	}
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "task_graph.h"
+
+#include <vector>
+
+namespace jobs
+{
+	//a graph of passes that name the resources they read and write instead of the tasks they wait for. the run orders
+	//them topologically over a Graph, so passes that don't share a resource run side by side, each resource is freed
+	//as soon as the last pass touching it is done and cached passes (their outputs are already there) never run
+	struct Pass_Graph;
+
+	typedef unsigned int Resource;
+
+	//frees what the resource holds, user is the one given with the resource
+	typedef void(*Resource_Free)(void* user);
+
+	Pass_Graph*
+	pass_graph_create(Pool* pool);
+
+	//a resource no pass writes is the caller's and ready before the run. free (null for none) runs with affinity once
+	//every pass reading or writing it is done, and only when one of its writers ran
+	Resource
+	pass_graph_resource(Pass_Graph* graph, const char* name, Resource_Free free = nullptr, void* user = nullptr, AFFINITY affinity = AFFINITY::ANY);
+
+	//a pass runs once every writer of each of its inputs is done, so a resource is written once and only read after.
+	//a resource can have several writers and nothing orders them against each other: each one writes its own part of it
+	//(the tiles of the hybrid engines) or another resource has to order them. a pass can't read a resource it writes.
+	//a cached pass is declared all the same so its readers know their input is there without waiting for anything
+	void
+	pass_graph_pass(Pass_Graph* graph, const char* name, Task_Function function, void* user, const std::vector<Resource>& inputs, const std::vector<Resource>& outputs,
+		AFFINITY affinity = AFFINITY::ANY, bool cached = false);
+
+	//returns once every pass and free is done, only from the thread that created the pool. the passes have to be acyclic
+	void
+	pass_graph_run(Pass_Graph* graph);
+
+	void
+	pass_graph_free(Pass_Graph* graph);
+};
@@ -0,0 +1,214 @@
+#include "pbr_precompute.h"
+#include "bake.h"
+#include "sky_refresh.h"
+
+#include <string.h>
+#include <algorithm>
+
+struct PBR_Baker
+{
+	pbr::Baker* baker;
+};
+
+struct PBR_Sky_Refresh
+{
+	pbr::Sky_Refresh* refresh;
+};
+
+struct Buffers_Copy
+{
+	const PBR_Bake_Settings* settings;
+	const PBR_Bake_Buffers* buffers;
+};
+
+inline size_t
+_face_floats(int size)
+{
+	return (size_t)3 * size * size;
+}
+
+//the LODs before lod come first in the prefiltered buffer
+inline size_t
+_lod_offset(const PBR_Bake_Settings* settings, int lod)
+{
+	size_t offset = 0;
+	for (int level = 0; level < lod; ++level)
+		offset += 6 * _face_floats(std::max(settings->prefilter_size >> level, 1));
+	return offset;
+}
+
+void
+_buffers_publish(pbr::BAKE_TEXTURE texture, int lod, io::Image* images, int count, bool partial, void* user)
+{
+	Buffers_Copy* copy = (Buffers_Copy*)user;
+	float* out = nullptr;
+	switch (texture)
+	{
+	case pbr::BAKE_TEXTURE::DIFFUSE:
+		out = copy->buffers->diffuse;
+		break;
+	case pbr::BAKE_TEXTURE::PREFILTERED:
+		out = copy->buffers->prefiltered ? copy->buffers->prefiltered + _lod_offset(copy->settings, lod) : nullptr;
+		break;
+	case pbr::BAKE_TEXTURE::BRDF_LUT:
+		out = copy->buffers->brdf_lut;
+		break;
+	default:
+		break;
+	}
+	if (out == nullptr)
+		return;
+
+	for (int i = 0; i < count; ++i)
+	{
+		size_t floats = (size_t)images[i].channels * images[i].width * images[i].height;
+		memcpy(out, images[i].data, sizeof(float) * floats);
+		out += floats;
+	}
+	if (copy->buffers->copied)
+		copy->buffers->copied((PBR_TEXTURE)texture, lod, partial ? 1 : 0, copy->buffers->user);
+}
+
+void
+pbr_settings_preset(PBR_PRESET preset, PBR_Bake_Settings* settings)
+{
+	cli::Bake_Options options = cli::options_preset((cli::PRESET)preset);
+	settings->diffuse_size = options.diffuse_size;
+	settings->env_size = options.env_size;
+	settings->prefilter_size = options.prefilter_size;
+	settings->brdf_lut_size = options.brdf_lut_size;
+	settings->lod_count = options.lod_count;
+	settings->error_target = options.error_target;
+	settings->prefilter_max_samples = options.prefilter_max_samples;
+	settings->brdf_lut_samples = options.brdf_lut_samples;
+	settings->light_fraction = options.light_fraction;
+	settings->rotation = options.env_rotation;
+	settings->cpu_backend = options.backend == cli::BACKEND::CPU ? 1 : 0;
+	settings->progressive_ms = (float)options.progressive_ms;
+	settings->time_limit_ms = (float)options.time_limit_ms;
+}
+
+size_t
+pbr_bake_buffer_floats(const PBR_Bake_Settings* settings, PBR_TEXTURE texture)
+{
+	switch (texture)
+	{
+	case PBR_TEXTURE_DIFFUSE:
+		return 6 * _face_floats(settings->diffuse_size);
+	case PBR_TEXTURE_PREFILTERED:
+		return _lod_offset(settings, settings->lod_count);
+	case PBR_TEXTURE_BRDF_LUT:
+		return (size_t)2 * settings->brdf_lut_size * settings->brdf_lut_size;
+	default:
+		return 0;
+	}
+}
+
+PBR_Baker*
+pbr_baker_create(unsigned int threads, const char* shader_dir, int use_current_context)
+{
+	PBR_Baker* self = new PBR_Baker{};
+	self->baker = pbr::baker_create(std::max(threads, 1u), shader_dir, use_current_context != 0);
+	return self;
+}
+
+void
+pbr_baker_free(PBR_Baker* baker)
+{
+	pbr::baker_free(baker->baker);
+	delete baker;
+}
+
+int
+pbr_bake(PBR_Baker* baker, const PBR_Bake_Settings* settings, const PBR_Equirect* diffuse, const PBR_Equirect* env, const PBR_Bake_Buffers* buffers)
+{
+	cli::Bake_Options options = cli::options_preset(cli::PRESET::DESKTOP);
+	options.diffuse_size = settings->diffuse_size;
+	options.env_size = settings->env_size;
+	options.prefilter_size = settings->prefilter_size;
+	options.brdf_lut_size = settings->brdf_lut_size;
+	options.lod_count = settings->lod_count;
+	options.error_target = settings->error_target;
+	options.prefilter_max_samples = settings->prefilter_max_samples;
+	options.brdf_lut_samples = settings->brdf_lut_samples;
+	options.light_fraction = settings->light_fraction;
+	options.env_rotation = settings->rotation;
+	options.backend = settings->cpu_backend ? cli::BACKEND::CPU : cli::BACKEND::GL;
+	options.progressive_ms = settings->progressive_ms;
+	options.time_limit_ms = settings->time_limit_ms;
+
+	//views of the caller's equirects, the bake only reads them
+	io::Image images[2];
+	const PBR_Equirect* equirects[2] = { diffuse, env };
+	for (int i = 0; i < 2; ++i)
+	{
+		images[i].width = equirects[i]->width;
+		images[i].height = equirects[i]->height;
+		images[i].channels = 3;
+		images[i].type = io::PIXEL_TYPE::FLOAT;
+		images[i].data = (void*)equirects[i]->rgb;
+	}
+	pbr::Bake_Sources sources{ &images[0], &images[1] };
+
+	Buffers_Copy copy{ settings, buffers };
+	pbr::Bake_Output output{};
+	output.cube_type = io::PIXEL_TYPE::FLOAT;
+	output.lut_type = io::PIXEL_TYPE::FLOAT;
+	output.gl_faces = true;
+	output.publish = _buffers_publish;
+	output.user = &copy;
+
+	pbr::Bake_Result result;
+	bool ok = pbr::bake_run(baker->baker, options, sources, output, result);
+	pbr::bake_result_free(result);
+	return ok ? 1 : 0;
+}
+
+PBR_Sky_Refresh*
+pbr_sky_refresh_create(const PBR_Sky_Refresh_Settings* settings, const char* shader_dir)
+{
+	if (shader_dir)
+		glgpu::shader_dir_set(shader_dir);
+	pbr::Sky_Refresh_Config config{};
+	config.prefilter_size = settings->prefilter_size;
+	config.lod_count = settings->lod_count;
+	config.tile_size = settings->tile_size;
+	config.max_samples = settings->max_samples;
+	config.frame_budget_ms = settings->frame_budget_ms;
+
+	PBR_Sky_Refresh* self = new PBR_Sky_Refresh{};
+	self->refresh = pbr::sky_refresh_create(config);
+	return self;
+}
+
+void
+pbr_sky_refresh_free(PBR_Sky_Refresh* refresh)
+{
+	pbr::sky_refresh_free(refresh->refresh);
+	delete refresh;
+}
+
+void
+pbr_sky_refresh_env_set(PBR_Sky_Refresh* refresh, unsigned int env, int env_size)
+{
+	pbr::sky_refresh_env_set(refresh->refresh, (glgpu::cubemap)(size_t)env, env_size);
+}
+
+int
+pbr_sky_refresh_step(PBR_Sky_Refresh* refresh)
+{
+	return pbr::sky_refresh_step(refresh->refresh) ? 1 : 0;
+}
+
+unsigned int
+pbr_sky_refresh_front(const PBR_Sky_Refresh* refresh)
+{
+	return (unsigned int)(size_t)pbr::sky_refresh_front(refresh->refresh);
+}
+
+PBR_Sky_Refresh_Stats
+pbr_sky_refresh_stats(const PBR_Sky_Refresh* refresh)
+{
+	pbr::Sky_Refresh_Stats stats = pbr::sky_refresh_stats(refresh->refresh);
+	return PBR_Sky_Refresh_Stats{ stats.cycles, stats.latency_ms, stats.steps, stats.step_gpu_ms };
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+//C interface of the bake library for engines and editors that don't build against the C++ headers (bake.h),
+//everything comes in and goes out as float buffers, no files are read or written
+
+#include <stddef.h>
+
+#ifdef PBR_PRECOMPUTE_DLL
+#define PBR_API __declspec(dllexport)
+#else
+#define PBR_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct PBR_Baker PBR_Baker;
+
+typedef enum PBR_PRESET
+{
+	PBR_PRESET_PREVIEW,
+	PBR_PRESET_MOBILE,
+	PBR_PRESET_DESKTOP,
+	PBR_PRESET_CINEMATIC
+} PBR_PRESET;
+
+typedef enum PBR_TEXTURE
+{
+	PBR_TEXTURE_DIFFUSE,
+	PBR_TEXTURE_PREFILTERED,
+	PBR_TEXTURE_BRDF_LUT
+} PBR_TEXTURE;
+
+//same meaning as the command line options
+typedef struct PBR_Bake_Settings
+{
+	int diffuse_size;
+	int env_size;
+	int prefilter_size;
+	int brdf_lut_size;
+	int lod_count;
+	float error_target;
+	unsigned int prefilter_max_samples;
+	unsigned int brdf_lut_samples;
+	float light_fraction;
+	float rotation; //degrees the env is turned around +Y, from +X toward +Z
+	int cpu_backend; //1 bakes on the worker threads only, the baker never needs a GL context then
+	float progressive_ms; //0 prefilters each LOD in one shot
+	float time_limit_ms;
+} PBR_Bake_Settings;
+
+//RGB float equirect, rows bottom up like glTexImage2D takes them (and the .hdr decoder gives them)
+typedef struct PBR_Equirect
+{
+	int width;
+	int height;
+	const float* rgb;
+} PBR_Equirect;
+
+//caller buffers, pbr_bake_buffer_floats long. cubes are RGB faces in GL order and layout, level major
+//(LOD 0 faces +X..-Z, then LOD 1...) so they upload as they are, the LUT is RG. a null buffer skips the copy.
+//copied (null for none) is told each time a texture or LOD landed in its buffer, from the thread that baked it:
+//with progressive_ms a LOD lands partial at each interval, then a last time with partial 0
+typedef struct PBR_Bake_Buffers
+{
+	float* diffuse;
+	float* prefiltered;
+	float* brdf_lut;
+	void (*copied)(PBR_TEXTURE texture, int lod, int partial, void* user);
+	void* user;
+} PBR_Bake_Buffers;
+
+PBR_API void
+pbr_settings_preset(PBR_PRESET preset, PBR_Bake_Settings* settings);
+
+PBR_API size_t
+pbr_bake_buffer_floats(const PBR_Bake_Settings* settings, PBR_TEXTURE texture);
+
+//threads counts the calling thread, shader_dir null keeps PBR_Shaders. with use_current_context the bakes render
+//with the GL 4.5 context current on the calling thread instead of a hidden window's
+PBR_API PBR_Baker*
+pbr_baker_create(unsigned int threads, const char* shader_dir, int use_current_context);
+
+PBR_API void
+pbr_baker_free(PBR_Baker* baker);
+
+//only from the thread that created the baker, 0 if the settings aren't valid (the reason gets printed)
+PBR_API int
+pbr_bake(PBR_Baker* baker, const PBR_Bake_Settings* settings, const PBR_Equirect* diffuse, const PBR_Equirect* env, const PBR_Bake_Buffers* buffers);
+
+//keeps the prefiltered map of a changing env (a time of day sky) up to date a few tiles a frame instead of baking it,
+//the front map is always a complete one of a single env. everything on the thread with the caller's GL 4.5 context
+typedef struct PBR_Sky_Refresh PBR_Sky_Refresh;
+
+typedef struct PBR_Sky_Refresh_Settings
+{
+	int prefilter_size;
+	int lod_count;
+	int tile_size;             //square tiles a step draws, at least one a step
+	unsigned int max_samples;  //per texel of the rough LODs
+	float frame_budget_ms;     //GPU time a step aims to take
+} PBR_Sky_Refresh_Settings;
+
+typedef struct PBR_Sky_Refresh_Stats
+{
+	unsigned long long cycles; //complete maps swapped in
+	double latency_ms;         //from the env a cycle read being taken to its map being swapped in, last cycle
+	unsigned int steps;        //steps the last cycle took
+	double step_gpu_ms;
+} PBR_Sky_Refresh_Stats;
+
+//shader_dir null keeps PBR_Shaders (or what a baker set)
+PBR_API PBR_Sky_Refresh*
+pbr_sky_refresh_create(const PBR_Sky_Refresh_Settings* settings, const char* shader_dir);
+
+PBR_API void
+pbr_sky_refresh_free(PBR_Sky_Refresh* refresh);
+
+//env is the GL name of a complete RGB16F cubemap the caller renders the sky into, its base level is copied when a cycle starts
+PBR_API void
+pbr_sky_refresh_env_set(PBR_Sky_Refresh* refresh, unsigned int env, int env_size);
+
+//once a frame, 1 when a new map was swapped in
+PBR_API int
+pbr_sky_refresh_step(PBR_Sky_Refresh* refresh);
+
+//GL name of the last complete map (a mip level per LOD, GL face layout), 0 before the first. it changes with every swap
+PBR_API unsigned int
+pbr_sky_refresh_front(const PBR_Sky_Refresh* refresh);
+
+PBR_API PBR_Sky_Refresh_Stats
+pbr_sky_refresh_stats(const PBR_Sky_Refresh* refresh);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,104 @@
+#include "pfm.h"
+#include "mapped_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+namespace io
+{
+	inline void
+	_pfm_skip_space(const char* header, size_t length, size_t& offset)
+	{
+		while (offset < length && isspace((unsigned char)header[offset]))
+			++offset;
+	}
+
+	inline float
+	_pfm_float(const unsigned char* data, bool swap)
+	{
+		unsigned char bytes[4] = { data[0], data[1], data[2], data[3] };
+		if (swap)
+		{
+			bytes[0] = data[3];
+			bytes[1] = data[2];
+			bytes[2] = data[1];
+			bytes[3] = data[0];
+		}
+		float value;
+		memcpy(&value, bytes, sizeof(value));
+		return value;
+	}
+
+	bool
+	pfm_read(const char* path, Image& img, bool zero_copy)
+	{
+		Mapped_File file;
+		if (file_map(path, file, true) == false)
+			return false;
+
+		//"PF" width height scale with a single whitespace before the raw floats, the header is short
+		char header[128]{};
+		size_t length = file.size < sizeof(header) - 1 ? file.size : sizeof(header) - 1;
+		memcpy(header, file.data, length);
+
+		int channels = 0;
+		if (strncmp(header, "PF", 2) == 0)
+			channels = 3;
+		else if (strncmp(header, "Pf", 2) == 0)
+			channels = 1;
+
+		size_t offset = 2;
+		char* end;
+		_pfm_skip_space(header, length, offset);
+		long width = strtol(header + offset, &end, 10);
+		offset = end - header;
+		_pfm_skip_space(header, length, offset);
+		long height = strtol(header + offset, &end, 10);
+		offset = end - header;
+		_pfm_skip_space(header, length, offset);
+		double scale = strtod(header + offset, &end);
+		offset = end - header;
+
+		size_t texels = (size_t)width * (size_t)height;
+		if (channels == 0 || width <= 0 || height <= 0 || scale == 0.0 || offset >= length || isspace((unsigned char)header[offset]) == 0 ||
+			offset + 1 + sizeof(float) * channels * texels > file.size)
+		{
+			file_unmap(file);
+			return false;
+		}
+		offset += 1;
+
+		//a negative scale is little endian, the byte order of every platform we build for
+		bool swap = scale > 0.0;
+		const unsigned char* data = file.data + offset;
+
+		img.width = (int)width;
+		img.height = (int)height;
+		img.channels = 3;
+		img.type = PIXEL_TYPE::FLOAT;
+
+		//the view starts page aligned so only the header length decides if the floats are aligned
+		if (zero_copy && channels == 3 && swap == false && offset % sizeof(float) == 0)
+		{
+			img.data = (void*)data;
+			img.mapping = new Mapped_File(file);
+			return true;
+		}
+
+		float* out = (float*)malloc(sizeof(float) * 3 * texels);
+		for (size_t texel = 0; texel < texels; ++texel)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				int channel = channels == 3 ? c : 0;
+				out[3 * texel + c] = _pfm_float(data + sizeof(float) * (channels * texel + channel), swap);
+			}
+		}
+		file_unmap(file);
+
+		img.data = out;
+		img.mapping = nullptr;
+		return true;
+	}
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "image.h"
+
+namespace io
+{
+	//portable float map, "PF" is RGB and "Pf" gray, rows are stored bottom up like the images we read
+	//so a little endian RGB file is already our layout, with zero_copy img is then a read only view
+	//into the mapped file (image_free unmaps it), any other file is copied out to malloc'd RGB float
+	bool
+	pfm_read(const char* path, Image& img, bool zero_copy);
+};
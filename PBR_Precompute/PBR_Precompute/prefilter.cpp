@@ -0,0 +1,453 @@
+#include "prefilter.h"
+
+#include "Gfx.h"
+
+#include <algorithm>
+
+using namespace math;
+
+namespace pbr
+{
+	float
+	vdc(unsigned int bits)
+	{
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return float(bits) * 2.3283064365386963e-10f; //0x100000000
+	}
+
+	vec2f
+	hammersley(unsigned int i, unsigned int n)
+	{
+		return vec2f{ float(i) / float(n), vdc(i) };
+	}
+
+	vec2f
+	sobol02(unsigned int i)
+	{
+		unsigned int r = 0;
+		for (unsigned int bits = i, v = 1u << 31; bits != 0; bits >>= 1, v ^= v >> 1)
+			if (bits & 1)
+				r ^= v;
+		return vec2f{ vdc(i), float(r) * 2.3283064365386963e-10f };
+	}
+
+	vec3f
+	ggx_importance_sample(const vec2f& xi, const vec3f& normal, float roughness)
+	{
+		float a = roughness * roughness;
+		float phi = 2.0f * PI * xi[0];
+		float cos_theta = sqrtf((1.0f - xi[1]) / (1.0f + (a * a - 1.0f) * xi[1]));
+		float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+
+		vec3f h{ cosf(phi) * sin_theta, sinf(phi) * sin_theta, cos_theta };
+
+		vec3f up = fabsf(normal[2]) < 0.999f ? Z_AXIS : X_AXIS;
+		vec3f tangent = math::normalize(cross(up, normal));
+		vec3f bitangent = math::normalize(cross(normal, tangent));
+
+		return math::normalize(tangent * h[0] + bitangent * h[1] + normal * h[2]);
+	}
+
+	float
+	ndf_ggx(float nh, float roughness)
+	{
+		float r = roughness * roughness;
+		float r2 = r * r;
+		float denom = nh * nh * (r2 - 1.0f) + 1.0f;
+		denom = PI * denom * denom;
+		return r2 / std::max(denom, 0.001f);
+	}
+
+	float
+	prefilter_density_lod(float density, int env_size, int env_mip_count)
+	{
+		float texel = 4.0f * PI / (6.0f * env_size * env_size);
+		float samp = 1.0f / (density + 0.0001f);
+		float lod = 0.5f * log2f(samp / texel) + PREFILTER_LOD_BIAS;
+		return std::min(std::max(lod, 0.0f), float(env_mip_count - 1));
+	}
+
+	unsigned int
+	prefilter_light_count(unsigned int sample_count, float roughness, float light_fraction)
+	{
+		if (roughness == 0.0f || light_fraction <= 0.0f)
+			return 0;
+		return std::min((unsigned int)(sample_count * light_fraction), sample_count - 1);
+	}
+
+	//sample i of a texel, the light_total light samples are spread evenly over the sample_total of the sequence
+	//and each strategy walks its own Sobol sequence. weight is NL times the balance heuristic over both strategies
+	//(1 without light samples), lod_samples is the sample count the source lod is picked for.
+	//false if the sample doesn't contribute
+	inline bool
+	_prefilter_sample(const Envmap& env, const vec3f& normal, float roughness, unsigned int i, unsigned int sample_total, unsigned int light_total, unsigned int lod_samples, vec3f& l, float& weight, float& lod)
+	{
+		unsigned int light_index = (unsigned int)((unsigned long long)i * light_total / sample_total);
+		bool light_sample = (unsigned long long)(i + 1) * light_total / sample_total > light_index;
+
+		float light_pdf = 0.0f;
+		if (light_sample)
+			l = env_light_sample(env.light, sobol02(light_index), light_pdf);
+		else
+		{
+			vec3f halfway = ggx_importance_sample(sobol02(i - light_index), normal, roughness);
+			l = math::normalize(halfway * (2.0f * dot(normal, halfway)) - normal);
+			if (light_total > 0)
+				light_pdf = env_light_pdf(env.light, l);
+		}
+
+		float nl = dot(normal, l);
+		if (nl <= 0.0f)
+			return false;
+
+		//the view is the normal so NH and HV are the same
+		float nh = std::max(dot(normal, math::normalize(normal + l)), 0.0f);
+		float ggx_pdf = ndf_ggx(nh, roughness) * nh / (4.0f * nh) + 0.0001f;
+
+		//the source lod follows the GGX density for both strategies, a light pdf in it would fetch a sharp sun
+		//inside the light texels and a blurred one right outside them and count its energy twice
+		float mixture = (float(sample_total - light_total) * ggx_pdf + float(light_total) * light_pdf) / sample_total;
+		weight = nl * ggx_pdf / mixture;
+		lod = roughness == 0.0f ? 0.0f : prefilter_density_lod(lod_samples * ggx_pdf, env.size, env.mip_count);
+		return true;
+	}
+
+	Progressive_Run
+	progressive_start(const Progressive_Budget& budget, unsigned int sample_total)
+	{
+		Progressive_Run self{};
+		self.budget = budget;
+		self.sample_total = sample_total;
+		self.samples_done = 0;
+		self.start = std::chrono::steady_clock::now();
+		self.next_publish_ms = budget.publish_interval_ms;
+		return self;
+	}
+
+	double
+	progressive_elapsed_ms(const Progressive_Run& run)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - run.start).count();
+	}
+
+	bool
+	progressive_next(Progressive_Run& run, unsigned int& first, unsigned int& count)
+	{
+		if (run.samples_done >= run.sample_total)
+			return false;
+
+		//whatever happens we make it to the first batch so there's something to publish
+		if (run.samples_done > 0)
+		{
+			if (run.budget.cancel && *run.budget.cancel)
+				return false;
+			if (run.budget.limit_ms > 0.0 && progressive_elapsed_ms(run) >= run.budget.limit_ms)
+				return false;
+		}
+
+		first = run.samples_done;
+		count = run.budget.batch_size == 0 ? run.sample_total : run.budget.batch_size;
+		count = std::min(count, run.sample_total - first);
+		run.samples_done += count;
+		return true;
+	}
+
+	bool
+	progressive_publish_due(Progressive_Run& run)
+	{
+		if (run.budget.publish_interval_ms <= 0.0 || run.samples_done >= run.sample_total)
+			return false;
+
+		double elapsed = progressive_elapsed_ms(run);
+		if (elapsed < run.next_publish_ms)
+			return false;
+
+		while (run.next_publish_ms <= elapsed)
+			run.next_publish_ms += run.budget.publish_interval_ms;
+		return true;
+	}
+
+	Prefilter_Accumulator
+	prefilter_accumulator_create(int size)
+	{
+		Prefilter_Accumulator self{};
+		self.size = size;
+		for (int face = 0; face < 6; ++face)
+		{
+			self.color[face].assign(3 * size * size, 0.0f);
+			self.weight[face].assign(size * size, 0.0f);
+		}
+		return self;
+	}
+
+	//samples [first, first + count) of the texel of a capture face looking along normal, summed like the accumulator keeps them
+	inline void
+	_prefilter_texel(const Envmap& env, const vec3f& normal, float roughness, unsigned int first, unsigned int count, unsigned int sample_total, unsigned int light_total, vec3f& color, float& weight)
+	{
+		color = vec3f{};
+		weight = 0.0f;
+		for (unsigned int i = first; i < first + count; ++i)
+		{
+			vec3f l;
+			float w, lod;
+			if (_prefilter_sample(env, normal, roughness, i, sample_total, light_total, sample_total, l, w, lod))
+			{
+				color += envmap_sample(env, l, lod) * w;
+				weight += w;
+			}
+		}
+	}
+
+	void
+	prefilter_accumulate(const Envmap& env, Prefilter_Accumulator& acc, float roughness, unsigned int first, unsigned int count, unsigned int sample_total, unsigned int light_total, jobs::Pool* pool)
+	{
+		int size = acc.size;
+
+		//a row of a face per job, rows don't share accumulator texels
+		jobs::parallel_for(pool, 6 * size, [&](unsigned int row)
+		{
+			int face = row / size;
+			int y = row % size;
+			for (int x = 0; x < size; ++x)
+			{
+				vec3f normal = face_view_dir(POSTPROCESS_FACE_VIEWS[face], (x + 0.5f) / size, (y + 0.5f) / size);
+				vec3f color;
+				float weight;
+				_prefilter_texel(env, normal, roughness, first, count, sample_total, light_total, color, weight);
+
+				int texel = y * size + x;
+				acc.color[face][3 * texel + 0] += color[0];
+				acc.color[face][3 * texel + 1] += color[1];
+				acc.color[face][3 * texel + 2] += color[2];
+				acc.weight[face][texel] += weight;
+			}
+		});
+	}
+
+	vec3f
+	prefilter_texel(const Envmap& env, const vec3f& normal, float roughness, unsigned int sample_total, unsigned int light_total)
+	{
+		vec3f color;
+		float weight;
+		_prefilter_texel(env, normal, roughness, 0, sample_total, sample_total, light_total, color, weight);
+		return weight > 0.0f ? color * (1.0f / weight) : vec3f{};
+	}
+
+	void
+	prefilter_rows(const Envmap& env, int size, int face, int first_row, int row_count, float roughness, unsigned int sample_total, unsigned int light_total, float* rgb, jobs::Pool* pool)
+	{
+		jobs::parallel_for(pool, row_count, [&](unsigned int row)
+		{
+			int y = first_row + (int)row;
+			float* out = rgb + 3 * (size_t)row * size;
+			for (int x = 0; x < size; ++x)
+			{
+				vec3f normal = face_view_dir(POSTPROCESS_FACE_VIEWS[face], (x + 0.5f) / size, (y + 0.5f) / size);
+				vec3f color = prefilter_texel(env, normal, roughness, sample_total, light_total);
+				out[3 * x + 0] = color[0];
+				out[3 * x + 1] = color[1];
+				out[3 * x + 2] = color[2];
+			}
+		});
+	}
+
+	void
+	prefilter_resolve(const Prefilter_Accumulator& acc, io::Image faces[6])
+	{
+		int texels = acc.size * acc.size;
+		for (int face = 0; face < 6; ++face)
+		{
+			float* out = (float*)faces[face].data;
+			for (int texel = 0; texel < texels; ++texel)
+			{
+				float w = acc.weight[face][texel];
+				float inv = w > 0.0f ? 1.0f / w : 0.0f;
+				out[3 * texel + 0] = acc.color[face][3 * texel + 0] * inv;
+				out[3 * texel + 1] = acc.color[face][3 * texel + 1] * inv;
+				out[3 * texel + 2] = acc.color[face][3 * texel + 2] * inv;
+			}
+		}
+	}
+
+	void
+	prefilter_progressive(const Envmap& env, int size, float roughness, unsigned int sample_total, unsigned int light_total, const Progressive_Budget& budget, Progressive_Publish publish, void* user, jobs::Pool* pool)
+	{
+		Prefilter_Accumulator acc = prefilter_accumulator_create(size);
+
+		io::Image faces[6];
+		for (int face = 0; face < 6; ++face)
+		{
+			faces[face].width = size;
+			faces[face].height = size;
+			faces[face].channels = 3;
+			faces[face].data = new float[3 * size * size];
+		}
+
+		Progressive_Run run = progressive_start(budget, sample_total);
+		unsigned int first, count;
+		while (progressive_next(run, first, count))
+		{
+			prefilter_accumulate(env, acc, roughness, first, count, sample_total, light_total, pool);
+			if (progressive_publish_due(run))
+			{
+				prefilter_resolve(acc, faces);
+				publish(faces, run.samples_done, sample_total, true, user);
+			}
+		}
+
+		prefilter_resolve(acc, faces);
+		publish(faces, run.samples_done, sample_total, false, user);
+
+		for (int face = 0; face < 6; ++face)
+			delete[] (float*)faces[face].data;
+	}
+
+	//relative variance of a single sample of the prefilter (ratio) estimator at this normal,
+	//mip selection done as if sample_count samples were taken
+	inline float
+	_relative_variance(const Envmap& env, const vec3f& normal, float roughness, unsigned int pilot_samples, unsigned int sample_count, float light_fraction)
+	{
+		std::vector<float> ys, ws;
+		ys.reserve(pilot_samples);
+		ws.reserve(pilot_samples);
+
+		unsigned int light_total = prefilter_light_count(pilot_samples, roughness, light_fraction);
+		float sum_y = 0.0f, sum_w = 0.0f;
+		for (unsigned int i = 0; i < pilot_samples; ++i)
+		{
+			vec3f l;
+			float w, lod;
+			if (_prefilter_sample(env, normal, roughness, i, pilot_samples, light_total, sample_count, l, w, lod))
+			{
+				float y = luminance(envmap_sample(env, l, lod)) * w;
+				ys.push_back(y);
+				ws.push_back(w);
+				sum_y += y;
+				sum_w += w;
+			}
+		}
+
+		if (sum_w <= 0.0f || sum_y <= 0.0f)
+			return 0.0f;
+
+		//delta method variance of sum(y)/sum(w)
+		float ratio = sum_y / sum_w;
+		float mean_w = sum_w / pilot_samples;
+		float var = 0.0f;
+		for (std::size_t i = 0; i < ys.size(); ++i)
+		{
+			float d = ys[i] - ratio * ws[i];
+			var += d * d;
+		}
+		var /= pilot_samples * mean_w * mean_w;
+		return var / (ratio * ratio);
+	}
+
+	inline float
+	_mean_relative_variance(const Envmap& env, float roughness, const Prefilter_Schedule_Config& config, unsigned int sample_count)
+	{
+		unsigned int n = config.probes_per_face;
+		std::vector<float> variances(6 * n * n);
+		jobs::parallel_for(config.pool, 6 * n * n, [&](unsigned int probe)
+		{
+			unsigned int face = probe / (n * n);
+			unsigned int x = probe % n;
+			unsigned int y = (probe / n) % n;
+			vec3f normal = math::normalize(cube_face_dir(face, (x + 0.5f) / n, (y + 0.5f) / n));
+			variances[probe] = _relative_variance(env, normal, roughness, config.pilot_samples, sample_count, config.light_fraction);
+		});
+
+		float sum = 0.0f;
+		for (float variance : variances)
+			sum += variance;
+		return sum / variances.size();
+	}
+
+	//Smith's geometry term with the IBL k = roughness^2 / 2 of the shader
+	inline float
+	_geometry_schlick_ggx(float d, float k)
+	{
+		return d / (d * (1.0f - k) + k);
+	}
+
+	vec2f
+	brdf_integrate(float nv, float roughness, unsigned int sample_count)
+	{
+		//normal is +Z, view on the XZ plane
+		vec3f normal{ 0.0f, 0.0f, 1.0f };
+		vec3f view{ sqrtf(1.0f - nv * nv), 0.0f, nv };
+		float k = roughness * roughness / 2.0f;
+
+		float scale = 0.0f, bias = 0.0f;
+		for (unsigned int i = 0; i < sample_count; ++i)
+		{
+			vec3f h = ggx_importance_sample(hammersley(i, sample_count), normal, roughness);
+			vec3f l = math::normalize(h * (2.0f * dot(view, h)) - view);
+			float nl = std::max(l[2], 0.0f);
+			if (nl > 0.0f)
+			{
+				float nh = std::max(h[2], 0.0f);
+				float vh = std::max(dot(view, h), 0.0f);
+				float g = _geometry_schlick_ggx(std::max(nv, 0.0f), k) * _geometry_schlick_ggx(nl, k);
+				float g_vis = g * vh / (nh * nv);
+				float fc = powf(1.0f - vh, 5.0f);
+				scale += (1.0f - fc) * g_vis;
+				bias += fc * g_vis;
+			}
+		}
+		return vec2f{ scale / sample_count, bias / sample_count };
+	}
+
+	std::vector<Prefilter_LOD>
+	prefilter_schedule(const Envmap& env, unsigned int lod_count, const Prefilter_Schedule_Config& config)
+	{
+		std::vector<Prefilter_LOD> lods(lod_count);
+		float target2 = config.error_target * config.error_target;
+
+		for (unsigned int mip = 0; mip < lod_count; ++mip)
+		{
+			Prefilter_LOD& lod = lods[mip];
+			lod.roughness = (float)mip / lod_count;
+			lod.requested_error = config.error_target;
+
+			//a mirror lobe is a single fetch along the normal, no noise at all
+			if (lod.roughness == 0.0f)
+			{
+				lod.sample_count = 1;
+				lod.achieved_error = 0.0f;
+				continue;
+			}
+
+			//no target, every LOD takes the max and we only report the error it reaches
+			if (config.error_target <= 0.0f)
+			{
+				lod.sample_count = config.max_samples;
+				lod.achieved_error = sqrtf(_mean_relative_variance(env, lod.roughness, config, config.max_samples) / config.max_samples);
+				continue;
+			}
+
+			//the source mip depends on the sample count and the variance depends on the source mip,
+			//so iterate a couple of times starting from the pilot
+			unsigned int count = config.pilot_samples;
+			float rel_var = _mean_relative_variance(env, lod.roughness, config, count);
+			for (int it = 0; it < 3; ++it)
+			{
+				unsigned int wanted = (unsigned int)ceilf(rel_var / target2);
+				wanted = std::min(std::max(wanted, config.min_samples), config.max_samples);
+				if (wanted == count)
+					break;
+				count = wanted;
+				rel_var = _mean_relative_variance(env, lod.roughness, config, count);
+			}
+
+			lod.sample_count = count;
+			lod.achieved_error = sqrtf(rel_var / count);
+		}
+
+		return lods;
+	}
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "Vector.h"
+#include "envmap.h"
+#include "task_graph.h"
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+namespace pbr
+{
+	//CPU mirror of the sampling functions in specular_prefiltering_convolution.pixel,
+	//keep both in sync otherwise the estimates below will not describe what the GPU does
+	float
+	vdc(unsigned int bits);
+
+	math::vec2f
+	hammersley(unsigned int i, unsigned int n);
+
+	//first two Sobol dimensions, what the prefilter samples with so it can be refined progressively
+	math::vec2f
+	sobol02(unsigned int i);
+
+	math::vec3f
+	ggx_importance_sample(const math::vec2f& xi, const math::vec3f& normal, float roughness);
+
+	float
+	ndf_ggx(float nh, float roughness);
+
+	//LOD_BIAS of the shader
+	constexpr float PREFILTER_LOD_BIAS = 1.0f;
+
+	//env mip level a sample is fetched from so that its footprint covers its share of the lobe,
+	//density is the samples per steradian taken around its direction (sample_count * pdf), env_size the env base level face size
+	float
+	prefilter_density_lod(float density, int env_size, int env_mip_count);
+
+	//how many of a texel's sample_count samples are drawn from env.light instead of the GGX lobe,
+	//a mirror lobe never takes light samples
+	unsigned int
+	prefilter_light_count(unsigned int sample_count, float roughness, float light_fraction);
+
+	struct Prefilter_LOD
+	{
+		float roughness;
+		unsigned int sample_count;
+		float requested_error;
+		float achieved_error;
+	};
+
+	struct Prefilter_Schedule_Config
+	{
+		float error_target;         //relative RMS standard error we accept in each LOD, 0 gives every LOD max_samples
+		unsigned int probes_per_face; //probe texels per face side, probes_per_face^2 texels per face get estimated
+		unsigned int pilot_samples;
+		unsigned int min_samples;
+		unsigned int max_samples;
+		jobs::Pool* pool;             //null estimates on the calling thread
+		float light_fraction;         //share of the samples drawn from env.light, 0 is GGX only
+	};
+
+	struct Progressive_Budget
+	{
+		double publish_interval_ms; //an intermediate result is published every interval, <= 0 publishes only the final one
+		double limit_ms;            //refining stops after this long even if not converged, <= 0 runs until converged
+		unsigned int batch_size;    //samples accumulated per pass, 0 takes all of them in a single pass
+		const std::atomic<bool>* cancel;
+	};
+
+	//a one shot prefilter is a progressive one with this budget
+	constexpr Progressive_Budget PROGRESSIVE_UNLIMITED{ 0.0, 0.0, 0, nullptr };
+
+	//faces are RGB float, owned by the engine and only valid during the call. partial ones are the intermediate results
+	//published at the deadlines, the last call (partial false) has what the run ended with
+	typedef void(*Progressive_Publish)(const io::Image faces[6], unsigned int samples_done, unsigned int sample_total, bool partial, void* user);
+
+	//hands out the disjoint sample ranges of a progressive run and tracks its deadlines, shared by the GL and CPU engines
+	struct Progressive_Run
+	{
+		Progressive_Budget budget;
+		unsigned int sample_total;
+		unsigned int samples_done;
+		std::chrono::steady_clock::time_point start;
+		double next_publish_ms;
+	};
+
+	Progressive_Run
+	progressive_start(const Progressive_Budget& budget, unsigned int sample_total);
+
+	//next range of the sample sequence to accumulate, false once converged, cancelled or out of time
+	bool
+	progressive_next(Progressive_Run& run, unsigned int& first, unsigned int& count);
+
+	//true when an intermediate result should be published now
+	bool
+	progressive_publish_due(Progressive_Run& run);
+
+	double
+	progressive_elapsed_ms(const Progressive_Run& run);
+
+	//CPU prefilter engine, colors are the sum of sample * NL and weights the sum of NL per texel so
+	//disjoint sample ranges add up to the same estimate as a single pass,
+	//with light samples (light_total > 0, needs env.light) both are MIS weighted with the balance heuristic
+	struct Prefilter_Accumulator
+	{
+		int size;
+		std::vector<float> color[6];
+		std::vector<float> weight[6];
+	};
+
+	Prefilter_Accumulator
+	prefilter_accumulator_create(int size);
+
+	//faces are laid out like the captures of the cube passes (POSTPROCESS_FACE_VIEWS)
+	void
+	prefilter_accumulate(const Envmap& env, Prefilter_Accumulator& acc, float roughness, unsigned int first, unsigned int count, unsigned int sample_total, unsigned int light_total, jobs::Pool* pool);
+
+	//one shot prefilter of the texel looking along normal, what the shader writes for it with sample_offset 0
+	math::vec3f
+	prefilter_texel(const Envmap& env, const math::vec3f& normal, float roughness, unsigned int sample_total, unsigned int light_total);
+
+	//one shot prefilter of rows [first_row, first_row + row_count) of a capture face of size (laid out like prefilter_accumulate's),
+	//resolved into row_count rows of RGB floats, a row per job. the same texels the GL pass renders so a face can be split between them
+	void
+	prefilter_rows(const Envmap& env, int size, int face, int first_row, int row_count, float roughness, unsigned int sample_total, unsigned int light_total, float* rgb, jobs::Pool* pool);
+
+	//faces have to be allocated RGB float images of the accumulator size
+	void
+	prefilter_resolve(const Prefilter_Accumulator& acc, io::Image faces[6]);
+
+	void
+	prefilter_progressive(const Envmap& env, int size, float roughness, unsigned int sample_total, unsigned int light_total, const Progressive_Budget& budget, Progressive_Publish publish, void* user, jobs::Pool* pool);
+
+	//CPU mirror of specular_BRDF_convolution.pixel, the split sum scale and bias of F0 at cos(view, normal) nv and roughness
+	math::vec2f
+	brdf_integrate(float nv, float roughness, unsigned int sample_count);
+
+	//picks the sample count of each roughness level from the error target by estimating the
+	//monte carlo variance of the prefilter estimator on a subset of texels
+	std::vector<Prefilter_LOD>
+	prefilter_schedule(const Envmap& env, unsigned int lod_count, const Prefilter_Schedule_Config& config);
+};
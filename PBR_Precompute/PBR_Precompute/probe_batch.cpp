@@ -0,0 +1,235 @@
+#include "probe_batch.h"
+
+#include "glew.h"
+
+#include <assert.h>
+
+#include "Gfx.h"
+#include "glgpu.h"
+#include "envmap.h"
+#include "prefilter.h"
+#include "cube_source.h"
+#include "bake_files.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+using namespace math;
+using namespace glgpu;
+using namespace io;
+
+namespace pbr
+{
+	//probes the sample schedule is estimated on, spread over the batch
+	constexpr int SCHEDULE_PROBES = 8;
+
+	//texel samples a draw takes at most, a whole rough LOD of a big batch in one draw can run long enough for the driver to reset the GPU
+	constexpr double DRAW_SAMPLE_BUDGET = 1 << 28;
+
+	//env of a probe as an RGB16F cubemap of size in the GL face layout with its solid angle weighted mip chain,
+	//turned like the env of a bake. null (the reason printed) if it can't be read
+	cubemap
+	_probe_env(const char* path, const cli::Bake_Options& options, float rotation, jobs::Pool* pool)
+	{
+		int size = options.env_size;
+		cli::LAYOUT layout = cube_source_layout(path, options.source_layout);
+		if (layout == cli::LAYOUT::EQUIRECT)
+		{
+			IMAGE_FORMAT format;
+			if (image_format_from_path(path, format) == false || format != IMAGE_FORMAT::PFM)
+				format = IMAGE_FORMAT::HDR;
+			Image equirect = image_read(path, format, pool, PIXEL_TYPE::HALF, options.cache);
+			if (equirect.data == nullptr)
+			{
+				printf("can't read the probe '%s'\n", path);
+				return NULL;
+			}
+			cubemap env = cubemap_hdr_create(equirect, vec2f{ (float)size, (float)size }, true, rotation);
+			image_free(equirect);
+			return env;
+		}
+
+		Image source[6], faces[6];
+		if (cube_source_read(path, layout, options.source_layer, pool, source) == false)
+		{
+			printf("can't read the probe '%s'\n", path);
+			return NULL;
+		}
+		cube_faces_resample(source, size, nullptr, rotation, faces, pool);
+		cubemap env = cubemap_float_create(faces, true);
+		for (int i = 0; i < 6; ++i)
+		{
+			image_free(source[i]);
+			image_free(faces[i]);
+		}
+		return env;
+	}
+
+	//the most samples each LOD needs in any of the schedules
+	void
+	_schedule_merge(std::vector<Prefilter_LOD>& schedule, const std::vector<Prefilter_LOD>& probe)
+	{
+		if (schedule.empty())
+		{
+			schedule = probe;
+			return;
+		}
+		for (size_t lod = 0; lod < schedule.size(); ++lod)
+		{
+			schedule[lod].sample_count = std::max(schedule[lod].sample_count, probe[lod].sample_count);
+			schedule[lod].achieved_error = std::max(schedule[lod].achieved_error, probe[lod].achieved_error);
+		}
+	}
+
+	GLuint
+	_cube_array_create(GLenum internal_format, int size, int level_count, int layers)
+	{
+		GLuint array;
+		glGenTextures(1, &array);
+		glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, array);
+		glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level_count, internal_format, size, size, layers);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, level_count > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, NULL);
+		return array;
+	}
+
+	bool
+	probe_batch_run(Baker* baker, const cli::Bake_Options& options)
+	{
+		if (options_valid(options) == false)
+			return false;
+		assert(options.probes_path && options.probe_paths.empty() == false);
+
+		//the batch is GL passes only, this brings the context up on a baker that hasn't rendered yet
+		baker_backend(baker, cli::BACKEND::GL);
+
+		auto start = std::chrono::steady_clock::now();
+		jobs::Pool* pool = baker_pool(baker);
+		int probe_count = (int)options.probe_paths.size();
+		int layers = 6 * probe_count;
+		int env_mip_count = (int)std::log2(options.env_size) + 1;
+		float rotation = options.env_rotation * PI / 180.0f;
+
+		Prefilter_Schedule_Config schedule_config{};
+		schedule_config.error_target = options.error_target;
+		schedule_config.probes_per_face = 4;
+		schedule_config.pilot_samples = std::min(256u, options.prefilter_max_samples);
+		schedule_config.min_samples = std::min(16u, options.prefilter_max_samples);
+		schedule_config.max_samples = options.prefilter_max_samples;
+		schedule_config.pool = pool;
+
+		//every probe's mip chain is built like a single bake's and copied into its 6 layers of the array
+		GLuint env_array = _cube_array_create(GL_RGB16F, options.env_size, env_mip_count, layers);
+		std::vector<Prefilter_LOD> schedule;
+		int schedule_probes = std::min(probe_count, SCHEDULE_PROBES);
+		int next_scheduled = 0;
+		for (int probe = 0; probe < probe_count; ++probe)
+		{
+			cubemap env = _probe_env(options.probe_paths[probe], options, rotation, pool);
+			if (env == NULL)
+			{
+				glDeleteTextures(1, &env_array);
+				return false;
+			}
+			for (int level = 0; level < env_mip_count; ++level)
+			{
+				int size = std::max(options.env_size >> level, 1);
+				glCopyImageSubData((GLuint)env, GL_TEXTURE_CUBE_MAP, level, 0, 0, 0, env_array, GL_TEXTURE_CUBE_MAP_ARRAY, level, 0, 0, 6 * probe, size, size, 6);
+			}
+
+			if (next_scheduled < schedule_probes && probe == next_scheduled * probe_count / schedule_probes)
+			{
+				Envmap env_cpu = envmap_from_cubemap(env, options.env_size, env_mip_count);
+				_schedule_merge(schedule, prefilter_schedule(env_cpu, options.lod_count, schedule_config));
+				envmap_free(env_cpu);
+				++next_scheduled;
+			}
+			cubemap_free(env);
+		}
+		for (int lod = 0; lod < options.lod_count; ++lod)
+			printf("LOD %d: roughness %.2f, %u samples, error requested %.4f achieved %.4f (worst of %d probes)\n", lod,
+				schedule[lod].roughness, schedule[lod].sample_count, schedule[lod].requested_error, schedule[lod].achieved_error, schedule_probes);
+
+		GLuint prefiltered_array = _cube_array_create(GL_RGBA16F, options.prefilter_size, options.lod_count, layers);
+		GLuint fbo, empty_vao;
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glGenVertexArrays(1, &empty_vao);
+		glBindVertexArray(empty_vao);
+
+		program prog = program_create("probe_batch.vertex", "probe_batch.geometry", "probe_batch_prefilter.pixel");
+		program_use(prog);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, env_array);
+		uniform1i_set(prog, "env_maps", TEXTURE_UNIT::UNIT_0);
+		uniform1f_set(prog, "env_size", (float)options.env_size);
+		uniform1i_set(prog, "env_mip_count", env_mip_count);
+
+		//level, layer then face major like the KTX2 level data, layer * 6 + face is the array layer
+		std::vector<Image> images((size_t)options.lod_count * layers);
+		std::vector<float> readback;
+		for (int lod = 0; lod < options.lod_count; ++lod)
+		{
+			int size = std::max(options.prefilter_size >> lod, 1);
+			unsigned int sample_count = schedule[lod].sample_count;
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, prefiltered_array, lod);
+			glViewport(0, 0, size, size);
+			uniform1f_set(prog, "roughness", schedule[lod].roughness);
+			uniform1f_set(prog, "size", (float)size);
+			uniform1ui_set(prog, "sample_total", sample_count);
+
+			//an instance a layer, as many layers a draw as the budget takes
+			double layer_samples = (double)size * size * sample_count;
+			int draw_layers = (int)std::min(std::max(DRAW_SAMPLE_BUDGET / layer_samples, 1.0), (double)layers);
+			for (int layer_base = 0; layer_base < layers; layer_base += draw_layers)
+			{
+				uniform1i_set(prog, "layer_base", layer_base);
+				glDrawArraysInstanced(GL_TRIANGLES, 0, 3, std::min(draw_layers, layers - layer_base));
+				glFlush();
+			}
+
+			//every layer of the level in one readback
+			size_t face_floats = 3 * (size_t)size * size;
+			readback.resize(face_floats * layers);
+			glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, prefiltered_array);
+			glGetTexImage(GL_TEXTURE_CUBE_MAP_ARRAY, lod, GL_RGB, GL_FLOAT, readback.data());
+			glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, env_array);
+			for (int layer = 0; layer < layers; ++layer)
+			{
+				Image& img = images[(size_t)lod * layers + layer];
+				img.width = size;
+				img.height = size;
+				img.channels = 3;
+				img.type = PIXEL_TYPE::FLOAT;
+				img.data = malloc(sizeof(float) * face_floats);
+				memcpy(img.data, readback.data() + face_floats * layer, sizeof(float) * face_floats);
+			}
+		}
+
+		glBindVertexArray(NULL);
+		glBindFramebuffer(GL_FRAMEBUFFER, NULL);
+		glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, NULL);
+		glDeleteVertexArrays(1, &empty_vao);
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(1, &prefiltered_array);
+		glDeleteTextures(1, &env_array);
+		program_delete(prog);
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		printf("prefiltered %d probes in %.1f ms (%.2f ms a probe)\n", probe_count, ms, ms / probe_count);
+
+		bool ok = cube_ktx2_write(options, pool, options.probes_path, KTX2_FORMAT::RGBA16F, images.data(), probe_count, options.lod_count);
+		for (Image& img : images)
+			image_free(img);
+		return ok;
+	}
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "bake.h"
+
+namespace pbr
+{
+	//bakes the prefiltered maps of every probe of options.probe_paths into one KTX2 cubemap array at options.probes_path
+	//(a cube per probe, every LOD a level, in the format of the cube encoding). the probe envs go into a cubemap array and each
+	//LOD of all of them is a single layered pass, so the cost follows the texels and not the probe count. the sample
+	//schedule is shared, the most samples any of a few probes spread over the batch needs. GGX samples only.
+	//only from the thread that created the baker, false (and the reason printed) if a probe can't be read
+	bool
+	probe_batch_run(Baker* baker, const cli::Bake_Options& options);
+};
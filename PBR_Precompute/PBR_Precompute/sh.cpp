@@ -0,0 +1,107 @@
+#include "sh.h"
+
+#include "Gfx.h"
+#include "envmap.h"
+
+#include <math.h>
+
+using namespace math;
+
+namespace pbr
+{
+	//the basis with y as the polar axis, z takes the place x has in the z polar convention
+	inline void
+	_sh9_basis(const vec3f& dir, float basis[9])
+	{
+		float x = dir[0], y = dir[1], z = dir[2];
+		basis[0] = 0.282095f;
+		basis[1] = 0.488603f * x;
+		basis[2] = 0.488603f * y;
+		basis[3] = 0.488603f * z;
+		basis[4] = 1.092548f * x * z;
+		basis[5] = 1.092548f * x * y;
+		basis[6] = 0.315392f * (3.0f * y * y - 1.0f);
+		basis[7] = 1.092548f * z * y;
+		basis[8] = 0.546274f * (z * z - x * x);
+	}
+
+	vec3f
+	sh9_eval(const Sh9& sh, const vec3f& dir)
+	{
+		float basis[9];
+		_sh9_basis(dir, basis);
+		vec3f sum{};
+		for (int i = 0; i < 9; ++i)
+			sum = sum + sh.c[i] * basis[i];
+		return sum;
+	}
+
+	Sh9
+	sh9_project_faces(const io::Image faces[6], jobs::Pool* pool)
+	{
+		Sh9 partial[6] = {};
+		jobs::parallel_for(pool, 6, [&](unsigned int face) {
+			const io::Image& img = faces[face];
+			const float* texels = (const float*)img.data;
+			int size = img.width;
+			float texel_area = 4.0f / ((float)size * size);
+			for (int y = 0; y < size; ++y)
+			{
+				for (int x = 0; x < size; ++x)
+				{
+					//solid angle of the texel, its area on the unit cube over the cube of its distance
+					float s = (x + 0.5f) / size, t = (y + 0.5f) / size;
+					float a = 2.0f * s - 1.0f, b = 2.0f * t - 1.0f;
+					float d2 = 1.0f + a * a + b * b;
+					float solid_angle = texel_area / (d2 * sqrtf(d2));
+
+					float basis[9];
+					_sh9_basis(normalize(cube_face_dir(face, s, t)), basis);
+					const float* p = texels + 3 * ((size_t)y * size + x);
+					vec3f radiance{ p[0], p[1], p[2] };
+					for (int i = 0; i < 9; ++i)
+						partial[face].c[i] = partial[face].c[i] + radiance * (basis[i] * solid_angle);
+				}
+			}
+		});
+
+		Sh9 sh{};
+		for (int face = 0; face < 6; ++face)
+			for (int i = 0; i < 9; ++i)
+				sh.c[i] = sh.c[i] + partial[face].c[i];
+		return sh;
+	}
+
+	Sh9
+	sh9_rotate_y(const Sh9& sh, float radians)
+	{
+		//a turn around the polar axis only mixes the cos(m phi) and sin(m phi) functions of each order m:
+		//(x, z) and (xy, zy) for m = 1, (zz - xx, xz) for m = 2 where z^2 - x^2 is -cos(2 phi)
+		const int PAIRS[3][3] = { { 1, 3, 1 }, { 5, 7, 1 }, { 8, 4, 2 } };
+		Sh9 out = sh;
+		for (int i = 0; i < 3; ++i)
+		{
+			int cos_index = PAIRS[i][0], sin_index = PAIRS[i][1];
+			float angle = PAIRS[i][2] * radians;
+			float c = cosf(angle), s = sinf(angle);
+			float sign = PAIRS[i][2] == 2 ? -1.0f : 1.0f;
+			vec3f a = sh.c[cos_index] * sign, b = sh.c[sin_index];
+			out.c[cos_index] = (a * c - b * s) * sign;
+			out.c[sin_index] = a * s + b * c;
+		}
+		return out;
+	}
+
+	vec3f
+	sh9_irradiance(const Sh9& sh, const vec3f& normal)
+	{
+		//the clamped cosine's band factors PI, 2 PI / 3 and PI / 4 over PI
+		const float BAND[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+		float basis[9];
+		_sh9_basis(normal, basis);
+		vec3f sum{};
+		for (int i = 0; i < 9; ++i)
+			sum = sum + sh.c[i] * (BAND[i] * basis[i]);
+		return vec3f{ fmaxf(sum[0], 0.0f), fmaxf(sum[1], 0.0f), fmaxf(sum[2], 0.0f) };
+	}
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Vector.h"
+#include "image.h"
+#include "task_graph.h"
+
+namespace pbr
+{
+	//order 2 (9 coefficients) real spherical harmonics of an RGB env with +Y as the polar axis, all the irradiance of an
+	//env needs (Ramamoorthi and Hanrahan, An Efficient Representation for Irradiance Environment Maps)
+	struct Sh9
+	{
+		math::vec3f c[9];
+	};
+
+	//the function the SH9 holds along dir as it is, no convolution. for the SH9 of a map that already is convolved
+	//(the diffuse captures), sh9_irradiance would blur it a second time
+	math::vec3f
+	sh9_eval(const Sh9& sh, const math::vec3f& dir);
+
+	//RGB float faces in the GL face layout, each texel weighted by its solid angle, a face per worker
+	Sh9
+	sh9_project_faces(const io::Image faces[6], jobs::Pool* pool);
+
+	//the SH9 of the env turned radians around +Y from +X toward +Z, exact, no reprojection
+	Sh9
+	sh9_rotate_y(const Sh9& sh, float radians);
+
+	//irradiance over PI toward the normal from an SH9 of radiance, what the diffuse cubemap keeps: the clamped cosine's
+	//band factors PI, 2 PI / 3 and PI / 4 without the PI, so 1, 2/3 and 1/4. only for radiance, see sh9_eval
+	math::vec3f
+	sh9_irradiance(const Sh9& sh, const math::vec3f& normal);
+};
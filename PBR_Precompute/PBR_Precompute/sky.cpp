@@ -0,0 +1,258 @@
+#include "sky.h"
+
+#include "Gfx.h"
+#include "envmap.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+
+using namespace math;
+
+namespace pbr
+{
+	//angular radius of the sun, it is widened when the texels are too coarse or the disc radiance wouldn't fit a half float
+	constexpr float SUN_ANGULAR_RADIUS = 0.00465f;
+	constexpr float SUN_MAX_RADIANCE = 30000.0f;
+
+	struct Perez
+	{
+		float a, b, c, d, e;
+	};
+
+	//Perez coefficients and zenith values of Y, x and y, everything a sky direction needs
+	struct Sky_Model
+	{
+		Perez perez[3];
+		float zenith[3];
+		float sun_perez[3]; //F(0, sun theta) the zenith values are divided by
+		vec3f sun_dir;
+		bool sun_up;
+		vec3f sun_rgb;      //illuminance after the atmosphere
+		vec3f ground;
+	};
+
+	inline float
+	_perez(const Perez& p, float cos_theta, float gamma, float cos_gamma)
+	{
+		return (1.0f + p.a * expf(p.b / cos_theta)) * (1.0f + p.c * expf(p.d * gamma) + p.e * cos_gamma * cos_gamma);
+	}
+
+	inline vec3f
+	_xyY_to_rgb(float x, float y, float Y)
+	{
+		float X = x / y * Y;
+		float Z = (1.0f - x - y) / y * Y;
+		return vec3f{
+			fmaxf(3.2406f * X - 1.5372f * Y - 0.4986f * Z, 0.0f),
+			fmaxf(-0.9689f * X + 1.8758f * Y + 0.0415f * Z, 0.0f),
+			fmaxf(0.0557f * X - 0.2040f * Y + 1.0570f * Z, 0.0f)
+		};
+	}
+
+	//sky above the horizon, the directions under it are clamped to it
+	vec3f
+	_sky_radiance(const Sky_Model& model, const vec3f& dir)
+	{
+		float cos_theta = fmaxf(dir[1], 0.01f);
+		float cos_gamma = std::min(std::max(dot(dir, model.sun_dir), -1.0f), 1.0f);
+		float gamma = acosf(cos_gamma);
+		float value[3];
+		for (int i = 0; i < 3; ++i)
+			value[i] = model.zenith[i] * _perez(model.perez[i], cos_theta, gamma, cos_gamma) / model.sun_perez[i];
+		return _xyY_to_rgb(value[1], value[2], value[0]);
+	}
+
+	inline vec3f
+	_radiance(const Sky_Model& model, const vec3f& dir)
+	{
+		return dir[1] >= 0.0f ? _sky_radiance(model, dir) : model.ground;
+	}
+
+	//transmittance along the sun's path, Rayleigh and the turbidity's Angstrom haze over the relative air mass
+	vec3f
+	_sun_transmittance(float turbidity, float sun_theta)
+	{
+		float theta_degrees = sun_theta * 180.0f / PI;
+		float air_mass = 1.0f / (cosf(sun_theta) + 0.15f * powf(std::max(93.885f - theta_degrees, 0.01f), -1.253f));
+		const float LAMBDA[3] = { 0.65f, 0.57f, 0.475f };
+		float beta = 0.04608f * turbidity - 0.04586f;
+		vec3f t{};
+		for (int i = 0; i < 3; ++i)
+		{
+			float rayleigh = 0.008735f * powf(LAMBDA[i], -4.08f);
+			float haze = beta * powf(LAMBDA[i], -1.3f);
+			t[i] = expf(-(rayleigh + haze) * air_mass);
+		}
+		return t;
+	}
+
+	Sky_Model
+	_sky_model(const Sky_Params& sky)
+	{
+		float t = sky.turbidity;
+		float elevation = sky.sun_elevation * PI / 180.0f;
+		float azimuth = sky.sun_azimuth * PI / 180.0f;
+
+		Sky_Model self{};
+		self.sun_dir = vec3f{ cosf(elevation) * cosf(azimuth), sinf(elevation), cosf(elevation) * sinf(azimuth) };
+		self.sun_up = sky.sun_elevation > 0.0f;
+
+		//the model is fitted for a sun above the horizon
+		float theta = std::min(PI / 2.0f - elevation, 1.55f);
+		float theta2 = theta * theta, theta3 = theta2 * theta;
+		self.perez[0] = Perez{ 0.1787f * t - 1.4630f, -0.3554f * t + 0.4275f, -0.0227f * t + 5.3251f, 0.1206f * t - 2.5771f, -0.0670f * t + 0.3703f };
+		self.perez[1] = Perez{ -0.0193f * t - 0.2592f, -0.0665f * t + 0.0008f, -0.0004f * t + 0.2125f, -0.0641f * t - 0.8989f, -0.0033f * t + 0.0452f };
+		self.perez[2] = Perez{ -0.0167f * t - 0.2608f, -0.0950f * t + 0.0092f, -0.0079f * t + 0.2102f, -0.0441f * t - 1.6537f, -0.0109f * t + 0.0529f };
+		self.zenith[0] = 1.0f;
+		self.zenith[1] = t * t * (0.00166f * theta3 - 0.00375f * theta2 + 0.00209f * theta) +
+			t * (-0.02903f * theta3 + 0.06377f * theta2 - 0.03202f * theta + 0.00394f) +
+			(0.11693f * theta3 - 0.21196f * theta2 + 0.06052f * theta + 0.25886f);
+		self.zenith[2] = t * t * (0.00275f * theta3 - 0.00610f * theta2 + 0.00317f * theta) +
+			t * (-0.04214f * theta3 + 0.08970f * theta2 - 0.04153f * theta + 0.00516f) +
+			(0.15346f * theta3 - 0.26756f * theta2 + 0.06670f * theta + 0.26688f);
+		for (int i = 0; i < 3; ++i)
+			self.sun_perez[i] = _perez(self.perez[i], 1.0f, theta, cosf(theta));
+
+		self.sun_rgb = self.sun_up ? _sun_transmittance(t, theta) * sky.sun_illuminance : vec3f{};
+
+		//illuminance of the ground, the sky integrated over the upper hemisphere on a coarse grid and the sun
+		const int RINGS = 16, SEGMENTS = 32;
+		vec3f illuminance = self.sun_rgb * fmaxf(self.sun_dir[1], 0.0f);
+		for (int ring = 0; ring < RINGS; ++ring)
+		{
+			float ring_theta = (ring + 0.5f) * (PI / 2.0f) / RINGS;
+			float solid_angle = sinf(ring_theta) * (PI / 2.0f / RINGS) * (2.0f * PI / SEGMENTS);
+			for (int segment = 0; segment < SEGMENTS; ++segment)
+			{
+				float phi = (segment + 0.5f) * 2.0f * PI / SEGMENTS;
+				vec3f dir{ sinf(ring_theta) * cosf(phi), cosf(ring_theta), sinf(ring_theta) * sinf(phi) };
+				illuminance = illuminance + _sky_radiance(self, dir) * (cosf(ring_theta) * solid_angle);
+			}
+		}
+		self.ground = illuminance * (sky.ground_albedo / PI);
+		return self;
+	}
+
+	//disc radius for texels of texel_angle radians, at least a few texels across and dim enough for a half float
+	inline float
+	_sun_radius(const Sky_Model& model, float texel_angle)
+	{
+		float brightest = std::max(model.sun_rgb[0], std::max(model.sun_rgb[1], model.sun_rgb[2]));
+		float radius = std::max(SUN_ANGULAR_RADIUS, 1.5f * texel_angle);
+		return std::max(radius, sqrtf(brightest / (PI * SUN_MAX_RADIANCE)));
+	}
+
+	inline float
+	_face_texel_solid_angle(int size, int x, int y)
+	{
+		float a = 2.0f * (x + 0.5f) / size - 1.0f, b = 2.0f * (y + 0.5f) / size - 1.0f;
+		float d2 = 1.0f + a * a + b * b;
+		return 4.0f / ((float)size * size) / (d2 * sqrtf(d2));
+	}
+
+	void
+	sky_faces(const Sky_Params& sky, int size, io::Image faces[6], jobs::Pool* pool)
+	{
+		Sky_Model model = _sky_model(sky);
+		for (int i = 0; i < 6; ++i)
+		{
+			faces[i] = io::Image{};
+			faces[i].width = size;
+			faces[i].height = size;
+			faces[i].channels = 3;
+			faces[i].type = io::PIXEL_TYPE::FLOAT;
+			faces[i].data = malloc(sizeof(float) * 3 * size * size);
+		}
+
+		jobs::parallel_for(pool, 6 * size, [&](unsigned int row) {
+			int face = row / size, y = row % size;
+			float* out = (float*)faces[face].data + (size_t)3 * y * size;
+			for (int x = 0; x < size; ++x)
+			{
+				vec3f radiance = _radiance(model, normalize(cube_face_dir(face, (x + 0.5f) / size, (y + 0.5f) / size)));
+				out[3 * x + 0] = radiance[0];
+				out[3 * x + 1] = radiance[1];
+				out[3 * x + 2] = radiance[2];
+			}
+		});
+		if (model.sun_up == false)
+			return;
+
+		//the disc's radiance makes the texels it covers add up to the sun's illuminance whatever their solid angle
+		float cos_radius = cosf(_sun_radius(model, PI / 2.0f / size));
+		double covered[6] = {};
+		jobs::parallel_for(pool, 6, [&](unsigned int face) {
+			for (int y = 0; y < size; ++y)
+				for (int x = 0; x < size; ++x)
+					if (dot(normalize(cube_face_dir(face, (x + 0.5f) / size, (y + 0.5f) / size)), model.sun_dir) >= cos_radius)
+						covered[face] += _face_texel_solid_angle(size, x, y);
+		});
+		double solid_angle = covered[0] + covered[1] + covered[2] + covered[3] + covered[4] + covered[5];
+		assert(solid_angle > 0.0);
+		vec3f disc = model.sun_rgb * (float)(1.0 / solid_angle);
+		jobs::parallel_for(pool, 6, [&](unsigned int face) {
+			float* texels = (float*)faces[face].data;
+			for (int y = 0; y < size; ++y)
+			{
+				for (int x = 0; x < size; ++x)
+				{
+					if (dot(normalize(cube_face_dir(face, (x + 0.5f) / size, (y + 0.5f) / size)), model.sun_dir) < cos_radius)
+						continue;
+					float* p = texels + 3 * ((size_t)y * size + x);
+					p[0] += disc[0];
+					p[1] += disc[1];
+					p[2] += disc[2];
+				}
+			}
+		});
+	}
+
+	inline vec3f
+	_equirect_dir(int width, int height, int x, int y)
+	{
+		float phi = ((x + 0.5f) / width - 0.5f) * 2.0f * PI;
+		float latitude = ((y + 0.5f) / height - 0.5f) * PI;
+		return vec3f{ cosf(latitude) * cosf(phi), sinf(latitude), cosf(latitude) * sinf(phi) };
+	}
+
+	io::Image
+	sky_luminance_equirect(const Sky_Params& sky, int width, jobs::Pool* pool)
+	{
+		Sky_Model model = _sky_model(sky);
+		int height = std::max(width / 2, 1);
+		io::Image self{};
+		self.width = width;
+		self.height = height;
+		self.channels = 1;
+		self.type = io::PIXEL_TYPE::FLOAT;
+		self.data = malloc(sizeof(float) * width * height);
+		float* texels = (float*)self.data;
+
+		jobs::parallel_for(pool, height, [&](unsigned int y) {
+			for (int x = 0; x < width; ++x)
+				texels[(size_t)y * width + x] = luminance(_radiance(model, _equirect_dir(width, height, x, (int)y)));
+		});
+		if (model.sun_up == false)
+			return self;
+
+		//same disc as the faces, a handful of texels so a plain loop
+		float cos_radius = cosf(_sun_radius(model, PI / height));
+		double solid_angle = 0.0;
+		for (int y = 0; y < height; ++y)
+		{
+			float texel_solid_angle = cosf(((y + 0.5f) / height - 0.5f) * PI) * (2.0f * PI / width) * (PI / height);
+			for (int x = 0; x < width; ++x)
+				if (dot(_equirect_dir(width, height, x, y), model.sun_dir) >= cos_radius)
+					solid_angle += texel_solid_angle;
+		}
+		assert(solid_angle > 0.0);
+		float disc = luminance(model.sun_rgb) / (float)solid_angle;
+		for (int y = 0; y < height; ++y)
+			for (int x = 0; x < width; ++x)
+				if (dot(_equirect_dir(width, height, x, y), model.sun_dir) >= cos_radius)
+					texels[(size_t)y * width + x] += disc;
+		return self;
+	}
+};
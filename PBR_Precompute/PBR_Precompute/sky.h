@@ -0,0 +1,27 @@
+#pragma once
+
+#include "image.h"
+#include "task_graph.h"
+
+namespace pbr
+{
+	//analytic daylight, Preetham, Shirley and Smits' sky (A Practical Analytic Model for Daylight) with a sun disc,
+	//in units where the zenith radiance is 1. directions follow the equirect mapping, +Y up
+	struct Sky_Params
+	{
+		float turbidity;       //2 is a clear sky, 10 a hazy one
+		float sun_elevation;   //degrees above the horizon
+		float sun_azimuth;     //degrees from +X toward +Z, the u of the equirect mapping
+		float sun_illuminance; //of the sun seen at normal incidence before the atmosphere dims and reddens it
+		float ground_albedo;   //the ground below the horizon is a lambertian plane lit by the sky and the sun
+	};
+
+	//RGB float faces (malloc'd) in the GL face layout the splat and cubemap_float_create use, a row per task.
+	//the sun's energy goes into a disc wide enough for the RGB16F texture it gets uploaded to
+	void
+	sky_faces(const Sky_Params& sky, int size, io::Image faces[6], jobs::Pool* pool);
+
+	//1 channel float luminance equirect width x width / 2, rows bottom up, what env_light_build takes for the light samples
+	io::Image
+	sky_luminance_equirect(const Sky_Params& sky, int width, jobs::Pool* pool);
+};
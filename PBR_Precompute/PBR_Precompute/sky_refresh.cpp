@@ -0,0 +1,345 @@
+#include "sky_refresh.h"
+
+#include "glew.h"
+
+#include <assert.h>
+
+#include "backend.h"
+#include "envmap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace math;
+using namespace glgpu;
+
+namespace pbr
+{
+	//timers in flight, their results are read a few frames later so a step never waits on the GPU
+	constexpr int TIMER_QUERIES = 4;
+
+	struct Sky_Refresh
+	{
+		Sky_Refresh_Config config;
+		program prog;
+		Gl_Captures captures; //of GL_FACE_VIEWS, the maps are drawn face by face like any GL cube
+		GLuint fbo;
+
+		cubemap env_source;
+		int env_source_size;
+		cubemap env; //copy of the source the running cycle reads
+		int env_size;
+
+		cubemap maps[2];
+		int front;
+		bool front_valid;
+
+		//where the running cycle is, LOD major then face then tile
+		bool cycle_running;
+		int lod;
+		int face;
+		int tile;
+		std::chrono::steady_clock::time_point cycle_start;
+		unsigned int cycle_steps;
+
+		//GPU ns per texel sample, measured by the timers of the earlier steps, 0 until the first one comes back
+		double ns_per_sample;
+		GLuint queries[TIMER_QUERIES];
+		double query_work[TIMER_QUERIES]; //texel samples each timer measured, 0 for a free one
+		int next_query;
+
+		Sky_Refresh_Stats stats;
+	};
+
+	//what a step changes, put back before it returns so it can run in the middle of the engine's frame
+	struct Gl_State
+	{
+		GLint framebuffer;
+		GLint prog;
+		GLint vertex_array;
+		GLint array_buffer;
+		GLint viewport[4];
+		GLint scissor[4];
+		GLint active_texture;
+		GLint unit0_cubemap;
+		GLboolean blend;
+		GLboolean depth_test;
+		GLboolean cull_face;
+		GLboolean scissor_test;
+	};
+
+	inline void
+	_gl_state_save(Gl_State& state)
+	{
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &state.framebuffer);
+		glGetIntegerv(GL_CURRENT_PROGRAM, &state.prog);
+		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &state.vertex_array);
+		glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &state.array_buffer);
+		glGetIntegerv(GL_VIEWPORT, state.viewport);
+		glGetIntegerv(GL_SCISSOR_BOX, state.scissor);
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &state.active_texture);
+		glActiveTexture(GL_TEXTURE0);
+		glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP, &state.unit0_cubemap);
+		state.blend = glIsEnabled(GL_BLEND);
+		state.depth_test = glIsEnabled(GL_DEPTH_TEST);
+		state.cull_face = glIsEnabled(GL_CULL_FACE);
+		state.scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+	}
+
+	inline void
+	_gl_enable(GLenum cap, GLboolean enabled)
+	{
+		if (enabled)
+			glEnable(cap);
+		else
+			glDisable(cap);
+	}
+
+	inline void
+	_gl_state_restore(const Gl_State& state)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, state.framebuffer);
+		glUseProgram(state.prog);
+		glBindVertexArray(state.vertex_array);
+		glBindBuffer(GL_ARRAY_BUFFER, state.array_buffer);
+		glViewport(state.viewport[0], state.viewport[1], state.viewport[2], state.viewport[3]);
+		glScissor(state.scissor[0], state.scissor[1], state.scissor[2], state.scissor[3]);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, state.unit0_cubemap);
+		glActiveTexture(state.active_texture);
+		_gl_enable(GL_BLEND, state.blend);
+		_gl_enable(GL_DEPTH_TEST, state.depth_test);
+		_gl_enable(GL_CULL_FACE, state.cull_face);
+		_gl_enable(GL_SCISSOR_TEST, state.scissor_test);
+	}
+
+	inline int
+	_lod_size(const Sky_Refresh* self, int lod)
+	{
+		return std::max(self->config.prefilter_size >> lod, 1);
+	}
+
+	//a mirror lobe is a single fetch along the normal
+	inline unsigned int
+	_lod_samples(const Sky_Refresh* self, int lod)
+	{
+		return lod == 0 ? 1 : self->config.max_samples;
+	}
+
+	//RGB16F with every LOD allocated, complete as a mipmapped texture
+	cubemap
+	_map_create(int size, int lod_count)
+	{
+		cubemap map = cubemap_create(vec2f{ (float)size, (float)size }, INTERNAL_TEXTURE_FORMAT::RGB16F, EXTERNAL_TEXTURE_FORMAT::RGB, DATA_TYPE::FLOAT, true);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, (GLuint)map);
+		for (int level = 1; level < lod_count; ++level)
+			for (unsigned int i = 0; i < 6; ++i)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGB16F, std::max(size >> level, 1), std::max(size >> level, 1), 0, GL_RGB, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, lod_count - 1);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, NULL);
+		return map;
+	}
+
+	//folds the timers that came back into the cost model
+	void
+	_timers_collect(Sky_Refresh* self)
+	{
+		for (int i = 0; i < TIMER_QUERIES; ++i)
+		{
+			if (self->query_work[i] == 0.0)
+				continue;
+			GLint available = 0;
+			glGetQueryObjectiv(self->queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available == 0)
+				continue;
+
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(self->queries[i], GL_QUERY_RESULT, &ns);
+			double measured = (double)ns / self->query_work[i];
+			self->ns_per_sample = self->ns_per_sample == 0.0 ? measured : 0.75 * self->ns_per_sample + 0.25 * measured;
+			self->stats.step_gpu_ms = (double)ns / 1e6;
+			self->query_work[i] = 0.0;
+		}
+	}
+
+	//a box filtered mip chain, the solid angle weighted cubemap_mipmaps_generate costs a frame on its own
+	void
+	_env_latch(Sky_Refresh* self)
+	{
+		int size = self->env_source_size;
+		if (self->env_size != size)
+		{
+			cubemap_free(self->env);
+			self->env = cubemap_create(vec2f{ (float)size, (float)size }, INTERNAL_TEXTURE_FORMAT::RGB16F, EXTERNAL_TEXTURE_FORMAT::RGB, DATA_TYPE::FLOAT, true);
+			self->env_size = size;
+			//glCopyImageSubData refuses a texture that isn't complete, the levels have to be there before the first copy
+			glBindTexture(GL_TEXTURE_CUBE_MAP, (GLuint)self->env);
+			glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+		}
+		glCopyImageSubData((GLuint)self->env_source, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, (GLuint)self->env, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, size, size, 6);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, (GLuint)self->env);
+		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	}
+
+	Sky_Refresh*
+	sky_refresh_create(const Sky_Refresh_Config& config)
+	{
+		assert(config.prefilter_size > 0 && config.lod_count > 0 && config.tile_size > 0 && config.max_samples > 0);
+		Sky_Refresh* self = new Sky_Refresh{};
+		self->config = config;
+		self->prog = program_create("cube.vertex", "specular_prefiltering_convolution.pixel");
+		self->captures = gl_captures_create(GL_FACE_VIEWS, 0.0f);
+		glGenFramebuffers(1, &self->fbo);
+
+		for (int i = 0; i < 2; ++i)
+			self->maps[i] = _map_create(config.prefilter_size, config.lod_count);
+		self->front = 1;
+		glGenQueries(TIMER_QUERIES, self->queries);
+		return self;
+	}
+
+	void
+	sky_refresh_free(Sky_Refresh* refresh)
+	{
+		glDeleteQueries(TIMER_QUERIES, refresh->queries);
+		for (int i = 0; i < 2; ++i)
+			cubemap_free(refresh->maps[i]);
+		cubemap_free(refresh->env);
+		glDeleteFramebuffers(1, &refresh->fbo);
+		gl_captures_free(refresh->captures);
+		program_delete(refresh->prog);
+		delete refresh;
+	}
+
+	void
+	sky_refresh_env_set(Sky_Refresh* refresh, cubemap env, int env_size)
+	{
+		refresh->env_source = env;
+		refresh->env_source_size = env_size;
+	}
+
+	bool
+	sky_refresh_step(Sky_Refresh* refresh)
+	{
+		Sky_Refresh* self = refresh;
+		_timers_collect(self);
+		if (self->cycle_running == false && self->env_source == NULL)
+			return false;
+
+		Gl_State state;
+		_gl_state_save(state);
+
+		if (self->cycle_running == false)
+		{
+			_env_latch(self);
+			self->cycle_running = true;
+			self->lod = 0;
+			self->face = 0;
+			self->tile = 0;
+			self->cycle_start = std::chrono::steady_clock::now();
+			self->cycle_steps = 0;
+		}
+		++self->cycle_steps;
+
+		const Sky_Refresh_Config& config = self->config;
+		int size = _lod_size(self, self->lod);
+		int tile_size = std::min(config.tile_size, size);
+		int tiles_per_side = (size + tile_size - 1) / tile_size;
+		unsigned int samples = _lod_samples(self, self->lod);
+		float roughness = (float)self->lod / config.lod_count;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, self->fbo);
+		glDisable(GL_BLEND);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+		glEnable(GL_SCISSOR_TEST);
+		glViewport(0, 0, size, size);
+
+		//the same uniforms as a one shot bake LOD, GGX samples only since the light distribution would have to be rebuilt with every env
+		program prog = self->prog;
+		program_use(prog);
+		cubemap_bind(self->env, TEXTURE_UNIT::UNIT_0);
+		uniform1i_set(prog, "env_map", TEXTURE_UNIT::UNIT_0);
+		uniform1i_set(prog, "env_light_pdf", TEXTURE_UNIT::UNIT_1);
+		uniform1i_set(prog, "env_light_marginal", TEXTURE_UNIT::UNIT_2);
+		uniform1i_set(prog, "env_light_conditional", TEXTURE_UNIT::UNIT_3);
+		uniform1f_set(prog, "env_size", (float)self->env_size);
+		uniform1i_set(prog, "env_mip_count", (int)std::log2(self->env_size) + 1);
+		uniform1f_set(prog, "roughness", roughness);
+		uniform1ui_set(prog, "sample_total", samples);
+		uniform1ui_set(prog, "sample_offset", 0);
+		uniform1ui_set(prog, "sample_count", samples);
+		uniform1ui_set(prog, "light_total", 0);
+
+		int query = self->next_query;
+		bool timed = self->query_work[query] == 0.0;
+		if (timed)
+			glBeginQuery(GL_TIME_ELAPSED, self->queries[query]);
+
+		//tiles until the model says the budget is spent, without one only a tile a step until the first timer is back
+		cubemap back = self->maps[1 - self->front];
+		double budget_ns = config.frame_budget_ms * 1e6;
+		double tile_work = (double)tile_size * tile_size * samples;
+		double work = 0.0;
+		int bound_face = -1;
+		bool lod_done = false;
+		do
+		{
+			if (self->face != bound_face)
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + self->face, (GLuint)back, self->lod);
+				bound_face = self->face;
+			}
+			int x = (self->tile % tiles_per_side) * tile_size;
+			int y = (self->tile / tiles_per_side) * tile_size;
+			int width = std::min(tile_size, size - x);
+			int height = std::min(tile_size, size - y);
+			glScissor(x, y, width, height);
+			gl_captures_draw(self->captures, prog, self->face);
+			work += (double)width * height * samples;
+
+			if (++self->tile == tiles_per_side * tiles_per_side)
+			{
+				self->tile = 0;
+				if (++self->face == 6)
+				{
+					self->face = 0;
+					++self->lod;
+					lod_done = true;
+				}
+			}
+		} while (lod_done == false && self->ns_per_sample > 0.0 && (work + tile_work) * self->ns_per_sample <= budget_ns);
+
+		if (timed)
+		{
+			glEndQuery(GL_TIME_ELAPSED);
+			self->query_work[query] = work;
+			self->next_query = (query + 1) % TIMER_QUERIES;
+		}
+		_gl_state_restore(state);
+
+		//commands run in order, whatever samples the front map after this sees the finished one
+		if (self->lod < config.lod_count)
+			return false;
+		self->front = 1 - self->front;
+		self->front_valid = true;
+		self->cycle_running = false;
+		self->stats.cycles++;
+		self->stats.latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - self->cycle_start).count();
+		self->stats.steps = self->cycle_steps;
+		return true;
+	}
+
+	cubemap
+	sky_refresh_front(const Sky_Refresh* refresh)
+	{
+		return refresh->front_valid ? refresh->maps[refresh->front] : NULL;
+	}
+
+	Sky_Refresh_Stats
+	sky_refresh_stats(const Sky_Refresh* refresh)
+	{
+		return refresh->stats;
+	}
+};
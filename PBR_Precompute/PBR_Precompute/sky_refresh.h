@@ -0,0 +1,52 @@
+#pragma once
+
+#include "glgpu.h"
+
+namespace pbr
+{
+	//keeps the prefiltered map of a changing env (a time of day sky) up to date without hitching: each step prefilters a few
+	//tiles of one face of one LOD into a back map within a GPU time budget, rotating through the LODs, faces and tiles,
+	//and the maps swap once every tile of every LOD is done so the front one is always a complete map of a single env
+	struct Sky_Refresh;
+
+	struct Sky_Refresh_Config
+	{
+		int prefilter_size;        //LOD 0 face size
+		int lod_count;
+		int tile_size;             //square tiles, a face smaller than a tile is a single one
+		unsigned int max_samples;  //per texel of the rough LODs, the mirror LOD 0 takes one
+		double frame_budget_ms;    //GPU time a step aims to take, at least one tile is done per step
+	};
+
+	struct Sky_Refresh_Stats
+	{
+		unsigned long long cycles; //complete maps swapped in
+		double latency_ms;         //from the env a cycle read being taken to its map being swapped in, last cycle
+		unsigned int steps;        //steps the last cycle took
+		double step_gpu_ms;        //measured GPU time of the last step whose timer came back
+	};
+
+	//GL thread of the caller's context, from the shader directory glgpu reads from
+	Sky_Refresh*
+	sky_refresh_create(const Sky_Refresh_Config& config);
+
+	void
+	sky_refresh_free(Sky_Refresh* refresh);
+
+	//RGB16F cubemap of the env, complete as a texture (glCopyImageSubData wants it) but only its base level is read.
+	//it is copied when a cycle starts so the caller can keep rendering into it, changes show up in the next cycle
+	void
+	sky_refresh_env_set(Sky_Refresh* refresh, glgpu::cubemap env, int env_size);
+
+	//one frame's share of the work, saves and restores the GL state it touches. true when it swapped in a new map
+	bool
+	sky_refresh_step(Sky_Refresh* refresh);
+
+	//the last complete map, every LOD a mip level in the GL face layout, null before the first cycle is done.
+	//the handle changes with every swap, ask for it each frame
+	glgpu::cubemap
+	sky_refresh_front(const Sky_Refresh* refresh);
+
+	Sky_Refresh_Stats
+	sky_refresh_stats(const Sky_Refresh* refresh);
+};
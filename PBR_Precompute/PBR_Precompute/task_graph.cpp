@@ -0,0 +1,468 @@
+#include "task_graph.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+namespace jobs
+{
+	struct Job
+	{
+		void(*function)(void* user);
+		void* user;
+	};
+
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+
+		std::atomic<long long> busy_ns;
+		std::atomic<long long> helping_ns;
+		std::atomic<unsigned long long> tasks;
+		std::atomic<unsigned long long> steals;
+	};
+
+	struct Pool
+	{
+		std::vector<std::thread> threads;
+		std::vector<std::unique_ptr<Worker>> workers;
+
+		//AFFINITY::MAIN jobs, only worker 0 pops them
+		std::mutex main_mutex;
+		std::deque<Job> main_jobs;
+
+		//sleeping workers wait for one of the counters (or a run they help with) to change
+		std::mutex sleep_mutex;
+		std::condition_variable wake;
+		std::atomic<unsigned int> queued;
+		std::atomic<unsigned int> queued_main;
+		std::atomic<bool> quit;
+
+		std::chrono::steady_clock::time_point start;
+	};
+
+	struct Task
+	{
+		const char* name;
+		Task_Function function;
+		void* user;
+		AFFINITY affinity;
+		Graph* graph;
+
+		std::atomic<int> pending; //dependencies not done yet
+		std::vector<Task*> successors;
+	};
+
+	struct Graph
+	{
+		Pool* pool;
+		std::vector<std::unique_ptr<Task>> tasks;
+		std::atomic<int> remaining;
+	};
+
+	//which worker of which pool the current thread is, -1 for threads outside it
+	thread_local Pool* _current_pool = nullptr;
+	thread_local int _current_worker = -1;
+	thread_local int _help_depth = 0;
+	thread_local int _run_depth = 0;
+
+	inline int
+	_worker_index(const Pool* pool)
+	{
+		return _current_pool == pool ? _current_worker : -1;
+	}
+
+	inline long long
+	_now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//taking the lock before notifying keeps a worker from missing the wake up between checking the counters and sleeping
+	inline void
+	_wake(Pool* pool, bool all)
+	{
+		{
+			std::lock_guard<std::mutex> lock(pool->sleep_mutex);
+		}
+		if (all)
+			pool->wake.notify_all();
+		else
+			pool->wake.notify_one();
+	}
+
+	inline void
+	_push(Pool* pool, const Job& job, AFFINITY affinity)
+	{
+		if (affinity == AFFINITY::MAIN)
+		{
+			{
+				std::lock_guard<std::mutex> lock(pool->main_mutex);
+				pool->main_jobs.push_back(job);
+			}
+			++pool->queued_main;
+			//the main thread might be any of the sleepers
+			_wake(pool, true);
+			return;
+		}
+
+		int index = std::max(_worker_index(pool), 0);
+		Worker& worker = *pool->workers[index];
+		{
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			worker.jobs.push_back(job);
+		}
+		++pool->queued;
+		_wake(pool, false);
+	}
+
+	//worker 0 takes the main thread jobs first, they are usually the critical path (GL passes),
+	//then its own newest job, then the oldest job of someone else
+	inline bool
+	_pop(Pool* pool, int index, Job& job)
+	{
+		if (index == 0 && pool->queued_main > 0)
+		{
+			std::lock_guard<std::mutex> lock(pool->main_mutex);
+			if (pool->main_jobs.empty() == false)
+			{
+				job = pool->main_jobs.front();
+				pool->main_jobs.pop_front();
+				--pool->queued_main;
+				return true;
+			}
+		}
+
+		if (pool->queued == 0)
+			return false;
+
+		if (index >= 0)
+		{
+			Worker& worker = *pool->workers[index];
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			if (worker.jobs.empty() == false)
+			{
+				job = worker.jobs.back();
+				worker.jobs.pop_back();
+				--pool->queued;
+				return true;
+			}
+		}
+
+		int count = (int)pool->workers.size();
+		for (int i = 1; i <= count; ++i)
+		{
+			int victim = (std::max(index, 0) + i) % count;
+			if (victim == index)
+				continue;
+
+			Worker& worker = *pool->workers[victim];
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			if (worker.jobs.empty() == false)
+			{
+				job = worker.jobs.front();
+				worker.jobs.pop_front();
+				--pool->queued;
+				if (index >= 0)
+					++pool->workers[index]->steals;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	inline void
+	_run(Pool* pool, int index, const Job& job)
+	{
+		long long start = _now_ns();
+		++_run_depth;
+		job.function(job.user);
+
+		//jobs a job runs while it helps are already in its busy time
+		if (--_run_depth == 0 && index >= 0)
+			pool->workers[index]->busy_ns += _now_ns() - start;
+		if (index >= 0)
+			++pool->workers[index]->tasks;
+	}
+
+	//runs jobs until remaining drops to 0, whoever takes it to 0 has to _wake everyone
+	inline void
+	_help(Pool* pool, std::atomic<int>& remaining)
+	{
+		int index = _worker_index(pool);
+		long long start = _now_ns();
+		++_help_depth;
+
+		while (remaining > 0)
+		{
+			Job job;
+			if (_pop(pool, index, job))
+			{
+				_run(pool, index, job);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(pool->sleep_mutex);
+			pool->wake.wait(lock, [&]()
+			{
+				return remaining == 0 || pool->queued > 0 || (index == 0 && pool->queued_main > 0);
+			});
+		}
+
+		//worker 0 only counts as a worker while it helps, nested helps are already inside the outer one
+		if (--_help_depth == 0 && index >= 0)
+			pool->workers[index]->helping_ns += _now_ns() - start;
+	}
+
+	void
+	_worker_main(Pool* pool, int index)
+	{
+		_current_pool = pool;
+		_current_worker = index;
+
+		while (true)
+		{
+			Job job;
+			if (_pop(pool, index, job))
+			{
+				_run(pool, index, job);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(pool->sleep_mutex);
+			pool->wake.wait(lock, [pool]() { return pool->quit || pool->queued > 0; });
+			if (pool->quit)
+				break;
+		}
+	}
+
+	Pool*
+	pool_create(unsigned int threads)
+	{
+		threads = std::max(threads, 1u);
+
+		Pool* self = new Pool;
+		self->queued = 0;
+		self->queued_main = 0;
+		self->quit = false;
+		self->start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < threads; ++i)
+		{
+			std::unique_ptr<Worker> worker(new Worker);
+			worker->busy_ns = 0;
+			worker->helping_ns = 0;
+			worker->tasks = 0;
+			worker->steals = 0;
+			self->workers.push_back(std::move(worker));
+		}
+
+		_current_pool = self;
+		_current_worker = 0;
+		for (unsigned int i = 1; i < threads; ++i)
+			self->threads.emplace_back(_worker_main, self, (int)i);
+
+		return self;
+	}
+
+	void
+	pool_free(Pool* pool)
+	{
+		pool->quit = true;
+		_wake(pool, true);
+		for (auto& thread : pool->threads)
+			thread.join();
+
+		if (_current_pool == pool)
+		{
+			_current_pool = nullptr;
+			_current_worker = -1;
+		}
+		delete pool;
+	}
+
+	unsigned int
+	pool_threads(const Pool* pool)
+	{
+		return (unsigned int)pool->workers.size();
+	}
+
+	std::vector<Worker_Stats>
+	pool_stats(const Pool* pool)
+	{
+		double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pool->start).count();
+
+		std::vector<Worker_Stats> stats(pool->workers.size());
+		for (std::size_t i = 0; i < stats.size(); ++i)
+		{
+			const Worker& worker = *pool->workers[i];
+			stats[i].busy_ms = worker.busy_ns * 1e-6;
+			stats[i].elapsed_ms = i == 0 ? worker.helping_ns * 1e-6 : elapsed_ms;
+			stats[i].tasks = worker.tasks;
+			stats[i].steals = worker.steals;
+		}
+		return stats;
+	}
+
+	void
+	pool_stats_print(const Pool* pool)
+	{
+		std::vector<Worker_Stats> stats = pool_stats(pool);
+		for (std::size_t i = 0; i < stats.size(); ++i)
+		{
+			double utilization = stats[i].elapsed_ms > 0.0 ? 100.0 * stats[i].busy_ms / stats[i].elapsed_ms : 0.0;
+			printf("worker %zu%s: %llu tasks, %llu steals, busy %.1f of %.1f ms (%.0f%%, idle %.1f ms)\n", i, i == 0 ? " (main)" : "",
+				stats[i].tasks, stats[i].steals, stats[i].busy_ms, stats[i].elapsed_ms, utilization,
+				std::max(stats[i].elapsed_ms - stats[i].busy_ms, 0.0));
+		}
+	}
+
+	Graph*
+	graph_create(Pool* pool)
+	{
+		Graph* self = new Graph;
+		self->pool = pool;
+		self->remaining = 0;
+		return self;
+	}
+
+	Task*
+	graph_task(Graph* graph, const char* name, Task_Function function, void* user, AFFINITY affinity)
+	{
+		std::unique_ptr<Task> task(new Task);
+		task->name = name;
+		task->function = function;
+		task->user = user;
+		task->affinity = affinity;
+		task->graph = graph;
+		task->pending = 0;
+
+		Task* self = task.get();
+		graph->tasks.push_back(std::move(task));
+		return self;
+	}
+
+	void
+	graph_depend(Task* task, Task* dependency)
+	{
+		assert(task->graph == dependency->graph && "tasks of different graphs");
+		dependency->successors.push_back(task);
+		++task->pending;
+	}
+
+	void _task_queue(Task* task);
+
+	void
+	_task_run(void* user)
+	{
+		Task* task = (Task*)user;
+		task->function(task->user);
+
+		for (Task* successor : task->successors)
+			if (--successor->pending == 0)
+				_task_queue(successor);
+
+		//same for the graph once graph_run sees remaining at 0
+		Pool* pool = task->graph->pool;
+		if (--task->graph->remaining == 0)
+			_wake(pool, true);
+	}
+
+	void
+	_task_queue(Task* task)
+	{
+		_push(task->graph->pool, Job{ _task_run, task }, task->affinity);
+	}
+
+	void
+	graph_run(Graph* graph)
+	{
+		assert(_worker_index(graph->pool) == 0 && "graph_run from a thread that didn't create the pool");
+		if (graph->tasks.empty())
+			return;
+
+		//roots are collected before any of them runs, a running task queues its successors itself
+		std::vector<Task*> roots;
+		for (auto& task : graph->tasks)
+			if (task->pending == 0)
+				roots.push_back(task.get());
+		assert(roots.empty() == false && "dependency cycle");
+
+		graph->remaining = (int)graph->tasks.size();
+		for (Task* task : roots)
+			_task_queue(task);
+
+		_help(graph->pool, graph->remaining);
+	}
+
+	void
+	graph_free(Graph* graph)
+	{
+		delete graph;
+	}
+
+	struct For_Chunk
+	{
+		void(*function)(void* user, unsigned int i);
+		void* user;
+		unsigned int begin;
+		unsigned int end;
+		std::atomic<int>* remaining;
+		Pool* pool;
+	};
+
+	void
+	_for_chunk_run(void* user)
+	{
+		For_Chunk* chunk = (For_Chunk*)user;
+		for (unsigned int i = chunk->begin; i < chunk->end; ++i)
+			chunk->function(chunk->user, i);
+
+		//the chunks are gone as soon as the caller sees remaining at 0
+		Pool* pool = chunk->pool;
+		if (--*chunk->remaining == 0)
+			_wake(pool, true);
+	}
+
+	void
+	parallel_for(Pool* pool, unsigned int count, void(*function)(void* user, unsigned int i), void* user)
+	{
+		if (count == 0)
+			return;
+
+		//a few chunks per worker so the ones that finish early have something to steal
+		unsigned int chunk_count = pool ? std::min(count, 4 * pool_threads(pool)) : 1;
+		if (chunk_count == 1)
+		{
+			for (unsigned int i = 0; i < count; ++i)
+				function(user, i);
+			return;
+		}
+
+		std::atomic<int> remaining(chunk_count);
+		std::vector<For_Chunk> chunks(chunk_count);
+		for (unsigned int c = 0; c < chunk_count; ++c)
+		{
+			chunks[c].function = function;
+			chunks[c].user = user;
+			chunks[c].begin = (unsigned int)((unsigned long long)count * c / chunk_count);
+			chunks[c].end = (unsigned int)((unsigned long long)count * (c + 1) / chunk_count);
+			chunks[c].remaining = &remaining;
+			chunks[c].pool = pool;
+		}
+
+		//pushed last to first so the caller pops them in order while thieves take the far end
+		for (unsigned int c = chunk_count - 1; c > 0; --c)
+			_push(pool, Job{ _for_chunk_run, &chunks[c] }, AFFINITY::ANY);
+		_for_chunk_run(&chunks[0]);
+
+		_help(pool, remaining);
+	}
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <type_traits>
+
+namespace jobs
+{
+	//work stealing thread pool, every worker has its own deque it pushes to and pops from the back,
+	//idle workers steal from the front of the others. the thread that creates the pool is worker 0,
+	//it doesn't run on its own but helps while it waits in graph_run or parallel_for
+	struct Pool;
+
+	//a set of tasks with dependencies between them, a task gets queued once all its dependencies are done
+	struct Graph;
+	struct Task;
+
+	typedef void(*Task_Function)(void* user);
+
+	enum class AFFINITY
+	{
+		ANY,  //any worker
+		MAIN  //only the thread that created the pool, for work that needs its GL context
+	};
+
+	struct Worker_Stats
+	{
+		double busy_ms;        //running tasks
+		double elapsed_ms;     //since the pool started, for worker 0 only the time spent in graph_run and parallel_for
+		unsigned long long tasks;
+		unsigned long long steals;
+	};
+
+	//threads counts the calling thread, a pool of 1 runs everything on the caller
+	Pool*
+	pool_create(unsigned int threads);
+
+	void
+	pool_free(Pool* pool);
+
+	unsigned int
+	pool_threads(const Pool* pool);
+
+	std::vector<Worker_Stats>
+	pool_stats(const Pool* pool);
+
+	void
+	pool_stats_print(const Pool* pool);
+
+	Graph*
+	graph_create(Pool* pool);
+
+	//name shows up in nothing but the debugger, user has to outlive the graph run
+	Task*
+	graph_task(Graph* graph, const char* name, Task_Function function, void* user, AFFINITY affinity = AFFINITY::ANY);
+
+	//task runs after dependency is done, both have to be in the same graph and it can't be running yet
+	void
+	graph_depend(Task* task, Task* dependency);
+
+	//queues the tasks without dependencies and returns once every task is done, only from the thread that created the pool
+	void
+	graph_run(Graph* graph);
+
+	void
+	graph_free(Graph* graph);
+
+	//calls function(user, i) for every i in [0, count) over the pool and returns when all of them are done,
+	//callable from any task (the caller helps instead of blocking), a null pool runs it inline
+	void
+	parallel_for(Pool* pool, unsigned int count, void(*function)(void* user, unsigned int i), void* user);
+
+	template<typename F>
+	inline void
+	parallel_for(Pool* pool, unsigned int count, F&& f)
+	{
+		typedef typename std::remove_reference<F>::type Function;
+		parallel_for(pool, count, [](void* user, unsigned int i) { (*(Function*)user)(i); }, (void*)&f);
+	}
+};